@@ -0,0 +1,248 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Thread scaling benchmark. Each thread has its own builder and checker,
+ * all sharing one key, and signs and verifies tokens as fast as it can.
+ * If something in the crypto path takes a lock shared by all threads, the
+ * per-thread rate falls off as threads are added. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <jwt.h>
+
+struct bench_thread {
+	pthread_t tid;
+	const jwk_item_t *item;
+	jwt_alg_t alg;
+	unsigned long ops;
+	int failed;
+};
+
+static volatile int bench_stop;
+
+static void *bench_worker(void *arg)
+{
+	struct bench_thread *t = arg;
+	jwt_builder_t *builder = jwt_builder_new();
+	jwt_checker_t *checker = jwt_checker_new();
+
+	if (builder == NULL || checker == NULL ||
+	    jwt_builder_setkey(builder, t->alg, t->item) ||
+	    jwt_checker_setkey(checker, t->alg, t->item)) {
+		t->failed = 1;
+		goto worker_done;
+	}
+
+	while (!__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+		char *token = jwt_builder_generate(builder);
+
+		if (token == NULL || jwt_checker_verify(checker, token)) {
+			free(token);
+			t->failed = 1;
+			break;
+		}
+
+		free(token);
+		t->ops++;
+	}
+
+worker_done:
+	jwt_builder_free(builder);
+	jwt_checker_free(checker);
+
+	return NULL;
+}
+
+static double bench_run(const jwk_item_t *item, jwt_alg_t alg, int threads,
+			int seconds)
+{
+	struct bench_thread *t;
+	struct timespec start, end;
+	unsigned long ops = 0;
+	double elapsed;
+	int i, failed = 0;
+
+	t = calloc(threads, sizeof(*t));
+	if (t == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	bench_stop = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; i++) {
+		t[i].item = item;
+		t[i].alg = alg;
+		if (pthread_create(&t[i].tid, NULL, bench_worker, &t[i])) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sleep(seconds);
+	__atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(t[i].tid, NULL);
+		ops += t[i].ops;
+		failed |= t[i].failed;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	free(t);
+
+	if (failed) {
+		fprintf(stderr, "Sign/verify failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	return ops / elapsed;
+}
+
+_Noreturn static void usage(const char *name, int exit_state)
+{
+	fprintf(stderr, "\
+Usage: %s [OPTIONS]\n\
+\n\
+  -h, --help            This help information\n\
+  -k, --key=FILE        JSON Web Key to use (default is an ES256 key)\n\
+  -a, --algorithm=ALG   Algorithm, if the key does not have one\n\
+  -c, --crypto=NAME     Crypto ops to use (e.g. openssl)\n\
+  -t, --threads=N       Most threads to run (default is online CPUs)\n\
+  -s, --seconds=N       Seconds to run each pass (default 2)\n\
+  -p, --private         Use a private OpenSSL library context\n\
+\n\
+Runs sign plus verify with 1, 2, 4, ... up to N threads, and prints the\n\
+total and per-thread rates for each. On a lock free path, the per-thread\n\
+rate stays flat until the CPUs run out.\n", name);
+
+	exit(exit_state);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *key_file = KEYDIR "/ec_key_prime256v1.json";
+	jwk_set_t *jwk_set;
+	const jwk_item_t *item;
+	jwt_alg_t alg = JWT_ALG_NONE;
+	int oc, threads, max_threads, seconds = 2;
+
+	const char *optstr = "hk:a:c:t:s:p";
+	struct option opttbl[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "key",	required_argument,	NULL, 'k' },
+		{ "algorithm",	required_argument,	NULL, 'a' },
+		{ "crypto",	required_argument,	NULL, 'c' },
+		{ "threads",	required_argument,	NULL, 't' },
+		{ "seconds",	required_argument,	NULL, 's' },
+		{ "private",	no_argument,		NULL, 'p' },
+		{ NULL, 0, 0, 0 },
+	};
+
+	max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((oc = getopt_long(argc, argv, optstr, opttbl, NULL)) != -1) {
+		switch (oc) {
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+
+		case 'k':
+			key_file = optarg;
+			break;
+
+		case 'a':
+			alg = jwt_str_alg(optarg);
+			if (alg >= JWT_ALG_INVAL) {
+				fprintf(stderr, "Unknown algorithm [%s]\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+		case 'c':
+			if (jwt_set_crypto_ops(optarg)) {
+				fprintf(stderr, "Unknown crypto ops [%s]\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+
+		case 's':
+			seconds = atoi(optarg);
+			break;
+
+		case 'p':
+			if (jwt_set_crypto_libctx(NULL)) {
+				fprintf(stderr, "Could not set up a library "
+					"context\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+		default: /* '?' */
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if (max_threads < 1 || seconds < 1)
+		usage(argv[0], EXIT_FAILURE);
+
+	jwk_set = jwks_create_fromfile(key_file);
+	if (jwk_set == NULL || jwks_error(jwk_set)) {
+		fprintf(stderr, "Could not read JWK: %s\n",
+			jwk_set ? jwks_error_msg(jwk_set) : key_file);
+		exit(EXIT_FAILURE);
+	}
+
+	item = jwks_item_get(jwk_set, 0);
+	if (item == NULL || jwks_item_error(item)) {
+		fprintf(stderr, "Could not read JWK: %s\n",
+			item ? jwks_item_error_msg(item) : key_file);
+		exit(EXIT_FAILURE);
+	}
+
+	if (alg == JWT_ALG_NONE)
+		alg = jwks_item_alg(item);
+
+	printf("# %s %s, %ds per pass\n", jwt_get_crypto_ops(),
+	       jwt_alg_str(alg), seconds);
+	printf("%-8s %14s %14s\n", "threads", "ops/sec", "ops/sec/thread");
+
+	for (threads = 1; ; threads *= 2) {
+		double rate;
+
+		/* Always finish on the max */
+		if (threads > max_threads)
+			threads = max_threads;
+
+		rate = bench_run(item, alg, threads, seconds);
+
+		printf("%-8d %14.0f %14.0f\n", threads, rate, rate / threads);
+		fflush(stdout);
+
+		if (threads == max_threads)
+			break;
+	}
+
+	jwks_free(jwk_set);
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Compares jwt_checker_verify() with a verifier from JWT_DEFINE_VERIFIER()
+ * on the same token, key and claims. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <jwt.h>
+#include <jwt-verifier.h>
+
+JWT_DEFINE_VERIFIER(bench_hs256, JWT_ALG_HS256, 2048)
+JWT_DEFINE_VERIFIER(bench_es256, JWT_ALG_ES256, 2048)
+
+struct bench_case {
+	const char *key;
+	jwt_alg_t alg;
+	jwt_verifier_err_t (*verify)(const jwt_verifier_t *,
+				     const jwt_verifier_policy_t *,
+				     const char *, size_t);
+};
+
+static const struct bench_case bench_cases[] = {
+	{ "oct_key_256.json", JWT_ALG_HS256, bench_hs256 },
+	{ "ec_key_prime256v1.json", JWT_ALG_ES256, bench_es256 },
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void bench_fail(const char *what)
+{
+	fprintf(stderr, "%s\n", what);
+	exit(EXIT_FAILURE);
+}
+
+static void bench_one(const struct bench_case *bc, int seconds)
+{
+	jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+	jwt_builder_t *builder;
+	jwt_checker_t *checker;
+	jwt_verifier_t *v;
+	const jwk_item_t *item;
+	jwk_set_t *jwk_set;
+	unsigned long n;
+	double start, end, checker_rate, verifier_rate;
+	jwt_value_t jval;
+	char path[1024];
+	char *token;
+	size_t len;
+
+	snprintf(path, sizeof(path), KEYDIR "/%s", bc->key);
+	jwk_set = jwks_create_fromfile(path);
+	if (jwk_set == NULL || jwks_error(jwk_set))
+		bench_fail("Could not read JWK");
+	item = jwks_item_get(jwk_set, 0);
+
+	builder = jwt_builder_new();
+	if (builder == NULL || jwt_builder_setkey(builder, bc->alg, item))
+		bench_fail("Could not set up builder");
+	jwt_set_SET_STR(&jval, "iss", "files.maclara-llc.com");
+	jwt_builder_claim_set(builder, &jval);
+	jwt_builder_time_offset(builder, JWT_CLAIM_EXP, 3600);
+	token = jwt_builder_generate(builder);
+	if (token == NULL)
+		bench_fail("Could not generate token");
+	len = strlen(token);
+
+	policy.iss = "files.maclara-llc.com";
+
+	checker = jwt_checker_new();
+	if (checker == NULL || jwt_checker_setkey(checker, bc->alg, item) ||
+	    jwt_checker_claim_set(checker, JWT_CLAIM_ISS, policy.iss))
+		bench_fail("Could not set up checker");
+
+	v = jwt_verifier_new(bc->alg, item);
+	if (v == NULL)
+		bench_fail("Could not set up verifier");
+
+	start = bench_now();
+	end = start + seconds;
+	for (n = 0; bench_now() < end; n++) {
+		if (jwt_checker_verify(checker, token))
+			bench_fail(jwt_checker_error_msg(checker));
+	}
+	checker_rate = n / (bench_now() - start);
+
+	start = bench_now();
+	end = start + seconds;
+	for (n = 0; bench_now() < end; n++) {
+		if (bc->verify(v, &policy, token, len) != JWT_VERIFIER_OK)
+			bench_fail("Verifier failed");
+	}
+	verifier_rate = n / (bench_now() - start);
+
+	printf("%-8s %14.0f %14.0f %8.2fx\n", jwt_alg_str(bc->alg),
+	       checker_rate, verifier_rate, verifier_rate / checker_rate);
+	fflush(stdout);
+
+	jwt_verifier_free(v);
+	jwt_checker_free(checker);
+	jwt_builder_free(builder);
+	free(token);
+	jwks_free(jwk_set);
+}
+
+_Noreturn static void usage(const char *name, int exit_state)
+{
+	fprintf(stderr, "\
+Usage: %s [OPTIONS]\n\
+\n\
+  -h, --help            This help information\n\
+  -c, --crypto=NAME     Crypto ops to use (e.g. openssl)\n\
+  -s, --seconds=N       Seconds to run each pass (default 2)\n\
+\n\
+Verifies the same token with a checker and with a specialized verifier,\n\
+and prints the verifies per second for each.\n", name);
+
+	exit(exit_state);
+}
+
+int main(int argc, char *argv[])
+{
+	int oc, seconds = 2;
+	size_t i;
+
+	const char *optstr = "hc:s:";
+	struct option opttbl[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "crypto",	required_argument,	NULL, 'c' },
+		{ "seconds",	required_argument,	NULL, 's' },
+		{ NULL, 0, 0, 0 },
+	};
+
+	while ((oc = getopt_long(argc, argv, optstr, opttbl, NULL)) != -1) {
+		switch (oc) {
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+
+		case 'c':
+			if (jwt_set_crypto_ops(optarg)) {
+				fprintf(stderr, "Unknown crypto ops [%s]\n",
+					optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
+		case 's':
+			seconds = atoi(optarg);
+			break;
+
+		default: /* '?' */
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if (seconds < 1)
+		usage(argv[0], EXIT_FAILURE);
+
+	printf("# %s, %ds per pass\n", jwt_get_crypto_ops(), seconds);
+	printf("%-8s %14s %14s %9s\n", "alg", "checker/sec", "verifier/sec",
+	       "speedup");
+
+	for (i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++)
+		bench_one(&bench_cases[i], seconds);
+
+	return 0;
+}
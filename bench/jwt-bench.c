@@ -0,0 +1,793 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* LibJWT microbenchmarks. Every case runs for a fixed time on 1, 2, 4, ...
+ * up to N threads, and reports its rate, latency percentiles, and the
+ * allocations LibJWT and Jansson made per operation, from the library's
+ * own allocation statistics. Output is a table, CSV or JSON, so runs can
+ * be compared with whatever tools you like. CSV and JSON also break the
+ * allocations down by the part of LibJWT that made them.
+ *
+ * Cases:
+ *   sign, verify	Every alg, with every compiled crypto ops, and
+ *			payloads padded out to each of the sizes
+ *   b64-encode,	LibJWT's base64url, on each of the sizes
+ *   b64-decode
+ *   json-parse		Jansson parsing a payload of each of the sizes
+ *   jwks-load		Loading the test keyring */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <jansson.h>
+#include <jwt.h>
+
+/* Not part of the API, but the static library has them */
+int jwt_base64uri_encode(char **_dst, const char *plain, int plain_len);
+void *jwt_base64uri_decode(const char *src, int *ret_len);
+
+static const char *bench_backends[] = { "openssl", "gnutls", "mbedtls" };
+
+static const struct {
+	jwt_alg_t alg;
+	const char *key;
+} bench_keys[] = {
+	{ JWT_ALG_HS256,	"oct_key_256.json" },
+	{ JWT_ALG_HS384,	"oct_key_384.json" },
+	{ JWT_ALG_HS512,	"oct_key_512.json" },
+	{ JWT_ALG_RS256,	"rsa_key_2048.json" },
+	{ JWT_ALG_RS384,	"rsa_key_2048.json" },
+	{ JWT_ALG_RS512,	"rsa_key_2048.json" },
+	{ JWT_ALG_ES256,	"ec_key_prime256v1.json" },
+	{ JWT_ALG_ES256K,	"ec_key_secp256k1.json" },
+	{ JWT_ALG_ES384,	"ec_key_secp384r1.json" },
+	{ JWT_ALG_ES512,	"ec_key_secp521r1.json" },
+	{ JWT_ALG_PS256,	"rsa_pss_key_2048.json" },
+	{ JWT_ALG_PS384,	"rsa_pss_key_2048_384.json" },
+	{ JWT_ALG_PS512,	"rsa_pss_key_2048_512.json" },
+	{ JWT_ALG_EDDSA,	"eddsa_key_ed25519.json" },
+};
+
+/* One benchmark case, shared by all of its threads */
+struct bench_case {
+	const char *name;
+	const char *backend;
+	jwt_alg_t alg;
+	size_t size;
+
+	const jwk_item_t *item;
+	const char *data;	/* Token, JSON or base64 to work on	*/
+	size_t data_len;
+
+	int (*setup)(struct bench_case *bc, void **ctx);
+	int (*run)(struct bench_case *bc, void *ctx);
+	void (*teardown)(void *ctx);
+};
+
+struct bench_thread {
+	pthread_t tid;
+	struct bench_case *bc;
+	void *ctx;
+	uint64_t *lat;
+	size_t nlat, cap;
+	int failed;
+};
+
+struct bench_result {
+	unsigned long ops;
+	double rate;
+	uint64_t p50, p99, p999;
+	double allocs;
+	double bytes;
+	size_t peak;
+	double sys[JWT_ALLOC_ALL];
+};
+
+enum { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+static int bench_fmt = FMT_TEXT;
+static int bench_rows;
+static int bench_ms = 200;
+static volatile int bench_stop;
+static pthread_barrier_t bench_ready, bench_go;
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**** Cases ****/
+
+static int sign_setup(struct bench_case *bc, void **ctx)
+{
+	jwt_builder_t *builder = jwt_builder_new();
+	jwt_value_t jval;
+
+	*ctx = builder;
+
+	if (builder == NULL || jwt_builder_setkey(builder, bc->alg, bc->item) ||
+	    jwt_builder_set_crypto_ops(builder, bc->backend))
+		return 1;
+
+	/* Payload padding */
+	if (bc->data_len) {
+		jwt_set_SET_STR(&jval, "data", bc->data);
+		if (jwt_builder_claim_set(builder, &jval))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int sign_run(struct bench_case *bc, void *ctx)
+{
+	char *token = jwt_builder_generate(ctx);
+
+	(void)bc;
+
+	if (token == NULL)
+		return 1;
+
+	free(token);
+
+	return 0;
+}
+
+static void sign_teardown(void *ctx)
+{
+	jwt_builder_free(ctx);
+}
+
+static int verify_setup(struct bench_case *bc, void **ctx)
+{
+	jwt_checker_t *checker = jwt_checker_new();
+
+	*ctx = checker;
+
+	if (checker == NULL || jwt_checker_setkey(checker, bc->alg, bc->item) ||
+	    jwt_checker_set_crypto_ops(checker, bc->backend))
+		return 1;
+
+	return 0;
+}
+
+static int verify_run(struct bench_case *bc, void *ctx)
+{
+	return jwt_checker_verify(ctx, bc->data);
+}
+
+static void verify_teardown(void *ctx)
+{
+	jwt_checker_free(ctx);
+}
+
+static int none_setup(struct bench_case *bc, void **ctx)
+{
+	(void)bc;
+	*ctx = NULL;
+	return 0;
+}
+
+static void none_teardown(void *ctx)
+{
+	(void)ctx;
+}
+
+static int b64_encode_run(struct bench_case *bc, void *ctx)
+{
+	char *out = NULL;
+
+	(void)ctx;
+
+	if (jwt_base64uri_encode(&out, bc->data, bc->data_len) < 0)
+		return 1;
+
+	free(out);
+
+	return 0;
+}
+
+static int b64_decode_run(struct bench_case *bc, void *ctx)
+{
+	void *out;
+	int len;
+
+	(void)ctx;
+
+	out = jwt_base64uri_decode(bc->data, &len);
+	if (out == NULL)
+		return 1;
+
+	free(out);
+
+	return 0;
+}
+
+static int json_parse_run(struct bench_case *bc, void *ctx)
+{
+	json_t *js = json_loadb(bc->data, bc->data_len, 0, NULL);
+
+	(void)ctx;
+
+	if (js == NULL)
+		return 1;
+
+	json_decref(js);
+
+	return 0;
+}
+
+static int jwks_load_run(struct bench_case *bc, void *ctx)
+{
+	jwk_set_t *jwk_set = jwks_load_strn(NULL, bc->data, bc->data_len);
+	int ret;
+
+	(void)ctx;
+
+	ret = (jwk_set == NULL || jwks_error(jwk_set)) ? 1 : 0;
+	jwks_free(jwk_set);
+
+	return ret;
+}
+
+/**** Runner ****/
+
+static void *bench_worker(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct bench_case *bc = t->bc;
+
+	t->failed = bc->setup(bc, &t->ctx);
+
+	pthread_barrier_wait(&bench_ready);
+	pthread_barrier_wait(&bench_go);
+
+	while (!t->failed && !__atomic_load_n(&bench_stop, __ATOMIC_RELAXED)) {
+		uint64_t start;
+
+		if (t->nlat == t->cap) {
+			uint64_t *lat;
+
+			t->cap = t->cap ? t->cap * 2 : 4096;
+			lat = realloc(t->lat, t->cap * sizeof(*lat));
+			if (lat == NULL) {
+				t->failed = 1;
+				break;
+			}
+			t->lat = lat;
+		}
+
+		start = bench_ns();
+		if (bc->run(bc, t->ctx))
+			t->failed = 1;
+		t->lat[t->nlat++] = bench_ns() - start;
+	}
+
+	bc->teardown(t->ctx);
+
+	return NULL;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_pct(const uint64_t *lat, size_t n, double pct)
+{
+	size_t idx = (size_t)(pct * n);
+
+	return lat[idx < n ? idx : n - 1];
+}
+
+static int bench_run(struct bench_case *bc, int threads,
+		     struct bench_result *res)
+{
+	struct bench_thread *t;
+	struct timespec ts;
+	jwt_alloc_stats_t st;
+	size_t base;
+	uint64_t start, elapsed, *lat;
+	size_t n = 0;
+	int i, failed = 0;
+
+	t = calloc(threads, sizeof(*t));
+	if (t == NULL)
+		return 1;
+
+	pthread_barrier_init(&bench_ready, NULL, threads + 1);
+	pthread_barrier_init(&bench_go, NULL, threads + 1);
+	bench_stop = 0;
+
+	for (i = 0; i < threads; i++) {
+		t[i].bc = bc;
+		if (pthread_create(&t[i].tid, NULL, bench_worker, &t[i])) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Everyone is set up, now count only the work */
+	pthread_barrier_wait(&bench_ready);
+	jwt_alloc_stats_reset();
+	jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+	base = st.live;
+	start = bench_ns();
+	pthread_barrier_wait(&bench_go);
+
+	ts.tv_sec = bench_ms / 1000;
+	ts.tv_nsec = (bench_ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+	__atomic_store_n(&bench_stop, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(t[i].tid, NULL);
+		failed |= t[i].failed;
+		n += t[i].nlat;
+	}
+
+	elapsed = bench_ns() - start;
+
+	pthread_barrier_destroy(&bench_ready);
+	pthread_barrier_destroy(&bench_go);
+
+	lat = failed || !n ? NULL : malloc(n * sizeof(*lat));
+	if (lat != NULL) {
+		n = 0;
+		for (i = 0; i < threads; i++) {
+			memcpy(lat + n, t[i].lat, t[i].nlat * sizeof(*lat));
+			n += t[i].nlat;
+		}
+
+		qsort(lat, n, sizeof(*lat), bench_cmp);
+
+		res->ops = n;
+		res->rate = n / (elapsed / 1e9);
+		res->p50 = bench_pct(lat, n, 0.50);
+		res->p99 = bench_pct(lat, n, 0.99);
+		res->p999 = bench_pct(lat, n, 0.999);
+
+		jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+		res->allocs = (double)st.count / n;
+		res->bytes = (double)st.bytes / n;
+		res->peak = st.peak - base;
+
+		for (i = JWT_ALLOC_OTHER; i < JWT_ALLOC_ALL; i++) {
+			jwt_alloc_stats_get(i, &st);
+			res->sys[i] = (double)st.count / n;
+		}
+	}
+
+	for (i = 0; i < threads; i++)
+		free(t[i].lat);
+	free(t);
+	free(lat);
+
+	return lat == NULL;
+}
+
+static void bench_print(const struct bench_case *bc, int threads,
+			const struct bench_result *res)
+{
+	const char *alg = bc->alg == JWT_ALG_NONE ? "-" : jwt_alg_str(bc->alg);
+	const char *backend = bc->backend ? bc->backend : "-";
+
+	switch (bench_fmt) {
+	case FMT_CSV:
+		if (!bench_rows)
+			printf("bench,backend,alg,size,threads,ops,ops_per_sec,"
+			       "p50_ns,p99_ns,p999_ns,allocs_per_op,bytes_per_op,"
+			       "peak_bytes,other_allocs,parse_allocs,"
+			       "base64_allocs,json_allocs,crypto_allocs,"
+			       "jwks_allocs\n");
+		printf("%s,%s,%s,%zu,%d,%lu,%.0f,%llu,%llu,%llu,%.2f,%.0f,%zu,"
+		       "%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+		       bc->name, backend, alg, bc->size, threads, res->ops,
+		       res->rate, (unsigned long long)res->p50,
+		       (unsigned long long)res->p99,
+		       (unsigned long long)res->p999, res->allocs, res->bytes,
+		       res->peak, res->sys[JWT_ALLOC_OTHER],
+		       res->sys[JWT_ALLOC_PARSE], res->sys[JWT_ALLOC_BASE64],
+		       res->sys[JWT_ALLOC_JSON], res->sys[JWT_ALLOC_CRYPTO],
+		       res->sys[JWT_ALLOC_JWKS]);
+		break;
+
+	case FMT_JSON:
+		printf("%s\n  {\"bench\": \"%s\", \"backend\": \"%s\", "
+		       "\"alg\": \"%s\", \"size\": %zu, \"threads\": %d, "
+		       "\"ops\": %lu, \"ops_per_sec\": %.0f, \"p50_ns\": %llu, "
+		       "\"p99_ns\": %llu, \"p999_ns\": %llu, "
+		       "\"allocs_per_op\": %.2f, \"bytes_per_op\": %.0f, "
+		       "\"peak_bytes\": %zu, \"allocs_by\": {\"other\": %.2f, "
+		       "\"parse\": %.2f, \"base64\": %.2f, \"json\": %.2f, "
+		       "\"crypto\": %.2f, \"jwks\": %.2f}}",
+		       bench_rows ? "," : "[",
+		       bc->name, backend, alg, bc->size, threads, res->ops,
+		       res->rate, (unsigned long long)res->p50,
+		       (unsigned long long)res->p99,
+		       (unsigned long long)res->p999, res->allocs, res->bytes,
+		       res->peak, res->sys[JWT_ALLOC_OTHER],
+		       res->sys[JWT_ALLOC_PARSE], res->sys[JWT_ALLOC_BASE64],
+		       res->sys[JWT_ALLOC_JSON], res->sys[JWT_ALLOC_CRYPTO],
+		       res->sys[JWT_ALLOC_JWKS]);
+		break;
+
+	default:
+		if (!bench_rows)
+			printf("%-10s %-8s %-6s %6s %3s %12s %10s %10s %10s "
+			       "%7s %8s\n", "bench", "backend", "alg", "size",
+			       "thr", "ops/sec", "p50(ns)", "p99(ns)",
+			       "p999(ns)", "allocs", "bytes");
+		printf("%-10s %-8s %-6s %6zu %3d %12.0f %10llu %10llu %10llu "
+		       "%7.2f %8.0f\n", bc->name, backend, alg, bc->size,
+		       threads, res->rate, (unsigned long long)res->p50,
+		       (unsigned long long)res->p99,
+		       (unsigned long long)res->p999, res->allocs, res->bytes);
+	}
+
+	bench_rows++;
+	fflush(stdout);
+}
+
+static void bench_case(struct bench_case *bc, int max_threads)
+{
+	struct bench_result res;
+	int threads;
+
+	for (threads = 1; ; threads *= 2) {
+		if (threads > max_threads)
+			threads = max_threads;
+
+		memset(&res, 0, sizeof(res));
+		if (bench_run(bc, threads, &res)) {
+			fprintf(stderr, "# %s %s %s: not supported\n", bc->name,
+				bc->backend ? bc->backend : "-",
+				bc->alg ? jwt_alg_str(bc->alg) : "-");
+			return;
+		}
+
+		bench_print(bc, threads, &res);
+
+		if (threads == max_threads)
+			break;
+	}
+}
+
+/**** Setup ****/
+
+static char *bench_read(const char *file, size_t *len)
+{
+	char path[1024];
+	char *buf;
+	FILE *fp;
+	long size;
+
+	snprintf(path, sizeof(path), KEYDIR "/%s", file);
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	buf = malloc(size + 1);
+	if (buf == NULL || fread(buf, 1, size, fp) != (size_t)size) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	buf[size] = '\0';
+	fclose(fp);
+
+	*len = size;
+
+	return buf;
+}
+
+static char *bench_pad(size_t size)
+{
+	char *pad = malloc(size + 1);
+
+	if (pad == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(pad, 'x', size);
+	pad[size] = '\0';
+
+	return pad;
+}
+
+static int bench_want(const char *list, const char *name)
+{
+	const char *p;
+	size_t len = strlen(name);
+
+	if (list == NULL)
+		return 1;
+
+	for (p = list; (p = strstr(p, name)) != NULL; p += len) {
+		if ((p == list || p[-1] == ',') &&
+		    (p[len] == '\0' || p[len] == ','))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void bench_crypto(const char *name, const char *algs,
+			 const char *backends, size_t size, int max_threads)
+{
+	size_t i, j, pad_len;
+	char *pad = bench_pad(size);
+
+	for (i = 0; i < sizeof(bench_keys) / sizeof(bench_keys[0]); i++) {
+		const char *alg = jwt_alg_str(bench_keys[i].alg);
+		jwk_set_t *jwk_set;
+		json_t *js;
+		char *key;
+
+		if (!bench_want(algs, alg))
+			continue;
+
+		/* Drop the key's own alg, so one RSA key can do all three */
+		key = bench_read(bench_keys[i].key, &pad_len);
+		js = json_loads(key, 0, NULL);
+		free(key);
+		json_object_del(js, "alg");
+		key = json_dumps(js, JSON_COMPACT);
+		json_decref(js);
+
+		jwk_set = jwks_load(NULL, key);
+		free(key);
+		if (jwk_set == NULL || jwks_error(jwk_set)) {
+			fprintf(stderr, "%s: bad key\n", bench_keys[i].key);
+			exit(EXIT_FAILURE);
+		}
+
+		for (j = 0; j < sizeof(bench_backends) / sizeof(bench_backends[0]); j++) {
+			struct bench_case bc = {
+				.name = name,
+				.backend = bench_backends[j],
+				.alg = bench_keys[i].alg,
+				.size = size,
+				.item = jwks_item_get(jwk_set, 0),
+				.data = pad,
+				.data_len = size,
+				.setup = sign_setup,
+				.run = sign_run,
+				.teardown = sign_teardown,
+			};
+			char *token = NULL;
+			void *ctx;
+
+			/* Not wanted, or not compiled in */
+			if (!bench_want(backends, bench_backends[j]) ||
+			    jwt_set_crypto_ops(bench_backends[j]))
+				continue;
+
+			if (!strcmp(name, "verify")) {
+				if (!sign_setup(&bc, &ctx))
+					token = jwt_builder_generate(ctx);
+				sign_teardown(ctx);
+
+				bc.data = token;
+				bc.data_len = token ? strlen(token) : 0;
+				bc.setup = verify_setup;
+				bc.run = verify_run;
+				bc.teardown = verify_teardown;
+			}
+
+			if (bc.data != NULL)
+				bench_case(&bc, max_threads);
+			else
+				fprintf(stderr, "# %s %s %s: not supported\n",
+					name, bc.backend, alg);
+
+			free(token);
+		}
+
+		jwks_free(jwk_set);
+	}
+
+	free(pad);
+}
+
+static void bench_other(const char *name, size_t size, int max_threads)
+{
+	struct bench_case bc = {
+		.name = name,
+		.size = size,
+		.setup = none_setup,
+		.teardown = none_teardown,
+	};
+	char *buf = NULL;
+
+	if (!strcmp(name, "b64-encode")) {
+		buf = bench_pad(size);
+		bc.data_len = size;
+		bc.run = b64_encode_run;
+	} else if (!strcmp(name, "b64-decode")) {
+		char *pad;
+
+		/* Nothing to decode */
+		if (size == 0)
+			return;
+
+		pad = bench_pad(size);
+
+		jwt_base64uri_encode(&buf, pad, size);
+		free(pad);
+		bc.data_len = strlen(buf);
+		bc.run = b64_decode_run;
+	} else if (!strcmp(name, "json-parse")) {
+		char *pad = bench_pad(size);
+
+		if (asprintf(&buf, "{\"iss\":\"files.maclara-llc.com\","
+			     "\"iat\":1736694594,\"data\":\"%s\"}", pad) < 0)
+			exit(EXIT_FAILURE);
+		free(pad);
+		bc.data_len = strlen(buf);
+		bc.run = json_parse_run;
+	} else {
+		buf = bench_read("jwks_keyring.json", &bc.data_len);
+		bc.size = bc.data_len;
+		bc.run = jwks_load_run;
+	}
+
+	bc.data = buf;
+	bench_case(&bc, max_threads);
+
+	free(buf);
+}
+
+_Noreturn static void usage(const char *name, int exit_state)
+{
+	fprintf(stderr, "\
+Usage: %s [OPTIONS]\n\
+\n\
+  -h, --help            This help information\n\
+  -b, --bench=LIST      Cases to run (default: all of sign, verify,\n\
+                        b64-encode, b64-decode, json-parse, jwks-load)\n\
+  -a, --algs=LIST       Algorithms for sign and verify (default: all)\n\
+  -c, --crypto=LIST     Crypto ops for sign and verify (default: all)\n\
+  -z, --sizes=LIST      Payload sizes in bytes (default: 0,1024,8192)\n\
+  -t, --threads=N       Most threads to run (default 1)\n\
+  -m, --ms=N            Milliseconds to run each case (default 200)\n\
+  -f, --format=FMT      Output as text, csv or json (default text)\n\
+\n\
+Lists are comma separated. Each case is run with 1, 2, 4, ... up to N\n\
+threads. Allocations are those made by LibJWT and Jansson, and do not\n\
+include the ones made inside the crypto library.\n", name);
+
+	exit(exit_state);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *cases[] = {
+		"sign", "verify", "b64-encode", "b64-decode", "json-parse",
+		"jwks-load",
+	};
+	const char *benches = NULL, *algs = NULL, *backends = NULL;
+	const char *sizes = "0,1024,8192";
+	int oc, max_threads = 1;
+	size_t i;
+
+	const char *optstr = "hb:a:c:z:t:m:f:";
+	struct option opttbl[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "bench",	required_argument,	NULL, 'b' },
+		{ "algs",	required_argument,	NULL, 'a' },
+		{ "crypto",	required_argument,	NULL, 'c' },
+		{ "sizes",	required_argument,	NULL, 'z' },
+		{ "threads",	required_argument,	NULL, 't' },
+		{ "ms",		required_argument,	NULL, 'm' },
+		{ "format",	required_argument,	NULL, 'f' },
+		{ NULL, 0, 0, 0 },
+	};
+
+	while ((oc = getopt_long(argc, argv, optstr, opttbl, NULL)) != -1) {
+		switch (oc) {
+		case 'h':
+			usage(argv[0], EXIT_SUCCESS);
+
+		case 'b':
+			benches = optarg;
+			break;
+
+		case 'a':
+			algs = optarg;
+			break;
+
+		case 'c':
+			backends = optarg;
+			break;
+
+		case 'z':
+			sizes = optarg;
+			break;
+
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+
+		case 'm':
+			bench_ms = atoi(optarg);
+			break;
+
+		case 'f':
+			if (!strcmp(optarg, "text"))
+				bench_fmt = FMT_TEXT;
+			else if (!strcmp(optarg, "csv"))
+				bench_fmt = FMT_CSV;
+			else if (!strcmp(optarg, "json"))
+				bench_fmt = FMT_JSON;
+			else
+				usage(argv[0], EXIT_FAILURE);
+			break;
+
+		default: /* '?' */
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if (max_threads < 1 || bench_ms < 1)
+		usage(argv[0], EXIT_FAILURE);
+
+	jwt_alloc_stats_enable(1);
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const char *p = sizes;
+
+		if (!bench_want(benches, cases[i]))
+			continue;
+
+		/* Loading keys doesn't have a size */
+		if (!strcmp(cases[i], "jwks-load")) {
+			bench_other(cases[i], 0, max_threads);
+			continue;
+		}
+
+		while (*p) {
+			char *end;
+			size_t size = strtoul(p, &end, 10);
+
+			if (end == p)
+				usage(argv[0], EXIT_FAILURE);
+
+			if (i < 2)
+				bench_crypto(cases[i], algs, backends, size,
+					     max_threads);
+			else
+				bench_other(cases[i], size, max_threads);
+
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+
+	if (bench_fmt == FMT_JSON)
+		printf("%s]\n", bench_rows ? "\n" : "[");
+
+	return 0;
+}
@@ -0,0 +1,798 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * @file jwt-verifier.h
+ * @brief Verifiers specialized at compile time for one algorithm
+ */
+
+#ifndef JWT_VERIFIER_H
+#define JWT_VERIFIER_H
+
+#include <jwt.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup jwt_verifier_grp Specialized Verifiers
+ *
+ * A service that only ever accepts one algorithm, with one pinned key and
+ * one claims policy, doesn't need most of what jwt_checker_t does for it.
+ * JWT_DEFINE_VERIFIER() writes a verify function for just that case. The
+ * algorithm and the largest token size are fixed when it is compiled, so
+ * it works out of a buffer on the stack, never allocates, and never
+ * builds a JSON tree. Only the members it needs are picked out of the
+ * header and payload.
+ *
+ * @code
+ * JWT_DEFINE_VERIFIER(verify_es256, JWT_ALG_ES256, 2048)
+ *
+ * jwt_verifier_t *v = jwt_verifier_new(JWT_ALG_ES256, item);
+ * jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+ *
+ * policy.iss = "https://auth.example.com";
+ *
+ * if (verify_es256(v, &policy, token, strlen(token)) != JWT_VERIFIER_OK)
+ *	...reject the token...
+ * @endcode
+ *
+ * A token is accepted by these verifiers only if a jwt_checker_t with the
+ * same key, alg, claims and leeways would accept it. The header and
+ * payload are checked against the same JSON grammar as the checker uses,
+ * UTF-8 and number ranges included. It goes the other way too, except
+ * that these fail closed on things the checker can make sense of, but
+ * that don't come up in practice: a member name or a checked string claim
+ * with a backslash escape in it, nesting more than 64 deep, a real number
+ * that might be too big for a double, and a token larger than the limit.
+ * There is no callback, and nothing is handed back; if you need the
+ * claims, use jwt_checker_t.
+ *
+ * @{
+ */
+
+/**
+ * @brief Opaque verifier object
+ *
+ * Holds the pinned key, and everything LibJWT could work out about
+ * verifying with it ahead of time. It is never changed once created, so
+ * one verifier can be used by any number of threads at once.
+ */
+typedef struct jwt_verifier jwt_verifier_t;
+
+/**
+ * @brief Results from a specialized verifier
+ */
+typedef enum {
+	JWT_VERIFIER_OK = 0,	/**< Token is good */
+	JWT_VERIFIER_ERR_SIZE,	/**< Token is larger than the verifier allows */
+	JWT_VERIFIER_ERR_FORMAT,/**< Token is not three base64url parts, or
+				     the header or payload is not a JSON
+				     object */
+	JWT_VERIFIER_ERR_ALG,	/**< Header alg is missing or not the
+				     verifier's */
+	JWT_VERIFIER_ERR_CLAIMS,/**< One or more claims failed */
+	JWT_VERIFIER_ERR_SIG,	/**< Signature did not verify */
+} jwt_verifier_err_t;
+
+/**
+ * @brief Claims a specialized verifier checks
+ *
+ * These are the same checks as jwt_checker_claim_set() and
+ * jwt_checker_time_leeway(), and have the same defaults.
+ */
+typedef struct {
+	const char *iss;	/**< Required ``iss``, or NULL to not check */
+	const char *sub;	/**< Required ``sub``, or NULL to not check */
+	const char *aud;	/**< Required ``aud``, or NULL to not check */
+	time_t exp;		/**< Leeway for ``exp``, or -1 to not check */
+	time_t nbf;		/**< Leeway for ``nbf``, or -1 to not check */
+} jwt_verifier_policy_t;
+
+/**
+ * @brief Initializer for a jwt_verifier_policy_t, the same as a new checker
+ */
+#define JWT_VERIFIER_POLICY_INIT { NULL, NULL, NULL, 0, 0 }
+
+/**
+ * @brief Create a verifier for one alg and key
+ *
+ * The same rules as jwt_checker_setkey() apply, except that a key is
+ * required. The verifier holds a reference to the key, so it may be freed
+ * from its set while the verifier is still in use.
+ *
+ * @param alg Algorithm to verify with, or JWT_ALG_NONE to use the key's
+ * @param key The key to verify with
+ * @return A new verifier, or NULL if the alg and key can't be used
+ */
+JWT_EXPORT
+jwt_verifier_t *jwt_verifier_new(jwt_alg_t alg, const jwk_item_t *key);
+
+/**
+ * @brief Free a verifier
+ *
+ * @param v Pointer to a verifier, or NULL
+ */
+JWT_EXPORT
+void jwt_verifier_free(jwt_verifier_t *v);
+
+/**
+ * @brief Check a raw signature with a verifier
+ *
+ * This is the only part of a specialized verifier that is not inline.
+ *
+ * @param v Pointer to a verifier
+ * @param alg The algorithm the caller was built for
+ * @param head The signing input, header and payload with the dot
+ * @param head_len Length of head
+ * @param sig The decoded signature
+ * @param sig_len Length of sig
+ * @return 0 if the signature is good, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_verifier_sig(const jwt_verifier_t *v, jwt_alg_t alg, const char *head,
+		     size_t head_len, const unsigned char *sig, size_t sig_len);
+
+/** @cond PRIVATE */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __JWTV_INLINE static inline __attribute__((always_inline))
+#else
+#define __JWTV_INLINE static inline
+#endif
+
+/* Folds away when alg is a constant */
+__JWTV_INLINE const char *__jwtv_alg_name(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_HS256: return "HS256";
+	case JWT_ALG_HS384: return "HS384";
+	case JWT_ALG_HS512: return "HS512";
+	case JWT_ALG_RS256: return "RS256";
+	case JWT_ALG_RS384: return "RS384";
+	case JWT_ALG_RS512: return "RS512";
+	case JWT_ALG_ES256: return "ES256";
+	case JWT_ALG_ES256K: return "ES256K";
+	case JWT_ALG_ES384: return "ES384";
+	case JWT_ALG_ES512: return "ES512";
+	case JWT_ALG_PS256: return "PS256";
+	case JWT_ALG_PS384: return "PS384";
+	case JWT_ALG_PS512: return "PS512";
+	case JWT_ALG_EDDSA: return "EdDSA";
+	default: return NULL;
+	}
+}
+
+static inline int __jwtv_b64(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 26;
+	if (c >= '0' && c <= '9')
+		return c - '0' + 52;
+	if (c == '-')
+		return 62;
+	if (c == '_')
+		return 63;
+	return -1;
+}
+
+/* Unpadded base64url, returns the decoded length or -1 */
+static inline long __jwtv_b64_decode(const char *in, size_t len,
+				     unsigned char *out)
+{
+	unsigned int acc = 0;
+	int bits = 0;
+	long n = 0;
+	size_t i;
+
+	/* A single character left over can't be anything */
+	if (len % 4 == 1)
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		int v = __jwtv_b64((unsigned char)in[i]);
+
+		if (v < 0)
+			return -1;
+
+		acc = (acc << 6) | (unsigned int)v;
+		bits += 6;
+
+		if (bits >= 8) {
+			bits -= 8;
+			out[n++] = (unsigned char)(acc >> bits);
+		}
+	}
+
+	return n;
+}
+
+static inline const char *__jwtv_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' ||
+			   *p == '\r'))
+		p++;
+
+	return p;
+}
+
+static inline int __jwtv_hex4(const char *p, const char *end,
+			      unsigned int *out)
+{
+	unsigned int v = 0;
+	int i;
+
+	if (end - p < 4)
+		return 1;
+
+	for (i = 0; i < 4; i++) {
+		char c = p[i];
+
+		v <<= 4;
+		if (c >= '0' && c <= '9')
+			v |= (unsigned int)(c - '0');
+		else if (c >= 'a' && c <= 'f')
+			v |= (unsigned int)(c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			v |= (unsigned int)(c - 'A' + 10);
+		else
+			return 1;
+	}
+
+	*out = v;
+
+	return 0;
+}
+
+/* An escape, p is just past the backslash. Same rules as the checker:
+ * surrogates in pairs, and no nils. Returns just past it, or NULL. */
+static inline const char *__jwtv_esc(const char *p, const char *end)
+{
+	unsigned int cp, lo;
+
+	if (p >= end)
+		return NULL;
+
+	switch (*p) {
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+		return p + 1;
+	case 'u':
+		break;
+	default:
+		return NULL;
+	}
+
+	if (__jwtv_hex4(p + 1, end, &cp) || cp == 0 ||
+	    (cp >= 0xdc00 && cp <= 0xdfff))
+		return NULL;
+
+	if (cp < 0xd800 || cp > 0xdbff)
+		return p + 5;
+
+	if (end - p < 11 || p[5] != '\\' || p[6] != 'u' ||
+	    __jwtv_hex4(p + 7, end, &lo) || lo < 0xdc00 || lo > 0xdfff)
+		return NULL;
+
+	return p + 11;
+}
+
+/* Length of the UTF-8 sequence at p, or 0 if it isn't one. Overlong
+ * forms, surrogates and anything past U+10FFFF are turned away, as
+ * jansson does. */
+static inline int __jwtv_utf8(const char *p, const char *end)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	unsigned int cp;
+	int n, i;
+
+	if (u[0] >= 0xc2 && u[0] <= 0xdf) {
+		n = 2;
+		cp = u[0] & 0x1f;
+	} else if (u[0] >= 0xe0 && u[0] <= 0xef) {
+		n = 3;
+		cp = u[0] & 0x0f;
+	} else if (u[0] >= 0xf0 && u[0] <= 0xf4) {
+		n = 4;
+		cp = u[0] & 0x07;
+	} else {
+		return 0;
+	}
+
+	if (end - p < n)
+		return 0;
+
+	for (i = 1; i < n; i++) {
+		if ((u[i] & 0xc0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (u[i] & 0x3f);
+	}
+
+	if ((n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000) ||
+	    (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+		return 0;
+
+	return n;
+}
+
+/* Skip a string, p is on the opening quote. Returns just past the
+ * closing quote, or NULL. */
+static inline const char *__jwtv_str(const char *p, const char *end,
+				     int *esc)
+{
+	for (p++; p < end;) {
+		unsigned char c = (unsigned char)*p;
+		int n;
+
+		if (c == '"')
+			return p + 1;
+
+		if (c < 0x20)
+			return NULL;
+
+		if (c == '\\') {
+			*esc = 1;
+			p = __jwtv_esc(p + 1, end);
+			if (p == NULL)
+				return NULL;
+		} else if (c < 0x80) {
+			p++;
+		} else {
+			n = __jwtv_utf8(p, end);
+			if (!n)
+				return NULL;
+			p += n;
+		}
+	}
+
+	return NULL;
+}
+
+static inline const char *__jwtv_lit(const char *p, const char *end,
+				     const char *lit, size_t len)
+{
+	if ((size_t)(end - p) < len || memcmp(p, lit, len))
+		return NULL;
+
+	return p + len;
+}
+
+static inline const char *__jwtv_digits(const char *p, const char *end)
+{
+	const char *start = p;
+
+	while (p < end && *p >= '0' && *p <= '9')
+		p++;
+
+	return p == start ? NULL : p;
+}
+
+/* A number, with the checker's grammar and range. Integers have to fit
+ * in a long long. Reals that could be too big for a double, anything
+ * with more than 300 digits before the point once the exponent is
+ * applied, fail closed. */
+static inline const char *__jwtv_num(const char *p, const char *end)
+{
+	const char *digits, *frac;
+	long exp = 0;
+	int neg = 0;
+
+	if (p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+
+	digits = p;
+	if (p < end && *p == '0')
+		p++;
+	else if ((p = __jwtv_digits(p, end)) == NULL)
+		return NULL;
+	frac = p;
+
+	if (p < end && *p == '.' && (p = __jwtv_digits(p + 1, end)) == NULL)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *e;
+		int eneg = 0;
+
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			eneg = *p++ == '-';
+
+		e = p;
+		if ((p = __jwtv_digits(p, end)) == NULL)
+			return NULL;
+
+		for (; e < p && exp < 100000; e++)
+			exp = exp * 10 + (*e - '0');
+		if (eneg)
+			exp = -exp;
+	} else if (frac == p) {
+		/* An integer, which the checker takes as a long long */
+		static const char max[] = "9223372036854775807";
+		size_t len = (size_t)(p - digits);
+
+		if (len > sizeof(max) - 1 ||
+		    (len == sizeof(max) - 1 &&
+		     memcmp(digits, neg ? "9223372036854775808" : max,
+			    len) > 0))
+			return NULL;
+
+		return p;
+	}
+
+	if ((frac - digits) + exp > 300)
+		return NULL;
+
+	return p;
+}
+
+/* Skip any value, checking it all the way down. Deeper than 64 levels
+ * fails closed; the checker allows more. */
+static inline const char *__jwtv_value(const char *p, const char *end)
+{
+	unsigned long long objs = 0;
+	int depth = 0, esc = 0;
+
+	for (;;) {
+		if (p >= end)
+			return NULL;
+
+		switch (*p) {
+		case '{':
+		case '[':
+			if (depth == 64)
+				return NULL;
+			objs = (objs << 1) | (*p == '{');
+			depth++;
+			p = __jwtv_ws(p + 1, end);
+			if (p < end && *p == ((objs & 1) ? '}' : ']')) {
+				p++;
+				depth--;
+				objs >>= 1;
+				goto next;
+			}
+			if (objs & 1)
+				goto key;
+			continue;
+		case '"':
+			p = __jwtv_str(p, end, &esc);
+			break;
+		case 't':
+			p = __jwtv_lit(p, end, "true", 4);
+			break;
+		case 'f':
+			p = __jwtv_lit(p, end, "false", 5);
+			break;
+		case 'n':
+			p = __jwtv_lit(p, end, "null", 4);
+			break;
+		default:
+			p = __jwtv_num(p, end);
+			break;
+		}
+
+		if (p == NULL)
+			return NULL;
+
+next:
+		/* Close what we can, then on to the next member */
+		for (;;) {
+			if (!depth)
+				return p;
+
+			p = __jwtv_ws(p, end);
+			if (p >= end)
+				return NULL;
+
+			if (*p == ((objs & 1) ? '}' : ']')) {
+				p++;
+				depth--;
+				objs >>= 1;
+				continue;
+			}
+
+			if (*p != ',')
+				return NULL;
+			p = __jwtv_ws(p + 1, end);
+			break;
+		}
+
+		if (!(objs & 1))
+			continue;
+
+key:
+		if (p >= end || *p != '"' ||
+		    (p = __jwtv_str(p, end, &esc)) == NULL)
+			return NULL;
+
+		p = __jwtv_ws(p, end);
+		if (p >= end || *p != ':')
+			return NULL;
+		p = __jwtv_ws(p + 1, end);
+	}
+}
+
+/* Walk the members of the object in json. For each one, name and val
+ * point at the quoted name and the value. Returns 1 for a member, 0 at the
+ * end, and -1 if this isn't an object we accept. */
+static inline int __jwtv_member(const char **pos, const char *end, int first,
+				const char **name, size_t *name_len,
+				const char **val, size_t *val_len)
+{
+	const char *p = __jwtv_ws(*pos, end);
+	int esc = 0;
+
+	if (p >= end)
+		return -1;
+
+	if (*p == '}') {
+		*pos = __jwtv_ws(p + 1, end);
+		return *pos == end ? 0 : -1;
+	}
+
+	if (!first) {
+		if (*p != ',')
+			return -1;
+		p = __jwtv_ws(p + 1, end);
+	}
+
+	if (p >= end || *p != '"')
+		return -1;
+
+	*name = p + 1;
+	p = __jwtv_str(p, end, &esc);
+	if (p == NULL || esc)
+		return -1;
+	*name_len = (size_t)(p - *name) - 1;
+
+	p = __jwtv_ws(p, end);
+	if (p >= end || *p != ':')
+		return -1;
+	p = __jwtv_ws(p + 1, end);
+
+	*val = p;
+	p = __jwtv_value(p, end);
+	if (p == NULL)
+		return -1;
+	*val_len = (size_t)(p - *val);
+
+	*pos = p;
+
+	return 1;
+}
+
+static inline int __jwtv_open(const char **pos, const char *end)
+{
+	const char *p = __jwtv_ws(*pos, end);
+
+	if (p >= end || *p != '{')
+		return 1;
+
+	*pos = p + 1;
+
+	return 0;
+}
+
+#define __jwtv_is(__n, __l, __s) \
+	((__l) == sizeof(__s) - 1 && !memcmp((__n), (__s), (__l)))
+
+/* A string value that is exactly str, with no escapes */
+static inline int __jwtv_str_eq(const char *val, size_t len, const char *str)
+{
+	size_t slen = strlen(str);
+
+	return val != NULL && len == slen + 2 && val[0] == '"' &&
+		!memchr(val + 1, '\\', slen) && !memcmp(val + 1, str, slen);
+}
+
+/* A plain integer, like jansson would give us */
+static inline int __jwtv_int(const char *val, size_t len, long long *out)
+{
+	long long n = 0;
+	size_t i = 0;
+	int neg = 0;
+
+	if (len && val[0] == '-') {
+		neg = 1;
+		i++;
+	}
+
+	if (i == len || len - i > 18)
+		return 1;
+
+	for (; i < len; i++) {
+		if (val[i] < '0' || val[i] > '9')
+			return 1;
+		n = (n * 10) + (val[i] - '0');
+	}
+
+	*out = neg ? -n : n;
+
+	return 0;
+}
+
+static inline jwt_verifier_err_t __jwtv_head(const char *json, size_t len,
+					     jwt_alg_t alg)
+{
+	const char *p = json, *end = json + len;
+	const char *name, *val, *alg_val = NULL;
+	size_t name_len, val_len, alg_len = 0;
+	int first = 1, ret;
+
+	if (__jwtv_open(&p, end))
+		return JWT_VERIFIER_ERR_FORMAT;
+
+	/* Last one wins, same as the checker */
+	while ((ret = __jwtv_member(&p, end, first, &name, &name_len, &val,
+				    &val_len)) > 0) {
+		first = 0;
+		if (__jwtv_is(name, name_len, "alg")) {
+			alg_val = val;
+			alg_len = val_len;
+		}
+	}
+
+	if (ret < 0)
+		return JWT_VERIFIER_ERR_FORMAT;
+
+	if (!__jwtv_str_eq(alg_val, alg_len, __jwtv_alg_name(alg)))
+		return JWT_VERIFIER_ERR_ALG;
+
+	return JWT_VERIFIER_OK;
+}
+
+static inline jwt_verifier_err_t __jwtv_claims(const char *json, size_t len,
+					const jwt_verifier_policy_t *policy)
+{
+	const char *p = json, *end = json + len;
+	const char *name, *val;
+	const char *exp = NULL, *nbf = NULL;
+	const char *iss = NULL, *sub = NULL, *aud = NULL;
+	size_t name_len, val_len;
+	size_t exp_len = 0, nbf_len = 0, iss_len = 0, sub_len = 0, aud_len = 0;
+	time_t now = time(NULL);
+	long long t;
+	int first = 1, ret;
+
+	if (__jwtv_open(&p, end))
+		return JWT_VERIFIER_ERR_FORMAT;
+
+	while ((ret = __jwtv_member(&p, end, first, &name, &name_len, &val,
+				    &val_len)) > 0) {
+		first = 0;
+		if (name_len != 3)
+			continue;
+		if (!memcmp(name, "exp", 3)) {
+			exp = val;
+			exp_len = val_len;
+		} else if (!memcmp(name, "nbf", 3)) {
+			nbf = val;
+			nbf_len = val_len;
+		} else if (!memcmp(name, "iss", 3)) {
+			iss = val;
+			iss_len = val_len;
+		} else if (!memcmp(name, "sub", 3)) {
+			sub = val;
+			sub_len = val_len;
+		} else if (!memcmp(name, "aud", 3)) {
+			aud = val;
+			aud_len = val_len;
+		}
+	}
+
+	if (ret < 0)
+		return JWT_VERIFIER_ERR_FORMAT;
+
+	/* Missing times are fine, just like the checker */
+	if (policy->exp >= 0 && exp != NULL &&
+	    (__jwtv_int(exp, exp_len, &t) || t <= (long long)(now - policy->exp)))
+		return JWT_VERIFIER_ERR_CLAIMS;
+
+	if (policy->nbf >= 0 && nbf != NULL &&
+	    (__jwtv_int(nbf, nbf_len, &t) || t > (long long)(now + policy->nbf)))
+		return JWT_VERIFIER_ERR_CLAIMS;
+
+	if ((policy->iss && !__jwtv_str_eq(iss, iss_len, policy->iss)) ||
+	    (policy->sub && !__jwtv_str_eq(sub, sub_len, policy->sub)) ||
+	    (policy->aud && !__jwtv_str_eq(aud, aud_len, policy->aud)))
+		return JWT_VERIFIER_ERR_CLAIMS;
+
+	return JWT_VERIFIER_OK;
+}
+
+__JWTV_INLINE jwt_verifier_err_t __jwtv_run(const jwt_verifier_t *v,
+		const jwt_verifier_policy_t *policy, jwt_alg_t alg,
+		const char *token, size_t len, unsigned char *buf)
+{
+	const char *dot1, *dot2;
+	jwt_verifier_err_t err;
+	long n;
+
+	dot1 = (const char *)memchr(token, '.', len);
+	if (dot1 == NULL)
+		return JWT_VERIFIER_ERR_FORMAT;
+	dot2 = (const char *)memchr(dot1 + 1, '.', len - (dot1 + 1 - token));
+	if (dot2 == NULL)
+		return JWT_VERIFIER_ERR_FORMAT;
+
+	/* One buffer, used for each part in turn */
+	n = __jwtv_b64_decode(token, dot1 - token, buf);
+	if (n < 0)
+		return JWT_VERIFIER_ERR_FORMAT;
+	err = __jwtv_head((const char *)buf, n, alg);
+	if (err != JWT_VERIFIER_OK)
+		return err;
+
+	n = __jwtv_b64_decode(dot1 + 1, dot2 - (dot1 + 1), buf);
+	if (n < 0)
+		return JWT_VERIFIER_ERR_FORMAT;
+	err = __jwtv_claims((const char *)buf, n, policy);
+	if (err != JWT_VERIFIER_OK)
+		return err;
+
+	n = __jwtv_b64_decode(dot2 + 1, len - (dot2 + 1 - token), buf);
+	if (n <= 0)
+		return n < 0 ? JWT_VERIFIER_ERR_FORMAT : JWT_VERIFIER_ERR_SIG;
+
+	if (jwt_verifier_sig(v, alg, token, dot2 - token, buf, n))
+		return JWT_VERIFIER_ERR_SIG;
+
+	return JWT_VERIFIER_OK;
+}
+
+/** @endcond */
+
+/**
+ * @brief Define a verifier specialized for one algorithm
+ *
+ * Defines a static function:
+ *
+ * @code
+ * jwt_verifier_err_t name(const jwt_verifier_t *v,
+ *			   const jwt_verifier_policy_t *policy,
+ *			   const char *token, size_t len);
+ * @endcode
+ *
+ * which verifies token with v, which must have been created for alg, and
+ * checks its claims against policy. Tokens longer than max_len are turned
+ * away, and max_len bytes of stack are used.
+ *
+ * @param name Name of the function to define
+ * @param alg A jwt_alg_t constant, e.g. JWT_ALG_ES256
+ * @param max_len Largest token to accept, in bytes
+ */
+#define JWT_DEFINE_VERIFIER(name, alg, max_len)				\
+static inline jwt_verifier_err_t name(const jwt_verifier_t *__v,	\
+				      const jwt_verifier_policy_t *__p,	\
+				      const char *__token, size_t __len)	\
+{									\
+	unsigned char __buf[(max_len) - ((max_len) / 4)];		\
+									\
+	if (__len > (max_len))						\
+		return JWT_VERIFIER_ERR_SIZE;				\
+									\
+	return __jwtv_run(__v, __p, alg, __token, __len, __buf);	\
+}
+
+/**
+ * @}
+ * @noop jwt_verifier_grp
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JWT_VERIFIER_H */
@@ -42,6 +42,14 @@ typedef struct jwt jwt_t;
  */
 typedef struct jwk_set jwk_set_t;
 
+/** @ingroup jwks_ring_grp
+ * @brief Opaque key ring object
+ *
+ * Holds one jwk_set_t at a time, which can be swapped for a new one while
+ * checkers are verifying with it.
+ */
+typedef struct jwks_ring jwks_ring_t;
+
 /** @ingroup jwt_alg_grp
  * @brief JWT algorithm types
  *
@@ -211,6 +219,34 @@ typedef void *(*jwt_malloc_t)(size_t);
  */
 typedef void (*jwt_free_t)(void *);
 
+/** @ingroup jwt_memory_grp
+ * @brief Parts of LibJWT that allocation statistics are kept for
+ *
+ * An allocation is counted against the innermost of these it was made
+ * in, so the base64 decoding done while parsing a token counts as
+ * JWT_ALLOC_BASE64 and not JWT_ALLOC_PARSE.
+ */
+typedef enum {
+	JWT_ALLOC_OTHER = 0,	/**< Anything not covered below		*/
+	JWT_ALLOC_PARSE,	/**< Splitting and checking tokens	*/
+	JWT_ALLOC_BASE64,	/**< Base64url encoding and decoding	*/
+	JWT_ALLOC_JSON,		/**< Jansson, for headers, claims, JWKS	*/
+	JWT_ALLOC_CRYPTO,	/**< Crypto ops, signing and verifying	*/
+	JWT_ALLOC_JWKS,		/**< Loading JWK and JWKS		*/
+	JWT_ALLOC_ALL,		/**< Totals for all of the above	*/
+} jwt_alloc_sys_t;
+
+/** @ingroup jwt_memory_grp
+ * @brief Allocation statistics, see jwt_alloc_stats_get()
+ */
+typedef struct {
+	unsigned long count;	/**< Number of allocations		*/
+	unsigned long frees;	/**< Number of those that were freed	*/
+	size_t bytes;		/**< Total bytes allocated		*/
+	size_t live;		/**< Bytes allocated and not yet freed	*/
+	size_t peak;		/**< Highest that live has been		*/
+} jwt_alloc_stats_t;
+
 /** @ingroup jwt_alg_grp
  * Get the jwt_alg_t set for this JWT object.
  *
@@ -249,6 +285,44 @@ typedef enum {
         JWT_CLAIM_JTI           = 0x0040, /**< @rfc_t{7519,4.1.7} ``"jti"`` */
 } jwt_claims_t;
 
+/** @ingroup jwt_grp
+ * @brief Why a checker or builder failed
+ *
+ * These are stable, and new ones are only ever added to the end. Errors
+ * that don't have one of their own are JWT_ERR_OTHER, and are only
+ * described by the error message.
+ */
+typedef enum {
+	JWT_ERR_NONE = 0,	/**< No error				*/
+	JWT_ERR_OTHER,		/**< See the error message		*/
+	JWT_ERR_NOMEM,		/**< Memory allocation failed		*/
+	JWT_ERR_NO_TOKEN,	/**< No token was given			*/
+	JWT_ERR_TOKEN_NIL,	/**< Token contains a nil byte		*/
+	JWT_ERR_NO_HEADER_DOT,	/**< No dot after the header		*/
+	JWT_ERR_NO_PAYLOAD_DOT,	/**< No dot after the payload		*/
+	JWT_ERR_HEADER,		/**< Header is not base64url JSON	*/
+	JWT_ERR_PAYLOAD,	/**< Payload is not base64url JSON	*/
+	JWT_ERR_NO_ALG,		/**< No ``"alg"`` in the header		*/
+	JWT_ERR_BAD_ALG,	/**< Unknown ``"alg"`` in the header	*/
+	JWT_ERR_CALLBACK,	/**< User callback returned an error	*/
+	JWT_ERR_CLAIMS,		/**< Claims failed, see the claims mask	*/
+	JWT_ERR_SIG_MISSING,	/**< A signature was expected		*/
+	JWT_ERR_SIG_NO_ALG,	/**< Signature, but ``"alg"`` is none	*/
+	JWT_ERR_NO_KEY,		/**< Signature, but no key to check it	*/
+	JWT_ERR_KEY_ALG,	/**< Key's alg does not match the token	*/
+	JWT_ERR_CONFIG_ALG,	/**< Configured alg does not match	*/
+	JWT_ERR_SIG_DECODE,	/**< Signature is not base64url		*/
+	JWT_ERR_SIG_VERIFY,	/**< Signature did not verify		*/
+	JWT_ERR_SIGN,		/**< Signing failed			*/
+	JWT_ERR_LIMIT,		/**< Token or a part of it is too long	*/
+	JWT_ERR_JSON_LIMIT,	/**< Header or payload JSON is too big	*/
+	JWT_ERR_ALG_DENIED,	/**< Alg is not allowed by the checker	*/
+	JWT_ERR_KID,		/**< Header kid does not match the key	*/
+	JWT_ERR_SIG_LEN,	/**< Signature is the wrong size for alg */
+	JWT_ERR_POLICY,		/**< Claims did not match the policy	*/
+	JWT_ERR_NO_KID,		/**< No kid, and no one key to use	*/
+} jwt_error_t;
+
 /**
  * @defgroup jwt_grp JSON Web Token
  * @{
@@ -321,6 +395,15 @@ int jwt_builder_error(const jwt_builder_t *builder);
 JWT_EXPORT
 const char *jwt_builder_error_msg(const jwt_builder_t *builder);
 
+/**
+ * @brief Get the error code of a builder object
+ *
+ * @param builder Pointer to a builder object
+ * @return JWT_ERR_NONE if there is no error. See jwt_checker_error_code().
+ */
+JWT_EXPORT
+jwt_error_t jwt_builder_error_code(const jwt_builder_t *builder);
+
 /**
  * @brief Clear error state in a builder object
  *
@@ -350,6 +433,9 @@ void jwt_builder_error_clear(jwt_builder_t *builder);
  * @warning The warning represents an insecure token. Using insecure tokens is
  * not very useful and strongly discouraged.
  *
+ * The builder holds a reference to the key (see jwks_item_ref()), so the
+ * jwk_set_t it came from can be freed while the builder is still in use.
+ *
  * @param builder Pointer to a builder object
  * @param alg A valid jwt_alg_t type
  * @param key A JWK key object
@@ -372,6 +458,84 @@ int jwt_builder_setkey(jwt_builder_t *builder, const jwt_alg_t alg,
 JWT_EXPORT
 int jwt_builder_enable_iat(jwt_builder_t *builder, int enable);
 
+/**
+ * @brief Compile the builder into a template for faster generation
+ *
+ * When enabled, the first call to jwt_builder_generate() encodes the header
+ * and serializes the static claims once. Later calls only fill in the time
+ * based claims (``iat``, ``nbf`` and ``exp``) and the ``jti``, encode the
+ * payload and sign it, which saves a lot of JSON and memory work for
+ * services that issue many tokens with the same shape.
+ *
+ * Any change to the builder (key, claims, headers, or time offsets) drops
+ * the template, and it is compiled again on the next generate. Tokens are
+ * the same as the ones created without a template.
+ *
+ * @note The template is not used while a callback is set with
+ *  jwt_builder_setcb(), since the callback may change each token.
+ *
+ * @param builder Pointer to a builder object
+ * @param enable 0 to disable, any other value to enable
+ * @return Previous value (0 or 1), or -1 on error
+ */
+JWT_EXPORT
+int jwt_builder_enable_template(jwt_builder_t *builder, int enable);
+
+/**
+ * @brief Longest ``jti`` the builder will add, including the nil
+ */
+#define JWT_JTI_MAX	64
+
+/**
+ * @brief Prototype for making a ``jti``
+ *
+ * Write a nil terminated ID of no more than len - 1 chars to jti. IDs must
+ * be printable ASCII, without ``"`` or ``\``, which covers UUIDs and any
+ * base64url or hex encoding.
+ *
+ * @param jti Buffer to write the ID to
+ * @param len Size of the buffer, which is JWT_JTI_MAX
+ * @param ctx The ctx given to jwt_builder_setjti()
+ * @return 0 on success, non-zero to fail the token
+ */
+typedef int (*jwt_jti_cb_t)(char *jti, size_t len, void *ctx);
+
+/**
+ * @brief Set JWT ID usage on builder
+ *
+ * By default, the builder does not set a ``jti`` claim. When enabled, each
+ * token gets a new one, replacing any ``jti`` in the builder's claims.
+ * Unless a callback is set with jwt_builder_setjti(), it is 16 random
+ * bytes from the OS, base64url encoded.
+ *
+ * This works with jwt_builder_enable_template(). The ``jti`` is filled in
+ * on each generate, the same as the time based claims.
+ *
+ * @param builder Pointer to a builder object
+ * @param enable 0 to disable, any other value to enable
+ * @return Previous value (0 or 1), or -1 on error
+ */
+JWT_EXPORT
+int jwt_builder_enable_jti(jwt_builder_t *builder, int enable);
+
+/**
+ * @brief Set a callback for making the ``jti`` of each token
+ *
+ * For when the IDs have to come from somewhere else, such as a sequence
+ * shared with other services. This also enables ``jti``, the same as
+ * jwt_builder_enable_jti(). A NULL cb goes back to random IDs.
+ *
+ * @note Like the callback from jwt_builder_setcb(), this is only called
+ *  from one thread at a time by jwt_builder_generate_batch().
+ *
+ * @param builder Pointer to a builder object
+ * @param cb Pointer to a callback function, or NULL
+ * @param ctx Pointer to data to pass to the callback function
+ * @return 0 on success, non-zero otherwise with error set in the builder
+ */
+JWT_EXPORT
+int jwt_builder_setjti(jwt_builder_t *builder, jwt_jti_cb_t cb, void *ctx);
+
 /**
  * @brief Set a callback for generating tokens
  *
@@ -407,6 +571,21 @@ int jwt_builder_setcb(jwt_builder_t *builder, jwt_callback_t cb, void *ctx);
 JWT_EXPORT
 void *jwt_builder_getctx(jwt_builder_t *builder);
 
+/**
+ * @brief Set the crypto operations used by this builder
+ *
+ * Tokens generated by this builder are signed with the named crypto ops,
+ * regardless of what jwt_set_crypto_ops() or jwt_set_crypto_ops_alg()
+ * have chosen. Keys are still loaded as usual, so any JWK can be used.
+ *
+ * @param builder Pointer to a builder object
+ * @param opname Name of the crypto ops, as with jwt_set_crypto_ops(), or
+ *  NULL to go back to the library wide choice
+ * @return 0 on success, non-zero otherwise with error set in the builder
+ */
+JWT_EXPORT
+int jwt_builder_set_crypto_ops(jwt_builder_t *builder, const char *opname);
+
 /**
  * @brief Generate a token
  *
@@ -470,6 +649,50 @@ void *jwt_builder_getctx(jwt_builder_t *builder);
 JWT_EXPORT
 char *jwt_builder_generate(jwt_builder_t *builder);
 
+/**
+ * @brief Generate many tokens at once
+ *
+ * Creates n tokens from the builder, spreading the signing over a pool of
+ * worker threads (one per online CPU, at most n), the same pool as
+ * jwt_checker_verify_batch() uses. Tokens are returned in
+ * out in the same order as the input, and all of them share the same
+ * ``iat``, ``nbf`` and ``exp`` values.
+ *
+ * Each token can have extra claims. If claims_override is not NULL, then
+ * claims_override[i] is either NULL or a JSON object string, whose members
+ * are added to token i, replacing any claims of the same name in the
+ * builder. All of them are parsed before anything is signed.
+ *
+ * @code
+ * const char *extra[] = {
+ *     "{\"sub\":\"device-0\"}",
+ *     "{\"sub\":\"device-1\"}",
+ * };
+ * char *out[2];
+ *
+ * if (jwt_builder_generate_batch(builder, extra, 2, out) == 0) {
+ *     ...
+ * }
+ * @endcode
+ *
+ * @note If a callback is set with jwt_builder_setcb(), it is called for
+ *  every token, but all of the work is done on the caller's thread. The
+ *  builder must not be changed while this is running.
+ *
+ * @param builder Pointer to a builder object
+ * @param claims_override NULL, or an array of n JSON strings (or NULL)
+ * @param n Number of tokens to generate
+ * @param out Array of n pointers that receives the tokens. Caller is
+ *  responsible for freeing each of them. Tokens that failed are NULL.
+ * @return 0 on success, the number of tokens that failed, or -1 if
+ *  nothing was generated. On error, the first failure is set in the
+ *  builder object.
+ */
+JWT_EXPORT
+int jwt_builder_generate_batch(jwt_builder_t *builder,
+			       const char *claims_override[], size_t n,
+			       char *out[]);
+
 /**
  * @}
  * @noop jwt_builder_grp
@@ -555,6 +778,34 @@ int jwt_checker_error(const jwt_checker_t *checker);
 JWT_EXPORT
 const char *jwt_checker_error_msg(const jwt_checker_t *checker);
 
+/**
+ * @brief Get the error code of a checker object
+ *
+ * This is cheaper than jwt_checker_error_msg() for telling failures
+ * apart, and doesn't change between releases. The message for most
+ * codes is only looked up when it's asked for. A signature that fails is
+ * always JWT_ERR_SIG_VERIFY, though the crypto backend may have put a
+ * message of its own on it.
+ *
+ * @param checker Pointer to a checker object
+ * @return JWT_ERR_NONE if there is no error, JWT_ERR_OTHER if the error
+ *  has no code of its own, or the reason the last verify failed.
+ */
+JWT_EXPORT
+jwt_error_t jwt_checker_error_code(const jwt_checker_t *checker);
+
+/**
+ * @brief Get the claims that failed verification
+ *
+ * When jwt_checker_error_code() is JWT_ERR_CLAIMS, this says which
+ * ones. Every claim is checked, so more than one may be set.
+ *
+ * @param checker Pointer to a checker object
+ * @return Bitmask of @ref jwt_claims_t, 0 if none failed
+ */
+JWT_EXPORT
+jwt_claims_t jwt_checker_error_claims(const jwt_checker_t *checker);
+
 /**
  * @brief Clear error state in a checker object
  *
@@ -577,6 +828,31 @@ JWT_EXPORT
 int jwt_checker_setkey(jwt_checker_t *checker, const jwt_alg_t alg, const
 		       jwk_item_t *key);
 
+/**
+ * @brief Verify with keys from a key ring
+ *
+ * When the checker has no key of its own from jwt_checker_setkey(), the
+ * key is the one in the ring's current set with the same ``kid`` as the
+ * token's header. A token with no ``kid`` gets the only key in the set,
+ * and fails with JWT_ERR_NO_KID if there isn't just the one. Keys with an
+ * error are skipped. A key with no alg is used with the header's alg, as
+ * long as it is one for the key's type and curve.
+ *
+ * With a ring, every token has to be signed by one of its keys. Tokens
+ * with an alg of none fail with JWT_ERR_SIG_MISSING, and ones with a
+ * ``kid`` that isn't in the set with JWT_ERR_NO_KEY, as do all tokens
+ * while the set is empty. A callback sees the chosen key in jwt_config_t,
+ * and may change it but not take it away, and the key is only good until
+ * the verify is done. See @ref jwks_ring_grp.
+ *
+ * @param checker Pointer to a checker object
+ * @param ring Pointer to a key ring, or NULL to stop using one. The
+ *  checker takes its own reference.
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_checker_set_keyring(jwt_checker_t *checker, jwks_ring_t *ring);
+
 /**
  * @brief Set a callback for generating tokens
  *
@@ -617,6 +893,131 @@ int jwt_checker_setcb(jwt_checker_t *checker, jwt_callback_t cb, void *ctx);
 JWT_EXPORT
 void *jwt_checker_getctx(jwt_checker_t *checker);
 
+/**
+ * @brief Set the crypto operations used by this checker
+ *
+ * Tokens verified by this checker use the named crypto ops, regardless of
+ * what jwt_set_crypto_ops() or jwt_set_crypto_ops_alg() have chosen.
+ *
+ * @param checker Pointer to a checker object
+ * @param opname Name of the crypto ops, as with jwt_set_crypto_ops(), or
+ *  NULL to go back to the library wide choice
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_set_crypto_ops(jwt_checker_t *checker, const char *opname);
+
+/**
+ * @brief Limits on what a checker will try to parse
+ *
+ * A field left at 0 is not limited. Lengths of the token and its parts
+ * are checked before anything is copied or decoded. The JSON limits are
+ * checked on the decoded header and payload before they are parsed, so
+ * nothing is built for JSON that is over them. String lengths are as
+ * written, including any escapes.
+ */
+typedef struct {
+	size_t token_len;	/**< Whole token			*/
+	size_t header_len;	/**< Base64url encoded header		*/
+	size_t payload_len;	/**< Base64url encoded payload		*/
+	size_t sig_len;		/**< Base64url encoded signature	*/
+	unsigned int json_depth;	/**< Nesting of objects and arrays */
+	unsigned int json_members;	/**< Object members and array
+					 * elements, all together	*/
+	size_t json_string;	/**< Longest string, keys included	*/
+} jwt_limits_t;
+
+/** Bit for alg in a mask for jwt_checker_set_algs() */
+#define JWT_ALG_BIT(__alg) (1U << (__alg))
+
+/**
+ * @brief Limit the size and shape of tokens a checker will accept
+ *
+ * Tokens over any of the limits fail with JWT_ERR_LIMIT or
+ * JWT_ERR_JSON_LIMIT, at a cost that depends on the limits and not on
+ * the token.
+ *
+ * @param checker Pointer to a checker object
+ * @param limits Limits to copy in, or NULL to remove all limits
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_set_limits(jwt_checker_t *checker, const jwt_limits_t *limits);
+
+/**
+ * @brief Limit which algs a checker will accept
+ *
+ * Checked as soon as the header is parsed, before the payload. Tokens
+ * with any other alg fail with JWT_ERR_ALG_DENIED. This includes
+ * ``"none"``, unless JWT_ALG_BIT(JWT_ALG_NONE) is in the mask.
+ *
+ * @code
+ * jwt_checker_set_algs(checker, JWT_ALG_BIT(JWT_ALG_ES256) |
+ *                               JWT_ALG_BIT(JWT_ALG_EDDSA));
+ * @endcode
+ *
+ * @param checker Pointer to a checker object
+ * @param mask JWT_ALG_BIT() of each allowed alg, or 0 to allow all
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_set_algs(jwt_checker_t *checker, unsigned int mask);
+
+/**
+ * @brief Work saved by jwt_checker_fail_fast()
+ */
+typedef struct {
+	unsigned long alg;	/**< Rejected for the header's alg	*/
+	unsigned long kid;	/**< Rejected for the header's kid	*/
+	unsigned long sig_len;	/**< Rejected for the signature length	*/
+	unsigned long long payload_bytes; /**< Payload never decoded	*/
+} jwt_fail_fast_stats_t;
+
+/**
+ * @brief Reject tokens on their header before decoding the payload
+ *
+ * Normally, the header and payload are both decoded and parsed, then the
+ * callback is run and the claims checked, and only then is the token
+ * compared with the key. With this on, tokens are compared with what
+ * the checker can accept as soon as the header is parsed:
+ *
+ * - The header's alg must match the checker's alg, or its key's.
+ * - If both the header and the key have a kid, they must match.
+ * - The signature must be the right length for the alg (and for RSA,
+ *   the key).
+ *
+ * With no key of its own, a checker with a key ring picks the ring key
+ * for the header first, as jwt_checker_set_keyring() describes, and holds
+ * the token to that key.
+ *
+ * Tokens that fail any of these are rejected without their payload being
+ * decoded and without the callback being run. When a callback is set,
+ * it may pick the key, so only the signature length is checked early.
+ *
+ * This changes which error is reported for a token with more than one
+ * thing wrong with it, which is why it is off by default.
+ *
+ * @param checker Pointer to a checker object
+ * @param enable 1 to turn on, 0 to turn off
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_fail_fast(jwt_checker_t *checker, int enable);
+
+/**
+ * @brief Get the work saved by jwt_checker_fail_fast()
+ *
+ * These count up from when the checker was made, and are safe to read
+ * while tokens are being verified.
+ *
+ * @param checker Pointer to a checker object
+ * @param stats Filled in with the counts
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_checker_fail_fast_stats(const jwt_checker_t *checker,
+				jwt_fail_fast_stats_t *stats);
+
 /**
  * @brief Verify a token
  *
@@ -629,6 +1030,53 @@ void *jwt_checker_getctx(jwt_checker_t *checker);
 JWT_EXPORT
 int jwt_checker_verify(jwt_checker_t *checker, const char *token);
 
+/**
+ * @brief Verify many tokens at once
+ *
+ * Verifies n tokens with the checker, spreading the work over a pool of
+ * worker threads (one per online CPU, at most n). The result for
+ * tokens[i] is put in results[i], which is 0 if the token verified and
+ * non-zero otherwise.
+ *
+ * Each thread starts on its own share of the tokens, and helps with what
+ * is left of the others once it is done. With a key ring, tokens with the
+ * same header are put in the same share, so each thread mostly uses the
+ * same key. The workers are started the first time they are needed, and
+ * kept for later batches. A batch that starts while another one has them
+ * is done on the caller's thread.
+ *
+ * The tokens do not need to be nil terminated if lens is given, which
+ * makes it easy to verify tokens in place in a larger buffer. If lens is
+ * NULL, then each token must be a nil terminated string.
+ *
+ * @code
+ * const char *tokens[] = { tok1, tok2, tok3 };
+ * int results[3];
+ *
+ * if (jwt_checker_verify_batch(checker, tokens, NULL, 3, results) > 0) {
+ *     for (i = 0; i < 3; i++)
+ *         if (results[i])
+ *             ...
+ * }
+ * @endcode
+ *
+ * @note If a callback is set with jwt_checker_setcb(), it is called for
+ *  every token, but all of the work is done on the caller's thread. The
+ *  checker must not be changed while this is running.
+ *
+ * @param checker Pointer to a checker object
+ * @param tokens Array of n tokens
+ * @param lens NULL, or an array of n token lengths
+ * @param n Number of tokens to verify
+ * @param results Array of n ints that receives the result for each token
+ * @return 0 on success, the number of tokens that failed, or -1 if
+ *  nothing was verified. On error, the first failure is set in the
+ *  checker object.
+ */
+JWT_EXPORT
+int jwt_checker_verify_batch(jwt_checker_t *checker, const char *tokens[],
+			     const size_t lens[], size_t n, int results[]);
+
 /**
  * @}
  * @noop jwt_checker_grp
@@ -1020,106 +1468,760 @@ int jwt_checker_time_leeway(jwt_checker_t *checker, jwt_claims_t claim,
  */
 
 /**
- * @defgroup jwt_object_grp JWT Functions
+ * @defgroup jwt_policy_grp Claim Policies
  *
- * For most usage, setting values in the builder object is enough to provide
- * all the information you would like set in a JWT token. However, if some
- * information is dynamic, meaning it is only known at the time the token is
- * created, then you can provide this during the builder callback on the jwt_t
- * object.
+ * A policy is a list of rules for the claims of a token, which covers
+ * what jwt_checker_claim_set() can't: any claim, not just the standard
+ * ones, a set of acceptable values instead of one, ``aud`` given as an
+ * array, and numeric ranges.
+ *
+ * Rule     | Passes when the claim...
+ * -------- | ---------------------------------------------------------
+ * Required | is present, with any value
+ * Values   | is a string in the set, or an array with one that is
+ * Range    | is an integer from min to max, inclusive
+ *
+ * Values and ranges also make the claim required. Adding more than one
+ * value for a claim adds to its set. A claim can have values or a
+ * range, but not both.
+ *
+ * @code
+ * jwt_policy_t *policy = jwt_policy_new();
+ *
+ * jwt_policy_add_str(policy, "iss", "https://a.example.com");
+ * jwt_policy_add_str(policy, "iss", "https://b.example.com");
+ * jwt_policy_add_str(policy, "aud", "api");
+ * jwt_policy_add_range(policy, "level", 1, 5);
+ * jwt_policy_require(policy, "jti");
+ *
+ * jwt_checker_set_policy(checker, policy);
+ * jwt_policy_free(policy);
+ * @endcode
+ *
+ * The checker compiles the policy into its own matcher, with the claim
+ * names and each set of values hashed, so the policy can be freed or
+ * reused after. Every rule is then checked in one pass over the claims
+ * of each token, after the checks set with jwt_checker_claim_set().
  *
- * When verifying a token, the checker callback should not modify the jwt_t
- * object at all. Access to the jwt_t is provided only to allow additional
- * validation beyond LibJWT's internal checks.
  * @{
  */
 
 /**
- * @brief Set a value in the header of a JWT
- *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param value A jwt_value_t structure with relevant actions filled in
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
- *  value.error field will match this return value.
+ * @brief Opaque policy object
  */
-JWT_EXPORT
-jwt_value_error_t jwt_header_set(jwt_t *jwt, jwt_value_t *value);
+typedef struct jwt_policy jwt_policy_t;
+
+/** Most rules (distinct claims) a policy can have */
+#define JWT_POLICY_MAX_RULES 64
 
 /**
- * @brief Get a value from the header of a JWT
+ * @brief Make a new, empty policy
  *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param value A jwt_value_t structure with relevant actions filled in
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
- *  value.error field will match this return value.
+ * @return Pointer to a policy, or NULL on error
  */
 JWT_EXPORT
-jwt_value_error_t jwt_header_get(jwt_t *jwt, jwt_value_t *value);
+jwt_policy_t *jwt_policy_new(void);
 
 /**
- * @brief Delete a value from the header of a JWT
+ * @brief Free a policy
  *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param header The name of the header to delete, or NULL to clear the entire
- *  header
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success.
+ * @param policy Pointer to a policy, or NULL
  */
 JWT_EXPORT
-jwt_value_error_t jwt_header_del(jwt_t *jwt, const char *header);
+void jwt_policy_free(jwt_policy_t *policy);
 
 /**
- * @brief Set a value in the claims of a JWT
+ * @brief Require a claim to be present
  *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param value A jwt_value_t structure with relevant actions filled in
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
- *  value.error field will match this return value.
+ * @param policy Pointer to a policy
+ * @param claim Name of the claim
+ * @return 0 on success, non-zero otherwise
  */
 JWT_EXPORT
-jwt_value_error_t jwt_claim_set(jwt_t *jwt, jwt_value_t *value);
+int jwt_policy_require(jwt_policy_t *policy, const char *claim);
 
 /**
- * @brief Get a value from the claims of a JWT
+ * @brief Add an acceptable string value for a claim
  *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param value A jwt_value_t structure with relevant actions filled in
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
- *  value.error field will match this return value.
+ * @param policy Pointer to a policy
+ * @param claim Name of the claim
+ * @param value One of the values the claim may have
+ * @return 0 on success, non-zero otherwise
  */
 JWT_EXPORT
-jwt_value_error_t jwt_claim_get(jwt_t *jwt, jwt_value_t *value);
+int jwt_policy_add_str(jwt_policy_t *policy, const char *claim,
+		       const char *value);
 
 /**
- * @brief Delete a value from the claims of a JWT
+ * @brief Set the range of integers a claim may have
  *
- * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
- * @param claim The name of the claim to delete, or NULL to clear all claims
- * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success.
+ * @param policy Pointer to a policy
+ * @param claim Name of the claim
+ * @param min Lowest acceptable value
+ * @param max Highest acceptable value
+ * @return 0 on success, non-zero otherwise
  */
 JWT_EXPORT
-jwt_value_error_t jwt_claim_del(jwt_t *jwt, const char *claim);
+int jwt_policy_add_range(jwt_policy_t *policy, const char *claim, long min,
+			 long max);
 
 /**
- * @}
- * @noop jwt_object_grp
+ * @brief Compile a policy into a checker
+ *
+ * Tokens that don't match fail with JWT_ERR_POLICY. For the standard
+ * claims, jwt_checker_error_claims() says which ones failed.
+ *
+ * @param checker Pointer to a checker object
+ * @param policy Pointer to a policy, or NULL to remove the checker's
+ * @return 0 on success, non-zero otherwise with error set in the checker
  */
+JWT_EXPORT
+int jwt_checker_set_policy(jwt_checker_t *checker,
+			   const jwt_policy_t *policy);
 
 /**
  * @}
- * @noop jwt_claims_grp
+ * @noop jwt_policy_grp
  */
 
 /**
- * @defgroup jwt_alg_grp Algorithms
+ * @defgroup jwt_scopes_grp Scopes
+ *
+ * Instead of splitting the scopes of every token and comparing them as
+ * strings, give the checker the list of scope names you care about once.
+ * Each name gets a bit, in the order given, and verifying a token with
+ * jwt_checker_verify_scopes() also gives you the bits for the scopes it
+ * was granted. Checking a route is then a single AND.
+ *
+ * Scopes are taken from any of these claims:
+ *
+ * Claim     | Form
+ * --------- | ----------------------------------------------------------
+ * ``scope`` | Space separated string, @rfc_t{8693,4.2}
+ * ``scp``   | Space separated string, or array of strings
+ * ``roles`` | Array of strings, or a single string
+ *
+ * Names that are not in the list are ignored.
+ *
+ * @code
+ * enum { SCOPE_READ = 0, SCOPE_WRITE, SCOPE_ADMIN };
+ * const char *names[] = { "read", "write", "admin" };
+ * unsigned long long scopes;
+ *
+ * jwt_checker_set_scopes(checker, names, 3);
+ *
+ * if (jwt_checker_verify_scopes(checker, token, &scopes))
+ *         return 401;
+ * if (!(scopes & JWT_SCOPE_BIT(SCOPE_WRITE)))
+ *         return 403;
+ * @endcode
  *
- * Utility functions to convert between string and type for ``alg``
  * @{
  */
 
+/** Most scope names a checker can have */
+#define JWT_SCOPES_MAX 64
+
+/** The bit for the scope at index __i in the list of names */
+#define JWT_SCOPE_BIT(__i) (1ULL << (__i))
+
 /**
- * Convert alg type to it's string representation.
+ * @brief Set the scope names for a checker
  *
- * Returns a string that matches the alg type provided.
+ * The names are copied. Each must be unique and not empty.
+ *
+ * @param checker Pointer to a checker object
+ * @param names Array of scope names, or NULL to remove them
+ * @param count Number of names, up to JWT_SCOPES_MAX
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_set_scopes(jwt_checker_t *checker, const char *names[],
+			   unsigned int count);
+
+/**
+ * @brief Verify a token and get the scopes it grants
+ *
+ * The same as jwt_checker_verify(), and like it, safe to call from more
+ * than one thread at a time if no callback changes the checker.
+ *
+ * @param checker Pointer to a checker object
+ * @param token A string containing a token to be verified
+ * @param scopes Set to the JWT_SCOPE_BIT() of each scope granted, or 0 if
+ *  verification failed
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_verify_scopes(jwt_checker_t *checker, const char *token,
+			      unsigned long long *scopes);
+
+/**
+ * @}
+ * @noop jwt_scopes_grp
+ */
+
+/**
+ * @defgroup jwt_verified_grp Verified Tokens
+ *
+ * jwt_checker_verify() only says whether a token is good. When you also
+ * want what is in it, jwt_checker_verify_extract() hands you the headers
+ * and claims it already parsed, instead of you copying them out in a
+ * callback or decoding the token again.
+ *
+ * What you get is a read-only handle. It is reference counted, so it can
+ * be passed to other threads or kept in a cache, with each holder taking
+ * its own reference. The last jwt_verified_unref() frees it.
+ *
+ * @code
+ * jwt_verified_auto_t *v = NULL;
+ * jwt_value_t jval;
+ *
+ * if (jwt_checker_verify_extract(checker, token, &v))
+ *         return 401;
+ *
+ * jwt_set_GET_STR(&jval, "sub");
+ * if (jwt_verified_claim_get(v, &jval) == JWT_VALUE_ERR_NONE)
+ *         printf("Hello, %s\n", jval.str_val);
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * @brief Opaque verified token object
+ */
+typedef struct jwt_verified jwt_verified_t;
+
+/**
+ * @brief Verify a token and keep what was parsed
+ *
+ * The same as jwt_checker_verify(), and like it, safe to call from more
+ * than one thread at a time if no callback changes the checker.
+ *
+ * @param checker Pointer to a checker object
+ * @param token A string containing a token to be verified
+ * @param out Set to a new handle with one reference on success, or NULL
+ * @return 0 on success, non-zero otherwise with error set in the checker
+ */
+JWT_EXPORT
+int jwt_checker_verify_extract(jwt_checker_t *checker, const char *token,
+			       jwt_verified_t **out);
+
+/**
+ * @brief Take another reference to a verified token
+ *
+ * @param verified Pointer to a verified token object
+ * @return verified, for convenience
+ */
+JWT_EXPORT
+jwt_verified_t *jwt_verified_ref(jwt_verified_t *verified);
+
+/**
+ * @brief Drop a reference to a verified token, freeing it with the last
+ *
+ * @param verified Pointer to a verified token object, or NULL
+ */
+JWT_EXPORT
+void jwt_verified_unref(jwt_verified_t *verified);
+
+#if defined(__GNUC__) || defined(__clang__)
+/**
+ * @brief Helper function to drop a reference and set the pointer to NULL
+ *
+ * This is mainly to use with the jwt_verified_auto_t type.
+ *
+ * @param Pointer to a pointer for a jwt_verified_t object
+ */
+static inline void jwt_verified_unrefp(jwt_verified_t **verified) {
+	if (verified) {
+		jwt_verified_unref(*verified);
+		*verified = NULL;
+	}
+}
+#define jwt_verified_auto_t jwt_verified_t \
+	__attribute__((cleanup(jwt_verified_unrefp)))
+#endif
+
+/**
+ * @brief Get a value from the header of a verified token
+ *
+ * Works the same as jwt_header_get().
+ *
+ * @param verified Pointer to a verified token object
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_verified_header_get(const jwt_verified_t *verified,
+					  jwt_value_t *value);
+
+/**
+ * @brief Get a value from the claims of a verified token
+ *
+ * Works the same as jwt_claim_get().
+ *
+ * @param verified Pointer to a verified token object
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_verified_claim_get(const jwt_verified_t *verified,
+					 jwt_value_t *value);
+
+/**
+ * @brief Get the alg a verified token was signed with
+ *
+ * @param verified Pointer to a verified token object
+ * @return The alg, or JWT_ALG_INVAL if verified is NULL
+ */
+JWT_EXPORT
+jwt_alg_t jwt_verified_alg(const jwt_verified_t *verified);
+
+/**
+ * @brief Get the scopes a verified token grants
+ *
+ * See @ref jwt_scopes_grp
+ *
+ * @param verified Pointer to a verified token object
+ * @return The JWT_SCOPE_BIT() of each scope granted
+ */
+JWT_EXPORT
+unsigned long long jwt_verified_scopes(const jwt_verified_t *verified);
+
+/**
+ * @}
+ * @noop jwt_verified_grp
+ */
+
+/**
+ * @defgroup jwt_view_grp Views
+ *
+ * The getters above copy what they return, and for anything that isn't a
+ * string, number or bool, that means dumping it to a new JSON string. A
+ * view instead points right at a value in the parsed token, of any type,
+ * at any depth. Nothing here allocates, and strings come back as a
+ * pointer and length into the token's own storage.
+ *
+ * Values are reached with an @rfc_t{6901} JSON Pointer, such as
+ * ``/realm_access/roles/0``, and arrays and objects can be walked with an
+ * iterator.
+ *
+ * @code
+ * jwt_view_t claims, roles, role;
+ * jwt_view_iter_t it;
+ * const char *str;
+ * size_t len;
+ *
+ * jwt_verified_claims_view(verified, &claims);
+ * if (jwt_view_pointer(&claims, "/realm_access/roles", &roles))
+ *         return;
+ *
+ * jwt_view_iter_init(&roles, &it);
+ * while (!jwt_view_iter_next(&it, NULL, &role)) {
+ *         if (!jwt_view_str(&role, &str, &len))
+ *                 printf("%.*s\n", (int)len, str);
+ * }
+ * @endcode
+ *
+ * A view is only good for as long as what it came from: the
+ * jwt_verified_t, or for jwt_claims_view() and jwt_headers_view(), the
+ * jwt_t given to a callback.
+ *
+ * @{
+ */
+
+/**
+ * @brief Type of the value a view points to
+ */
+typedef enum {
+	JWT_VIEW_NONE = 0,	/**< Not a value, e.g. not found	*/
+	JWT_VIEW_NULL,		/**< JSON null				*/
+	JWT_VIEW_BOOL,		/**< true or false			*/
+	JWT_VIEW_INT,		/**< Integer				*/
+	JWT_VIEW_REAL,		/**< Number with a fraction or exponent	*/
+	JWT_VIEW_STR,		/**< String				*/
+	JWT_VIEW_ARRAY,		/**< Array				*/
+	JWT_VIEW_OBJECT,	/**< Object				*/
+} jwt_view_type_t;
+
+/**
+ * @brief A read-only view of one value in a token
+ *
+ * Treat this as opaque. It is only a struct so it can live on the stack.
+ */
+typedef struct {
+	const void *node;
+} jwt_view_t;
+
+/**
+ * @brief Iterator over the members of an array or object view
+ *
+ * Treat this as opaque. It is only a struct so it can live on the stack.
+ */
+typedef struct {
+	const void *node;
+	void *iter;
+	size_t idx;
+} jwt_view_iter_t;
+
+/**
+ * @brief View the claims of a verified token
+ *
+ * @param verified Pointer to a verified token object
+ * @param view Set to a view of the claims object
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_verified_claims_view(const jwt_verified_t *verified,
+			     jwt_view_t *view);
+
+/**
+ * @brief View the header of a verified token
+ *
+ * @param verified Pointer to a verified token object
+ * @param view Set to a view of the header object
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_verified_headers_view(const jwt_verified_t *verified,
+			      jwt_view_t *view);
+
+/**
+ * @brief View the claims of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, e.g. in a callback
+ * @param view Set to a view of the claims object
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_claims_view(const jwt_t *jwt, jwt_view_t *view);
+
+/**
+ * @brief View the header of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, e.g. in a callback
+ * @param view Set to a view of the header object
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwt_headers_view(const jwt_t *jwt, jwt_view_t *view);
+
+/**
+ * @brief Follow a JSON Pointer from a view
+ *
+ * The pointer is relative to view, and ``""`` is view itself. Object
+ * member names in it can be at most 255 bytes once unescaped.
+ *
+ * @param view Pointer to a view
+ * @param pointer A JSON Pointer, e.g. ``/address/country``
+ * @param out Set to a view of what pointer refers to. This may be view.
+ * @return 0 on success, non-zero if there is nothing there
+ */
+JWT_EXPORT
+int jwt_view_pointer(const jwt_view_t *view, const char *pointer,
+		     jwt_view_t *out);
+
+/**
+ * @brief Get the type of a view
+ *
+ * @param view Pointer to a view
+ * @return Type of the value, JWT_VIEW_NONE if there is none
+ */
+JWT_EXPORT
+jwt_view_type_t jwt_view_type(const jwt_view_t *view);
+
+/**
+ * @brief Get a string from a view
+ *
+ * The string is nil terminated, but may also have nils in it, which is
+ * what len is for.
+ *
+ * @param view Pointer to a view
+ * @param str Set to the string, which belongs to the token
+ * @param len Set to the length of the string, can be NULL
+ * @return 0 on success, non-zero if the view is not a string
+ */
+JWT_EXPORT
+int jwt_view_str(const jwt_view_t *view, const char **str, size_t *len);
+
+/**
+ * @brief Get an integer from a view
+ *
+ * @param view Pointer to a view
+ * @param val Set to the integer
+ * @return 0 on success, non-zero if the view is not an integer
+ */
+JWT_EXPORT
+int jwt_view_int(const jwt_view_t *view, long long *val);
+
+/**
+ * @brief Get a number from a view
+ *
+ * Integers are converted.
+ *
+ * @param view Pointer to a view
+ * @param val Set to the number
+ * @return 0 on success, non-zero if the view is not a number
+ */
+JWT_EXPORT
+int jwt_view_real(const jwt_view_t *view, double *val);
+
+/**
+ * @brief Get a bool from a view
+ *
+ * @param view Pointer to a view
+ * @param val Set to 1 for true and 0 for false
+ * @return 0 on success, non-zero if the view is not a bool
+ */
+JWT_EXPORT
+int jwt_view_bool(const jwt_view_t *view, int *val);
+
+/**
+ * @brief Get the number of members in an array or object view
+ *
+ * @param view Pointer to a view
+ * @return Number of members, 0 for anything else
+ */
+JWT_EXPORT
+size_t jwt_view_size(const jwt_view_t *view);
+
+/**
+ * @brief Start iterating over an array or object view
+ *
+ * For any other view, the iterator is empty.
+ *
+ * @param view Pointer to a view
+ * @param it Iterator to set up
+ */
+JWT_EXPORT
+void jwt_view_iter_init(const jwt_view_t *view, jwt_view_iter_t *it);
+
+/**
+ * @brief Get the next member from an iterator
+ *
+ * @param it Pointer to an iterator
+ * @param key For objects, set to the member name. Set to NULL for arrays.
+ *  Can be NULL.
+ * @param val Set to a view of the member
+ * @return 0 on success, non-zero when there are no more members
+ */
+JWT_EXPORT
+int jwt_view_iter_next(jwt_view_iter_t *it, const char **key,
+		       jwt_view_t *val);
+
+/**
+ * @}
+ * @noop jwt_view_grp
+ */
+
+/**
+ * @defgroup jwt_peek_grp Peeking
+ *
+ * @warning Nothing here verifies anything. What jwt_peek() returns is
+ *  whatever the sender put in the token, and must only be used to decide
+ *  where the token goes next, such as which checker or keyring to verify
+ *  it with. Never act on a peeked value until the token is verified.
+ *
+ * A gateway that routes on ``iss`` or ``kid`` needs a couple of values
+ * before it knows which checker to use. jwt_peek() finds the three parts
+ * of a token, and any header and claim values asked for, without using
+ * the heap. The header and payload are decoded a little at a time into a
+ * small buffer on the stack and scanned, using the same rules for the
+ * token and its JSON as a checker does. Only the values asked for are
+ * kept, in the jwt_peek_t.
+ *
+ * @code
+ * jwt_peek_field_t fields[] = {
+ *         { .where = JWT_PEEK_HEADER, .name = "kid" },
+ *         { .where = JWT_PEEK_CLAIM, .name = "iss" },
+ * };
+ * jwt_peek_t peek;
+ *
+ * if (jwt_peek(token, strlen(token), &peek, fields, 2))
+ *         return REJECT;
+ *
+ * if (fields[1].value != NULL)
+ *         checker = route(fields[1].value, fields[1].len);
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * @brief Size of the space in a jwt_peek_t for values
+ */
+#define JWT_PEEK_BUF	512
+
+/**
+ * @brief Which part of a token a peeked value comes from
+ */
+typedef enum {
+	JWT_PEEK_HEADER = 0,	/**< The JOSE header	*/
+	JWT_PEEK_CLAIM,		/**< The payload	*/
+} jwt_peek_where_t;
+
+/**
+ * @brief One value to look for with jwt_peek()
+ *
+ * The caller sets where and name. The value and len are set by
+ * jwt_peek(). Strings are unescaped, and numbers, true, false and null
+ * are given as they appear in the JSON. Arrays and objects are not
+ * returned. The value is nil terminated, and points into the jwt_peek_t.
+ */
+typedef struct {
+	jwt_peek_where_t where;	/**< Header or payload		*/
+	const char *name;	/**< Name of the member		*/
+	const char *value;	/**< The value, or NULL if not found	*/
+	size_t len;		/**< Length of the value	*/
+} jwt_peek_field_t;
+
+/**
+ * @brief Where things are in a token, and the values that were found
+ *
+ * The offsets are into the token given to jwt_peek(), and are of the
+ * base64url text. The header starts at offset 0.
+ */
+typedef struct {
+	size_t header_len;	/**< Length of the header		*/
+	size_t payload_off;	/**< Offset of the payload		*/
+	size_t payload_len;	/**< Length of the payload		*/
+	size_t sig_off;		/**< Offset of the signature		*/
+	size_t sig_len;		/**< Length of the signature		*/
+	char buf[JWT_PEEK_BUF];	/**< Where values are kept		*/
+} jwt_peek_t;
+
+/**
+ * @brief Look at a token without verifying it
+ *
+ * @warning The token is NOT verified. See @ref jwt_peek_grp.
+ *
+ * Finds the parts of the token, and fills in the value of each field
+ * that is in it. A field that isn't found, or that doesn't fit in what
+ * is left of @ref JWT_PEEK_BUF, has its value set to NULL. When a member
+ * is in there more than once, the last one is used, same as a checker.
+ *
+ * Does not allocate any memory.
+ *
+ * @param token Pointer to the token, which does not have to be nil
+ *  terminated
+ * @param len Length of the token
+ * @param peek Where to put the offsets and values
+ * @param fields Values to look for. Can be NULL if count is 0.
+ * @param count Number of fields
+ * @return 0 on success, non-zero if the token is not well formed
+ */
+JWT_EXPORT
+int jwt_peek(const char *token, size_t len, jwt_peek_t *peek,
+	     jwt_peek_field_t *fields, unsigned int count);
+
+/**
+ * @}
+ * @noop jwt_peek_grp
+ */
+
+/**
+ * @defgroup jwt_object_grp JWT Functions
+ *
+ * For most usage, setting values in the builder object is enough to provide
+ * all the information you would like set in a JWT token. However, if some
+ * information is dynamic, meaning it is only known at the time the token is
+ * created, then you can provide this during the builder callback on the jwt_t
+ * object.
+ *
+ * When verifying a token, the checker callback should not modify the jwt_t
+ * object at all. Access to the jwt_t is provided only to allow additional
+ * validation beyond LibJWT's internal checks.
+ * @{
+ */
+
+/**
+ * @brief Set a value in the header of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_header_set(jwt_t *jwt, jwt_value_t *value);
+
+/**
+ * @brief Get a value from the header of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_header_get(jwt_t *jwt, jwt_value_t *value);
+
+/**
+ * @brief Delete a value from the header of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param header The name of the header to delete, or NULL to clear the entire
+ *  header
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_header_del(jwt_t *jwt, const char *header);
+
+/**
+ * @brief Set a value in the claims of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_claim_set(jwt_t *jwt, jwt_value_t *value);
+
+/**
+ * @brief Get a value from the claims of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param value A jwt_value_t structure with relevant actions filled in
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success. The
+ *  value.error field will match this return value.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_claim_get(jwt_t *jwt, jwt_value_t *value);
+
+/**
+ * @brief Delete a value from the claims of a JWT
+ *
+ * @param jwt Pointer to a jwt_t token, previously created with jwt_create()
+ * @param claim The name of the claim to delete, or NULL to clear all claims
+ * @return A jwt_value_error_t value, JWT_VALUE_ERR_NONE being success.
+ */
+JWT_EXPORT
+jwt_value_error_t jwt_claim_del(jwt_t *jwt, const char *claim);
+
+/**
+ * @}
+ * @noop jwt_object_grp
+ */
+
+/**
+ * @}
+ * @noop jwt_claims_grp
+ */
+
+/**
+ * @defgroup jwt_alg_grp Algorithms
+ *
+ * Utility functions to convert between string and type for ``alg``
+ * @{
+ */
+
+/**
+ * Convert alg type to it's string representation.
+ *
+ * Returns a string that matches the alg type provided.
  *
  * @param alg A valid jwt_alg_t specifier.
  * @returns Returns a string (e.g. "RS256") matching the alg or NULL for
@@ -1144,6 +2246,16 @@ const char *jwt_alg_str(jwt_alg_t alg);
 JWT_EXPORT
 jwt_alg_t jwt_str_alg(const char *alg);
 
+/**
+ * Convert an error code to a message.
+ *
+ * @param err A jwt_error_t value
+ * @returns A static string describing err. For JWT_ERR_NONE and
+ *  JWT_ERR_OTHER this is an empty string. Never returns NULL.
+ */
+JWT_EXPORT
+const char *jwt_error_str(jwt_error_t err);
+
 /**
  * @}
  * @noop jwt_alg_grp
@@ -1354,7 +2466,8 @@ void jwks_error_clear(jwk_set_t *jwk_set);
 
 /**
  * Free all memory associated with a jwt_set_t, including any jwk_item_t in
- * the set.
+ * the set. Items that something else holds a reference to, such as a
+ * checker they were given to, live on until that is dropped.
  *
  * @param jwk_set An existing jwk_set_t
  */
@@ -1548,6 +2661,29 @@ int jwks_item_key_oct(const jwk_item_t *item, const unsigned char **buf,
 JWT_EXPORT
 int jwks_item_key_bits(const jwk_item_t *item);
 
+/**
+ * @brief Take a reference to a jwk_item_t
+ *
+ * Keeps the item alive after it is freed from its set. Builders, checkers
+ * and verifiers do this for the key they are given, so only code that
+ * holds on to an item itself needs to.
+ *
+ * @param item A JWK Item, or NULL
+ * @return The item
+ */
+JWT_EXPORT
+const jwk_item_t *jwks_item_ref(const jwk_item_t *item);
+
+/**
+ * @brief Drop a reference to a jwk_item_t
+ *
+ * The item is freed once its set and every reference have let go of it.
+ *
+ * @param item A JWK Item from jwks_item_ref(), or NULL
+ */
+JWT_EXPORT
+void jwks_item_unref(const jwk_item_t *item);
+
 /**
  * @brief Free remove and free the nth jwk_item_t in a jwk_set
  *
@@ -1594,6 +2730,110 @@ size_t jwks_item_count(const jwk_set_t *jwk_set);
  * @noop jwks_item_grp
  */
 
+/**
+ * @defgroup jwks_ring_grp Key Rotation
+ *
+ * A key ring lets checkers pick their key by ``kid`` from a jwk_set_t
+ * that can be swapped for a new one at any time, such as when a JWKS is
+ * fetched again, with no locks around jwt_checker_verify().
+ *
+ * Verifying never waits. Each verify marks itself as reading the ring
+ * for the current epoch, which is a couple of atomic ops, and the set it
+ * saw stays valid until it is done. jwks_ring_swap() puts the new set in
+ * place right away, then waits for anyone still reading the old one to
+ * finish before freeing it. Only the thread doing the swap ever waits.
+ *
+ * @code
+ * jwks_ring_t *ring = jwks_ring_new(jwks_create_fromurl(url, 1));
+ *
+ * jwt_checker_set_keyring(checker, ring);
+ *
+ * // Later, from any thread
+ * jwks_ring_swap(ring, jwks_create_fromurl(url, 1));
+ * @endcode
+ *
+ * @warning Don't swap from a checker callback of a checker using the same
+ *  ring. It would wait for itself.
+ *
+ * @{
+ */
+
+/**
+ * @brief Create a key ring
+ *
+ * @param jwk_set The set to start with, or NULL for none. The ring owns
+ *  it from here on, even on failure.
+ * @return A new key ring with one reference, or NULL on error
+ */
+JWT_EXPORT
+jwks_ring_t *jwks_ring_new(jwk_set_t *jwk_set);
+
+/**
+ * @brief Replace the set in a key ring
+ *
+ * Verifies that start after this returns use the new set. The old one is
+ * freed once no verify is using it, before this returns. Keys from the
+ * old set that something holds a reference to live on.
+ *
+ * @param ring Pointer to a key ring
+ * @param jwk_set The new set, or NULL for none. The ring owns it from
+ *  here on, even on failure.
+ * @return 0 on success, non-zero otherwise
+ */
+JWT_EXPORT
+int jwks_ring_swap(jwks_ring_t *ring, jwk_set_t *jwk_set);
+
+/**
+ * @brief Number of times a key ring's set has been replaced
+ *
+ * @param ring Pointer to a key ring
+ * @return The count, or 0 if ring is NULL
+ */
+JWT_EXPORT
+unsigned long jwks_ring_swaps(const jwks_ring_t *ring);
+
+/**
+ * @brief Take a reference to a key ring
+ *
+ * @param ring Pointer to a key ring, or NULL
+ * @return The key ring
+ */
+JWT_EXPORT
+jwks_ring_t *jwks_ring_ref(jwks_ring_t *ring);
+
+/**
+ * @brief Drop a reference to a key ring
+ *
+ * The ring, and its set, are freed with the last one. Checkers hold a
+ * reference of their own.
+ *
+ * @param ring Pointer to a key ring, or NULL
+ */
+JWT_EXPORT
+void jwks_ring_unref(jwks_ring_t *ring);
+
+#if defined(__GNUC__) || defined(__clang__)
+/**
+ * @brief Helper function to drop a key ring and set the pointer to NULL
+ *
+ * This is mainly to use with the jwks_ring_auto_t type.
+ *
+ * @param ring Pointer to a pointer for a jwks_ring_t object
+ */
+static inline void jwks_ring_unrefp(jwks_ring_t **ring) {
+	if (ring) {
+		jwks_ring_unref(*ring);
+		*ring = NULL;
+	}
+}
+#define jwks_ring_auto_t jwks_ring_t __attribute__((cleanup(jwks_ring_unrefp)))
+#endif
+
+/**
+ * @}
+ * @noop jwks_ring_grp
+ */
+
 /**
  * @}
  * @noop jwks_grp
@@ -1644,6 +2884,56 @@ int jwt_set_alloc(jwt_malloc_t pmalloc, jwt_free_t pfree);
 JWT_EXPORT
 void jwt_get_alloc(jwt_malloc_t *pmalloc, jwt_free_t *pfree);
 
+/**
+ * @brief Turn allocation statistics on or off
+ *
+ * While on, every allocation LibJWT makes, including those made by the
+ * crypto ops, is counted against the part of the library that made it.
+ * See @ref jwt_alloc_sys_t. Memory allocated inside the crypto libraries
+ * themselves is not seen.
+ *
+ * Jansson's allocations are only counted if jwt_set_alloc() has been
+ * used to send them through LibJWT. Turning statistics on then wraps
+ * Jansson's allocator so they count as JWT_ALLOC_JSON, and turning them
+ * off puts it back. Allocators set with json_set_alloc_funcs() by
+ * anything else are never changed.
+ *
+ * Turning them on resets all of the statistics. While off, the cost is a
+ * single check on each allocation. While on, each thread counts into its
+ * own set of counters, and they are added up by jwt_alloc_stats_get(),
+ * so threads doing batches don't wait on each other to count. With more
+ * than one thread, peak is the sum of each thread's own peak, which can
+ * be higher than live ever really was at one time.
+ *
+ * @note Memory that was allocated before statistics were turned on is
+ *  not counted when it is freed.
+ *
+ * @param enable 1 to turn statistics on, 0 to turn them off
+ * @return 0 on success, or errno otherwise
+ */
+JWT_EXPORT
+int jwt_alloc_stats_enable(int enable);
+
+/**
+ * @brief Get allocation statistics
+ *
+ * @param sys The part of LibJWT to get them for, or JWT_ALLOC_ALL
+ * @param stats Where to put them. This is zeroed if statistics are off.
+ * @return 0 on success, or EINVAL for a bad sys or a NULL stats
+ */
+JWT_EXPORT
+int jwt_alloc_stats_get(jwt_alloc_sys_t sys, jwt_alloc_stats_t *stats);
+
+/**
+ * @brief Reset allocation statistics
+ *
+ * Counts go back to zero, and peaks go down to what is currently
+ * allocated. Memory that is still allocated is kept track of, so it is
+ * still taken off of live when it is freed.
+ */
+JWT_EXPORT
+void jwt_alloc_stats_reset(void);
+
  /**
   * @}
   * @noop jwt_memory_grp
@@ -1666,6 +2956,12 @@ void jwt_get_alloc(jwt_malloc_t *pmalloc, jwt_free_t *pfree);
  * @remark ENVIRONMENT: You can set JWT_CRYPTO to the default operations you
  * wish to use. If JWT_CRYPTO is invalid, an error message will be
  * printed to the console when LibJWT is loaded by the application.
+ *
+ * @remark ENVIRONMENT: If JWT_CRYPTO_AUTOTUNE is set to anything other than
+ * "0", jwt_crypto_ops_autotune() is run the first time a token is signed
+ * or verified with the default operations, not when LibJWT is loaded, so
+ * jwt_set_crypto_libctx() can still be called first. Choosing operations
+ * with any of the functions below before then means it is never run.
  * @{
  */
 
@@ -1716,11 +3012,396 @@ int jwt_set_crypto_ops_t(jwt_crypto_provider_t opname);
 JWT_EXPORT
 int jwt_crypto_ops_supports_jwk(void);
 
+/**
+ * Set the crypto operations used for one algorithm
+ *
+ * Signing and verifying with alg will use the named crypto ops instead of
+ * the default set with jwt_set_crypto_ops(). Calling jwt_set_crypto_ops()
+ * or jwt_set_crypto_ops_t() clears all of these.
+ *
+ * @param alg The algorithm to change
+ * @param opname The name of the crypto operations to use, or NULL to go
+ *  back to the default
+ * @return 0 on success, 1 for error
+ */
+JWT_EXPORT
+int jwt_set_crypto_ops_alg(jwt_alg_t alg, const char *opname);
+
+/**
+ * Retrieve the name of the crypto operations used for one algorithm
+ *
+ * @param alg The algorithm to look up
+ * @return name of the crypto operation set, or NULL for an invalid alg
+ */
+JWT_EXPORT
+const char *jwt_get_crypto_ops_alg(jwt_alg_t alg);
+
+/**
+ * Pick the fastest crypto operations for each algorithm
+ *
+ * Runs a short sign and verify benchmark of every algorithm with each of
+ * the crypto operations compiled into LibJWT, using throw away keys, and
+ * calls jwt_set_crypto_ops_alg() with the fastest of them. This takes a
+ * noticeable amount of time (mostly generating the RSA key), so it is
+ * best done once, at startup. It does nothing if only one set of crypto
+ * operations is available.
+ *
+ * @return 0 on success, non-zero if some algorithm could not be tested
+ */
+JWT_EXPORT
+int jwt_crypto_ops_autotune(void);
+
+/**
+ * Set the OpenSSL library context used by LibJWT
+ *
+ * The OpenSSL ops fetch their digest and MAC algorithms once and reuse
+ * them, rather than letting OpenSSL look them up on every operation. By
+ * default they are fetched from OpenSSL's default library context. This
+ * lets you give LibJWT an OSSL_LIB_CTX of your own, or have LibJWT create
+ * one that is private to it, so lookups and locking are not shared with
+ * the rest of the application.
+ *
+ * The context can only be set once, before any keys are loaded or tokens
+ * are generated or verified with the OpenSSL ops. After that it is fixed
+ * for the life of the library, and this fails rather than pull anything
+ * out from under a thread that is using it. Keys are created in this
+ * library context.
+ *
+ * @param libctx Pointer to an OSSL_LIB_CTX, which must stay valid for the
+ *  life of the application, or NULL to have LibJWT create its own
+ * @return 0 on success, non-zero on error or if a different context is
+ *  already in use
+ */
+JWT_EXPORT
+int jwt_set_crypto_libctx(void *libctx);
+
 /**
  * @}
  * @noop jwt_crypto_grp
  */
 
+/**
+ * @defgroup jwt_metrics_grp Metrics
+ * Counters and latency histograms for checkers and builders
+ *
+ * Once turned on with jwt_checker_metrics_enable() or
+ * jwt_builder_metrics_enable(), every verify or generate is counted by
+ * alg and by result, and its latency is added to a histogram for its
+ * alg. Results are also counted for each kid, for up to 32 different
+ * kids, after which the rest are counted together with an empty kid. The
+ * kid is the one on the key that was used, never the one in the token's
+ * header. Tokens that never got as far as a key, and keys without a kid,
+ * are counted with the empty kid too.
+ *
+ * Counters are split into shards, and each thread updates its own shard
+ * with atomic operations, so nothing is locked while verifying. Reading
+ * them is done with a snapshot, which adds up all of the shards.
+ * Snapshots can be merged, for instance to report on a pool of
+ * checkers as one, and written out for Prometheus.
+ *
+ * Histograms have 8 buckets for each power of two nanoseconds, so any
+ * latency read back from one is within 12.5% of the real value.
+ * @{
+ */
+
+/**
+ * @brief Results that metrics are kept for
+ *
+ * A verify that fails for more than one reason is counted once, as the
+ * first of these it failed for.
+ */
+typedef enum {
+	JWT_METRIC_OK = 0,	/**< Success				*/
+	JWT_METRIC_ERR_PARSE,	/**< Token could not be parsed		*/
+	JWT_METRIC_ERR_CALLBACK,/**< User callback returned an error	*/
+	JWT_METRIC_ERR_ALG,	/**< Alg does not match key or config	*/
+	JWT_METRIC_ERR_KEY,	/**< No key, e.g. callback found no kid	*/
+	JWT_METRIC_ERR_EXP,	/**< Token has expired			*/
+	JWT_METRIC_ERR_NBF,	/**< Token is not valid yet		*/
+	JWT_METRIC_ERR_ISS,	/**< Issuer did not match		*/
+	JWT_METRIC_ERR_SUB,	/**< Subject did not match		*/
+	JWT_METRIC_ERR_AUD,	/**< Audience did not match		*/
+	JWT_METRIC_ERR_SIG,	/**< Signing or signature check failed	*/
+	JWT_METRIC_ERR_OTHER,	/**< Anything else			*/
+	JWT_METRIC_COUNT,	/**< Number of results (not a result)	*/
+} jwt_metric_t;
+
+/**
+ * @brief Opaque snapshot of metrics
+ */
+typedef struct jwt_metrics jwt_metrics_t;
+
+/**
+ * @brief Turn metrics on or off for a checker
+ *
+ * Turning them off throws away what has been collected. Turning them on
+ * when they already are does nothing.
+ *
+ * @note Like the rest of the checker setup, this must not be called while
+ *  the checker is being used to verify tokens.
+ *
+ * @param checker Pointer to a checker object
+ * @param enable 1 to turn metrics on, 0 to turn them off
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_checker_metrics_enable(jwt_checker_t *checker, int enable);
+
+/**
+ * @brief Turn metrics on or off for a builder
+ *
+ * See jwt_checker_metrics_enable(). For a builder, the kid is the one on
+ * the key used to sign.
+ *
+ * @param builder Pointer to a builder object
+ * @param enable 1 to turn metrics on, 0 to turn them off
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_builder_metrics_enable(jwt_builder_t *builder, int enable);
+
+/**
+ * @brief Take a snapshot of a checker's metrics
+ *
+ * This can be called while other threads are verifying with the checker.
+ *
+ * @param checker Pointer to a checker object
+ * @return A new snapshot, to be freed with jwt_metrics_free(), or NULL if
+ *  metrics are not on or on error
+ */
+JWT_EXPORT
+jwt_metrics_t *jwt_checker_metrics_snapshot(const jwt_checker_t *checker);
+
+/**
+ * @brief Take a snapshot of a builder's metrics
+ *
+ * @param builder Pointer to a builder object
+ * @return A new snapshot, to be freed with jwt_metrics_free(), or NULL if
+ *  metrics are not on or on error
+ */
+JWT_EXPORT
+jwt_metrics_t *jwt_builder_metrics_snapshot(const jwt_builder_t *builder);
+
+/**
+ * @brief Add one snapshot into another
+ *
+ * @param dst Snapshot to add to
+ * @param src Snapshot to add. This must be of the same kind (checker or
+ *  builder) as dst.
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_metrics_merge(jwt_metrics_t *dst, const jwt_metrics_t *src);
+
+/**
+ * @brief Free a snapshot
+ *
+ * @param metrics Snapshot to free, may be NULL
+ */
+JWT_EXPORT
+void jwt_metrics_free(jwt_metrics_t *metrics);
+
+/**
+ * @brief Number of operations with a result
+ *
+ * @param metrics Snapshot to read
+ * @param alg Algorithm to count for, or JWT_ALG_INVAL for all of them
+ * @param result Result to count
+ * @return The count, or 0 for a bad argument
+ */
+JWT_EXPORT
+unsigned long jwt_metrics_count(const jwt_metrics_t *metrics, jwt_alg_t alg,
+				jwt_metric_t result);
+
+/**
+ * @brief Number of operations for a kid
+ *
+ * @param metrics Snapshot to read
+ * @param kid Key ID to count for. An empty string gets the count for kids
+ *  past the first 32, keys with no kid, and tokens that had no key.
+ * @param failed 0 to count successes, 1 to count failures
+ * @return The count, or 0 if the kid has not been seen
+ */
+JWT_EXPORT
+unsigned long jwt_metrics_kid_count(const jwt_metrics_t *metrics,
+				    const char *kid, int failed);
+
+/**
+ * @brief Latency at a quantile
+ *
+ * @param metrics Snapshot to read
+ * @param alg Algorithm to read, or JWT_ALG_INVAL for all of them
+ * @param q Quantile, from 0.0 to 1.0 (e.g. 0.99 for p99)
+ * @return Latency in nanoseconds, or 0 if there is nothing recorded
+ */
+JWT_EXPORT
+unsigned long long jwt_metrics_quantile(const jwt_metrics_t *metrics,
+					jwt_alg_t alg, double q);
+
+/**
+ * @brief Write a snapshot out in the Prometheus text format
+ *
+ * For a checker, this writes PREFIX_verify_total with alg and result
+ * labels, PREFIX_verify_kid_total with kid and result labels, and the
+ * PREFIX_verify_duration_seconds histogram with an alg label. A builder
+ * is the same, with generate in place of verify. Only buckets that have
+ * something in them are written.
+ *
+ * @param metrics Snapshot to write
+ * @param prefix Prefix for metric names, or NULL for "jwt"
+ * @return A string which must be freed by the caller, or NULL on error
+ */
+JWT_EXPORT
+char *jwt_metrics_prometheus(const jwt_metrics_t *metrics,
+			     const char *prefix);
+
+/**
+ * @}
+ * @noop jwt_metrics_grp
+ */
+
+/**
+ * @defgroup jwt_trace_grp Tracing
+ * Timing of each stage of verifying or generating a token
+ *
+ * With a trace callback set, a checker or builder reports each stage of
+ * each token as it finishes: splitting the token, base64 and JSON work
+ * for the header and payload, the user callback, claim checks, and the
+ * signature. Each comes with monotonic start and end times in
+ * nanoseconds, and the number of bytes it worked on.
+ *
+ * With a slow callback set, the stages of each token are collected, and
+ * if the whole operation took at least the threshold, the breakdown is
+ * handed to the slow callback in one go. This can be sampled, so only
+ * one in so many slow operations are reported.
+ *
+ * When neither is set, the cost is a check for NULL at each stage.
+ *
+ * @note Both callbacks are called from whichever thread is verifying or
+ *  generating, including the threads used for batches.
+ * @{
+ */
+
+/**
+ * @brief Stages of verifying or generating a token
+ *
+ * Large payloads are decoded as they are parsed, and only have a
+ * JWT_TRACE_JSON span, which covers both.
+ */
+typedef enum {
+	JWT_TRACE_SPLIT = 0,	/**< Copying the token and finding dots	*/
+	JWT_TRACE_BASE64,	/**< Base64url encoding or decoding	*/
+	JWT_TRACE_JSON,		/**< Parsing or writing JSON		*/
+	JWT_TRACE_CALLBACK,	/**< The user's callback		*/
+	JWT_TRACE_CLAIMS,	/**< Checking claims			*/
+	JWT_TRACE_SIG,		/**< Signing, or checking the signature	*/
+} jwt_trace_stage_t;
+
+/**
+ * @brief One stage of one operation
+ */
+typedef struct {
+	jwt_trace_stage_t stage;	/**< Which stage this is	*/
+	unsigned long long start_ns;	/**< When it started		*/
+	unsigned long long end_ns;	/**< When it finished		*/
+	size_t bytes;			/**< Bytes worked on, if any	*/
+} jwt_trace_span_t;
+
+/** Most stages kept for one operation in @ref jwt_trace_op_t */
+#define JWT_TRACE_MAX_SPANS 16
+
+/**
+ * @brief Every stage of one slow operation
+ */
+typedef struct {
+	int builder;			/**< 1 for generate, 0 for verify	*/
+	jwt_alg_t alg;			/**< Alg of the token, if known		*/
+	int error;			/**< Whether it failed			*/
+	unsigned long long start_ns;	/**< When it started			*/
+	unsigned long long end_ns;	/**< When it finished			*/
+	size_t bytes;			/**< Length of the token, if known	*/
+	unsigned int count;		/**< Number of spans			*/
+	unsigned int dropped;		/**< Spans past JWT_TRACE_MAX_SPANS	*/
+	jwt_trace_span_t spans[JWT_TRACE_MAX_SPANS]; /**< Stages, in order */
+} jwt_trace_op_t;
+
+/**
+ * @brief Prototype for a trace callback, see jwt_checker_set_trace()
+ */
+typedef void (*jwt_trace_cb_t)(const jwt_trace_span_t *span, void *ctx);
+
+/**
+ * @brief Prototype for a slow operation callback
+ */
+typedef void (*jwt_trace_slow_cb_t)(const jwt_trace_op_t *op, void *ctx);
+
+/**
+ * @brief Report each stage of verifying to a callback
+ *
+ * @param checker Pointer to a checker object
+ * @param cb Function called as each stage finishes, or NULL to stop
+ * @param ctx Passed to cb
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_checker_set_trace(jwt_checker_t *checker, jwt_trace_cb_t cb,
+			  void *ctx);
+
+/**
+ * @brief Report the stages of slow verifies to a callback
+ *
+ * @param checker Pointer to a checker object
+ * @param threshold_ns Operations taking at least this long are slow
+ * @param sample Report one in this many slow operations (0 or 1 for all)
+ * @param cb Function called with the stages of a slow operation, or NULL
+ *  to stop
+ * @param ctx Passed to cb
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_checker_set_trace_slow(jwt_checker_t *checker,
+			       unsigned long long threshold_ns,
+			       unsigned int sample, jwt_trace_slow_cb_t cb,
+			       void *ctx);
+
+/**
+ * @brief Report each stage of generating to a callback
+ *
+ * See jwt_checker_set_trace().
+ *
+ * @param builder Pointer to a builder object
+ * @param cb Function called as each stage finishes, or NULL to stop
+ * @param ctx Passed to cb
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_builder_set_trace(jwt_builder_t *builder, jwt_trace_cb_t cb,
+			  void *ctx);
+
+/**
+ * @brief Report the stages of slow generates to a callback
+ *
+ * See jwt_checker_set_trace_slow().
+ *
+ * @param builder Pointer to a builder object
+ * @param threshold_ns Operations taking at least this long are slow
+ * @param sample Report one in this many slow operations (0 or 1 for all)
+ * @param cb Function called with the stages of a slow operation, or NULL
+ *  to stop
+ * @param ctx Passed to cb
+ * @return 0 on success, non-zero on error
+ */
+JWT_EXPORT
+int jwt_builder_set_trace_slow(jwt_builder_t *builder,
+			       unsigned long long threshold_ns,
+			       unsigned int sample, jwt_trace_slow_cb_t cb,
+			       void *ctx);
+
+/**
+ * @}
+ * @noop jwt_trace_grp
+ */
+
 /**
  * @}
  * @noop jwt_advanced_grp
@@ -163,3 +163,75 @@ base64_decode(const char *in, unsigned int inlen, unsigned char *out)
 
 	return j;
 }
+
+int
+base64uri_stream_init(base64uri_stream_t *s, const char *in, size_t len)
+{
+	s->in = in;
+	s->len = len;
+	s->pos = 0;
+	s->error = 0;
+
+	/* One char past a whole quad can't be anything */
+	return (len & 0x3) == 1;
+}
+
+static int
+base64uri_val(char ch)
+{
+	unsigned char c;
+
+	/* The URL safe alphabet, and for now, the standard one too */
+	if (ch == '-')
+		return 62;
+	if (ch == '_')
+		return 63;
+	if (ch < BASE64DE_FIRST || ch > BASE64DE_LAST)
+		return -1;
+
+	c = base64de[(unsigned char)ch];
+
+	return c == 255 ? -1 : c;
+}
+
+size_t
+base64uri_stream_read(base64uri_stream_t *s, char *out, size_t size)
+{
+	size_t j = 0;
+
+	while (s->pos < s->len && j + 3 <= size) {
+		size_t n = s->len - s->pos;
+		unsigned int v = 0;
+		size_t i;
+
+		if (n > 4)
+			n = 4;
+
+		for (i = 0; i < n; i++) {
+			int c;
+
+			if (s->in[s->pos + i] == BASE64_PAD)
+				break;
+
+			c = base64uri_val(s->in[s->pos + i]);
+			if (c < 0) {
+				s->error = 1;
+				return 0;
+			}
+			v = (v << 6) | c;
+		}
+
+		/* Padding is the end, whatever comes after it */
+		s->pos = i < n ? s->len : s->pos + n;
+
+		v <<= 6 * (4 - i);
+		if (i >= 2)
+			out[j++] = (v >> 16) & 0xFF;
+		if (i >= 3)
+			out[j++] = (v >> 8) & 0xFF;
+		if (i == 4)
+			out[j++] = v & 0xFF;
+	}
+
+	return j;
+}
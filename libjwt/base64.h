@@ -22,4 +22,24 @@ JWT_NO_EXPORT
 extern unsigned int base64_decode(const char *in, unsigned int inlen,
 				  unsigned char *out);
 
+/*
+ * Streaming base64url decode, a few quads at a time.
+ * init returns non-zero if the length can't be right.
+ * read returns how much was put in out, 0 at the end or on error.
+ */
+typedef struct {
+	const char *in;
+	size_t len;
+	size_t pos;
+	int error;
+} base64uri_stream_t;
+
+JWT_NO_EXPORT
+extern int base64uri_stream_init(base64uri_stream_t *s, const char *in,
+				 size_t len);
+
+JWT_NO_EXPORT
+extern size_t base64uri_stream_read(base64uri_stream_t *s, char *out,
+				    size_t size);
+
 #endif /* BASE64_H */
@@ -65,90 +65,284 @@ static int gnutls_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
 	return 0;
 }
 
-#define SIGN_ERROR(_msg) { jwt_write_error(jwt, "JWT[GnuTLS]: " _msg); goto sign_clean_privkey; }
+static gnutls_digest_algorithm_t gnutls_digest_alg(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_RS256:
+	case JWT_ALG_PS256:
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return GNUTLS_DIG_SHA256;
+	case JWT_ALG_HS384:
+	case JWT_ALG_RS384:
+	case JWT_ALG_PS384:
+	case JWT_ALG_ES384:
+		return GNUTLS_DIG_SHA384;
+	case JWT_ALG_HS512:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS512:
+	case JWT_ALG_ES512:
+		return GNUTLS_DIG_SHA512;
+	// LCOV_EXCL_START
+	default:
+		return GNUTLS_DIG_UNKNOWN;
+	// LCOV_EXCL_STOP
+	}
+}
 
-static int gnutls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-			       const char *str, unsigned int str_len)
+/* The signature alg for everything but EdDSA, which depends on the key */
+static gnutls_sign_algorithm_t gnutls_sign_alg(jwt_alg_t alg)
 {
-	/* For EC handling. */
-	int r_padding = 0, s_padding = 0, r_out_padding = 0,
-		s_out_padding = 0;
-	gnutls_privkey_t privkey;
-	size_t out_size;
-	gnutls_datum_t sig_dat, r, s;
-	gnutls_digest_algorithm_t alg;
-	int pk_alg, flags = 0;
-	unsigned int adj;
+	switch (alg) {
+	/* RSA */
+	case JWT_ALG_RS256:
+		return GNUTLS_SIGN_RSA_SHA256;
+	case JWT_ALG_RS384:
+		return GNUTLS_SIGN_RSA_SHA384;
+	case JWT_ALG_RS512:
+		return GNUTLS_SIGN_RSA_SHA512;
 
-	if (gnutls_privkey_init(&privkey))
-		SIGN_ERROR("Error initializing privkey"); // LCOV_EXCL_LINE
+	/* RSA-PSS */
+	case JWT_ALG_PS256:
+		return GNUTLS_SIGN_RSA_PSS_SHA256;
+	case JWT_ALG_PS384:
+		return GNUTLS_SIGN_RSA_PSS_SHA384;
+	case JWT_ALG_PS512:
+		return GNUTLS_SIGN_RSA_PSS_SHA512;
 
-	if (jwt->alg == JWT_ALG_ES256K)
-		SIGN_ERROR("ES256K not supported"); // LCOV_EXCL_LINE
+	/* EC */
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return GNUTLS_SIGN_ECDSA_SHA256;
+	case JWT_ALG_ES384:
+		return GNUTLS_SIGN_ECDSA_SHA384;
+	case JWT_ALG_ES512:
+		return GNUTLS_SIGN_ECDSA_SHA512;
 
-	if (jwt->key->pem == NULL)
-		SIGN_ERROR("No PEM to load"); // LCOV_EXCL_LINE
+	// LCOV_EXCL_START
+	default:
+		return GNUTLS_SIGN_UNKNOWN;
+	// LCOV_EXCL_STOP
+	}
+}
+
+static int gnutls_is_ec(jwt_alg_t alg)
+{
+	return alg == JWT_ALG_ES256 || alg == JWT_ALG_ES256K ||
+		alg == JWT_ALG_ES384 || alg == JWT_ALG_ES512;
+}
+
+static int gnutls_load_privkey(jwt_t *jwt, gnutls_privkey_t *privkey)
+{
+	if (jwt->key->pem == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: No PEM to load");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
 
 	gnutls_datum_t key_dat = {
 		(unsigned char *)jwt->key->pem,
 		strlen(jwt->key->pem)
 	};
-	gnutls_datum_t body_dat = {
-		(unsigned char *)str,
-		str_len
+
+	if (gnutls_privkey_init(privkey)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: Error initializing privkey");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (gnutls_privkey_import_x509_raw(*privkey, &key_dat,
+					   GNUTLS_X509_FMT_PEM, NULL, 0)) {
+		// LCOV_EXCL_START
+		gnutls_privkey_deinit(*privkey);
+		jwt_write_error(jwt, "JWT[GnuTLS]: Could not import private key");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+
+static int gnutls_load_pubkey(jwt_t *jwt, gnutls_pubkey_t *pubkey)
+{
+	gnutls_privkey_t privkey;
+	int ret;
+
+	if (jwt->key->pem == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: No PEM to load");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	gnutls_datum_t cert_dat = {
+		(unsigned char *)jwt->key->pem,
+		strlen(jwt->key->pem)
 	};
 
-	/* Try loading as a private key, and extracting the pubkey */
-	if (gnutls_privkey_import_x509_raw(privkey, &key_dat,
-					   GNUTLS_X509_FMT_PEM,
-					   NULL, 0)) {
-		SIGN_ERROR("Could not import private key"); // LCOV_EXCL_LINE
+	if (gnutls_pubkey_init(pubkey)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: Failed initializing pubkey");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (!gnutls_pubkey_import(*pubkey, &cert_dat, GNUTLS_X509_FMT_PEM))
+		return 0;
+
+	/* Try loading as a private key, and extracting the pubkey.
+	 * This is perfectly legit. A JWK can have a private key with
+	 * key_ops of SIGN and VERIFY. */
+	if (gnutls_load_privkey(jwt, &privkey)) {
+		// LCOV_EXCL_START
+		gnutls_pubkey_deinit(*pubkey);
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	ret = gnutls_pubkey_import_privkey(*pubkey, privkey, 0, 0);
+	gnutls_privkey_deinit(privkey);
+
+	if (ret) {
+		// LCOV_EXCL_START
+		gnutls_pubkey_deinit(*pubkey);
+		jwt_write_error(jwt, "JWT[GnuTLS]: Failed to import key");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+
+/* Convert a DER encoded EC signature to the raw R/S format JWA wants */
+static int gnutls_ec_out(jwt_t *jwt, const gnutls_datum_t *sig_dat,
+			 char **out, unsigned int *len)
+{
+	unsigned int adj = jwt_ecdsa_size(jwt->alg);
+
+	*out = jwt_malloc(adj * 2);
+	if (*out == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: Out of memory");
+		return 1;
+		// LCOV_EXCL_STOP
 	}
 
+	if (jwt_ecdsa_der_to_raw(sig_dat->data, sig_dat->size,
+				 (unsigned char *)*out, adj)) {
+		// LCOV_EXCL_START
+		jwt_freemem(*out);
+		jwt_write_error(jwt, "JWT[GnuTLS]: Error decoding EC key");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	*len = adj * 2;
+
+	return 0;
+}
+
+/* And back to DER for verifying. sig_dat points into der, which must
+ * have room for JWT_ECDSA_DER_MAX bytes. */
+static int gnutls_ec_in(jwt_t *jwt, unsigned char *sig, int sig_len,
+			unsigned char *der, gnutls_datum_t *sig_dat)
+{
+	if ((unsigned int)sig_len != jwt_ecdsa_size(jwt->alg) * 2) {
+		jwt_write_error(jwt, "JWT[GnuTLS]: Irregular sig_len for ECDHA");
+		return 1;
+	}
+
+	sig_dat->data = der;
+	sig_dat->size = jwt_ecdsa_raw_to_der(sig, sig_len, der);
+	if (sig_dat->size == 0) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: Could not encode R/S values for ECDHA");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+
+/* Hand back the signature in the format JWA wants */
+static int gnutls_sig_out(jwt_t *jwt, gnutls_datum_t *sig_dat, char **out,
+			  unsigned int *len)
+{
+	int ret = 0;
+
+	if (gnutls_is_ec(jwt->alg)) {
+		ret = gnutls_ec_out(jwt, sig_dat, out, len);
+	} else {
+		/* All others that aren't EC */
+		*out = jwt_malloc(sig_dat->size);
+		if (*out == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "JWT[GnuTLS]: Out of memory");
+			ret = 1;
+			// LCOV_EXCL_STOP
+		} else {
+			/* Copy signature to out */
+			memcpy(*out, sig_dat->data, sig_dat->size);
+			*len = sig_dat->size;
+		}
+	}
+
+	gnutls_free(sig_dat->data);
+
+	return ret;
+}
+
+#define SIGN_ERROR(_msg) { jwt_write_error(jwt, "JWT[GnuTLS]: " _msg); goto sign_clean_privkey; }
+
+static int gnutls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
+			       const char *str, unsigned int str_len)
+{
+	gnutls_privkey_t privkey;
+	gnutls_datum_t sig_dat;
+	gnutls_digest_algorithm_t alg;
+	int pk_alg, flags = 0;
+
 	/* Initialize for checking later. */
 	*out = NULL;
 
+	if (jwt->alg == JWT_ALG_ES256K) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: ES256K not supported");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (gnutls_load_privkey(jwt, &privkey))
+		return 1;
+
+	gnutls_datum_t body_dat = {
+		(unsigned char *)str,
+		str_len
+	};
+
 	switch (jwt->alg) {
 	/* RSA */
 	case JWT_ALG_RS256:
-		alg = GNUTLS_DIG_SHA256;
-		pk_alg = GNUTLS_PK_RSA;
-		break;
 	case JWT_ALG_RS384:
-		alg = GNUTLS_DIG_SHA384;
-		pk_alg = GNUTLS_PK_RSA;
-		break;
 	case JWT_ALG_RS512:
-		alg = GNUTLS_DIG_SHA512;
 		pk_alg = GNUTLS_PK_RSA;
 		break;
 
 	/* RSA-PSS */
 	case JWT_ALG_PS256:
-		alg = GNUTLS_DIG_SHA256;
-		pk_alg = GNUTLS_PK_RSA_PSS;
-		break;
 	case JWT_ALG_PS384:
-		alg = GNUTLS_DIG_SHA384;
-		pk_alg = GNUTLS_PK_RSA_PSS;
-		break;
 	case JWT_ALG_PS512:
-		alg = GNUTLS_DIG_SHA512;
 		pk_alg = GNUTLS_PK_RSA_PSS;
 		break;
 
 	/* EC */
 	case JWT_ALG_ES256:
 	case JWT_ALG_ES256K:
-		alg = GNUTLS_DIG_SHA256;
-		pk_alg = GNUTLS_PK_EC;
-		break;
 	case JWT_ALG_ES384:
-		alg = GNUTLS_DIG_SHA384;
-		pk_alg = GNUTLS_PK_EC;
-		break;
 	case JWT_ALG_ES512:
-		alg = GNUTLS_DIG_SHA512;
 		pk_alg = GNUTLS_PK_EC;
 		break;
 
@@ -169,6 +363,9 @@ static int gnutls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
 	// LCOV_EXCL_STOP
 	}
 
+	if (jwt->alg != JWT_ALG_EDDSA)
+		alg = gnutls_digest_alg(jwt->alg);
+
 	if (pk_alg == GNUTLS_PK_RSA_PSS) {
 		int ck = gnutls_privkey_get_pk_algorithm(privkey, NULL);
 		if (ck != GNUTLS_PK_RSA_PSS && ck != GNUTLS_PK_RSA)
@@ -183,58 +380,7 @@ static int gnutls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
                                 &body_dat, &sig_dat))
 		SIGN_ERROR("Failed to sign token"); // LCOV_EXCL_LINE
 
-	if (pk_alg == GNUTLS_PK_EC) {
-		/* Start EC handling. */
-		if (gnutls_decode_rs_value(&sig_dat, &r, &s))
-			SIGN_ERROR("Error decoding EC key"); // LCOV_EXCL_LINE
-
-		/* Check r and s size */
-		if (jwt->alg == JWT_ALG_ES256 || jwt->alg == JWT_ALG_ES256K)
-			adj = 32;
-		if (jwt->alg == JWT_ALG_ES384)
-			adj = 48;
-		if (jwt->alg == JWT_ALG_ES512)
-			adj = 66;
-
-		if (r.size > adj)
-			r_padding = r.size - adj;
-		else if (r.size < adj)
-			r_out_padding = adj - r.size;
-
-		if (s.size > adj)
-			s_padding = s.size - adj;
-		else if (s.size < adj)
-			s_out_padding = adj - s.size;
-
-		out_size = adj << 1;
-
-		*out = jwt_malloc(out_size);
-		if (*out == NULL)
-			SIGN_ERROR("Out of memory"); // LCOV_EXCL_LINE
-
-		memset(*out, 0, out_size);
-
-		memcpy(*out + r_out_padding, r.data + r_padding, r.size - r_padding);
-		memcpy(*out + (r.size - r_padding + r_out_padding) + s_out_padding,
-		       s.data + s_padding, (s.size - s_padding));
-
-		*len = (r.size - r_padding + r_out_padding) +
-			(s.size - s_padding + s_out_padding);
-		gnutls_free(r.data);
-		gnutls_free(s.data);
-	} else {
-		/* All others that aren't EC */
-		*out = jwt_malloc(sig_dat.size);
-		if (*out == NULL)
-			SIGN_ERROR("Out of memory"); // LCOV_EXCL_LINE
-
-		/* Copy signature to out */
-		memcpy(*out, sig_dat.data, sig_dat.size);
-		*len = sig_dat.size;
-	}
-
-	/* Clean and exit */
-	gnutls_free(sig_dat.data);
+	gnutls_sig_out(jwt, &sig_dat, out, len);
 
 sign_clean_privkey:
 	gnutls_privkey_deinit(privkey);
@@ -251,93 +397,26 @@ static int gnutls_verify_sha_pem(jwt_t *jwt, const char *head,
 				 unsigned int head_len, unsigned char *sig,
 				 int sig_len)
 {
-	gnutls_datum_t r, s;
 	gnutls_datum_t data = {
 		(unsigned char *)head,
 		head_len
 	};
 	gnutls_datum_t sig_dat = { NULL, 0 };
+	unsigned char der[JWT_ECDSA_DER_MAX];
 	gnutls_pubkey_t pubkey;
-	int alg, ret = 0;
-
-	if (gnutls_pubkey_init(&pubkey))
-		VERIFY_ERROR("Failed initializing pubkey"); // LCOV_EXCL_LINE
-
-	if (jwt->key->pem == NULL)
-		VERIFY_ERROR("No PEM to load"); // LCOV_EXCL_LINE
+	int alg, ret;
 
-	gnutls_datum_t cert_dat = {
-		(unsigned char *)jwt->key->pem,
-		strlen(jwt->key->pem)
-	};
-
-	if (jwt->alg == JWT_ALG_ES256K)
-		VERIFY_ERROR("ES256K not supported"); // LCOV_EXCL_LINE
-
-	if (gnutls_pubkey_init(&pubkey))
-		VERIFY_ERROR("Error initializing pubkey"); // LCOV_EXCL_LINE
-
-	ret = gnutls_pubkey_import(pubkey, &cert_dat, GNUTLS_X509_FMT_PEM);
-	if (ret) {
-		gnutls_privkey_t privkey;
-
-		/* Try loading as a private key, and extracting the pubkey.
-		 * This is perfectly legit. A JWK can have a private key with
-		 * key_ops of SIGN and VERIFY. */
-		if (gnutls_privkey_init(&privkey))
-			VERIFY_ERROR("Failed initializing privkey"); // LCOV_EXCL_LINE
-
-		/* Try loading as a private key, and extracting the pubkey */
-		if (gnutls_privkey_import_x509_raw(privkey, &cert_dat,
-						   GNUTLS_X509_FMT_PEM,
-						   NULL, 0)) {
-			VERIFY_ERROR("Failed importing key"); // LCOV_EXCL_LINE
-		}
-
-		ret = gnutls_pubkey_import_privkey(pubkey, privkey, 0, 0);
-		gnutls_privkey_deinit(privkey);
-
-		if (ret)
-			VERIFY_ERROR("Failed to import key"); // LCOV_EXCL_LINE
+	if (jwt->alg == JWT_ALG_ES256K) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: ES256K not supported");
+		return 1;
+		// LCOV_EXCL_STOP
 	}
 
-	switch (jwt->alg) {
-	/* RSA */
-	case JWT_ALG_RS256:
-		alg = GNUTLS_SIGN_RSA_SHA256;
-		break;
-	case JWT_ALG_RS384:
-		alg = GNUTLS_SIGN_RSA_SHA384;
-		break;
-	case JWT_ALG_RS512:
-		alg = GNUTLS_SIGN_RSA_SHA512;
-		break;
-
-	/* RSA-PSS */
-	case JWT_ALG_PS256:
-		alg = GNUTLS_SIGN_RSA_PSS_SHA256;
-		break;
-	case JWT_ALG_PS384:
-		alg = GNUTLS_SIGN_RSA_PSS_SHA384;
-		break;
-	case JWT_ALG_PS512:
-		alg = GNUTLS_SIGN_RSA_PSS_SHA512;
-		break;
-
-	/* EC */
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES256K:
-		alg = GNUTLS_SIGN_ECDSA_SHA256;
-		break;
-	case JWT_ALG_ES384:
-		alg = GNUTLS_SIGN_ECDSA_SHA384;
-		break;
-	case JWT_ALG_ES512:
-		alg = GNUTLS_SIGN_ECDSA_SHA512;
-		break;
+	if (gnutls_load_pubkey(jwt, &pubkey))
+		return 1;
 
-	/* EdDSA */
-	case JWT_ALG_EDDSA:
+	if (jwt->alg == JWT_ALG_EDDSA) {
 		alg = gnutls_pubkey_get_pk_algorithm(pubkey, NULL);
 		if (alg == GNUTLS_PK_EDDSA_ED25519)
 			alg = GNUTLS_SIGN_EDDSA_ED25519;
@@ -346,52 +425,22 @@ static int gnutls_verify_sha_pem(jwt_t *jwt, const char *head,
 		} else {
 			VERIFY_ERROR("Unknown EdDSA key type"); // LCOV_EXCL_LINE
 		}
-		break;
-	// LCOV_EXCL_START
-	default:
-		VERIFY_ERROR("Unknown alg");
-	// LCOV_EXCL_STOP
+	} else {
+		alg = gnutls_sign_alg(jwt->alg);
 	}
 
 	/* Rebuild signature using r and s extracted from sig when jwt->alg
 	 * is ESxxx. */
-	switch (jwt->alg) {
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES256K:
-	case JWT_ALG_ES384:
-	case JWT_ALG_ES512:
-		/* XXX Gotta be a better way. */
-		if (sig_len == 64) {
-			r.size = 32;
-			r.data = sig;
-			s.size = 32;
-			s.data = sig + 32;
-		} else if (sig_len == 96) {
-			r.size = 48;
-			r.data = sig;
-			s.size = 48;
-			s.data = sig + 48;
-		} else if (sig_len == 132) {
-			r.size = 66;
-			r.data = sig;
-			s.size = 66;
-			s.data = sig + 66;
-		} else {
-			VERIFY_ERROR("Irregular sig_len for ECDHA"); // LCOV_EXCL_LINE
-		}
-
-		if (gnutls_encode_rs_value(&sig_dat, &r, &s) ||
-		    gnutls_pubkey_verify_data2(pubkey, alg, 0, &data, &sig_dat))
-			ret = 1; // LCOV_EXCL_LINE
+	if (gnutls_is_ec(jwt->alg)) {
+		if (gnutls_ec_in(jwt, sig, sig_len, der, &sig_dat))
+			goto verify_clean_sig; // LCOV_EXCL_LINE
 
-		if (sig_dat.data != NULL)
-			gnutls_free(sig_dat.data);
+		ret = gnutls_pubkey_verify_data2(pubkey, alg, 0, &data,
+						 &sig_dat);
 
 		if (ret)
-			VERIFY_ERROR("Could not encode R/S values for ECDHA"); // LCOV_EXCL_LINE
-		break;
-
-	default:
+			VERIFY_ERROR("Failed to verify signature"); // LCOV_EXCL_LINE
+	} else {
 		/* Use simple signature verification. */
 		sig_dat.size = sig_len;
 		sig_dat.data = sig;
@@ -403,7 +452,154 @@ static int gnutls_verify_sha_pem(jwt_t *jwt, const char *head,
 verify_clean_sig:
 	gnutls_pubkey_deinit(pubkey);
 
-	return ret;
+	return jwt->error;
+}
+
+/* Incremental signing and verifying */
+struct gnutls_digest {
+	gnutls_hmac_hd_t hmac;	/* HMAC					*/
+	gnutls_hash_hd_t hash;	/* Everything else			*/
+	gnutls_digest_algorithm_t alg;
+};
+
+static void gnutls_digest_free(void *dctx)
+{
+	struct gnutls_digest *d = dctx;
+
+	if (d == NULL)
+		return;
+
+	if (d->hmac)
+		gnutls_hmac_deinit(d->hmac, NULL);
+	if (d->hash)
+		gnutls_hash_deinit(d->hash, NULL);
+
+	jwt_freemem(d);
+}
+
+static void *gnutls_digest_init(jwt_t *jwt, int verify)
+{
+	struct gnutls_digest *d;
+	int ret;
+
+	(void)verify;
+
+	if (jwt->alg == JWT_ALG_ES256K) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: ES256K not supported");
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	d = jwt_malloc(sizeof(*d));
+	if (d == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(d, 0, sizeof(*d));
+	d->alg = gnutls_digest_alg(jwt->alg);
+
+	switch (jwt->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		ret = gnutls_hmac_init(&d->hmac, (gnutls_mac_algorithm_t)d->alg,
+				       jwt->key->oct.key, jwt->key->oct.len);
+		break;
+
+	default:
+		ret = gnutls_hash_init(&d->hash, d->alg);
+	}
+
+	if (ret) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[GnuTLS]: Error starting digest");
+		gnutls_digest_free(d);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	return d;
+}
+
+static int gnutls_digest_update(void *dctx, const char *buf,
+				unsigned int len)
+{
+	struct gnutls_digest *d = dctx;
+
+	if (d->hmac)
+		return gnutls_hmac(d->hmac, buf, len) ? 1 : 0;
+
+	return gnutls_hash(d->hash, buf, len) ? 1 : 0;
+}
+
+static int gnutls_digest_sign(jwt_t *jwt, void *dctx, char **out,
+			      unsigned int *len)
+{
+	struct gnutls_digest *d = dctx;
+	unsigned char digest[64];
+	gnutls_datum_t hash = { digest, gnutls_hash_get_len(d->alg) };
+	gnutls_privkey_t privkey;
+	gnutls_datum_t sig_dat;
+
+	*out = NULL;
+
+	if (d->hmac) {
+		*len = gnutls_hmac_get_len((gnutls_mac_algorithm_t)d->alg);
+		*out = jwt_malloc(*len);
+		if (*out == NULL)
+			return 1; // LCOV_EXCL_LINE
+
+		gnutls_hmac_output(d->hmac, *out);
+
+		return 0;
+	}
+
+	gnutls_hash_output(d->hash, digest);
+
+	if (gnutls_load_privkey(jwt, &privkey))
+		return 1;
+
+	if (gnutls_privkey_sign_hash2(privkey, gnutls_sign_alg(jwt->alg), 0,
+				      &hash, &sig_dat))
+		jwt_write_error(jwt, "JWT[GnuTLS]: Failed to sign token");
+	else
+		gnutls_sig_out(jwt, &sig_dat, out, len);
+
+	gnutls_privkey_deinit(privkey);
+
+	return jwt->error;
+}
+
+static int gnutls_digest_verify(jwt_t *jwt, void *dctx, unsigned char *sig,
+				int sig_len)
+{
+	struct gnutls_digest *d = dctx;
+	unsigned char digest[64];
+	gnutls_datum_t hash = { digest, gnutls_hash_get_len(d->alg) };
+	gnutls_datum_t sig_dat = { sig, sig_len };
+	unsigned char der[JWT_ECDSA_DER_MAX];
+	gnutls_pubkey_t pubkey;
+	int is_ec = gnutls_is_ec(jwt->alg);
+
+	gnutls_hash_output(d->hash, digest);
+
+	if (gnutls_load_pubkey(jwt, &pubkey))
+		return 1;
+
+	if (is_ec && gnutls_ec_in(jwt, sig, sig_len, der, &sig_dat)) {
+		// LCOV_EXCL_START
+		gnutls_pubkey_deinit(pubkey);
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (gnutls_pubkey_verify_hash2(pubkey, gnutls_sign_alg(jwt->alg), 0,
+				       &hash, &sig_dat))
+		jwt_write_error(jwt, "JWT[GnuTLS]: Failed to verify signature");
+
+	gnutls_pubkey_deinit(pubkey);
+
+	return jwt->error;
 }
 
 /* Export our ops */
@@ -415,6 +611,12 @@ struct jwt_crypto_ops jwt_gnutls_ops = {
 	.sign_sha_pem		= gnutls_sign_sha_pem,
 	.verify_sha_pem		= gnutls_verify_sha_pem,
 
+	.digest_init		= gnutls_digest_init,
+	.digest_update		= gnutls_digest_update,
+	.digest_sign		= gnutls_digest_sign,
+	.digest_verify		= gnutls_digest_verify,
+	.digest_free		= gnutls_digest_free,
+
 	/* Needs to be implemented */
 	.jwk_implemented	= 1,
 	.process_eddsa		= openssl_process_eddsa,
@@ -110,7 +110,12 @@ jwk_set_t *jwks_load_fromurl(jwk_set_t *jwk_set, const char *url, int verify)
 	if (jwk_set == NULL)
 		return NULL; // LCOV_EXCL_LINE
 
+	JWT_PROBE1(jwks_fetch__entry, url);
+
 	str = __curl_get(jwk_set, url, &len, verify);
+
+	JWT_PROBE3(jwks_fetch__return, url, str ? len : 0, str == NULL);
+
 	if (str != NULL) {
 		jwk_set = jwks_load_strn(jwk_set, str, len);
 		jwt_freemem(str);
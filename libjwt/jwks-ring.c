@@ -0,0 +1,262 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* A jwk_set_t that can be replaced while checkers are reading it.
+ *
+ * Readers never wait. Each one adds itself to the reader count for the
+ * current epoch, loads the set, and takes itself off when done. Counts
+ * are sharded by thread, the same as the metrics, so threads don't all
+ * hit one cache line.
+ *
+ * A swap puts the new set in place, then twice moves the epoch on and
+ * waits for the count of the epoch it left to drain. Anyone who saw the
+ * old set was counted before the swap, under one epoch or the other, so
+ * once both have drained the old set is unused and can be freed. Moving
+ * the epoch on first sends new readers to the other count, so the wait
+ * always ends. Only the writer ever waits. */
+
+#define RING_SHARDS	8
+
+struct __ring_shard {
+	unsigned long readers[2];
+} __attribute__((aligned(64)));
+
+struct jwks_ring {
+	unsigned int refs;
+	unsigned int epoch;
+	jwk_set_t *set;
+	unsigned long swaps;
+	pthread_mutex_t lock;		/* Writers only			*/
+	struct __ring_shard shard[RING_SHARDS];
+};
+
+static __thread unsigned int shard_id;
+static unsigned int shard_next;
+
+jwks_ring_t *jwks_ring_new(jwk_set_t *jwk_set)
+{
+	jwks_ring_t *ring = jwt_malloc(sizeof(*ring));
+
+	if (ring == NULL) {
+		// LCOV_EXCL_START
+		jwks_free(jwk_set);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	memset(ring, 0, sizeof(*ring));
+	ring->refs = 1;
+	ring->set = jwk_set;
+	pthread_mutex_init(&ring->lock, NULL);
+
+	return ring;
+}
+
+jwks_ring_t *jwks_ring_ref(jwks_ring_t *ring)
+{
+	if (ring)
+		__atomic_add_fetch(&ring->refs, 1, __ATOMIC_RELAXED);
+
+	return ring;
+}
+
+void jwks_ring_unref(jwks_ring_t *ring)
+{
+	if (ring == NULL)
+		return;
+
+	if (__atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	jwks_free(ring->set);
+	pthread_mutex_destroy(&ring->lock);
+
+	jwt_freemem(ring);
+}
+
+/* The epoch given back has the shard in it too, so the unlock doesn't
+ * depend on being in the same thread. */
+const jwk_set_t *jwks_ring_read_lock(jwks_ring_t *ring, unsigned int *epoch)
+{
+	unsigned int idx;
+
+	if (!shard_id)
+		shard_id = (__atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED) %
+			    RING_SHARDS) + 1;
+
+	idx = __atomic_load_n(&ring->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&ring->shard[shard_id - 1].readers[idx], 1,
+			   __ATOMIC_SEQ_CST);
+
+	*epoch = ((shard_id - 1) << 1) | idx;
+
+	/* Counted before looking, so a swap can't miss us */
+	return __atomic_load_n(&ring->set, __ATOMIC_SEQ_CST);
+}
+
+void jwks_ring_read_unlock(jwks_ring_t *ring, unsigned int epoch)
+{
+	__atomic_sub_fetch(&ring->shard[epoch >> 1].readers[epoch & 1], 1,
+			   __ATOMIC_RELEASE);
+}
+
+/* Move the epoch on, and wait for readers of the one we left */
+static void __ring_drain(jwks_ring_t *ring)
+{
+	unsigned int idx = __atomic_fetch_add(&ring->epoch, 1,
+					      __ATOMIC_SEQ_CST) & 1;
+	int i;
+
+	for (i = 0; i < RING_SHARDS; i++) {
+		while (__atomic_load_n(&ring->shard[i].readers[idx],
+				       __ATOMIC_ACQUIRE))
+			sched_yield(); // LCOV_EXCL_LINE
+	}
+}
+
+int jwks_ring_swap(jwks_ring_t *ring, jwk_set_t *jwk_set)
+{
+	jwk_set_t *old;
+
+	if (ring == NULL) {
+		jwks_free(jwk_set);
+		return 1;
+	}
+
+	pthread_mutex_lock(&ring->lock);
+
+	old = __atomic_exchange_n(&ring->set, jwk_set, __ATOMIC_SEQ_CST);
+	__ring_drain(ring);
+	__ring_drain(ring);
+	__atomic_add_fetch(&ring->swaps, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&ring->lock);
+
+	jwks_free(old);
+
+	return 0;
+}
+
+unsigned long jwks_ring_swaps(const jwks_ring_t *ring)
+{
+	if (ring == NULL)
+		return 0;
+
+	return __atomic_load_n(&ring->swaps, __ATOMIC_RELAXED);
+}
+
+/* A token with no kid can only mean the one key, so it gets that when
+ * there is exactly one that is usable, and nothing otherwise. */
+const jwk_item_t *jwks_ring_key(const jwk_set_t *jwk_set, const char *kid)
+{
+	const jwk_item_t *only = NULL;
+	jwk_item_t *item;
+
+	if (jwk_set == NULL)
+		return NULL;
+
+	list_for_each_entry(item, &jwk_set->head, node) {
+		if (item->error)
+			continue;
+
+		if (kid == NULL) {
+			if (only != NULL)
+				return NULL;
+			only = item;
+		} else if (item->kid != NULL && !strcmp(item->kid, kid)) {
+			return item;
+		}
+	}
+
+	return only;
+}
+
+/* Whether a key with no alg of its own can check alg. A key from a PEM
+ * may not have a curve, and the crypto will catch a wrong one. */
+static int __ring_alg_ok(const jwk_item_t *key, jwt_alg_t alg)
+{
+	const char *crv;
+
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		return key->kty == JWK_KEY_TYPE_OCT;
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS256:
+	case JWT_ALG_PS384:
+	case JWT_ALG_PS512:
+		return key->kty == JWK_KEY_TYPE_RSA;
+	case JWT_ALG_EDDSA:
+		return key->kty == JWK_KEY_TYPE_OKP;
+	case JWT_ALG_ES256:
+		crv = "P-256";
+		break;
+	case JWT_ALG_ES256K:
+		crv = "secp256k1";
+		break;
+	case JWT_ALG_ES384:
+		crv = "P-384";
+		break;
+	case JWT_ALG_ES512:
+		crv = "P-521";
+		break;
+	default:
+		return 0;
+	}
+
+	return key->kty == JWK_KEY_TYPE_EC &&
+		(!key->curve[0] || !strcmp(key->curve, crv));
+}
+
+/* A ring is only for checking signatures, so an unsigned token, or one
+ * whose key isn't in the set, is never let through. */
+int jwks_ring_pick(jwt_t *jwt, const jwk_set_t *jwk_set,
+		   const jwk_item_t **key, jwt_alg_t *alg)
+{
+	const char *kid;
+	const jwk_item_t *item;
+
+	if (jwt->alg == JWT_ALG_NONE) {
+		jwt_write_errcode(jwt, JWT_ERR_SIG_MISSING);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
+		return 1;
+	}
+
+	kid = json_string_value(json_object_get(jwt->headers, "kid"));
+	item = jwks_ring_key(jwk_set, kid);
+	if (item == NULL) {
+		jwt_write_errcode(jwt, kid ? JWT_ERR_NO_KEY : JWT_ERR_NO_KID);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_KEY);
+		return 1;
+	}
+
+	/* Keys without an alg go by the header, if it suits the key */
+	if (item->alg != JWT_ALG_NONE ? item->alg != jwt->alg :
+	    !__ring_alg_ok(item, jwt->alg)) {
+		jwt_write_errcode(jwt, JWT_ERR_KEY_ALG);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
+		return 1;
+	}
+
+	*key = item;
+	*alg = jwt->alg;
+
+	return 0;
+}
@@ -139,6 +139,7 @@ static int process_octet(json_t *jwk, jwk_item_t *item)
 
 static jwk_item_t *jwk_process_one(jwk_set_t *jwk_set, json_t *jwk)
 {
+	struct jwt_crypto_ops *ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
 	const char *kty;
 	json_t *val;
 	jwk_item_t *item;
@@ -153,6 +154,7 @@ static jwk_item_t *jwk_process_one(jwk_set_t *jwk_set, json_t *jwk)
 	}
 
 	memset(item, 0, sizeof(*item));
+	item->refs = 1;
 	item->json = json_deep_copy(jwk);
 	if (item->json == NULL) {
 		// LCOV_EXCL_START
@@ -173,13 +175,13 @@ static jwk_item_t *jwk_process_one(jwk_set_t *jwk_set, json_t *jwk)
 
 	if (!jwt_strcmp(kty, "EC")) {
 		item->kty = JWK_KEY_TYPE_EC;
-		jwt_ops->process_ec(item->json, item);
+		ops->process_ec(item->json, item);
 	} else if (!jwt_strcmp(kty, "RSA")) {
 		item->kty = JWK_KEY_TYPE_RSA;
-		jwt_ops->process_rsa(item->json, item);
+		ops->process_rsa(item->json, item);
 	} else if (!jwt_strcmp(kty, "OKP")) {
 		item->kty = JWK_KEY_TYPE_OKP;
-		jwt_ops->process_eddsa(item->json, item);
+		ops->process_eddsa(item->json, item);
 	} else if (!jwt_strcmp(kty, "oct")) {
 		item->kty = JWK_KEY_TYPE_OCT;
 		process_octet(item->json, item);
@@ -323,22 +325,50 @@ jwk_item_t *jwks_find_bykid(jwk_set_t *jwk_set, const char *kid)
 	return NULL;
 }
 
-static void __item_free(jwk_item_t *todel)
+const jwk_item_t *jwks_item_ref(const jwk_item_t *item)
 {
-	if (todel->provider == JWT_CRYPTO_OPS_ANY)
+	/* The count is the only thing that changes after a key is loaded */
+	if (item)
+		__atomic_add_fetch(&((jwk_item_t *)item)->refs, 1,
+				   __ATOMIC_RELAXED);
+
+	return item;
+}
+
+void jwks_item_unref(const jwk_item_t *item)
+{
+	jwk_item_t *todel = (jwk_item_t *)item;
+	struct jwt_crypto_ops *ops;
+
+	if (todel == NULL)
+		return;
+
+	if (__atomic_sub_fetch(&todel->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (todel->provider == JWT_CRYPTO_OPS_ANY) {
 		jwt_freemem(todel->oct.key);
-	else
-		jwt_ops->process_item_free(todel);
+	} else {
+		ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
+		ops->process_item_free(todel);
+	}
 
 	/* A few non-crypto specific things. */
 	jwt_freemem(todel->kid);
 	json_decrefp(&todel->json);
-	list_del(&todel->node);
 
 	/* Free the container and the item itself. */
 	jwt_freemem(todel);
 }
 
+/* Takes it out of the set. Anyone else holding a reference, such as a
+ * checker it was given to, keeps it until they let go. */
+static void __item_free(jwk_item_t *todel)
+{
+	list_del(&todel->node);
+	jwks_item_unref(todel);
+}
+
 int jwks_item_free(jwk_set_t *jwk_set, const size_t index)
 {
 	jwk_item_t *item = NULL, *todel = NULL;
@@ -461,9 +491,13 @@ jwk_set_t *jwks_load_strn(jwk_set_t *jwk_set, const char *jwk_json_str,
 	json_auto_t *j_all = NULL;
 	json_error_t error;
 
+	JWT_ALLOC_SCOPE(JWT_ALLOC_JWKS);
+
 	if (jwk_json_str == NULL)
 		return NULL;
 
+	JWT_PROBE1(jwks_load__entry, len);
+
 	if (jwk_set == NULL)
 		jwk_set = jwks_new();
 	if (jwk_set == NULL)
@@ -476,7 +510,12 @@ jwk_set_t *jwks_load_strn(jwk_set_t *jwk_set, const char *jwk_json_str,
 	/* Parse the JSON string. */
 	j_all = json_loadb(jwk_json_str, len, JSON_DECODE_ANY, &error);
 
-	return jwks_process(jwk_set, j_all, &error);
+	jwk_set = jwks_process(jwk_set, j_all, &error);
+
+	JWT_PROBE3(jwks_load__return, len, jwks_item_count(jwk_set),
+		   jwks_error(jwk_set));
+
+	return jwk_set;
 }
 
 jwk_set_t *jwks_load(jwk_set_t *jwk_set, const char *jwk_json_str)
@@ -499,6 +538,8 @@ jwk_set_t *jwks_load_fromfile(jwk_set_t *jwk_set, const char *file_name)
 	json_auto_t *j_all = NULL;
 	json_error_t error;
 
+	JWT_ALLOC_SCOPE(JWT_ALLOC_JWKS);
+
 	if (file_name == NULL)
 		return NULL;
 
@@ -518,6 +559,8 @@ jwk_set_t *jwks_load_fromfp(jwk_set_t *jwk_set, FILE *input)
 	json_auto_t *j_all = NULL;
 	json_error_t error;
 
+	JWT_ALLOC_SCOPE(JWT_ALLOC_JWKS);
+
 	if (input == NULL)
 		return NULL;
 
@@ -0,0 +1,190 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+#include "openssl/jwt-openssl.h"
+
+/* Time a few sign and verify rounds of each alg with each of the compiled
+ * crypto ops, and use the fastest for that alg from then on. Keys are
+ * made up on the spot. JWKs are always parsed with OpenSSL, so any of the
+ * ops can use them. */
+
+static struct jwt_crypto_ops *jwt_tune_ops[] = {
+#ifdef HAVE_OPENSSL
+	&jwt_openssl_ops,
+#endif
+#ifdef HAVE_GNUTLS
+	&jwt_gnutls_ops,
+#endif
+#ifdef HAVE_MBEDTLS
+	&jwt_mbedtls_ops,
+#endif
+};
+
+/* Rounds per test. HMAC is cheap enough that we need more of them to get
+ * a useful number. */
+#define TUNE_ROUNDS_HMAC	256
+#define TUNE_ROUNDS_PKEY	16
+
+static const char tune_input[] =
+	"eyJhbGciOiJub25lIn0.eyJpc3MiOiJmaWxlcy5tYWNsYXJhLWxsYy5jb20ifQ";
+
+static double __now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static int __tune_round(jwt_t *jwt)
+{
+	char_auto *sig = NULL;
+	char_auto *sig_b64 = NULL;
+	unsigned int sig_len;
+
+	if (jwt_sign(jwt, &sig, &sig_len, tune_input, sizeof(tune_input) - 1))
+		return 1;
+
+	if (jwt_base64uri_encode(&sig_b64, sig, sig_len) <= 0)
+		return 1; // LCOV_EXCL_LINE
+
+	jwt_verify_sig(jwt, tune_input, sizeof(tune_input) - 1, sig_b64);
+
+	return jwt->error;
+}
+
+/* Seconds taken for the rounds, or a negative number if these ops can't
+ * do this alg at all. */
+static double __tune_one(struct jwt_crypto_ops *ops, jwt_alg_t alg,
+			 const jwk_item_t *key, int rounds)
+{
+	jwt_t jwt;
+	double start;
+	int i;
+
+	memset(&jwt, 0, sizeof(jwt));
+	jwt.alg = alg;
+	jwt.key = key;
+	jwt.ops = ops;
+
+	/* Warm up, and make sure it works */
+	if (__tune_round(&jwt))
+		return -1;
+
+	start = __now();
+
+	for (i = 0; i < rounds; i++) {
+		if (__tune_round(&jwt))
+			return -1; // LCOV_EXCL_LINE
+	}
+
+	return __now() - start;
+}
+
+static void __tune_alg(jwt_alg_t alg, const jwk_item_t *key, int rounds)
+{
+	struct jwt_crypto_ops *best = NULL;
+	double best_time = 0;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(jwt_tune_ops); i++) {
+		double t = __tune_one(jwt_tune_ops[i], alg, key, rounds);
+
+		if (t < 0)
+			continue;
+
+		if (best == NULL || t < best_time) {
+			best = jwt_tune_ops[i];
+			best_time = t;
+		}
+	}
+
+	if (best != NULL)
+		jwt_set_crypto_ops_alg(alg, best->name);
+}
+
+static int __tune_hmac(void)
+{
+	unsigned char secret[64];
+	jwk_item_t key;
+
+	if (RAND_bytes(secret, sizeof(secret)) != 1)
+		return 1; // LCOV_EXCL_LINE
+
+	memset(&key, 0, sizeof(key));
+	key.kty = JWK_KEY_TYPE_OCT;
+	key.provider = JWT_CRYPTO_OPS_ANY;
+	key.oct.key = secret;
+	key.oct.len = sizeof(secret);
+	key.bits = sizeof(secret) * 8;
+	key.is_private_key = 1;
+
+	__tune_alg(JWT_ALG_HS256, &key, TUNE_ROUNDS_HMAC);
+	__tune_alg(JWT_ALG_HS384, &key, TUNE_ROUNDS_HMAC);
+	__tune_alg(JWT_ALG_HS512, &key, TUNE_ROUNDS_HMAC);
+
+	return 0;
+}
+
+/* Algs that share a key are tuned together */
+static int __tune_pkey(const jwt_alg_t *algs, size_t count)
+{
+	jwk_item_t key;
+	size_t i;
+
+	memset(&key, 0, sizeof(key));
+
+	if (openssl_generate_key(&key, algs[0]))
+		return 1; // LCOV_EXCL_LINE
+
+	for (i = 0; i < count; i++)
+		__tune_alg(algs[i], &key, TUNE_ROUNDS_PKEY);
+
+	openssl_process_item_free(&key);
+
+	return 0;
+}
+
+int jwt_ops_autotune(void)
+{
+	static const jwt_alg_t rsa[] = {
+		JWT_ALG_RS256, JWT_ALG_RS384, JWT_ALG_RS512,
+		JWT_ALG_PS256, JWT_ALG_PS384, JWT_ALG_PS512,
+	};
+	static const jwt_alg_t ec[] = {
+		JWT_ALG_ES256, JWT_ALG_ES256K, JWT_ALG_ES384, JWT_ALG_ES512,
+		JWT_ALG_EDDSA,
+	};
+	int ret = 0;
+	size_t i;
+
+	/* Nothing to choose from */
+	if (ARRAY_SIZE(jwt_tune_ops) < 2)
+		return 0; // LCOV_EXCL_LINE
+
+	ret |= __tune_hmac();
+	ret |= __tune_pkey(rsa, ARRAY_SIZE(rsa));
+
+	/* Each of these has its own curve */
+	for (i = 0; i < ARRAY_SIZE(ec); i++)
+		ret |= __tune_pkey(&ec[i], 1);
+
+	return ret;
+}
@@ -26,6 +26,28 @@
 #error Must have target defined
 #endif
 
+#ifdef JWT_BUILDER
+/* Any change to the builder makes the compiled template stale */
+static void __tmpl_reset(jwt_common_t *__cmd)
+{
+	jwt_template_free(__cmd->tmpl);
+	__cmd->tmpl = NULL;
+}
+#else
+#define __tmpl_reset(__cmd) do { } while (0)
+#endif
+
+#ifdef JWT_CHECKER
+/* Work out how to verify with the alg, key and ops we have now */
+static void __plan_reset(jwt_common_t *__cmd)
+{
+	jwt_plan_free(&__cmd->plan);
+	jwt_plan_init(&__cmd->plan, __cmd->c.alg, __cmd->c.key, __cmd->c.ops);
+}
+#else
+#define __plan_reset(__cmd) do { } while (0)
+#endif
+
 void FUNC(free)(jwt_common_t *__cmd)
 {
 	if (__cmd == NULL)
@@ -33,6 +55,15 @@ void FUNC(free)(jwt_common_t *__cmd)
 
 	json_decref(__cmd->c.payload);
 	json_decref(__cmd->c.headers);
+	__tmpl_reset(__cmd);
+#ifdef JWT_CHECKER
+	jwt_plan_free(&__cmd->plan);
+	jwt_matcher_free(__cmd->policy);
+	jwt_scopes_free(__cmd->scopes);
+	jwks_ring_unref(__cmd->ring);
+#endif
+	jwks_item_unref(__cmd->c.key);
+	jwt_metrics_live_free(__cmd->c.metrics);
 
 	memset(__cmd, 0, sizeof(*__cmd));
 
@@ -58,51 +89,61 @@ jwt_common_t *FUNC(new)(void)
 	return __cmd;
 }
 
-static int __setkey_check(jwt_common_t *__cmd, const jwt_alg_t alg,
-		       const jwk_item_t *key)
+/* Why alg and key can't be used together, or NULL if they can. This
+ * is also run for each token, from any thread, so it only reports. */
+static const char *__setkey_check(const jwt_alg_t alg, const jwk_item_t *key)
 {
-	if (__cmd == NULL)
-		return 1;
-
 #ifdef JWT_BUILDER
-	if (key && !key->is_private_key) {
-		jwt_write_error(__cmd, "Signing requires a private key");
-		return 1;
-	}
+	if (key && !key->is_private_key)
+		return "Signing requires a private key";
 #endif
 	/* TODO: Check key_ops and use */
 
 	if (key == NULL) {
 		if (alg == JWT_ALG_NONE)
-			return 0;
+			return NULL;
 
-		jwt_write_error(__cmd, "Cannot set alg without a key");
+		return "Cannot set alg without a key";
 	} else if (key->alg == JWT_ALG_NONE) {
 		if (alg != JWT_ALG_NONE)
-			return 0;
+			return NULL;
 
-		jwt_write_error(__cmd, "Key provided, but could not find alg");
+		return "Key provided, but could not find alg";
 	} else {
 		if (alg == JWT_ALG_NONE)
-			return 0;
+			return NULL;
 
 		if (alg == key->alg)
-			return 0;
+			return NULL;
 
-		jwt_write_error(__cmd, "Alg mismatch");
+		return "Alg mismatch";
 	}
-
-	return 1;
 }
 
 int FUNC(setkey)(jwt_common_t *__cmd, const jwt_alg_t alg,
 		 const jwk_item_t *key)
 {
-	if (__setkey_check(__cmd, alg, key))
+	const jwk_item_t *old;
+	const char *err;
+
+	if (__cmd == NULL)
 		return 1;
 
+	err = __setkey_check(alg, key);
+	if (err != NULL) {
+		jwt_write_error(__cmd, "%s", err);
+		return 1;
+	}
+
+	old = __cmd->c.key;
+
+	/* Hold on to the key, so it outlives the set it came from. The old
+	 * one goes once nothing built from it is left. */
 	__cmd->c.alg = alg;
-	__cmd->c.key = key;
+	__cmd->c.key = jwks_item_ref(key);
+	__tmpl_reset(__cmd);
+	__plan_reset(__cmd);
+	jwks_item_unref(old);
 
 	return 0;
 }
@@ -120,15 +161,35 @@ const char *FUNC(error_msg)(const jwt_common_t *__cmd)
 	if (__cmd == NULL)
 		return NULL;
 
-	return __cmd->error_msg;
+	return jwt_error_msg_get(__cmd);
+}
+
+jwt_error_t FUNC(error_code)(const jwt_common_t *__cmd)
+{
+	if (__cmd == NULL || !__cmd->error)
+		return JWT_ERR_NONE;
+
+	return __cmd->errcode ? __cmd->errcode : JWT_ERR_OTHER;
 }
 
+#ifdef JWT_CHECKER
+jwt_claims_t FUNC(error_claims)(const jwt_common_t *__cmd)
+{
+	if (__cmd == NULL)
+		return 0;
+
+	return __cmd->claims_failed;
+}
+#endif
+
 void FUNC(error_clear)(jwt_common_t *__cmd)
 {
 	if (__cmd == NULL)
 		return;
 
 	__cmd->error = 0;
+	__cmd->errcode = JWT_ERR_NONE;
+	__cmd->claims_failed = 0;
 	__cmd->error_msg[0] = '\0';
 }
 
@@ -147,6 +208,55 @@ int FUNC(enable_iat)(jwt_common_t *__cmd, int enable)
 	else
 		__cmd->c.claims &= ~JWT_CLAIM_IAT;
 
+	__tmpl_reset(__cmd);
+
+	return orig;
+}
+
+int FUNC(enable_jti)(jwt_common_t *__cmd, int enable)
+{
+	int orig;
+
+	if (!__cmd)
+		return -1;
+
+	orig = __cmd->c.claims & JWT_CLAIM_JTI ? 1 : 0;
+
+	if (enable)
+		__cmd->c.claims |= JWT_CLAIM_JTI;
+	else
+		__cmd->c.claims &= ~JWT_CLAIM_JTI;
+
+	__tmpl_reset(__cmd);
+
+	return orig;
+}
+
+int FUNC(setjti)(jwt_common_t *__cmd, jwt_jti_cb_t cb, void *ctx)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	__cmd->jti_cb = cb;
+	__cmd->jti_ctx = ctx;
+	FUNC(enable_jti)(__cmd, 1);
+
+	return 0;
+}
+
+int FUNC(enable_template)(jwt_common_t *__cmd, int enable)
+{
+	int orig;
+
+	if (!__cmd)
+		return -1;
+
+	orig = __cmd->tmpl_enabled;
+	__cmd->tmpl_enabled = enable ? 1 : 0;
+
+	if (!enable)
+		__tmpl_reset(__cmd);
+
 	return orig;
 }
 #endif
@@ -169,6 +279,84 @@ int FUNC(setcb)(jwt_common_t *__cmd, jwt_callback_t cb, void *ctx)
 
 	__cmd->c.cb = cb;
 	__cmd->c.cb_ctx = ctx;
+	__tmpl_reset(__cmd);
+
+	return 0;
+}
+
+int FUNC(set_crypto_ops)(jwt_common_t *__cmd, const char *opname)
+{
+	struct jwt_crypto_ops *ops = NULL;
+
+	if (__cmd == NULL)
+		return 1;
+
+	if (opname != NULL) {
+		ops = jwt_ops_find(opname);
+		if (ops == NULL) {
+			jwt_write_error(__cmd, "No such crypto ops [%s]",
+					opname);
+			return 1;
+		}
+	}
+
+	__cmd->c.ops = ops;
+	__plan_reset(__cmd);
+
+	return 0;
+}
+
+int FUNC(metrics_enable)(jwt_common_t *__cmd, int enable)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	if (!enable) {
+		jwt_metrics_live_free(__cmd->c.metrics);
+		__cmd->c.metrics = NULL;
+		return 0;
+	}
+
+	if (__cmd->c.metrics != NULL)
+		return 0;
+
+#ifdef JWT_BUILDER
+	__cmd->c.metrics = jwt_metrics_new(1);
+#else
+	__cmd->c.metrics = jwt_metrics_new(0);
+#endif
+	if (__cmd->c.metrics == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(__cmd, "Error allocating memory");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+
+int FUNC(set_trace)(jwt_common_t *__cmd, jwt_trace_cb_t cb, void *ctx)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	__cmd->c.trace_cb = cb;
+	__cmd->c.trace_ctx = ctx;
+
+	return 0;
+}
+
+int FUNC(set_trace_slow)(jwt_common_t *__cmd, unsigned long long threshold_ns,
+			 unsigned int sample, jwt_trace_slow_cb_t cb, void *ctx)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	__cmd->c.slow_cb = cb;
+	__cmd->c.slow_ctx = ctx;
+	__cmd->c.slow_ns = threshold_ns;
+	__cmd->c.slow_sample = sample;
+	__cmd->c.slow_seen = 0;
 
 	return 0;
 }
@@ -226,6 +414,8 @@ jwt_value_error_t FUNC(claim_get)(jwt_common_t *__cmd, jwt_value_t *value)
 
 jwt_value_error_t FUNC(claim_set)(jwt_common_t *__cmd, jwt_value_t *value)
 {
+	if (__cmd)
+		__tmpl_reset(__cmd);
 	return __run_it(__cmd, __CLAIM, value, __setter);
 }
 
@@ -233,6 +423,7 @@ jwt_value_error_t FUNC(claim_del)(jwt_common_t *__cmd, const char *claim)
 {
 	if (!__cmd)
 		return JWT_VALUE_ERR_INVALID;
+	__tmpl_reset(__cmd);
 	return __deleter(__cmd->c.payload, claim);
 }
 
@@ -244,6 +435,8 @@ jwt_value_error_t FUNC(header_get)(jwt_common_t *__cmd, jwt_value_t *value)
 
 jwt_value_error_t FUNC(header_set)(jwt_common_t *__cmd, jwt_value_t *value)
 {
+	if (__cmd)
+		__tmpl_reset(__cmd);
 	return __run_it(__cmd, __HEADER, value, __setter);
 }
 
@@ -251,6 +444,7 @@ jwt_value_error_t FUNC(header_del)(jwt_common_t *__cmd, const char *header)
 {
 	if (!__cmd)
 		return JWT_VALUE_ERR_INVALID;
+	__tmpl_reset(__cmd);
 	return __deleter(__cmd->c.headers, header);
 }
 #endif
@@ -353,85 +547,489 @@ int FUNC(time_leeway)(jwt_common_t *__cmd, jwt_claims_t claim, time_t secs)
 	else
 		__cmd->c.claims |= claim;
 
+	__tmpl_reset(__cmd);
+
 	return 0;
 }
 
 #ifdef JWT_CHECKER
-int FUNC(verify)(jwt_common_t *__cmd, const char *token)
+int FUNC(set_limits)(jwt_common_t *__cmd, const jwt_limits_t *limits)
 {
-	JWT_CONFIG_DECLARE(config);
-	unsigned int payload_len;
-	jwt_auto_t *jwt = NULL;
+	if (__cmd == NULL)
+		return 1;
+
+	if (limits == NULL) {
+		memset(&__cmd->limits, 0, sizeof(__cmd->limits));
+		__cmd->json_limits = 0;
+		return 0;
+	}
+
+	__cmd->limits = *limits;
+	__cmd->json_limits = limits->json_depth || limits->json_members ||
+		limits->json_string;
+
+	return 0;
+}
 
+int FUNC(set_algs)(jwt_common_t *__cmd, unsigned int mask)
+{
 	if (__cmd == NULL)
 		return 1;
 
-	if (token == NULL || !strlen(token)) {
-		jwt_write_error(__cmd, "Must pass a token");
+	if (mask & ~(JWT_ALG_BIT(JWT_ALG_INVAL) - 1)) {
+		jwt_write_error(__cmd, "Alg mask has unknown algs");
 		return 1;
 	}
 
-	jwt = jwt_new();
-	if (jwt == NULL) {
-		// LCOV_EXCL_START
-		jwt_write_error(__cmd, "Could not allocate JWT object");
+	__cmd->algs = mask;
+
+	return 0;
+}
+
+int FUNC(set_policy)(jwt_common_t *__cmd, const jwt_policy_t *policy)
+{
+	struct jwt_matcher *m = NULL;
+
+	if (__cmd == NULL)
 		return 1;
-		// LCOV_EXCL_STOP
+
+	if (policy != NULL) {
+		m = jwt_matcher_compile(policy);
+		if (m == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(__cmd, "Could not compile policy");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
 	}
 
+	jwt_matcher_free(__cmd->policy);
+	__cmd->policy = m;
+
+	return 0;
+}
+
+int FUNC(set_scopes)(jwt_common_t *__cmd, const char *names[],
+		     unsigned int count)
+{
+	struct jwt_scopes *s = NULL;
+
+	if (__cmd == NULL)
+		return 1;
+
+	if (names != NULL && count) {
+		s = jwt_scopes_compile(names, count);
+		if (s == NULL) {
+			jwt_write_error(__cmd, "Invalid scope names");
+			return 1;
+		}
+	}
+
+	jwt_scopes_free(__cmd->scopes);
+	__cmd->scopes = s;
+
+	return 0;
+}
+
+int FUNC(set_keyring)(jwt_common_t *__cmd, jwks_ring_t *ring)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	jwks_ring_ref(ring);
+	jwks_ring_unref(__cmd->ring);
+	__cmd->ring = ring;
+
+	return 0;
+}
+
+int FUNC(fail_fast)(jwt_common_t *__cmd, int enable)
+{
+	if (__cmd == NULL)
+		return 1;
+
+	__cmd->fail_fast = enable ? 1 : 0;
+
+	return 0;
+}
+
+int FUNC(fail_fast_stats)(const jwt_common_t *__cmd,
+			  jwt_fail_fast_stats_t *stats)
+{
+	const jwt_fail_fast_stats_t *ff;
+
+	if (__cmd == NULL || stats == NULL)
+		return 1;
+
+	ff = &__cmd->ff_stats;
+	stats->alg = __atomic_load_n(&ff->alg, __ATOMIC_RELAXED);
+	stats->kid = __atomic_load_n(&ff->kid, __ATOMIC_RELAXED);
+	stats->sig_len = __atomic_load_n(&ff->sig_len, __ATOMIC_RELAXED);
+	stats->payload_bytes = __atomic_load_n(&ff->payload_bytes,
+					       __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/* Verify one token. Errors are left in jwt. Apart from the callback,
+ * nothing here changes the checker, so it is safe to call from more than
+ * one thread at a time. */
+static int __verify_one(jwt_common_t *__cmd, const char *token, size_t len,
+			jwt_t *jwt, const jwk_set_t *keys)
+{
+	JWT_CONFIG_DECLARE(config);
+	char_auto *buf = NULL;
+	unsigned int payload_len;
+	const char *err;
+
+	if (token == NULL || !len) {
+		jwt_write_errcode(jwt, JWT_ERR_NO_TOKEN);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_PARSE);
+		return 1;
+	}
+
+	/* Parsing checks the limits, so it needs to know who we are */
+	jwt->checker = __cmd;
+	jwt->keys = keys;
+
 	/* First parsing pass, error will be set for us */
-        if (jwt_parse(jwt, token, &payload_len)) {
-		jwt_copy_error(__cmd, jwt);
+	if (jwt_parse(jwt, token, len, &buf, &payload_len)) {
+		jwt_write_fail(jwt, JWT_METRIC_ERR_PARSE);
 		return 1;
-	};
+	}
 
 	config.key = __cmd->c.key;
 	config.alg = __cmd->c.alg;
 	config.ctx = __cmd->c.cb_ctx;
 
+	/* Our own key always wins over the key ring. Otherwise a ring
+	 * means the token has to be signed by one of its keys, even when
+	 * its set is empty. */
+	if (config.key == NULL && __cmd->ring != NULL &&
+	    jwks_ring_pick(jwt, keys, &config.key, &config.alg))
+		return 1;
+
 	/* Let the user handle this and update config */
-        if (__cmd->c.cb && __cmd->c.cb(jwt, &config)) {
-		jwt_write_error(__cmd, "User callback returned error");
+	if (__cmd->c.cb) {
+		uint64_t start = jwt_trace_begin(jwt);
+		int ret = __cmd->c.cb(jwt, &config);
+
+		jwt_trace_end(jwt, JWT_TRACE_CALLBACK, start, 0);
+		if (ret) {
+			jwt_write_errcode(jwt, JWT_ERR_CALLBACK);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_CALLBACK);
+			return 1;
+		}
+	}
+
+	/* Nor can the callback take the key away */
+	if (config.key == NULL && __cmd->ring != NULL) {
+		jwt_write_errcode(jwt, JWT_ERR_NO_KEY);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_KEY);
 		return 1;
 	}
 
 	/* Callback may have changed this */
-        if (__setkey_check(__cmd, config.alg, config.key))
+	err = __setkey_check(config.alg, config.key);
+	if (err != NULL) {
+		jwt_write_error(jwt, "%s", err);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 		return 1;
+	}
 
 	jwt->key = config.key;
+	jwt->ops = __cmd->c.ops;
 	jwt->checker = __cmd;
 
-	/* Finish it up */
-	jwt = jwt_verify_complete(jwt, &config, token, payload_len);
+	/* Finish it up. Anything that fails past the checks is the
+	 * signature. */
+	jwt_verify_complete(jwt, &config, buf, payload_len);
+	if (jwt->error)
+		jwt_write_fail(jwt, JWT_METRIC_ERR_SIG);
+
+	return jwt->error;
+}
+
+static int __verify(jwt_common_t *__cmd, const char *token, size_t len,
+		    jwt_t *jwt)
+{
+	uint64_t start = jwt_metrics_start(__cmd->c.metrics);
+	const jwk_set_t *keys = NULL;
+	struct jwt_trace tr;
+	unsigned int epoch = 0;
+
+	JWT_PROBE1(verify__entry, len);
+
+	if (jwt_trace_open(&tr, &__cmd->c, 0))
+		jwt->trace = &tr;
+
+	if (__cmd->ring)
+		keys = jwks_ring_read_lock(__cmd->ring, &epoch);
+
+	__verify_one(__cmd, token, len, jwt, keys);
+
+	if (jwt->trace) {
+		jwt_trace_close(&tr, &__cmd->c, jwt, len);
+		jwt->trace = NULL;
+	}
+
+	JWT_PROBE4(verify__return, jwt->alg, JWT_PROBE_KID(jwt), len,
+		   jwt->error);
+
+	if (__cmd->c.metrics != NULL) {
+		if (jwt->error)
+			jwt_write_fail(jwt, JWT_METRIC_ERR_OTHER);
+
+		/* Only the kids of our own keys get counted. The one in the
+		 * header is whatever the sender wanted it to be. */
+		jwt_metrics_record(__cmd->c.metrics, jwt->alg,
+				   JWT_PROBE_KID(jwt), jwt->fail, start);
+	}
+
+	/* The key may have come from the set, and goes with it */
+	if (__cmd->ring) {
+		jwt->key = NULL;
+		jwt->keys = NULL;
+		jwks_ring_read_unlock(__cmd->ring, epoch);
+	}
+
+	return jwt->error;
+}
+
+int FUNC(verify)(jwt_common_t *__cmd, const char *token)
+{
+	jwt_auto_t *jwt = NULL;
+
+	if (__cmd == NULL)
+		return 1;
+
+	jwt = jwt_new();
+	if (jwt == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(__cmd, "Could not allocate JWT object");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	__verify(__cmd, token, token ? strlen(token) : 0, jwt);
 
 	/* Copy any errors back */
 	jwt_copy_error(__cmd, jwt);
 
 	return __cmd->error;
 }
+
+#ifdef JWT_CHECKER
+int FUNC(verify_scopes)(jwt_common_t *__cmd, const char *token,
+			unsigned long long *scopes)
+{
+	jwt_auto_t *jwt = NULL;
+
+	if (scopes)
+		*scopes = 0;
+
+	if (__cmd == NULL)
+		return 1;
+
+	if (scopes == NULL) {
+		jwt_write_error(__cmd, "Need somewhere to put the scopes");
+		return 1;
+	}
+
+	jwt = jwt_new();
+	if (jwt == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(__cmd, "Could not allocate JWT object");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (__verify(__cmd, token, token ? strlen(token) : 0, jwt) == 0)
+		*scopes = jwt->scopes;
+
+	jwt_copy_error(__cmd, jwt);
+
+	return __cmd->error;
+}
+
+int FUNC(verify_extract)(jwt_common_t *__cmd, const char *token,
+			 jwt_verified_t **out)
+{
+	jwt_auto_t *jwt = NULL;
+
+	if (out)
+		*out = NULL;
+
+	if (__cmd == NULL)
+		return 1;
+
+	if (out == NULL) {
+		jwt_write_error(__cmd, "Need somewhere to put the token");
+		return 1;
+	}
+
+	jwt = jwt_new();
+	if (jwt == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(__cmd, "Could not allocate JWT object");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	if (__verify(__cmd, token, token ? strlen(token) : 0, jwt)) {
+		jwt_copy_error(__cmd, jwt);
+		return __cmd->error;
+	}
+
+	/* The parse we just did is all the caller needs */
+	*out = jwt_verified_take(jwt);
+	if (*out == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(__cmd, "Could not allocate verified token");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+#endif
+
+struct __batch {
+	jwt_common_t *cmd;
+	const char **tokens;
+	const size_t *lens;
+	int *results;
+	int failed;
+	int err_taken;
+
+	/* The first error, in the same form as the checker's */
+	int error;
+	jwt_error_t errcode;
+	jwt_claims_t claims_failed;
+	char error_msg[JWT_ERR_LEN];
+};
+
+static void __batch_one(void *ctx, size_t idx)
+{
+	struct __batch *b = ctx;
+	const char *token = b->tokens[idx];
+	jwt_auto_t *jwt = NULL;
+	size_t len;
+
+	jwt = jwt_new();
+	if (jwt == NULL) {
+		// LCOV_EXCL_START
+		b->results[idx] = 1;
+		__atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED);
+		return;
+		// LCOV_EXCL_STOP
+	}
+
+	if (b->lens)
+		len = b->lens[idx];
+	else
+		len = token ? strlen(token) : 0;
+
+	b->results[idx] = __verify(b->cmd, token, len, jwt);
+	if (!b->results[idx])
+		return;
+
+	__atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED);
+
+	/* Only the first one gets to report */
+	if (!__atomic_exchange_n(&b->err_taken, 1, __ATOMIC_ACQ_REL))
+		jwt_copy_error(b, jwt);
+}
+
+int FUNC(verify_batch)(jwt_common_t *__cmd, const char *tokens[],
+		       const size_t lens[], size_t n, int results[])
+{
+	struct __batch b;
+	size_t *order = NULL;
+	unsigned int threads;
+
+	if (__cmd == NULL)
+		return -1;
+
+	if (tokens == NULL || results == NULL) {
+		jwt_write_error(__cmd, "Must pass token and result arrays");
+		return -1;
+	}
+
+	memset(&b, 0, sizeof(b));
+	b.cmd = __cmd;
+	b.tokens = tokens;
+	b.lens = lens;
+	b.results = results;
+
+	/* A callback is the user's code, so we don't assume it can be run
+	 * on more than one thread. */
+	threads = __cmd->c.cb ? 1 : jwt_pool_threads(n);
+
+	/* With a key ring, tokens can each have their own key. Those with
+	 * the same header have the same key, so keep them together, and each
+	 * thread mostly works with just one or two keys. */
+	if (threads > 1 && __cmd->ring != NULL && __cmd->c.key == NULL)
+		order = jwt_pool_group(tokens, lens, n);
+
+	jwt_pool_run(threads, n, order, __batch_one, &b);
+	jwt_freemem(order);
+
+	/* Clears it when nothing failed */
+	jwt_copy_error(__cmd, &b);
+	if (b.failed)
+		__cmd->error = 1;
+
+	return b.failed;
+}
 #endif
 
 #ifdef JWT_BUILDER
-char *FUNC(generate)(jwt_common_t *__cmd)
+/* Compile the template, if it's in use and we don't have one yet */
+static int __tmpl_ready(jwt_common_t *__cmd)
+{
+	if (!__cmd->tmpl_enabled || __cmd->c.cb != NULL || __cmd->tmpl)
+		return 0;
+
+	__cmd->tmpl = jwt_template_compile(__cmd);
+
+	return __cmd->tmpl == NULL ? 1 : 0;
+}
+
+/* Make one token. Errors are left in jwt, which the caller allocated and
+ * zeroed. Apart from the callback, nothing here changes the builder, so
+ * it is safe to call from more than one thread at a time. */
+static char *__generate_one(jwt_common_t *__cmd, time_t tm, json_t *extra,
+			    jwt_t *jwt)
 {
 	JWT_CONFIG_DECLARE(config);
-	jwt_auto_t *jwt = NULL;
-	char *out = NULL;
+	char jti[JWT_JTI_MAX];
 	jwt_value_t jval;
-	time_t tm = time(NULL);
 
-	if (__cmd == NULL)
-		return NULL;
+	jwt->ops = __cmd->c.ops;
 
-	jwt = jwt_malloc(sizeof(*jwt));
-	if (jwt == NULL)
-		return NULL; // LCOV_EXCL_LINE
+	if ((__cmd->c.claims & JWT_CLAIM_JTI) && jwt_jti_make(__cmd, jti, jwt))
+		return NULL;
 
-	memset(jwt, 0, sizeof(*jwt));
+	/* Fast path, unless a callback needs to see each token */
+	if (__cmd->tmpl && extra == NULL && __cmd->c.cb == NULL)
+		return jwt_template_generate(__cmd->tmpl, tm, jti, jwt);
 
 	jwt->headers = json_deep_copy(__cmd->c.headers);
 	jwt->claims = json_deep_copy(__cmd->c.payload);
+	if (jwt->headers == NULL || jwt->claims == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "Error allocating memory");
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	if (extra && json_object_update(jwt->claims, extra)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "Error adding claims");
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
 
 	/* Our internal work first */
 	if (__cmd->c.claims & JWT_CLAIM_IAT) {
@@ -452,6 +1050,12 @@ char *FUNC(generate)(jwt_common_t *__cmd)
 		jwt_claim_set(jwt, &jval);
 	}
 
+	if (__cmd->c.claims & JWT_CLAIM_JTI) {
+		jwt_set_SET_STR(&jval, "jti", jti);
+		jval.replace = 1;
+		jwt_claim_set(jwt, &jval);
+	}
+
 	/* Alg and key checks */
 	config.alg = __cmd->c.alg;
 	if (config.alg == JWT_ALG_NONE && __cmd->c.key)
@@ -460,14 +1064,22 @@ char *FUNC(generate)(jwt_common_t *__cmd)
 	config.ctx = __cmd->c.cb_ctx;
 
 	/* Let the callback do it's thing */
-	if (__cmd->c.cb && __cmd->c.cb(jwt, &config)) {
-		jwt_write_error(__cmd, "User callback returned error");
-		return NULL;
+	if (__cmd->c.cb) {
+		uint64_t start = jwt_trace_begin(jwt);
+		int ret = __cmd->c.cb(jwt, &config);
+
+		jwt_trace_end(jwt, JWT_TRACE_CALLBACK, start, 0);
+		if (ret) {
+			jwt_write_errcode(jwt, JWT_ERR_CALLBACK);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_CALLBACK);
+			return NULL;
+		}
 	}
 
 	/* Callback may have changed this */
-	if (__setkey_check(__cmd, config.alg, config.key)) {
-		jwt_write_error(__cmd, "Algorithm and key returned by callback invalid");
+	if (__setkey_check(config.alg, config.key) != NULL) {
+		jwt_write_error(jwt, "Algorithm and key returned by callback invalid");
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 		return NULL;
 	}
 
@@ -477,9 +1089,178 @@ char *FUNC(generate)(jwt_common_t *__cmd)
 	if (jwt_head_setup(jwt))
 		return NULL; // LCOV_EXCL_LINE
 
-	out = jwt_encode_str(jwt);
+	return jwt_encode_str(jwt);
+}
+
+static char *__generate(jwt_common_t *__cmd, time_t tm, json_t *extra,
+			jwt_t *jwt)
+{
+	uint64_t start = jwt_metrics_start(__cmd->c.metrics);
+	struct jwt_trace tr;
+	char *out;
+
+	JWT_PROBE1(generate__entry, __cmd->c.alg);
+
+	if (jwt_trace_open(&tr, &__cmd->c, 1))
+		jwt->trace = &tr;
+
+	out = __generate_one(__cmd, tm, extra, jwt);
+
+	if (jwt->trace) {
+		jwt_trace_close(&tr, &__cmd->c, jwt, out ? strlen(out) : 0);
+		jwt->trace = NULL;
+	}
+
+	JWT_PROBE4(generate__return, jwt->alg, JWT_PROBE_KID(jwt),
+		   out ? strlen(out) : 0, out == NULL);
+
+	if (__cmd->c.metrics == NULL)
+		return out;
+
+	/* Past the alg and key checks, it's the signing that failed */
+	if (out == NULL)
+		jwt_write_fail(jwt, JWT_METRIC_ERR_SIG);
+
+	jwt_metrics_record(__cmd->c.metrics, jwt->alg ? jwt->alg : __cmd->c.alg,
+			   jwt->key ? jwt->key->kid : NULL, jwt->fail, start);
+
+	return out;
+}
+
+char *FUNC(generate)(jwt_common_t *__cmd)
+{
+	jwt_auto_t *jwt = NULL;
+	char *out;
+
+	if (__cmd == NULL)
+		return NULL;
+
+	if (__tmpl_ready(__cmd))
+		return NULL; // LCOV_EXCL_LINE
+
+	jwt = jwt_malloc(sizeof(*jwt));
+	if (jwt == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(jwt, 0, sizeof(*jwt));
+
+	out = __generate(__cmd, time(NULL), NULL, jwt);
 	jwt_copy_error(__cmd, jwt);
 
 	return out;
 }
+
+struct __batch {
+	jwt_common_t *cmd;
+	time_t tm;
+	json_t **extra;
+	char **out;
+	int failed;
+	int err_taken;
+
+	/* The first error, in the same form as the builder's */
+	int error;
+	jwt_error_t errcode;
+	jwt_claims_t claims_failed;
+	char error_msg[JWT_ERR_LEN];
+};
+
+static void __batch_one(void *ctx, size_t idx)
+{
+	struct __batch *b = ctx;
+	jwt_auto_t *jwt = NULL;
+
+	jwt = jwt_malloc(sizeof(*jwt));
+	if (jwt == NULL) {
+		__atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED); // LCOV_EXCL_LINE
+		return; // LCOV_EXCL_LINE
+	}
+
+	memset(jwt, 0, sizeof(*jwt));
+
+	b->out[idx] = __generate(b->cmd, b->tm, b->extra ? b->extra[idx] : NULL,
+				 jwt);
+	if (b->out[idx] != NULL)
+		return;
+
+	__atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED);
+
+	/* Only the first one gets to report */
+	if (!__atomic_exchange_n(&b->err_taken, 1, __ATOMIC_ACQ_REL))
+		jwt_copy_error(b, jwt);
+}
+
+int FUNC(generate_batch)(jwt_common_t *__cmd, const char *claims_override[],
+			 size_t n, char *out[])
+{
+	struct __batch b;
+	unsigned int threads;
+	size_t i;
+
+	if (__cmd == NULL)
+		return -1;
+
+	if (out == NULL) {
+		jwt_write_error(__cmd, "Must pass an output array");
+		return -1;
+	}
+
+	memset(out, 0, n * sizeof(*out));
+	memset(&b, 0, sizeof(b));
+	b.cmd = __cmd;
+	b.out = out;
+	b.tm = time(NULL);
+
+	/* Parse all of the extra claims first, so nothing is signed if any
+	 * of them are bad. */
+	if (claims_override != NULL && n) {
+		b.extra = jwt_malloc(n * sizeof(*b.extra));
+		if (b.extra == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(__cmd, "Error allocating memory");
+			return -1;
+			// LCOV_EXCL_STOP
+		}
+		memset(b.extra, 0, n * sizeof(*b.extra));
+
+		for (i = 0; i < n; i++) {
+			if (claims_override[i] == NULL)
+				continue;
+
+			b.extra[i] = jwt_json_loadb(claims_override[i],
+						    strlen(claims_override[i]),
+						    JSON_REJECT_DUPLICATES);
+			if (!json_is_object(b.extra[i])) {
+				jwt_write_error(__cmd,
+					"Claims override %zu is not a JSON object",
+					i);
+				b.failed = -1;
+				goto batch_done;
+			}
+		}
+	}
+
+	if (__tmpl_ready(__cmd)) {
+		b.failed = -1; // LCOV_EXCL_LINE
+		goto batch_done; // LCOV_EXCL_LINE
+	}
+
+	/* A callback is the user's code, so we don't assume it can be run
+	 * on more than one thread. */
+	threads = __cmd->c.cb || __cmd->jti_cb ? 1 : jwt_pool_threads(n);
+
+	jwt_pool_run(threads, n, NULL, __batch_one, &b);
+
+	if (b.failed) {
+		jwt_copy_error(__cmd, &b);
+		__cmd->error = 1;
+	}
+
+batch_done:
+	for (i = 0; b.extra && i < n; i++)
+		json_decref(b.extra[i]);
+	jwt_freemem(b.extra);
+
+	return b.failed;
+}
 #endif
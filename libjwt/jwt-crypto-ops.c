@@ -39,20 +39,86 @@ struct jwt_crypto_ops *jwt_ops = &jwt_mbedtls_ops;
 #error No crypto ops providers are enabled
 #endif
 
+/* Per algorithm overrides of jwt_ops. Entries are only ever swapped
+ * whole, so an operation that already looked up its ops keeps using them
+ * even if these change under it. */
+static struct jwt_crypto_ops *jwt_ops_alg[JWT_ALG_INVAL];
+
+/* Set by JWT_CRYPTO_AUTOTUNE. Tuning makes keys and times them, which is
+ * too much to do while the library is being loaded, and would fix the
+ * OpenSSL library context before the application has had a chance to
+ * set its own. So it waits until the global ops are first looked up for
+ * a token. Choosing ops for yourself before then means it never runs. */
+static int tune_pending;
+
+static void __tune_cancel(void)
+{
+	__atomic_store_n(&tune_pending, 0, __ATOMIC_RELAXED);
+}
+
+static void __tune_run(void)
+{
+	/* Only one thread gets to run it. Tuning always gives its ops, so it
+	 * never comes back here. */
+	if (__atomic_load_n(&tune_pending, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&tune_pending, 0, __ATOMIC_ACQ_REL))
+		jwt_ops_autotune(); // LCOV_EXCL_LINE
+}
+
+struct jwt_crypto_ops *jwt_ops_get(const jwt_t *jwt)
+{
+	struct jwt_crypto_ops *ops = jwt->ops;
+
+	if (ops == NULL)
+		__tune_run();
+
+	if (ops == NULL && jwt->alg < JWT_ALG_INVAL)
+		ops = __atomic_load_n(&jwt_ops_alg[jwt->alg], __ATOMIC_ACQUIRE);
+
+	if (ops == NULL)
+		ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
+
+	return ops;
+}
+
+struct jwt_crypto_ops *jwt_ops_find(const char *opname)
+{
+	int i;
+
+	for (i = 0; jwt_ops_available[i] != NULL; i++) {
+		if (!jwt_strcmp(jwt_ops_available[i]->name, opname))
+			return jwt_ops_available[i];
+	}
+
+	return NULL;
+}
+
+static void __ops_alg_reset(void)
+{
+	int i;
+
+	for (i = 0; i < JWT_ALG_INVAL; i++)
+		__atomic_store_n(&jwt_ops_alg[i], NULL, __ATOMIC_RELEASE);
+}
+
 const char *jwt_get_crypto_ops(void)
 {
-	if (jwt_ops == NULL)
+	struct jwt_crypto_ops *ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
+
+	if (ops == NULL)
 		return "(unknown)"; // LCOV_EXCL_LINE
 
-	return jwt_ops->name;
+	return ops->name;
 }
 
 jwt_crypto_provider_t jwt_get_crypto_ops_t(void)
 {
-	if (jwt_ops == NULL)
+	struct jwt_crypto_ops *ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
+
+	if (ops == NULL)
 		return JWT_CRYPTO_OPS_NONE; // LCOV_EXCL_LINE
 
-	return jwt_ops->provider;
+	return ops->provider;
 }
 
 int jwt_set_crypto_ops_t(jwt_crypto_provider_t opname)
@@ -64,7 +130,10 @@ int jwt_set_crypto_ops_t(jwt_crypto_provider_t opname)
 		if (jwt_ops_available[i]->provider != opname)
 			continue;
 
-		jwt_ops = jwt_ops_available[i];
+		__tune_cancel();
+		__atomic_store_n(&jwt_ops, jwt_ops_available[i],
+				 __ATOMIC_RELEASE);
+		__ops_alg_reset();
 		return 0;
 	}
 
@@ -73,40 +142,81 @@ int jwt_set_crypto_ops_t(jwt_crypto_provider_t opname)
 
 int jwt_set_crypto_ops(const char *opname)
 {
-	int i;
+	struct jwt_crypto_ops *ops = jwt_ops_find(opname);
 
 	/* The user asked for something, let's give it a try */
-	for (i = 0; jwt_ops_available[i] != NULL; i++) {
-		if (jwt_strcmp(jwt_ops_available[i]->name, opname))
-			continue;
+	if (ops == NULL)
+		return 1;
 
-		jwt_ops = jwt_ops_available[i];
-		return 0;
+	__tune_cancel();
+	__atomic_store_n(&jwt_ops, ops, __ATOMIC_RELEASE);
+	__ops_alg_reset();
+
+	return 0;
+}
+
+int jwt_set_crypto_ops_alg(jwt_alg_t alg, const char *opname)
+{
+	struct jwt_crypto_ops *ops = NULL;
+
+	if (alg <= JWT_ALG_NONE || alg >= JWT_ALG_INVAL)
+		return 1;
+
+	if (opname != NULL) {
+		ops = jwt_ops_find(opname);
+		if (ops == NULL)
+			return 1;
 	}
 
-	return 1;
+	__tune_cancel();
+	__atomic_store_n(&jwt_ops_alg[alg], ops, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+const char *jwt_get_crypto_ops_alg(jwt_alg_t alg)
+{
+	jwt_t jwt = { .alg = alg };
+
+	if (alg >= JWT_ALG_INVAL)
+		return NULL;
+
+	return jwt_ops_get(&jwt)->name;
+}
+
+int jwt_crypto_ops_autotune(void)
+{
+	__tune_cancel();
+
+	return jwt_ops_autotune();
 }
 
 int jwt_crypto_ops_supports_jwk(void)
 {
-	return jwt_ops->jwk_implemented ? 1 : 0;
+	struct jwt_crypto_ops *ops = __atomic_load_n(&jwt_ops, __ATOMIC_ACQUIRE);
+
+	return ops->jwk_implemented ? 1 : 0;
 }
 
 JWT_CONSTRUCTOR
 void jwt_init()
 {
 	const char *opname = getenv("JWT_CRYPTO");
+	const char *tune = getenv("JWT_CRYPTO_AUTOTUNE");
 
 	/* By default, we choose the top spot */
 	if (opname == NULL || opname[0] == '\0') {
-		jwt_ops = jwt_ops_available[0];
-		return;
-	}
-
-	/* Attempt to set ops */
-	if (jwt_set_crypto_ops(opname)) {
-		jwt_ops = jwt_ops_available[0];
+		__atomic_store_n(&jwt_ops, jwt_ops_available[0],
+				 __ATOMIC_RELEASE);
+	} else if (jwt_set_crypto_ops(opname)) {
+		/* Attempt to set ops */
+		__atomic_store_n(&jwt_ops, jwt_ops_available[0],
+				 __ATOMIC_RELEASE);
 		fprintf(stderr, "LibJWT: No such crypto ops [%s], falling back to [%s]\n",
-			opname, jwt_ops->name);
+			opname, jwt_ops_available[0]->name);
 	}
+
+	/* Pick the fastest ops for each alg, once they are first needed */
+	if (tune != NULL && tune[0] != '\0' && strcmp(tune, "0"))
+		tune_pending = 1; // LCOV_EXCL_LINE
 }
@@ -0,0 +1,162 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <string.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* JWA wants ECDSA signatures as the raw R and S values, each padded out to
+ * the size of the curve. The crypto libraries want (or give us) the DER
+ * encoding of:
+ *
+ *	Ecdsa-Sig-Value ::= SEQUENCE { r INTEGER, s INTEGER }
+ *
+ * Both are simple enough that we convert between them here, on the
+ * caller's buffers, with no bignums and no allocations. */
+
+#define ASN1_INTEGER	0x02
+#define ASN1_SEQUENCE	0x30
+
+unsigned int jwt_ecdsa_size(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return 32;
+	case JWT_ALG_ES384:
+		return 48;
+	case JWT_ALG_ES512:
+		return 66;
+	default:
+		return 0;
+	}
+}
+
+/* Read a DER length. We only ever need the short form and the one byte
+ * long form. */
+static int __der_len(const unsigned char **p, const unsigned char *end,
+		     size_t *len)
+{
+	if (*p >= end)
+		return 1;
+
+	if (**p < 0x80) {
+		*len = *(*p)++;
+		return 0;
+	}
+
+	if (**p != 0x81 || *p + 1 >= end)
+		return 1;
+
+	/* The long form is only allowed for lengths that need it */
+	*len = (*p)[1];
+	*p += 2;
+
+	return *len < 0x80 ? 1 : 0;
+}
+
+/* Read one INTEGER and put it right aligned in n bytes of out */
+static int __der_int(const unsigned char **p, const unsigned char *end,
+		     unsigned char *out, unsigned int n)
+{
+	const unsigned char *val;
+	size_t len;
+
+	if (*p >= end || *(*p)++ != ASN1_INTEGER)
+		return 1;
+
+	if (__der_len(p, end, &len) || !len || len > (size_t)(end - *p))
+		return 1;
+
+	val = *p;
+	*p += len;
+
+	/* Negative values are not valid here */
+	if (val[0] & 0x80)
+		return 1;
+
+	/* Leading zero is only allowed in front of a high bit */
+	if (len > 1 && val[0] == 0 && !(val[1] & 0x80))
+		return 1;
+
+	for (; len && *val == 0; len--, val++)
+		;
+
+	if (len > n)
+		return 1;
+
+	memset(out, 0, n - len);
+	memcpy(out + (n - len), val, len);
+
+	return 0;
+}
+
+int jwt_ecdsa_der_to_raw(const unsigned char *der, size_t der_len,
+			 unsigned char *raw, unsigned int n)
+{
+	const unsigned char *p = der, *end = der + der_len;
+	size_t len;
+
+	if (!n || der_len < 2 || *p++ != ASN1_SEQUENCE)
+		return 1;
+
+	if (__der_len(&p, end, &len) || len != (size_t)(end - p))
+		return 1;
+
+	if (__der_int(&p, end, raw, n) || __der_int(&p, end, raw + n, n))
+		return 1;
+
+	/* Nothing is allowed after s */
+	return p == end ? 0 : 1;
+}
+
+/* Write one INTEGER from n big endian bytes, returning its length */
+static size_t __der_put_int(unsigned char *der, const unsigned char *val,
+			    unsigned int n)
+{
+	size_t pos = 0;
+	int pad;
+
+	/* Minimal encoding, but always at least one byte */
+	for (; n > 1 && *val == 0; n--, val++)
+		;
+
+	pad = (val[0] & 0x80) ? 1 : 0;
+
+	der[pos++] = ASN1_INTEGER;
+	der[pos++] = (unsigned char)(n + pad);
+	if (pad)
+		der[pos++] = 0;
+	memcpy(der + pos, val, n);
+
+	return pos + n;
+}
+
+size_t jwt_ecdsa_raw_to_der(const unsigned char *raw, size_t raw_len,
+			    unsigned char *der)
+{
+	unsigned char body[JWT_ECDSA_DER_MAX];
+	size_t len, pos = 0;
+	unsigned int n = raw_len / 2;
+
+	if (!n || raw_len % 2 || raw_len > JWT_ECDSA_RAW_MAX)
+		return 0;
+
+	len = __der_put_int(body, raw, n);
+	len += __der_put_int(body + len, raw + n, n);
+
+	der[pos++] = ASN1_SEQUENCE;
+	if (len >= 0x80)
+		der[pos++] = 0x81;
+	der[pos++] = (unsigned char)len;
+	memcpy(der + pos, body, len);
+
+	return pos + len;
+}
@@ -18,7 +18,7 @@
 
 static int write_js(const json_t *js, char **buf)
 {
-	*buf = json_dumps(js, JSON_SORT_KEYS | JSON_COMPACT);
+	*buf = jwt_json_dumps(js, JSON_SORT_KEYS | JSON_COMPACT);
 
 	return *buf == NULL ? 1 : 0;
 }
@@ -63,6 +63,9 @@ static int jwt_encode(jwt_t *jwt, char **out)
 	char *buf = NULL;
 	int ret, head_len, payload_len;
 	unsigned int sig_len;
+	jwt_digest_t d;
+	uint64_t start;
+	size_t len;
 
 	if (out == NULL) {
 		// LCOV_EXCL_START
@@ -73,12 +76,18 @@ static int jwt_encode(jwt_t *jwt, char **out)
 	*out = NULL;
 
 	/* First the header. */
+	start = jwt_trace_begin(jwt);
 	ret = write_js(jwt->headers, &buf);
 	if (ret)
 		return 1; // LCOV_EXCL_LINE
+	len = strlen(buf);
+	jwt_trace_end(jwt, JWT_TRACE_JSON, start, len);
+
 	/* Encode it */
-	head_len = jwt_base64uri_encode(&head, buf, (int)strlen(buf));
+	start = jwt_trace_begin(jwt);
+	head_len = jwt_base64uri_encode(&head, buf, (int)len);
 	jwt_freemem(buf);
+	jwt_trace_end(jwt, JWT_TRACE_BASE64, start, len);
 
 	if (head_len <= 0) {
 		// LCOV_EXCL_START
@@ -88,6 +97,7 @@ static int jwt_encode(jwt_t *jwt, char **out)
 	}
 
 	/* Now the payload. */
+	start = jwt_trace_begin(jwt);
 	ret = write_js(jwt->claims, &buf);
 	if (ret) {
 		// LCOV_EXCL_START
@@ -95,9 +105,13 @@ static int jwt_encode(jwt_t *jwt, char **out)
 		return 1;
 		// LCOV_EXCL_STOP
 	}
+	len = strlen(buf);
+	jwt_trace_end(jwt, JWT_TRACE_JSON, start, len);
 
-	payload_len = jwt_base64uri_encode(&payload, buf, (int)strlen(buf));
+	start = jwt_trace_begin(jwt);
+	payload_len = jwt_base64uri_encode(&payload, buf, (int)len);
 	jwt_freemem(buf);
+	jwt_trace_end(jwt, JWT_TRACE_BASE64, start, len);
 
 	if (payload_len <= 0) {
 		// LCOV_EXCL_START
@@ -106,66 +120,49 @@ static int jwt_encode(jwt_t *jwt, char **out)
 		// LCOV_EXCL_STOP
 	}
 
-	/* The part we need to sign, but add space for 2 dots and a nil */
-	buf = jwt_malloc(head_len + payload_len + 3);
-	if (buf == NULL) {
-		// LCOV_EXCL_START
-		jwt_write_error(jwt, "Error allocating memory");
-		return 1;
-		// LCOV_EXCL_STOP
-	}
-
-	strcpy(buf, head);
-	strcat(buf, ".");
-	strcat(buf, payload);
-
 	if (jwt->alg == JWT_ALG_NONE) {
-		/* Add the trailing dot, and send it back */
-		strcat(buf, ".");
-		*out = buf;
+		/* Just the two parts, with the trailing dot, and a nil */
+		*out = jwt_malloc(head_len + payload_len + 3);
+		if (*out == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "Error allocating memory");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+
+		sprintf(*out, "%s.%s.", head, payload);
 		return 0;
 	}
 
-	/* At this point buf has "head.payload" */
-
-	/* Now the signature. */
-	ret = jwt_sign(jwt, &sig, &sig_len, buf, strlen(buf));
-	jwt_freemem(buf);
-	if (ret) {
-		// LCOV_EXCL_START
-		jwt_write_error(jwt, "Error allocating memory");
-		return ret;
-		// LCOV_EXCL_STOP
+	/* Now the signature. The signing input is "head.payload", but we
+	 * feed it in pieces so we never have to put it together. */
+	start = jwt_trace_begin(jwt);
+	if (jwt_digest_init(&d, jwt, 0) ||
+	    jwt_digest_update(&d, head, head_len) ||
+	    jwt_digest_update(&d, ".", 1) ||
+	    jwt_digest_update(&d, payload, payload_len) ||
+	    jwt_digest_sign(&d, &sig, &sig_len)) {
+		jwt_digest_free(&d);
+		return 1;
 	}
+	jwt_digest_free(&d);
+	jwt_trace_end(jwt, JWT_TRACE_SIG, start, head_len + payload_len + 1);
 
-	ret = jwt_base64uri_encode(&buf, sig, sig_len);
-	/* At this point buf has b64 of sig and ret is size of it */
-
-	if (ret < 0) {
+	/* We're good, so let's get it all together, with 2 dots and the
+	 * signature encoded in place. */
+	*out = jwt_malloc(head_len + payload_len +
+			  BASE64_ENCODE_OUT_SIZE(sig_len) + 3);
+	if (*out == NULL) {
 		// LCOV_EXCL_START
 		jwt_write_error(jwt, "Error allocating memory");
 		return 1;
 		// LCOV_EXCL_STOP
 	}
 
-	/* plus 2 dots and a nil */
-	ret = strlen(head) + strlen(payload) + strlen(buf) + 3;
+	ret = sprintf(*out, "%s.%s.", head, payload);
+	jwt_base64uri_encode_buf(*out + ret, sig, sig_len);
 
-	/* We're good, so let's get it all together */
-	*out = jwt_malloc(ret);
-	// LCOV_EXCL_START
-	if (*out == NULL) {
-		jwt_write_error(jwt, "Error allocating memory");
-		ret = 1;
-	} else {
-		sprintf(*out, "%s.%s.%s", head, payload, buf);
-		ret = 0;
-	}
-	// LCOV_EXCL_STOP
-
-	jwt_freemem(buf);
-
-	return ret;
+	return 0;
 }
 
 char *jwt_encode_str(jwt_t *jwt)
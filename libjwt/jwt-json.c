@@ -0,0 +1,1004 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <locale.h>
+#include <pthread.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+#include <jwt.h>
+
+#include "base64.h"
+
+#include "jwt-private.h"
+
+/* Everything that turns text into JSON, or JSON into text, goes through
+ * here. Values are always jansson's json_t, so the rest of LibJWT doesn't
+ * care which backend did the parsing.
+ *
+ * The built in parser is for what tokens look like: small, mostly flat
+ * objects with short keys and short strings. It reads straight from the
+ * buffer, with none of jansson's stream and per token buffers. The only
+ * allocation of its own is one scratch arena per document, for keys and
+ * unescaped strings, and that is on the stack for most tokens. Building
+ * with WITH_JANSSON_PARSER uses json_loadb() instead.
+ *
+ * Either one can also read base64url text, decoding it a chunk at a time
+ * as it parses, so there is never a decoded copy of the whole thing.
+ *
+ * The scanning half of the parser is always built, since jwt_peek() uses
+ * it whichever backend does the rest. */
+
+/* Starting arena, on the stack */
+#define JSON_ARENA_MIN	1024
+
+/* Streamed text is decoded this much at a time, also on the stack */
+#define JSON_CHUNK	512
+
+/* Same as jansson */
+#ifdef JSON_PARSER_MAX_DEPTH
+#define JSON_MAX_DEPTH	JSON_PARSER_MAX_DEPTH
+#else
+#define JSON_MAX_DEPTH	2048
+#endif
+
+/* Longest integer that can be in range, with its sign. Reals can be any
+ * length, so the text of a number goes in the arena. */
+#define JSON_INT_MAX	20
+
+/* The text either is all in pos to end, or comes a chunk at a time from
+ * fill, which returns 0 at the end. Keys and strings are unescaped into
+ * the arena, which only holds what is still needed: the keys of the
+ * objects we are in, and the string being read. Everything in it is
+ * addressed by offset, since it moves when it grows. */
+struct json_parser {
+	const char *pos;
+	const char *end;
+	size_t (*fill)(void *ctx, char *buf, size_t size);
+	void *ctx;
+	char *chunk;
+	char *arena;
+	size_t used;
+	size_t size;
+	int heap;		/* Arena is ours to free		*/
+	int fixed;		/* Arena can't grow			*/
+	int full;		/* Something didn't fit in a fixed one	*/
+	size_t flags;
+	unsigned int depth;
+};
+
+static int __refill(struct json_parser *p)
+{
+	size_t n;
+
+	if (p->fill == NULL)
+		return 0;
+
+	n = p->fill(p->ctx, p->chunk, JSON_CHUNK);
+	p->pos = p->chunk;
+	p->end = p->chunk + n;
+
+	return n > 0;
+}
+
+/* Next char without taking it, or -1 at the end */
+static inline int __peek(struct json_parser *p)
+{
+	if (p->pos == p->end && !__refill(p))
+		return -1;
+
+	return (unsigned char)*p->pos;
+}
+
+static inline int __next(struct json_parser *p)
+{
+	int c = __peek(p);
+
+	if (c >= 0)
+		p->pos++;
+
+	return c;
+}
+
+static int __skip_ws(struct json_parser *p)
+{
+	int c;
+
+	while ((c = __peek(p)) == ' ' || c == '\t' || c == '\n' || c == '\r')
+		p->pos++;
+
+	return c;
+}
+
+static int __arena_add(struct json_parser *p, const char *buf, size_t len)
+{
+	/* A fixed arena drops what doesn't fit, and says so, but the text
+	 * is still read, so the caller can carry on past it. */
+	if (p->fixed && (p->full || p->used + len > p->size)) {
+		p->full = 1;
+		return 0;
+	}
+
+	if (p->used + len > p->size) {
+		size_t size = p->size * 2;
+		char *arena;
+
+		while (size < p->used + len)
+			size *= 2;
+
+		arena = jwt_malloc(size);
+		if (arena == NULL)
+			return 1; // LCOV_EXCL_LINE
+
+		memcpy(arena, p->arena, p->used);
+		if (p->heap)
+			jwt_freemem(p->arena);
+		p->arena = arena;
+		p->size = size;
+		p->heap = 1;
+	}
+
+	memcpy(p->arena + p->used, buf, len);
+	p->used += len;
+
+	return 0;
+}
+
+static int __hex4(struct json_parser *p, unsigned int *out)
+{
+	unsigned int v = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		int c = __next(p);
+
+		v <<= 4;
+		if (c >= '0' && c <= '9')
+			v |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			v |= c - 'A' + 10;
+		else
+			return 1;
+	}
+
+	*out = v;
+
+	return 0;
+}
+
+static size_t __utf8_put(char *out, unsigned int cp)
+{
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		out[0] = 0xc0 | (cp >> 6);
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	} else if (cp < 0x10000) {
+		out[0] = 0xe0 | (cp >> 12);
+		out[1] = 0x80 | ((cp >> 6) & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+
+	out[0] = 0xf0 | (cp >> 18);
+	out[1] = 0x80 | ((cp >> 12) & 0x3f);
+	out[2] = 0x80 | ((cp >> 6) & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+static int __parse_escape(struct json_parser *p)
+{
+	unsigned int cp, lo;
+	char out[4];
+	size_t len = 1;
+
+	switch (__next(p)) {
+	case '"':  out[0] = '"'; break;
+	case '\\': out[0] = '\\'; break;
+	case '/':  out[0] = '/'; break;
+	case 'b':  out[0] = '\b'; break;
+	case 'f':  out[0] = '\f'; break;
+	case 'n':  out[0] = '\n'; break;
+	case 'r':  out[0] = '\r'; break;
+	case 't':  out[0] = '\t'; break;
+	case 'u':
+		if (__hex4(p, &cp))
+			return 1;
+
+		/* Surrogates have to come in pairs */
+		if (cp >= 0xdc00 && cp <= 0xdfff)
+			return 1;
+		if (cp >= 0xd800 && cp <= 0xdbff) {
+			if (__next(p) != '\\' || __next(p) != 'u' ||
+			    __hex4(p, &lo) || lo < 0xdc00 || lo > 0xdfff)
+				return 1;
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+		}
+
+		/* No nils, same as jansson without JSON_ALLOW_NUL */
+		if (cp == 0)
+			return 1;
+
+		len = __utf8_put(out, cp);
+		break;
+	default:
+		return 1;
+	}
+
+	return __arena_add(p, out, len);
+}
+
+/* Raw text is checked for UTF-8 a byte at a time, since a character can
+ * be split across chunks. The rules are jansson's: no overlong forms, no
+ * surrogates, and nothing past U+10FFFF. need is how many continuation
+ * bytes are still to come, and lo and hi bound the next one. */
+struct json_utf8 {
+	unsigned int need;
+	int lo;
+	int hi;
+};
+
+static int __utf8_next(struct json_utf8 *u, int c)
+{
+	if (u->need) {
+		if (c < u->lo || c > u->hi)
+			return 1;
+		u->need--;
+		u->lo = 0x80;
+		u->hi = 0xbf;
+		return 0;
+	}
+
+	u->lo = 0x80;
+	u->hi = 0xbf;
+
+	if (c < 0x80) {
+		return 0;
+	} else if (c >= 0xc2 && c <= 0xdf) {
+		u->need = 1;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		u->need = 2;
+		if (c == 0xe0)
+			u->lo = 0xa0;
+		else if (c == 0xed)
+			u->hi = 0x9f;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		u->need = 3;
+		if (c == 0xf0)
+			u->lo = 0x90;
+		else if (c == 0xf4)
+			u->hi = 0x8f;
+	} else {
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Reads a string into the arena, nil terminated, and gives its offset.
+ * Plain runs are copied straight from the text. Escapes always make
+ * good UTF-8, so only the raw bytes need checking, which keeps strings
+ * that are never kept, such as skipped ones and any too long for a fixed
+ * arena, to the same rules as the rest. */
+static int __parse_str(struct json_parser *p, size_t *off, size_t *len)
+{
+	struct json_utf8 u = { 0, 0x80, 0xbf };
+
+	*off = p->used;
+
+	/* Skip the opening quote */
+	p->pos++;
+
+	for (;;) {
+		const char *run = p->pos;
+		int c;
+
+		while (p->pos < p->end) {
+			c = (unsigned char)*p->pos;
+			if (c == '"' || c == '\\' || c < 0x20)
+				break;
+			if ((c >= 0x80 || u.need) && __utf8_next(&u, c))
+				return 1;
+			p->pos++;
+		}
+
+		if (p->pos > run && __arena_add(p, run, p->pos - run))
+			return 1; // LCOV_EXCL_LINE
+
+		/* Ran out of text, not out of string */
+		if (p->pos == p->end) {
+			if (__peek(p) < 0)
+				return 1;
+			continue;
+		}
+
+		/* Not in the middle of a character */
+		if (u.need)
+			return 1;
+
+		c = __next(p);
+		if (c == '"')
+			break;
+
+		/* Control chars have to be escaped, and it has to end */
+		if (c != '\\' || __parse_escape(p))
+			return 1;
+	}
+
+	*len = p->used - *off;
+
+	return __arena_add(p, "", 1);
+}
+
+/* Take the next char of a number into the arena, and into head while
+ * it could still be an integer in range. */
+static int __num_put(struct json_parser *p, char *head, size_t *len)
+{
+	char c = __next(p);
+
+	if (*len < JSON_INT_MAX)
+		head[*len] = c;
+	(*len)++;
+
+	return __arena_add(p, &c, 1);
+}
+
+/* One or more digits */
+static int __digits(struct json_parser *p, char *head, size_t *len)
+{
+	int c, any = 0;
+
+	while ((c = __peek(p)) >= '0' && c <= '9') {
+		if (__num_put(p, head, len))
+			return 1;
+		any = 1;
+	}
+
+	return !any;
+}
+
+/* Reads a number into the arena, nil terminated, checking the grammar so
+ * strtoll() and strtod() don't have to. The first JSON_INT_MAX chars also
+ * go in head, nil terminated, which is all an integer can need even when
+ * a fixed arena is full. */
+static int __scan_num(struct json_parser *p, char *head, size_t *len,
+		      int *real)
+{
+	int c;
+
+	*len = 0;
+	*real = 0;
+
+	if (__peek(p) == '-' && __num_put(p, head, len))
+		return 1; // LCOV_EXCL_LINE
+
+	c = __peek(p);
+	if (c == '0') {
+		if (__num_put(p, head, len))
+			return 1; // LCOV_EXCL_LINE
+	} else if (c < '1' || c > '9' || __digits(p, head, len)) {
+		return 1;
+	}
+
+	if (__peek(p) == '.') {
+		*real = 1;
+		if (__num_put(p, head, len) || __digits(p, head, len))
+			return 1;
+	}
+
+	c = __peek(p);
+	if (c == 'e' || c == 'E') {
+		*real = 1;
+		if (__num_put(p, head, len))
+			return 1; // LCOV_EXCL_LINE
+		c = __peek(p);
+		if ((c == '+' || c == '-') && __num_put(p, head, len))
+			return 1; // LCOV_EXCL_LINE
+		if (__digits(p, head, len))
+			return 1;
+	}
+
+	head[*len < JSON_INT_MAX ? *len : JSON_INT_MAX] = '\0';
+
+	return __arena_add(p, "", 1);
+}
+
+/* Too big is an error, as it is for jansson */
+static int __scan_int(const char *head, size_t len, json_int_t *v)
+{
+	if (len > JSON_INT_MAX)
+		return 1;
+
+	errno = 0;
+	*v = strtoll(head, NULL, 10);
+
+	return errno == ERANGE;
+}
+
+/* JSON always uses '.', whatever the locale of the thread calling us, so
+ * convert in the C locale. */
+static locale_t c_locale;
+static pthread_once_t c_locale_once = PTHREAD_ONCE_INIT;
+
+static void __c_locale_init(void)
+{
+	c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+}
+
+static int __scan_real(const char *num, double *v)
+{
+	pthread_once(&c_locale_once, __c_locale_init);
+	if (c_locale == (locale_t)0)
+		return 1; // LCOV_EXCL_LINE
+
+	errno = 0;
+	*v = strtod_l(num, NULL, c_locale);
+
+	return errno == ERANGE && (*v == HUGE_VAL || *v == -HUGE_VAL);
+}
+
+static int __literal(struct json_parser *p, const char *lit)
+{
+	for (; *lit; lit++) {
+		if (__next(p) != *lit)
+			return 1;
+	}
+
+	return 0;
+}
+
+static size_t __b64_fill(void *ctx, char *buf, size_t size)
+{
+	return base64uri_stream_read(ctx, buf, size);
+}
+
+#ifndef JWT_JSON_JANSSON
+
+static json_t *__parse_value(struct json_parser *p);
+
+static json_t *__parse_num(struct json_parser *p)
+{
+	char head[JSON_INT_MAX + 1];
+	size_t mark = p->used;
+	size_t len;
+	int real, ret;
+
+	if (__scan_num(p, head, &len, &real))
+		return NULL;
+
+	if (!real) {
+		json_int_t v;
+
+		ret = __scan_int(head, len, &v);
+		p->used = mark;
+
+		return ret ? NULL : json_integer(v);
+	} else {
+		double v;
+
+		ret = __scan_real(p->arena + mark, &v);
+		p->used = mark;
+
+		return ret ? NULL : json_real(v);
+	}
+}
+
+static json_t *__parse_object(struct json_parser *p)
+{
+	json_t *obj = json_object();
+	size_t mark = p->used;
+	int c;
+
+	if (obj == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	/* Skip the brace */
+	p->pos++;
+
+	if (__skip_ws(p) == '}') {
+		p->pos++;
+		return obj;
+	}
+
+	for (;;) {
+		size_t off, len;
+		json_t *val;
+
+		if (__skip_ws(p) != '"' || __parse_str(p, &off, &len))
+			break;
+
+		if ((p->flags & JSON_REJECT_DUPLICATES) &&
+		    json_object_get(obj, p->arena + off))
+			break;
+
+		if (__skip_ws(p) != ':')
+			break;
+		p->pos++;
+
+		val = __parse_value(p);
+		if (val == NULL)
+			break;
+
+		/* This checks that the key is UTF-8. The arena may have moved
+		 * while parsing the value, so the key is found again. */
+		if (json_object_set_new(obj, p->arena + off, val))
+			break;
+
+		/* Done with the key */
+		p->used = mark;
+
+		c = __skip_ws(p);
+		if (c == '}') {
+			p->pos++;
+			return obj;
+		}
+
+		if (c != ',')
+			break;
+		p->pos++;
+	}
+
+	json_decref(obj);
+
+	return NULL;
+}
+
+static json_t *__parse_array(struct json_parser *p)
+{
+	json_t *arr = json_array();
+	int c;
+
+	if (arr == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	/* Skip the bracket */
+	p->pos++;
+
+	if (__skip_ws(p) == ']') {
+		p->pos++;
+		return arr;
+	}
+
+	for (;;) {
+		json_t *val = __parse_value(p);
+
+		if (val == NULL || json_array_append_new(arr, val))
+			break;
+
+		c = __skip_ws(p);
+		if (c == ']') {
+			p->pos++;
+			return arr;
+		}
+
+		if (c != ',')
+			break;
+		p->pos++;
+	}
+
+	json_decref(arr);
+
+	return NULL;
+}
+
+static json_t *__parse_value(struct json_parser *p)
+{
+	size_t off, len;
+	json_t *val;
+
+	switch (__skip_ws(p)) {
+	case '{':
+	case '[':
+		if (++p->depth > JSON_MAX_DEPTH)
+			return NULL;
+		if (*p->pos == '{')
+			val = __parse_object(p);
+		else
+			val = __parse_array(p);
+		p->depth--;
+		return val;
+
+	case '"':
+		if (__parse_str(p, &off, &len))
+			return NULL;
+
+		/* This checks that it is UTF-8 */
+		val = json_stringn(p->arena + off, len);
+		p->used = off;
+		return val;
+
+	case 't':
+		return __literal(p, "true") ? NULL : json_true();
+	case 'f':
+		return __literal(p, "false") ? NULL : json_false();
+	case 'n':
+		return __literal(p, "null") ? NULL : json_null();
+	case -1:
+		return NULL;
+	}
+
+	return __parse_num(p);
+}
+
+static json_t *__parse(struct json_parser *p)
+{
+	char arena[JSON_ARENA_MIN];
+	json_t *js = NULL;
+	int c;
+
+	p->arena = arena;
+	p->size = sizeof(arena);
+
+	/* Same as jansson without JSON_DECODE_ANY */
+	c = __skip_ws(p);
+	if (c == '{' || c == '[')
+		js = __parse_value(p);
+
+	if (js != NULL && __skip_ws(p) != -1)
+		json_decrefp(&js);
+
+	if (p->heap)
+		jwt_freemem(p->arena);
+
+	return js;
+}
+
+json_t *jwt_json_loadb(const char *buf, size_t len, size_t flags)
+{
+	struct json_parser p = {
+		.pos	= buf,
+		.end	= buf + len,
+		.flags	= flags,
+	};
+
+	if (buf == NULL)
+		return NULL;
+
+	return __parse(&p);
+}
+
+json_t *jwt_json_load_b64(const char *src, size_t len, size_t flags)
+{
+	char chunk[JSON_CHUNK];
+	base64uri_stream_t s;
+	struct json_parser p = {
+		.fill	= __b64_fill,
+		.ctx	= &s,
+		.chunk	= chunk,
+		.flags	= flags,
+	};
+	json_t *js;
+
+	if (base64uri_stream_init(&s, src, len))
+		return NULL;
+
+	js = __parse(&p);
+
+	/* Bad base64 looks like the end of the text to the parser */
+	if (s.error)
+		json_decrefp(&js);
+
+	return js;
+}
+
+#else
+
+json_t *jwt_json_loadb(const char *buf, size_t len, size_t flags)
+{
+	if (buf == NULL)
+		return NULL;
+
+	return json_loadb(buf, len, flags, NULL);
+}
+
+static size_t __b64_callback(void *buf, size_t size, void *ctx)
+{
+	base64uri_stream_t *s = ctx;
+	size_t n = base64uri_stream_read(s, buf, size);
+
+	return s->error ? (size_t)-1 : n;
+}
+
+json_t *jwt_json_load_b64(const char *src, size_t len, size_t flags)
+{
+	base64uri_stream_t s;
+
+	if (base64uri_stream_init(&s, src, len))
+		return NULL;
+
+	return json_load_callback(__b64_callback, &s, flags, NULL);
+}
+
+#endif /* JWT_JSON_JANSSON */
+
+/* The rest is for jwt_peek(), which reads the same way the parser does,
+ * but keeps nothing but the values asked for. The arena is the buffer in
+ * the jwt_peek_t, and is fixed, so nothing is allocated. */
+
+/* Reads a value. Strings, numbers and literals are put in the arena, nil
+ * terminated, and 1 is returned. Arrays and objects are skipped, with 0
+ * returned. Anything that isn't JSON is -1. */
+static int __peek_value(struct json_parser *p, size_t *off, size_t *len);
+
+static void __peek_drop(struct json_parser *p, size_t mark)
+{
+	p->used = mark;
+	p->full = 0;
+}
+
+static int __skip_value(struct json_parser *p)
+{
+	size_t mark = p->used, off, len;
+	int ret = __peek_value(p, &off, &len);
+
+	__peek_drop(p, mark);
+
+	return ret < 0;
+}
+
+static int __skip_container(struct json_parser *p, int close)
+{
+	int c;
+
+	if (++p->depth > JSON_MAX_DEPTH)
+		return 1;
+
+	/* Skip the brace or bracket */
+	p->pos++;
+
+	c = __skip_ws(p);
+	while (c != close) {
+		if (close == '}') {
+			if (c != '"' || __skip_value(p) || __skip_ws(p) != ':')
+				return 1;
+			p->pos++;
+		}
+
+		if (__skip_value(p))
+			return 1;
+
+		c = __skip_ws(p);
+		if (c == ',') {
+			p->pos++;
+			c = __skip_ws(p);
+			if (c == close)
+				return 1;
+		} else if (c != close) {
+			return 1;
+		}
+	}
+
+	p->pos++;
+	p->depth--;
+
+	return 0;
+}
+
+static int __peek_value(struct json_parser *p, size_t *off, size_t *len)
+{
+	char head[JSON_INT_MAX + 1];
+	json_int_t i;
+	double d;
+	const char *lit;
+	int real;
+
+	switch (__skip_ws(p)) {
+	case '{':
+		return __skip_container(p, '}') ? -1 : 0;
+	case '[':
+		return __skip_container(p, ']') ? -1 : 0;
+	case '"':
+		return __parse_str(p, off, len) ? -1 : 1;
+	case 't':
+		lit = "true";
+		break;
+	case 'f':
+		lit = "false";
+		break;
+	case 'n':
+		lit = "null";
+		break;
+	case -1:
+		return -1;
+	default:
+		*off = p->used;
+		if (__scan_num(p, head, len, &real))
+			return -1;
+
+		/* Too big is an error, as it is for the parser. A real that
+		 * didn't fit can't be checked, but it isn't kept either. */
+		if (!real ? __scan_int(head, *len, &i) :
+		    !p->full && __scan_real(p->arena + *off, &d))
+			return -1;
+
+		return 1;
+	}
+
+	if (__literal(p, lit))
+		return -1;
+
+	*off = p->used;
+	*len = strlen(lit);
+	__arena_add(p, lit, *len + 1);
+
+	return 1;
+}
+
+static jwt_peek_field_t *__peek_want(struct json_parser *p,
+				     jwt_peek_where_t where, size_t off,
+				     size_t len, jwt_peek_field_t *fields,
+				     unsigned int count)
+{
+	unsigned int i;
+
+	/* Too long to have been kept, so not one we want */
+	if (p->full)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		if (fields[i].where == where &&
+		    !strncmp(fields[i].name, p->arena + off, len + 1))
+			return &fields[i];
+	}
+
+	return NULL;
+}
+
+/* The whole of a header or payload, which has to be an object */
+static int __peek_object(struct json_parser *p, jwt_peek_where_t where,
+			 jwt_peek_field_t *fields, unsigned int count)
+{
+	int c;
+
+	if (__skip_ws(p) != '{')
+		return 1;
+	p->pos++;
+
+	/* Same depth as the parser, where this object counts */
+	p->depth = 1;
+
+	c = __skip_ws(p);
+	while (c != '}') {
+		jwt_peek_field_t *want;
+		size_t mark = p->used, off, len;
+		int ret;
+
+		if (c != '"' || __parse_str(p, &off, &len))
+			return 1;
+
+		want = __peek_want(p, where, off, len, fields, count);
+
+		/* Done with the key */
+		__peek_drop(p, mark);
+
+		if (__skip_ws(p) != ':')
+			return 1;
+		p->pos++;
+
+		ret = __peek_value(p, &off, &len);
+		if (ret < 0)
+			return 1;
+
+		/* The last one wins, same as the parser */
+		if (want != NULL) {
+			want->value = NULL;
+			want->len = 0;
+
+			if (ret && !p->full) {
+				want->value = p->arena + off;
+				want->len = len;
+			}
+		}
+
+		if (want == NULL || want->value == NULL)
+			__peek_drop(p, mark);
+
+		c = __skip_ws(p);
+		if (c == ',') {
+			p->pos++;
+			c = __skip_ws(p);
+			if (c == '}')
+				return 1;
+		} else if (c != '}') {
+			return 1;
+		}
+	}
+
+	p->pos++;
+
+	/* Nothing after it */
+	return __skip_ws(p) != -1;
+}
+
+static int __peek_part(struct json_parser *p, base64uri_stream_t *s,
+		       const char *src, size_t len, jwt_peek_where_t where,
+		       jwt_peek_field_t *fields, unsigned int count)
+{
+	p->pos = p->end = NULL;
+
+	if (base64uri_stream_init(s, src, len))
+		return 1;
+
+	/* Bad base64 looks like the end of the text */
+	return __peek_object(p, where, fields, count) || s->error;
+}
+
+int jwt_peek(const char *token, size_t len, jwt_peek_t *peek,
+	     jwt_peek_field_t *fields, unsigned int count)
+{
+	char chunk[JSON_CHUNK];
+	base64uri_stream_t s;
+	struct json_parser p = {
+		.fill	= __b64_fill,
+		.ctx	= &s,
+		.chunk	= chunk,
+		.fixed	= 1,
+	};
+	const char *dot1, *dot2;
+	unsigned int i;
+
+	if (token == NULL || peek == NULL || (fields == NULL && count))
+		return 1;
+
+	for (i = 0; i < count; i++) {
+		if (fields[i].name == NULL)
+			return 1;
+		fields[i].value = NULL;
+		fields[i].len = 0;
+	}
+
+	/* Split it up the same way jwt_parse() does */
+	if (memchr(token, '\0', len) != NULL)
+		return 1;
+
+	dot1 = memchr(token, '.', len);
+	if (dot1 == NULL)
+		return 1;
+
+	dot2 = memchr(dot1 + 1, '.', len - (dot1 + 1 - token));
+	if (dot2 == NULL)
+		return 1;
+
+	peek->header_len = dot1 - token;
+	peek->payload_off = dot1 + 1 - token;
+	peek->payload_len = dot2 - dot1 - 1;
+	peek->sig_off = dot2 + 1 - token;
+	peek->sig_len = len - peek->sig_off;
+
+	p.arena = peek->buf;
+	p.size = sizeof(peek->buf);
+
+	if (!__peek_part(&p, &s, token, peek->header_len,
+			 JWT_PEEK_HEADER, fields, count) &&
+	    !__peek_part(&p, &s, token + peek->payload_off,
+			 peek->payload_len, JWT_PEEK_CLAIM, fields, count))
+		return 0;
+
+	/* Don't leave half an answer */
+	for (i = 0; i < count; i++) {
+		fields[i].value = NULL;
+		fields[i].len = 0;
+	}
+
+	return 1;
+}
+
+char *jwt_json_dumps(const json_t *js, size_t flags)
+{
+	return json_dumps(js, flags);
+}
@@ -7,8 +7,11 @@
    file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <jwt.h>
 
@@ -17,12 +20,274 @@
 static jwt_malloc_t pfn_malloc;
 static jwt_free_t pfn_free;
 
+__thread jwt_alloc_sys_t jwt_alloc_cur;
+
+/* Allocation statistics. Frees don't come with a size, so while these
+ * are on we keep the size of everything that's allocated in open
+ * addressed tables, keyed on the pointer. The pointer also picks which
+ * of the tables, each with its own lock, so threads only wait on each
+ * other when they land on the same one at the same time.
+ *
+ * The counts are kept the same way as the checker metrics. Each thread
+ * sticks to one shard and only does relaxed atomic adds to it, and they
+ * are added up when asked for. Something freed by another thread than
+ * the one that allocated it comes off of that thread's live, so a shard
+ * can go below zero, but the sum can't. Each shard keeps its own peak,
+ * so with more than one thread, the peak given back is the sum of them,
+ * which is never less than the real one. */
+struct __alloc_ent {
+	void *ptr;
+	size_t size;
+	jwt_alloc_sys_t sys;
+};
+
+#define STATS_STRIPE_BITS	6
+#define STATS_STRIPES		(1 << STATS_STRIPE_BITS)
+#define STATS_SHARDS		8
+
+struct __alloc_stripe {
+	pthread_mutex_t lock;
+	struct __alloc_ent *tbl;
+	size_t size;
+	size_t used;
+} __attribute__((aligned(64)));
+
+struct __alloc_count {
+	unsigned long count;
+	unsigned long frees;
+	size_t bytes;
+	long long live;
+	long long peak;
+};
+
+struct __alloc_shard {
+	struct __alloc_count sys[JWT_ALLOC_ALL + 1];
+} __attribute__((aligned(64)));
+
+static int stats_on;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct __alloc_stripe stripes[STATS_STRIPES];
+static struct __alloc_shard shards[STATS_SHARDS];
+static pthread_once_t stripes_once = PTHREAD_ONCE_INIT;
+
+static __thread unsigned int shard_id;
+static unsigned int shard_next;
+
+static void __stripes_init(void)
+{
+	int i;
+
+	for (i = 0; i < STATS_STRIPES; i++)
+		pthread_mutex_init(&stripes[i].lock, NULL);
+}
+
+static uint64_t __alloc_mix(const void *ptr)
+{
+	return ((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+/* The top bits pick the table, and the bottom ones the slot in it */
+static struct __alloc_stripe *__alloc_stripe(const void *ptr)
+{
+	return &stripes[__alloc_mix(ptr) >> (64 - STATS_STRIPE_BITS)];
+}
+
+static size_t __alloc_hash(const void *ptr, size_t size)
+{
+	return __alloc_mix(ptr) & (size - 1);
+}
+
+/* Tables are only ever used while their stripe is locked, and never
+ * with jwt_malloc, since that would come right back here. */
+static int __alloc_grow(struct __alloc_stripe *st)
+{
+	struct __alloc_ent *tbl, *old = st->tbl;
+	size_t i, size = st->size ? st->size * 2 : 64;
+
+	tbl = calloc(size, sizeof(*tbl));
+	if (tbl == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	for (i = 0; i < st->size; i++) {
+		size_t h;
+
+		if (old[i].ptr == NULL)
+			continue;
+
+		for (h = __alloc_hash(old[i].ptr, size); tbl[h].ptr;
+		     h = (h + 1) & (size - 1))
+			;
+		tbl[h] = old[i];
+	}
+
+	free(old);
+	st->tbl = tbl;
+	st->size = size;
+
+	return 0;
+}
+
+/* Count one allocation, or one free, against this thread's shard, for
+ * both the part of the library and the totals. */
+static void __alloc_count(jwt_alloc_sys_t sys, size_t size, int freed)
+{
+	struct __alloc_count *c;
+	int i;
+
+	if (!shard_id)
+		shard_id = (__atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED) %
+			    STATS_SHARDS) + 1;
+
+	for (i = 0; i < 2; i++) {
+		long long live;
+
+		c = &shards[shard_id - 1].sys[i ? JWT_ALLOC_ALL : sys];
+
+		if (freed) {
+			__atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&c->live, (long long)size,
+					   __ATOMIC_RELAXED);
+			continue;
+		}
+
+		__atomic_add_fetch(&c->count, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&c->bytes, size, __ATOMIC_RELAXED);
+
+		/* Only this thread ever raises its own live */
+		live = __atomic_add_fetch(&c->live, (long long)size,
+					  __ATOMIC_RELAXED);
+		if (live > __atomic_load_n(&c->peak, __ATOMIC_RELAXED))
+			__atomic_store_n(&c->peak, live, __ATOMIC_RELAXED);
+	}
+}
+
+static void __alloc_add(void *ptr, size_t size)
+{
+	struct __alloc_stripe *st = __alloc_stripe(ptr);
+	jwt_alloc_sys_t sys = jwt_alloc_cur;
+	size_t h;
+
+	pthread_mutex_lock(&st->lock);
+
+	if (!stats_on) {
+		// LCOV_EXCL_START
+		pthread_mutex_unlock(&st->lock);
+		return;
+		// LCOV_EXCL_STOP
+	}
+
+	/* Keep it no more than half full. If it can't grow, this one is
+	 * counted but not tracked, so its free won't be seen either. */
+	if ((st->used + 1) * 2 > st->size && __alloc_grow(st)) {
+		size = 0; // LCOV_EXCL_LINE
+	} else {
+		for (h = __alloc_hash(ptr, st->size); st->tbl[h].ptr;
+		     h = (h + 1) & (st->size - 1))
+			;
+		st->tbl[h].ptr = ptr;
+		st->tbl[h].size = size;
+		st->tbl[h].sys = sys;
+		st->used++;
+	}
+
+	pthread_mutex_unlock(&st->lock);
+
+	__alloc_count(sys, size, 0);
+}
+
+static void __alloc_del(void *ptr)
+{
+	struct __alloc_stripe *st = __alloc_stripe(ptr);
+	jwt_alloc_sys_t sys;
+	size_t h, i, j, mask, size;
+
+	pthread_mutex_lock(&st->lock);
+
+	if (!st->used) {
+		pthread_mutex_unlock(&st->lock);
+		return;
+	}
+
+	mask = st->size - 1;
+	for (h = __alloc_hash(ptr, st->size); st->tbl[h].ptr != ptr;
+	     h = (h + 1) & mask) {
+		/* Allocated before we were counting */
+		if (st->tbl[h].ptr == NULL) {
+			pthread_mutex_unlock(&st->lock);
+			return;
+		}
+	}
+
+	sys = st->tbl[h].sys;
+	size = st->tbl[h].size;
+	st->used--;
+
+	/* Shift back anything that probed past this slot, so lookups never
+	 * need tombstones. */
+	for (i = h, j = (h + 1) & mask; st->tbl[j].ptr; j = (j + 1) & mask) {
+		size_t k = __alloc_hash(st->tbl[j].ptr, st->size);
+
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			st->tbl[i] = st->tbl[j];
+			i = j;
+		}
+	}
+	st->tbl[i].ptr = NULL;
+
+	pthread_mutex_unlock(&st->lock);
+
+	__alloc_count(sys, size, 1);
+}
+
 void *jwt_malloc(size_t size)
 {
+	void *ptr;
+
 	if (pfn_malloc)
-		return pfn_malloc(size);
+		ptr = pfn_malloc(size);
+	else
+		ptr = malloc(size);
+
+	if (ptr && __atomic_load_n(&stats_on, __ATOMIC_RELAXED))
+		__alloc_add(ptr, size);
+
+	return ptr;
+}
+
+/* What we give to Jansson while statistics are on, so its allocations
+ * are counted as its own. This only ever replaces jwt_malloc, when
+ * jwt_set_alloc() has Jansson going through us. If the application set
+ * Jansson's allocators itself, they are left alone. */
+static void *__json_malloc(size_t size)
+{
+	JWT_ALLOC_SCOPE(JWT_ALLOC_JSON);
+
+	return jwt_malloc(size);
+}
+
+static int json_wrapped;
+
+/* Called with stats_lock held */
+static void __json_wrap(int enable)
+{
+	json_malloc_t m;
+	json_free_t f;
 
-	return malloc(size);
+	json_get_alloc_funcs(&m, &f);
+
+	if (enable && !json_wrapped) {
+		if (m != jwt_malloc || f != __jwt_freemem)
+			return;
+
+		json_set_alloc_funcs(__json_malloc, __jwt_freemem);
+		json_wrapped = 1;
+	} else if (!enable && json_wrapped) {
+		/* Put back what jwt_set_alloc() gave it, unless someone has
+		 * replaced us since. */
+		if (m == __json_malloc && f == __jwt_freemem)
+			json_set_alloc_funcs(jwt_malloc, __jwt_freemem);
+		json_wrapped = 0;
+	}
 }
 
 int jwt_set_alloc(jwt_malloc_t pmalloc, jwt_free_t pfree)
@@ -32,7 +297,12 @@ int jwt_set_alloc(jwt_malloc_t pmalloc, jwt_free_t pfree)
 	pfn_free = pfree;
 
 	/* Set same allocator functions for Jansson. */
+	pthread_mutex_lock(&stats_lock);
+	json_wrapped = 0;
 	json_set_alloc_funcs(jwt_malloc, __jwt_freemem);
+	if (stats_on)
+		__json_wrap(1);
+	pthread_mutex_unlock(&stats_lock);
 
 	return 0;
 }
@@ -49,12 +319,106 @@ void jwt_get_alloc(jwt_malloc_t *pmalloc, jwt_free_t *pfree)
 /* Should call the macros instead */
 void __jwt_freemem(void *ptr)
 {
+	if (ptr && __atomic_load_n(&stats_on, __ATOMIC_RELAXED))
+		__alloc_del(ptr);
+
 	if (pfn_free)
 		pfn_free(ptr);
 	else
 		free(ptr);
 }
 
+int jwt_alloc_stats_enable(int enable)
+{
+	int i;
+
+	pthread_once(&stripes_once, __stripes_init);
+
+	pthread_mutex_lock(&stats_lock);
+
+	if (enable && !stats_on) {
+		memset(shards, 0, sizeof(shards));
+		__json_wrap(1);
+	} else if (!enable && stats_on) {
+		__json_wrap(0);
+	}
+
+	__atomic_store_n(&stats_on, enable ? 1 : 0, __ATOMIC_RELAXED);
+
+	/* Anything still adding has the stripe locked, and sees it's off */
+	for (i = 0; !enable && i < STATS_STRIPES; i++) {
+		pthread_mutex_lock(&stripes[i].lock);
+		free(stripes[i].tbl);
+		stripes[i].tbl = NULL;
+		stripes[i].size = stripes[i].used = 0;
+		pthread_mutex_unlock(&stripes[i].lock);
+	}
+
+	pthread_mutex_unlock(&stats_lock);
+
+	return 0;
+}
+
+/* Add up the shards for one part of the library */
+static void __alloc_sum(jwt_alloc_sys_t sys, jwt_alloc_stats_t *st)
+{
+	long long live = 0, peak = 0;
+	int i;
+
+	for (i = 0; i < STATS_SHARDS; i++) {
+		const struct __alloc_count *c = &shards[i].sys[sys];
+
+		st->count += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+		st->frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+		st->bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+		live += __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+		peak += __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+	}
+
+	if (live < 0)
+		live = 0; // LCOV_EXCL_LINE
+	if (peak < live)
+		peak = live; // LCOV_EXCL_LINE
+
+	st->live = live;
+	st->peak = peak;
+}
+
+int jwt_alloc_stats_get(jwt_alloc_sys_t sys, jwt_alloc_stats_t *st)
+{
+	if (st == NULL || sys < JWT_ALLOC_OTHER || sys > JWT_ALLOC_ALL)
+		return EINVAL;
+
+	memset(st, 0, sizeof(*st));
+
+	if (!__atomic_load_n(&stats_on, __ATOMIC_RELAXED))
+		return 0;
+
+	__alloc_sum(sys, st);
+
+	return 0;
+}
+
+void jwt_alloc_stats_reset(void)
+{
+	int i, j;
+
+	for (i = 0; i < STATS_SHARDS; i++) {
+		for (j = 0; j <= JWT_ALLOC_ALL; j++) {
+			struct __alloc_count *c = &shards[i].sys[j];
+			long long live;
+
+			__atomic_store_n(&c->count, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->frees, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+
+			live = __atomic_load_n(&c->live, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->peak, live > 0 ? live : 0,
+					 __ATOMIC_RELAXED);
+		}
+	}
+}
+
 /* A time-safe strcmp function */
 int jwt_strcmp(const char *str1, const char *str2)
 {
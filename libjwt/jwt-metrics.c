@@ -0,0 +1,591 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* Checker and builder metrics. Each thread sticks to one shard, and only
+ * ever does relaxed atomic adds to it, so threads don't share cache lines
+ * unless there are more of them than shards. Histograms are allocated
+ * the first time their alg is seen. */
+
+#define METRICS_SHARDS	8
+#define METRICS_KIDS	32
+
+/* Log-linear buckets: exact below 16ns, then 8 for each power of two,
+ * up to 2^36ns (about 68 seconds). Anything longer goes in the last. */
+#define HIST_SUB_BITS	3
+#define HIST_LINEAR	16
+#define HIST_MAX_EXP	36
+#define HIST_BUCKETS	(HIST_LINEAR + \
+			 ((HIST_MAX_EXP - 3) << HIST_SUB_BITS))
+
+struct __metrics_data {
+	unsigned long count[JWT_ALG_INVAL][JWT_METRIC_COUNT];
+	unsigned long long sum[JWT_ALG_INVAL];
+	unsigned long *hist[JWT_ALG_INVAL];
+	unsigned long kid[METRICS_KIDS + 1][2];
+} __attribute__((aligned(64)));
+
+struct jwt_metrics_live {
+	int builder;
+	char *kids[METRICS_KIDS];
+	struct __metrics_data shard[METRICS_SHARDS];
+};
+
+struct jwt_metrics {
+	int builder;
+	char *kids[METRICS_KIDS];
+	struct __metrics_data d;
+};
+
+static const char *metric_names[JWT_METRIC_COUNT] = {
+	"ok", "parse", "callback", "alg", "key", "exp", "nbf", "iss", "sub",
+	"aud", "sig", "other",
+};
+
+static __thread unsigned int shard_id;
+static unsigned int shard_next;
+
+static unsigned int __hist_bucket(uint64_t ns)
+{
+	int e;
+
+	if (ns < HIST_LINEAR)
+		return ns;
+
+	e = 63 - __builtin_clzll(ns);
+	if (e > HIST_MAX_EXP)
+		return HIST_BUCKETS - 1;
+
+	return HIST_LINEAR + ((e - 4) << HIST_SUB_BITS) +
+		((ns >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/* Lowest value in a bucket, and how wide it is */
+static uint64_t __hist_low(unsigned int b, uint64_t *width)
+{
+	unsigned int e, sub;
+
+	if (b < HIST_LINEAR) {
+		*width = 1;
+		return b;
+	}
+
+	b -= HIST_LINEAR;
+	e = 4 + (b >> HIST_SUB_BITS);
+	sub = b & ((1 << HIST_SUB_BITS) - 1);
+	*width = 1ULL << (e - HIST_SUB_BITS);
+
+	return (uint64_t)((1 << HIST_SUB_BITS) + sub) << (e - HIST_SUB_BITS);
+}
+
+static void __data_free(struct __metrics_data *d)
+{
+	int i;
+
+	for (i = 0; i < JWT_ALG_INVAL; i++)
+		jwt_freemem(d->hist[i]);
+}
+
+static unsigned long *__hist_new(void)
+{
+	unsigned long *hist = jwt_malloc(HIST_BUCKETS * sizeof(*hist));
+
+	if (hist != NULL)
+		memset(hist, 0, HIST_BUCKETS * sizeof(*hist));
+
+	return hist;
+}
+
+static char *__strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *dup = jwt_malloc(len);
+
+	if (dup != NULL)
+		memcpy(dup, str, len);
+
+	return dup;
+}
+
+struct jwt_metrics_live *jwt_metrics_new(int builder)
+{
+	struct jwt_metrics_live *m = jwt_malloc(sizeof(*m));
+
+	if (m == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(m, 0, sizeof(*m));
+	m->builder = builder;
+
+	return m;
+}
+
+void jwt_metrics_live_free(struct jwt_metrics_live *m)
+{
+	int i;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < METRICS_SHARDS; i++)
+		__data_free(&m->shard[i]);
+
+	for (i = 0; i < METRICS_KIDS; i++)
+		jwt_freemem(m->kids[i]);
+
+	jwt_freemem(m);
+}
+
+uint64_t jwt_metrics_start(const struct jwt_metrics_live *m)
+{
+	return m ? jwt_now_ns() : 0;
+}
+
+/* Kids are claimed the first time they are seen, and never change after
+ * that, so looking one up takes no lock. Only kids of keys we were given
+ * get here, never ones from a token, so they don't run out unless keys
+ * are rotated more than METRICS_KIDS times. Turning metrics off and on
+ * again frees them all. */
+static int __kid_slot(char **kids, const char *kid)
+{
+	int i;
+
+	for (i = 0; i < METRICS_KIDS; i++) {
+		char *cur = __atomic_load_n(&kids[i], __ATOMIC_ACQUIRE);
+
+		if (cur == NULL) {
+			char *dup = __strdup(kid);
+
+			if (dup == NULL)
+				return METRICS_KIDS; // LCOV_EXCL_LINE
+
+			if (__atomic_compare_exchange_n(&kids[i], &cur, dup, 0,
+							__ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE))
+				return i;
+
+			/* Someone beat us to it, see if it was for us */
+			jwt_freemem(dup); // LCOV_EXCL_LINE
+		}
+
+		if (!strcmp(cur, kid))
+			return i;
+	}
+
+	return METRICS_KIDS;
+}
+
+void jwt_metrics_record(struct jwt_metrics_live *m, jwt_alg_t alg,
+			const char *kid, jwt_metric_t result, uint64_t start)
+{
+	struct __metrics_data *d;
+	unsigned long *hist;
+	uint64_t ns;
+
+	if (m == NULL)
+		return;
+
+	ns = jwt_metrics_start(m) - start;
+
+	if (!shard_id)
+		shard_id = (__atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED) %
+			    METRICS_SHARDS) + 1;
+	d = &m->shard[shard_id - 1];
+
+	if (alg < JWT_ALG_NONE || alg >= JWT_ALG_INVAL)
+		alg = JWT_ALG_NONE; // LCOV_EXCL_LINE
+
+	__atomic_fetch_add(&d->count[alg][result], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&d->sum[alg], ns, __ATOMIC_RELAXED);
+
+	hist = __atomic_load_n(&d->hist[alg], __ATOMIC_ACQUIRE);
+	if (hist == NULL) {
+		unsigned long *cur = NULL;
+
+		hist = __hist_new();
+		if (hist != NULL &&
+		    !__atomic_compare_exchange_n(&d->hist[alg], &cur, hist, 0,
+						 __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE)) {
+			// LCOV_EXCL_START
+			jwt_freemem(hist);
+			hist = cur;
+			// LCOV_EXCL_STOP
+		}
+	}
+	if (hist != NULL)
+		__atomic_fetch_add(&hist[__hist_bucket(ns)], 1,
+				   __ATOMIC_RELAXED);
+
+	/* No key, or one without a kid, counts with the overflow */
+	__atomic_fetch_add(&d->kid[kid ? __kid_slot(m->kids, kid) :
+				   METRICS_KIDS][result != JWT_METRIC_OK], 1,
+			   __ATOMIC_RELAXED);
+}
+
+/* Add src into dst. Kid slots in src are given in src_kids, and are
+ * mapped onto the ones in dst. */
+static int __data_add(jwt_metrics_t *dst, const struct __metrics_data *src,
+		      char * const *src_kids)
+{
+	int i, j;
+
+	for (i = 0; i < JWT_ALG_INVAL; i++) {
+		const unsigned long *hist;
+
+		for (j = 0; j < JWT_METRIC_COUNT; j++)
+			dst->d.count[i][j] += __atomic_load_n(&src->count[i][j],
+							      __ATOMIC_RELAXED);
+		dst->d.sum[i] += __atomic_load_n(&src->sum[i],
+						 __ATOMIC_RELAXED);
+
+		hist = __atomic_load_n(&src->hist[i], __ATOMIC_ACQUIRE);
+		if (hist == NULL)
+			continue;
+
+		if (dst->d.hist[i] == NULL)
+			dst->d.hist[i] = __hist_new();
+		if (dst->d.hist[i] == NULL)
+			return 1; // LCOV_EXCL_LINE
+
+		for (j = 0; j < HIST_BUCKETS; j++)
+			dst->d.hist[i][j] += __atomic_load_n(&hist[j],
+							     __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i <= METRICS_KIDS; i++) {
+		const char *kid = NULL;
+		int slot = METRICS_KIDS;
+
+		if (i < METRICS_KIDS) {
+			kid = __atomic_load_n(&src_kids[i], __ATOMIC_ACQUIRE);
+			if (kid == NULL)
+				continue;
+			slot = __kid_slot(dst->kids, kid);
+		}
+
+		for (j = 0; j < 2; j++)
+			dst->d.kid[slot][j] += __atomic_load_n(&src->kid[i][j],
+							       __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+static jwt_metrics_t *__snapshot(const struct jwt_metrics_live *m)
+{
+	jwt_metrics_t *snap;
+	int i;
+
+	if (m == NULL)
+		return NULL;
+
+	snap = jwt_malloc(sizeof(*snap));
+	if (snap == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(snap, 0, sizeof(*snap));
+	snap->builder = m->builder;
+
+	for (i = 0; i < METRICS_SHARDS; i++) {
+		if (__data_add(snap, &m->shard[i], m->kids)) {
+			// LCOV_EXCL_START
+			jwt_metrics_free(snap);
+			return NULL;
+			// LCOV_EXCL_STOP
+		}
+	}
+
+	return snap;
+}
+
+jwt_metrics_t *jwt_checker_metrics_snapshot(const jwt_checker_t *checker)
+{
+	return checker ? __snapshot(checker->c.metrics) : NULL;
+}
+
+jwt_metrics_t *jwt_builder_metrics_snapshot(const jwt_builder_t *builder)
+{
+	return builder ? __snapshot(builder->c.metrics) : NULL;
+}
+
+int jwt_metrics_merge(jwt_metrics_t *dst, const jwt_metrics_t *src)
+{
+	if (dst == NULL || src == NULL || dst->builder != src->builder)
+		return 1;
+
+	return __data_add(dst, &src->d, src->kids);
+}
+
+void jwt_metrics_free(jwt_metrics_t *metrics)
+{
+	int i;
+
+	if (metrics == NULL)
+		return;
+
+	__data_free(&metrics->d);
+
+	for (i = 0; i < METRICS_KIDS; i++)
+		jwt_freemem(metrics->kids[i]);
+
+	jwt_freemem(metrics);
+}
+
+unsigned long jwt_metrics_count(const jwt_metrics_t *metrics, jwt_alg_t alg,
+				jwt_metric_t result)
+{
+	unsigned long count = 0;
+	int i;
+
+	if (metrics == NULL || result < JWT_METRIC_OK ||
+	    result >= JWT_METRIC_COUNT || alg < JWT_ALG_NONE ||
+	    alg > JWT_ALG_INVAL)
+		return 0;
+
+	if (alg != JWT_ALG_INVAL)
+		return metrics->d.count[alg][result];
+
+	for (i = 0; i < JWT_ALG_INVAL; i++)
+		count += metrics->d.count[i][result];
+
+	return count;
+}
+
+unsigned long jwt_metrics_kid_count(const jwt_metrics_t *metrics,
+				    const char *kid, int failed)
+{
+	int i;
+
+	if (metrics == NULL || kid == NULL)
+		return 0;
+
+	failed = failed ? 1 : 0;
+
+	if (kid[0] == '\0')
+		return metrics->d.kid[METRICS_KIDS][failed];
+
+	for (i = 0; i < METRICS_KIDS && metrics->kids[i]; i++) {
+		if (!strcmp(metrics->kids[i], kid))
+			return metrics->d.kid[i][failed];
+	}
+
+	return 0;
+}
+
+unsigned long long jwt_metrics_quantile(const jwt_metrics_t *metrics,
+					jwt_alg_t alg, double q)
+{
+	unsigned long total = 0, rank, seen = 0;
+	unsigned long sum[HIST_BUCKETS];
+	int i, j, any = 0;
+
+	if (metrics == NULL || alg < JWT_ALG_NONE || alg > JWT_ALG_INVAL ||
+	    q < 0.0 || q > 1.0)
+		return 0;
+
+	memset(sum, 0, sizeof(sum));
+
+	for (i = 0; i < JWT_ALG_INVAL; i++) {
+		if ((alg != JWT_ALG_INVAL && i != (int)alg) ||
+		    metrics->d.hist[i] == NULL)
+			continue;
+
+		any = 1;
+		for (j = 0; j < HIST_BUCKETS; j++) {
+			sum[j] += metrics->d.hist[i][j];
+			total += metrics->d.hist[i][j];
+		}
+	}
+
+	if (!any || !total)
+		return 0;
+
+	/* The smallest value that has at least q of them at or below it */
+	rank = (unsigned long)(q * total);
+	if (rank < 1)
+		rank = 1;
+
+	for (j = 0; j < HIST_BUCKETS; j++) {
+		seen += sum[j];
+		if (seen >= rank) {
+			uint64_t width, low = __hist_low(j, &width);
+
+			return low + width / 2;
+		}
+	}
+
+	return 0; // LCOV_EXCL_LINE
+}
+
+/* Just enough of a string builder for the exposition format */
+struct __out {
+	char *buf;
+	size_t len;
+	size_t size;
+	int error;
+};
+
+__attribute__((format(printf, 2, 3)))
+static void __out_printf(struct __out *o, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (o->error)
+		return;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+		va_end(ap);
+
+		if (len < 0) {
+			o->error = 1; // LCOV_EXCL_LINE
+			return; // LCOV_EXCL_LINE
+		}
+
+		if (o->len + len < o->size)
+			break;
+
+		/* No realloc hook, so grow it ourselves */
+		{
+			size_t size = (o->size + len) * 2;
+			char *buf = jwt_malloc(size);
+
+			if (buf == NULL) {
+				o->error = 1; // LCOV_EXCL_LINE
+				return; // LCOV_EXCL_LINE
+			}
+			memcpy(buf, o->buf, o->len + 1);
+			jwt_freemem(o->buf);
+			o->buf = buf;
+			o->size = size;
+		}
+	}
+
+	o->len += len;
+}
+
+/* Label values need \, " and newlines escaped */
+static void __out_label(struct __out *o, const char *val)
+{
+	for (; *val; val++) {
+		if (*val == '\\' || *val == '"')
+			__out_printf(o, "\\%c", *val);
+		else if (*val == '\n')
+			__out_printf(o, "\\n");
+		else
+			__out_printf(o, "%c", *val);
+	}
+}
+
+char *jwt_metrics_prometheus(const jwt_metrics_t *metrics,
+			     const char *prefix)
+{
+	const struct __metrics_data *d;
+	const char *op;
+	struct __out o;
+	int i, j;
+
+	if (metrics == NULL)
+		return NULL;
+
+	if (prefix == NULL)
+		prefix = "jwt";
+
+	d = &metrics->d;
+	op = metrics->builder ? "generate" : "verify";
+
+	memset(&o, 0, sizeof(o));
+	o.size = 4096;
+	o.buf = jwt_malloc(o.size);
+	if (o.buf == NULL)
+		return NULL; // LCOV_EXCL_LINE
+	o.buf[0] = '\0';
+
+	__out_printf(&o, "# HELP %s_%s_total Tokens by alg and result.\n"
+		     "# TYPE %s_%s_total counter\n", prefix, op, prefix, op);
+	for (i = 0; i < JWT_ALG_INVAL; i++) {
+		for (j = 0; j < JWT_METRIC_COUNT; j++) {
+			if (!d->count[i][j])
+				continue;
+			__out_printf(&o, "%s_%s_total{alg=\"%s\",result=\"%s\"} "
+				     "%lu\n", prefix, op, jwt_alg_str(i),
+				     metric_names[j], d->count[i][j]);
+		}
+	}
+
+	__out_printf(&o, "# HELP %s_%s_kid_total Tokens by kid and result.\n"
+		     "# TYPE %s_%s_kid_total counter\n", prefix, op, prefix,
+		     op);
+	for (i = 0; i <= METRICS_KIDS; i++) {
+		const char *kid = i < METRICS_KIDS ? metrics->kids[i] : "";
+
+		if (kid == NULL)
+			continue;
+
+		for (j = 0; j < 2; j++) {
+			if (!d->kid[i][j])
+				continue;
+			__out_printf(&o, "%s_%s_kid_total{kid=\"", prefix, op);
+			__out_label(&o, kid);
+			__out_printf(&o, "\",result=\"%s\"} %lu\n",
+				     j ? "error" : "ok", d->kid[i][j]);
+		}
+	}
+
+	__out_printf(&o, "# HELP %s_%s_duration_seconds Latency by alg.\n"
+		     "# TYPE %s_%s_duration_seconds histogram\n", prefix, op,
+		     prefix, op);
+	for (i = 0; i < JWT_ALG_INVAL; i++) {
+		const char *alg = jwt_alg_str(i);
+		unsigned long total = 0;
+
+		if (d->hist[i] == NULL)
+			continue;
+
+		for (j = 0; j < HIST_BUCKETS; j++) {
+			uint64_t width, low;
+
+			if (!d->hist[i][j])
+				continue;
+
+			total += d->hist[i][j];
+			low = __hist_low(j, &width);
+			__out_printf(&o, "%s_%s_duration_seconds_bucket{alg=\"%s\","
+				     "le=\"%.9g\"} %lu\n", prefix, op, alg,
+				     (low + width) / 1e9, total);
+		}
+
+		__out_printf(&o, "%s_%s_duration_seconds_bucket{alg=\"%s\","
+			     "le=\"+Inf\"} %lu\n", prefix, op, alg, total);
+		__out_printf(&o, "%s_%s_duration_seconds_sum{alg=\"%s\"} %.9g\n",
+			     prefix, op, alg, d->sum[i] / 1e9);
+		__out_printf(&o, "%s_%s_duration_seconds_count{alg=\"%s\"} %lu\n",
+			     prefix, op, alg, total);
+	}
+
+	if (o.error) {
+		// LCOV_EXCL_START
+		jwt_freemem(o.buf);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	return o.buf;
+}
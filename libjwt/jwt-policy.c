@@ -0,0 +1,620 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* Claim policies. A jwt_policy_t is just the list of rules as they were
+ * added. When it is given to a checker, it gets compiled to a matcher:
+ * an open addressed table of claim names, and for each rule with values,
+ * an open addressed set of those. Checking a token is then one pass over
+ * its claims, with a bit for each rule that we saw.
+ *
+ * Scope names are kept the same way, in a table that maps each name to
+ * its bit. */
+
+typedef enum {
+	POLICY_REQUIRE = 0,
+	POLICY_STR,
+	POLICY_RANGE,
+} policy_type_t;
+
+struct jwt_policy_rule {
+	char *claim;
+	policy_type_t type;
+	char **vals;
+	unsigned int count;
+	unsigned int size;
+	long min;
+	long max;
+};
+
+struct jwt_policy {
+	struct jwt_policy_rule rules[JWT_POLICY_MAX_RULES];
+	unsigned int count;
+};
+
+struct jwt_match_str {
+	uint64_t hash;
+	char *str;		/* NULL for an empty slot		*/
+	size_t len;
+};
+
+struct jwt_match_rule {
+	char *claim;
+	uint64_t hash;
+	policy_type_t type;
+	jwt_claims_t std;	/* Bit for claims_failed, if any	*/
+	long min;
+	long max;
+	struct jwt_match_str *set;
+	unsigned int set_mask;
+};
+
+struct jwt_matcher {
+	unsigned int count;
+	unsigned int mask;
+	int *index;		/* Rule for each name slot, -1 if empty	*/
+	struct jwt_match_rule rules[];
+};
+
+struct jwt_scope_name {
+	char *str;		/* NULL for an empty slot		*/
+	size_t len;
+	uint64_t bit;
+};
+
+struct jwt_scopes {
+	unsigned int mask;
+	struct jwt_scope_name names[];
+};
+
+/* FNV-1a, 64 bit */
+static uint64_t __hash(const char *str, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= (unsigned char)*str++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/* Smallest power of two that keeps a table for n at most half full */
+static unsigned int __table_size(unsigned int n)
+{
+	unsigned int size = 4;
+
+	while (size < n * 2)
+		size <<= 1;
+
+	return size;
+}
+
+static char *__strdup(const char *str, size_t len)
+{
+	char *ret = jwt_malloc(len + 1);
+
+	if (ret == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memcpy(ret, str, len);
+	ret[len] = '\0';
+
+	return ret;
+}
+
+static jwt_claims_t __std_claim(const char *claim)
+{
+	static const struct {
+		const char *name;
+		jwt_claims_t claim;
+	} std[] = {
+		{ "iss", JWT_CLAIM_ISS },
+		{ "sub", JWT_CLAIM_SUB },
+		{ "aud", JWT_CLAIM_AUD },
+		{ "exp", JWT_CLAIM_EXP },
+		{ "nbf", JWT_CLAIM_NBF },
+		{ "iat", JWT_CLAIM_IAT },
+		{ "jti", JWT_CLAIM_JTI },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(std); i++) {
+		if (!strcmp(std[i].name, claim))
+			return std[i].claim;
+	}
+
+	return 0;
+}
+
+jwt_policy_t *jwt_policy_new(void)
+{
+	jwt_policy_t *policy = jwt_malloc(sizeof(*policy));
+
+	if (policy == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(policy, 0, sizeof(*policy));
+
+	return policy;
+}
+
+void jwt_policy_free(jwt_policy_t *policy)
+{
+	unsigned int i, j;
+
+	if (policy == NULL)
+		return;
+
+	for (i = 0; i < policy->count; i++) {
+		struct jwt_policy_rule *rule = &policy->rules[i];
+
+		for (j = 0; j < rule->count; j++)
+			jwt_freemem(rule->vals[j]);
+		jwt_freemem(rule->vals);
+		jwt_freemem(rule->claim);
+	}
+
+	jwt_freemem(policy);
+}
+
+/* Find the rule for claim, adding it if it isn't there */
+static struct jwt_policy_rule *__rule_get(jwt_policy_t *policy,
+					  const char *claim)
+{
+	struct jwt_policy_rule *rule;
+	unsigned int i;
+
+	if (policy == NULL || claim == NULL || !strlen(claim))
+		return NULL;
+
+	for (i = 0; i < policy->count; i++) {
+		if (!strcmp(policy->rules[i].claim, claim))
+			return &policy->rules[i];
+	}
+
+	if (policy->count >= JWT_POLICY_MAX_RULES)
+		return NULL;
+
+	rule = &policy->rules[policy->count];
+	memset(rule, 0, sizeof(*rule));
+	rule->claim = __strdup(claim, strlen(claim));
+	if (rule->claim == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	policy->count++;
+
+	return rule;
+}
+
+int jwt_policy_require(jwt_policy_t *policy, const char *claim)
+{
+	/* Every rule implies this, so there is nothing to change */
+	return __rule_get(policy, claim) ? 0 : 1;
+}
+
+int jwt_policy_add_str(jwt_policy_t *policy, const char *claim,
+		       const char *value)
+{
+	struct jwt_policy_rule *rule;
+	char *val;
+
+	if (value == NULL)
+		return 1;
+
+	rule = __rule_get(policy, claim);
+	if (rule == NULL || rule->type == POLICY_RANGE)
+		return 1;
+
+	if (rule->count == rule->size) {
+		unsigned int size = rule->size ? rule->size * 2 : 4;
+		char **vals = jwt_malloc(size * sizeof(*vals));
+
+		if (vals == NULL)
+			return 1; // LCOV_EXCL_LINE
+
+		if (rule->count)
+			memcpy(vals, rule->vals, rule->count * sizeof(*vals));
+		jwt_freemem(rule->vals);
+		rule->vals = vals;
+		rule->size = size;
+	}
+
+	val = __strdup(value, strlen(value));
+	if (val == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	rule->vals[rule->count++] = val;
+	rule->type = POLICY_STR;
+
+	return 0;
+}
+
+int jwt_policy_add_range(jwt_policy_t *policy, const char *claim, long min,
+			 long max)
+{
+	struct jwt_policy_rule *rule;
+
+	if (min > max)
+		return 1;
+
+	rule = __rule_get(policy, claim);
+	if (rule == NULL || rule->type == POLICY_STR)
+		return 1;
+
+	rule->type = POLICY_RANGE;
+	rule->min = min;
+	rule->max = max;
+
+	return 0;
+}
+
+/*****************************/
+
+void jwt_matcher_free(struct jwt_matcher *m)
+{
+	unsigned int i, j;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < m->count; i++) {
+		struct jwt_match_rule *rule = &m->rules[i];
+
+		if (rule->set) {
+			for (j = 0; j <= rule->set_mask; j++)
+				jwt_freemem(rule->set[j].str);
+			jwt_freemem(rule->set);
+		}
+		jwt_freemem(rule->claim);
+	}
+
+	jwt_freemem(m->index);
+	jwt_freemem(m);
+}
+
+static const struct jwt_match_str *__set_find(const struct jwt_match_rule *r,
+					      uint64_t hash, const char *str,
+					      size_t len)
+{
+	unsigned int i = hash & r->set_mask;
+
+	for (; r->set[i].str; i = (i + 1) & r->set_mask) {
+		const struct jwt_match_str *s = &r->set[i];
+
+		if (s->hash == hash && s->len == len &&
+		    !memcmp(s->str, str, len))
+			return s;
+	}
+
+	return NULL;
+}
+
+static int __set_compile(struct jwt_match_rule *r,
+			 const struct jwt_policy_rule *src)
+{
+	unsigned int i, size = __table_size(src->count);
+
+	r->set = jwt_malloc(size * sizeof(*r->set));
+	if (r->set == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	memset(r->set, 0, size * sizeof(*r->set));
+	r->set_mask = size - 1;
+
+	for (i = 0; i < src->count; i++) {
+		size_t len = strlen(src->vals[i]);
+		uint64_t hash = __hash(src->vals[i], len);
+		unsigned int slot = hash & r->set_mask;
+
+		/* The same value added twice is only kept once */
+		if (__set_find(r, hash, src->vals[i], len))
+			continue;
+
+		while (r->set[slot].str)
+			slot = (slot + 1) & r->set_mask;
+
+		r->set[slot].str = __strdup(src->vals[i], len);
+		if (r->set[slot].str == NULL)
+			return 1; // LCOV_EXCL_LINE
+		r->set[slot].hash = hash;
+		r->set[slot].len = len;
+	}
+
+	return 0;
+}
+
+struct jwt_matcher *jwt_matcher_compile(const jwt_policy_t *policy)
+{
+	struct jwt_matcher *m;
+	unsigned int i, size;
+
+	m = jwt_malloc(sizeof(*m) + policy->count * sizeof(m->rules[0]));
+	if (m == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(m, 0, sizeof(*m) + policy->count * sizeof(m->rules[0]));
+
+	size = __table_size(policy->count);
+	m->index = jwt_malloc(size * sizeof(*m->index));
+	if (m->index == NULL) {
+		// LCOV_EXCL_START
+		jwt_freemem(m);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	memset(m->index, 0xff, size * sizeof(*m->index));
+	m->mask = size - 1;
+
+	for (i = 0; i < policy->count; i++) {
+		const struct jwt_policy_rule *src = &policy->rules[i];
+		struct jwt_match_rule *r = &m->rules[i];
+		size_t len = strlen(src->claim);
+		unsigned int slot;
+
+		/* Counted first so a failure frees what we have so far */
+		m->count++;
+
+		r->claim = __strdup(src->claim, len);
+		if (r->claim == NULL)
+			goto fail; // LCOV_EXCL_LINE
+
+		r->hash = __hash(src->claim, len);
+		r->type = src->type;
+		r->std = __std_claim(src->claim);
+		r->min = src->min;
+		r->max = src->max;
+
+		if (r->type == POLICY_STR && __set_compile(r, src))
+			goto fail; // LCOV_EXCL_LINE
+
+		/* Names are unique in a policy, so no need to look first */
+		slot = r->hash & m->mask;
+		while (m->index[slot] >= 0)
+			slot = (slot + 1) & m->mask;
+		m->index[slot] = i;
+	}
+
+	return m;
+
+// LCOV_EXCL_START
+fail:
+	jwt_matcher_free(m);
+	return NULL;
+// LCOV_EXCL_STOP
+}
+
+static int __rule_find(const struct jwt_matcher *m, const char *claim)
+{
+	uint64_t hash = __hash(claim, strlen(claim));
+	unsigned int i = hash & m->mask;
+
+	for (; m->index[i] >= 0; i = (i + 1) & m->mask) {
+		const struct jwt_match_rule *r = &m->rules[m->index[i]];
+
+		if (r->hash == hash && !strcmp(r->claim, claim))
+			return m->index[i];
+	}
+
+	return -1;
+}
+
+static int __str_ok(const struct jwt_match_rule *r, const json_t *val)
+{
+	const char *str;
+	size_t len;
+
+	if (!json_is_string(val))
+		return 0;
+
+	str = json_string_value(val);
+	len = json_string_length(val);
+
+	return __set_find(r, __hash(str, len), str, len) != NULL;
+}
+
+static int __rule_ok(const struct jwt_match_rule *r, const json_t *val)
+{
+	const json_t *item;
+	json_int_t num;
+	size_t i;
+
+	switch (r->type) {
+	case POLICY_REQUIRE:
+		return 1;
+
+	case POLICY_STR:
+		if (!json_is_array(val))
+			return __str_ok(r, val);
+
+		/* One match is enough, as with "aud" */
+		json_array_foreach(val, i, item) {
+			if (__str_ok(r, item))
+				return 1;
+		}
+		return 0;
+
+	case POLICY_RANGE:
+		if (!json_is_integer(val))
+			return 0;
+
+		num = json_integer_value(val);
+		return num >= r->min && num <= r->max;
+	}
+
+	return 0; // LCOV_EXCL_LINE
+}
+
+int jwt_matcher_check(const struct jwt_matcher *m, const json_t *claims,
+		      jwt_claims_t *failed)
+{
+	uint64_t seen = 0, bad = 0, all;
+	const char *key;
+	json_t *val;
+	unsigned int i;
+
+	json_object_foreach((json_t *)claims, key, val) {
+		int r = __rule_find(m, key);
+
+		if (r < 0)
+			continue;
+
+		seen |= 1ULL << r;
+		if (!__rule_ok(&m->rules[r], val))
+			bad |= 1ULL << r;
+	}
+
+	/* Every rule needs its claim to be there */
+	all = m->count == JWT_POLICY_MAX_RULES ? ~0ULL : (1ULL << m->count) - 1;
+	bad |= all & ~seen;
+
+	if (!bad)
+		return 0;
+
+	for (i = 0; i < m->count; i++) {
+		if (bad & (1ULL << i))
+			*failed |= m->rules[i].std;
+	}
+
+	return 1;
+}
+
+/*****************************/
+
+void jwt_scopes_free(struct jwt_scopes *s)
+{
+	unsigned int i;
+
+	if (s == NULL)
+		return;
+
+	for (i = 0; i <= s->mask; i++)
+		jwt_freemem(s->names[i].str);
+
+	jwt_freemem(s);
+}
+
+/* Slot for the name, which is either it or the empty one it would go in */
+static unsigned int __scope_slot(const struct jwt_scopes *s, const char *name,
+				 size_t len)
+{
+	unsigned int i = __hash(name, len) & s->mask;
+
+	for (; s->names[i].str; i = (i + 1) & s->mask) {
+		const struct jwt_scope_name *n = &s->names[i];
+
+		if (n->len == len && !memcmp(n->str, name, len))
+			break;
+	}
+
+	return i;
+}
+
+struct jwt_scopes *jwt_scopes_compile(const char *names[], unsigned int count)
+{
+	unsigned int i, size = __table_size(count);
+	struct jwt_scopes *s;
+
+	if (names == NULL || !count || count > JWT_SCOPES_MAX)
+		return NULL;
+
+	s = jwt_malloc(sizeof(*s) + size * sizeof(s->names[0]));
+	if (s == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(s, 0, sizeof(*s) + size * sizeof(s->names[0]));
+	s->mask = size - 1;
+
+	for (i = 0; i < count; i++) {
+		size_t len = names[i] ? strlen(names[i]) : 0;
+		struct jwt_scope_name *n;
+
+		if (!len)
+			goto fail;
+
+		/* A name we already have is a mistake in the list */
+		n = &s->names[__scope_slot(s, names[i], len)];
+		if (n->str)
+			goto fail;
+
+		n->str = __strdup(names[i], len);
+		if (n->str == NULL)
+			goto fail; // LCOV_EXCL_LINE
+		n->len = len;
+		n->bit = JWT_SCOPE_BIT(i);
+	}
+
+	return s;
+
+fail:
+	jwt_scopes_free(s);
+	return NULL;
+}
+
+static uint64_t __scope_bit(const struct jwt_scopes *s, const char *name,
+			    size_t len)
+{
+	if (!len)
+		return 0;
+
+	/* Empty slots have no bit */
+	return s->names[__scope_slot(s, name, len)].bit;
+}
+
+/* Space separated, as in the "scope" claim */
+static uint64_t __scope_words(const struct jwt_scopes *s, const json_t *val)
+{
+	const char *str = json_string_value(val);
+	const char *end = str + json_string_length(val);
+	uint64_t bits = 0;
+
+	while (str < end) {
+		const char *sp = memchr(str, ' ', end - str);
+
+		if (sp == NULL)
+			sp = end;
+
+		bits |= __scope_bit(s, str, sp - str);
+		str = sp + 1;
+	}
+
+	return bits;
+}
+
+static uint64_t __scope_claim(const struct jwt_scopes *s, const json_t *val)
+{
+	const json_t *item;
+	uint64_t bits = 0;
+	size_t i;
+
+	if (json_is_string(val))
+		return __scope_words(s, val);
+
+	json_array_foreach(val, i, item) {
+		if (json_is_string(item))
+			bits |= __scope_bit(s, json_string_value(item),
+					    json_string_length(item));
+	}
+
+	return bits;
+}
+
+uint64_t jwt_scopes_get(const struct jwt_scopes *s, const json_t *claims)
+{
+	return __scope_claim(s, json_object_get(claims, "scope")) |
+		__scope_claim(s, json_object_get(claims, "scp")) |
+		__scope_claim(s, json_object_get(claims, "roles"));
+}
@@ -0,0 +1,290 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* A small worker pool for batch operations. The workers are started the
+ * first time they are needed and then wait for runs, so a batch costs a
+ * wakeup and not a thread create and join for each worker.
+ *
+ * A run is split into one part per thread, in order, and each thread
+ * works through its own part first. Once that is done, it takes work from
+ * the parts that are left, one item at a time, since a single signature
+ * is far more expensive than the atomic increment. The caller's thread
+ * does its share too, and always works through every part, so a run
+ * finishes even if no worker ever wakes up.
+ *
+ * Only one run has the workers at a time. Any other run that starts
+ * while they are busy is done on its caller's thread alone. */
+
+#define POOL_MAX	64
+
+struct __pool_part {
+	size_t next;
+	size_t end;
+} __attribute__((aligned(64)));
+
+struct jwt_pool_run {
+	jwt_pool_fn_t fn;
+	void *ctx;
+	const size_t *order;
+	unsigned int parts;
+	unsigned int joined;		/* Parts handed out, under lock	*/
+	struct __pool_part part[POOL_MAX];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_mutex_t run_lock;	/* Held for the length of a run	*/
+	struct jwt_pool_run *run;	/* NULL once no one may join	*/
+	unsigned long gen;
+	unsigned int active;		/* Workers in the current run	*/
+	unsigned int workers;
+	int quit;
+	int atfork;
+	pthread_t tids[POOL_MAX];
+} pool = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.wake		= PTHREAD_COND_INITIALIZER,
+	.done		= PTHREAD_COND_INITIALIZER,
+	.run_lock	= PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void __pool_work(struct jwt_pool_run *run, unsigned int me)
+{
+	unsigned int i;
+	size_t idx;
+
+	/* Our own part first, then help with the rest */
+	for (i = 0; i < run->parts; i++) {
+		struct __pool_part *p = &run->part[(me + i) % run->parts];
+
+		while ((idx = __atomic_fetch_add(&p->next, 1,
+						 __ATOMIC_RELAXED)) < p->end)
+			run->fn(run->ctx, run->order ? run->order[idx] : idx);
+	}
+}
+
+static void *__pool_worker(void *arg)
+{
+	unsigned long seen;
+
+	(void)arg;
+
+	pthread_mutex_lock(&pool.lock);
+	seen = pool.gen;
+
+	for (;;) {
+		struct jwt_pool_run *run;
+		unsigned int me;
+
+		while (!pool.quit && pool.gen == seen)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		if (pool.quit)
+			break;
+
+		seen = pool.gen;
+		run = pool.run;
+		if (run == NULL || run->joined >= run->parts)
+			continue;
+
+		me = run->joined++;
+		pool.active++;
+		pthread_mutex_unlock(&pool.lock);
+
+		__pool_work(run, me);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.active == 0)
+			pthread_cond_signal(&pool.done);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+/* The child of a fork has none of our threads, and the locks may have
+ * been held by one of them. Runs there start over from nothing. */
+static void __pool_child(void)
+{
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.wake, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pthread_mutex_init(&pool.run_lock, NULL);
+	pool.run = NULL;
+	pool.active = 0;
+	pool.workers = 0;
+}
+
+/* Make sure there are at least want workers, as far as we can */
+static void __pool_start(unsigned int want)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	if (!pool.atfork) {
+		pthread_atfork(NULL, NULL, __pool_child);
+		pool.atfork = 1;
+	}
+
+	while (pool.workers < want) {
+		if (pthread_create(&pool.tids[pool.workers], NULL,
+				   __pool_worker, NULL))
+			break; // LCOV_EXCL_LINE
+		pool.workers++;
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* Workers run our code, so they have to be gone before we are */
+static void __attribute__((destructor)) __pool_stop(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.workers; i++)
+		pthread_join(pool.tids[i], NULL);
+
+	pool.workers = 0;
+}
+
+unsigned int jwt_pool_threads(size_t n)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+		cpus = 1; // LCOV_EXCL_LINE
+	if (cpus > POOL_MAX)
+		cpus = POOL_MAX; // LCOV_EXCL_LINE
+
+	if ((size_t)cpus > n)
+		cpus = n ? n : 1;
+
+	return (unsigned int)cpus;
+}
+
+void jwt_pool_run(unsigned int threads, size_t n, const size_t *order,
+		  jwt_pool_fn_t fn, void *ctx)
+{
+	struct jwt_pool_run run;
+	unsigned int i;
+
+	if (threads > POOL_MAX)
+		threads = POOL_MAX; // LCOV_EXCL_LINE
+
+	if (threads > 1) {
+		if (pthread_mutex_trylock(&pool.run_lock))
+			threads = 1;
+		else
+			__pool_start(threads - 1);
+	}
+	if (threads < 1)
+		threads = 1;
+
+	run.fn = fn;
+	run.ctx = ctx;
+	run.order = order;
+	run.parts = threads;
+	run.joined = 1;			/* The first part is ours	*/
+
+	for (i = 0; i < threads; i++) {
+		run.part[i].next = n * i / threads;
+		run.part[i].end = n * (i + 1) / threads;
+	}
+
+	if (threads == 1) {
+		__pool_work(&run, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.run = &run;
+	pool.gen++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	__pool_work(&run, 0);
+
+	/* All of it has been handed out. Wait for anyone still working on
+	 * theirs, and don't let anyone else join. */
+	pthread_mutex_lock(&pool.lock);
+	pool.run = NULL;
+	while (pool.active)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+
+	pthread_mutex_unlock(&pool.run_lock);
+}
+
+struct __pool_key {
+	uint64_t hash;
+	size_t idx;
+};
+
+static int __pool_key_cmp(const void *a, const void *b)
+{
+	const struct __pool_key *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+
+	return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+size_t *jwt_pool_group(const char *tokens[], const size_t lens[], size_t n)
+{
+	struct __pool_key *keys;
+	size_t *order;
+	size_t i, j;
+
+	keys = jwt_malloc(sizeof(*keys) * n);
+	order = jwt_malloc(sizeof(*order) * n);
+	if (keys == NULL || order == NULL) {
+		// LCOV_EXCL_START
+		jwt_freemem(keys);
+		jwt_freemem(order);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	/* FNV-1a of the header, as it was sent */
+	for (i = 0; i < n; i++) {
+		const char *tok = tokens[i];
+		size_t len = tok == NULL ? 0 : lens ? lens[i] : strlen(tok);
+		uint64_t h = 0xcbf29ce484222325ULL;
+
+		for (j = 0; j < len && tok[j] != '.'; j++)
+			h = (h ^ (unsigned char)tok[j]) * 0x100000001b3ULL;
+
+		keys[i].hash = h;
+		keys[i].idx = i;
+	}
+
+	qsort(keys, n, sizeof(*keys), __pool_key_cmp);
+
+	for (i = 0; i < n; i++)
+		order[i] = keys[i].idx;
+
+	jwt_freemem(keys);
+
+	return order;
+}
@@ -16,8 +16,10 @@
 #include <jansson.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "ll.h"
+#include "jwt-probes.h"
 
 #ifndef ARRAY_SIZE
 #  ifdef __GNUC__
@@ -39,21 +41,69 @@ extern struct jwt_crypto_ops *jwt_ops;
 /* This can be used on anything with an error and error_msg field */
 #define jwt_write_error(__obj, __fmt, __args...)	\
 ({							\
-	if (!strlen((__obj)->error_msg))		\
+	if (!(__obj)->error)				\
 		snprintf((__obj)->error_msg,		\
 			 sizeof((__obj)->error_msg),	\
 		 __fmt, ##__args);			\
 	(__obj)->error = 1;				\
 })
 
+/* For a jwt_t, checker or builder, which also have an errcode. Nothing
+ * is formatted, the message comes from jwt_error_str() when asked for.
+ * Whichever of this or jwt_write_error() is first sticks. */
+#define jwt_write_errcode(__obj, __code)		\
+({							\
+	if (!(__obj)->error)				\
+		(__obj)->errcode = (__code);		\
+	(__obj)->error = 1;				\
+})
+
+/* For a failure whose code is only known once it reaches us, such as a
+ * signature the crypto backend already wrote a message for. The code
+ * goes on an error that doesn't have one yet, and the message stays. */
+#define jwt_write_errcode_late(__obj, __code)		\
+({							\
+	if (!(__obj)->errcode)				\
+		(__obj)->errcode = (__code);		\
+	(__obj)->error = 1;				\
+})
+
+/* The message for an error written by any of the above */
+#define jwt_error_msg_get(__obj)			\
+	((__obj)->error_msg[0] ? (__obj)->error_msg :	\
+	 jwt_error_str((__obj)->errcode))
+
 #define jwt_copy_error(__dst, __src)			\
 ({							\
-	strcpy((__dst)->error_msg, (__src)->error_msg);	\
+	if ((__src)->error_msg[0])			\
+		strcpy((__dst)->error_msg, (__src)->error_msg); \
+	else						\
+		(__dst)->error_msg[0] = '\0';		\
 	(__dst)->error = (__src)->error;		\
+	(__dst)->errcode = (__src)->errcode;		\
+	(__dst)->claims_failed = (__src)->claims_failed; \
+})
+
+/* Why a jwt_t failed, for metrics. Like the message, the first one set
+ * is the one that sticks. */
+#define jwt_write_fail(__jwt, __why)			\
+({							\
+	if ((__jwt)->fail == JWT_METRIC_OK)		\
+		(__jwt)->fail = (__why);		\
 })
 
 /******************************/
 
+/* What verifying with one alg and key takes, worked out once instead of
+ * for every token. It is only used for tokens that end up with that same
+ * alg, key and ops, which is all of them unless a callback changes it. */
+typedef struct {
+	jwt_alg_t alg;
+	const jwk_item_t *key;
+	struct jwt_crypto_ops *ops;
+	void *pctx;		/* Crypto ops state, NULL for no plan	*/
+} jwt_plan_t;
+
 struct jwt_common {
 	jwt_alg_t alg;
 	const jwk_item_t *key;
@@ -62,6 +112,17 @@ struct jwt_common {
 	jwt_claims_t claims;
 	jwt_callback_t cb;
 	void *cb_ctx;
+	struct jwt_crypto_ops *ops;	/* NULL to use jwt_ops_get()	*/
+	struct jwt_metrics_live *metrics;	/* NULL unless enabled	*/
+
+	/* Tracing, see jwt-trace.c */
+	jwt_trace_cb_t trace_cb;
+	void *trace_ctx;
+	jwt_trace_slow_cb_t slow_cb;
+	void *slow_ctx;
+	uint64_t slow_ns;
+	unsigned int slow_sample;
+	unsigned int slow_seen;
 
 	/* For builder, this is offset into the future.
 	 * For checker, this is the leeway.
@@ -70,16 +131,55 @@ struct jwt_common {
 	time_t nbf;
 };
 
+struct jwt_template;
+struct jwt_matcher;
+struct jwt_scopes;
+
 struct jwt_builder {
 	struct jwt_common c;
 	int error;
+	jwt_error_t errcode;
+	jwt_claims_t claims_failed;
 	char error_msg[JWT_ERR_LEN];
+
+	/* Compiled template (see jwt-template.c). This is dropped any time
+	 * the builder is changed, and recompiled on the next generate. */
+	int tmpl_enabled;
+	struct jwt_template *tmpl;
+
+	/* Makes the jti, if JWT_CLAIM_JTI is set. NULL for random. */
+	jwt_jti_cb_t jti_cb;
+	void *jti_ctx;
 };
 
 struct jwt_checker {
 	struct jwt_common c;
 	int error;
+	jwt_error_t errcode;
+	jwt_claims_t claims_failed;
 	char error_msg[JWT_ERR_LEN];
+
+	/* Verification plan for the alg and key given to setkey. This is
+	 * rebuilt any time either of those, or the ops, change. */
+	jwt_plan_t plan;
+
+	/* What we'll parse at all, see jwt_parse() */
+	jwt_limits_t limits;
+	int json_limits;		/* Any of the json_* are set	*/
+	unsigned int algs;		/* JWT_ALG_BIT()s, 0 for any	*/
+
+	/* Check the header against the key before the payload */
+	int fail_fast;
+	jwt_fail_fast_stats_t ff_stats;	/* Atomic adds only	*/
+
+	/* Compiled claim policy (see jwt-policy.c), NULL for none */
+	struct jwt_matcher *policy;
+
+	/* Scope names and their bits, NULL for none */
+	struct jwt_scopes *scopes;
+
+	/* Keys by kid, when there is no key from setkey */
+	jwks_ring_t *ring;
 };
 
 /*****************************/
@@ -89,8 +189,15 @@ struct jwt {
 	json_t *claims;
 	json_t *headers;
 	jwt_alg_t alg;
+	struct jwt_crypto_ops *ops;	/* NULL to use jwt_ops_get()	*/
 	int error;
+	jwt_error_t errcode;
+	jwt_claims_t claims_failed;
 	char error_msg[JWT_ERR_LEN];
+	jwt_metric_t fail;
+	struct jwt_trace *trace;	/* NULL unless tracing		*/
+	uint64_t scopes;		/* Granted, if checker has scopes	*/
+	const jwk_set_t *keys;		/* Checker's ring set, while read	*/
 	union {
 		struct jwt_checker *checker;
 		struct jwt_builder *builder;
@@ -136,6 +243,7 @@ struct jwk_item {
 	jwt_alg_t alg;		/**< @rfc{7517,4.4} JWA Algorithm supported		*/
 	char *kid;		/**< @rfc{7517,4.5} Key ID				*/
 	json_t *json;		/**< The json_t for this key				*/
+	unsigned int refs;	/**< The set's reference, and any others taken	*/
 };
 
 /* Crypto operations */
@@ -154,6 +262,27 @@ struct jwt_crypto_ops {
 		unsigned int head_len, unsigned char *sig,
 		int sig_len);
 
+	/* Incremental signing/verifying, so the signing input can be fed in
+	 * pieces as it is produced. HMAC verify is done with digest_sign.
+	 * These are not used for EdDSA, which needs the whole message. */
+	void *(*digest_init)(jwt_t *jwt, int verify);
+	int (*digest_update)(void *dctx, const char *buf, unsigned int len);
+	int (*digest_sign)(jwt_t *jwt, void *dctx, char **out,
+		unsigned int *len);
+	int (*digest_verify)(jwt_t *jwt, void *dctx, unsigned char *sig,
+		int sig_len);
+	void (*digest_free)(void *dctx);
+
+	/* Verification plans. plan_new does all of the lookups and key
+	 * checks for jwt->alg and jwt->key up front. plan_verify is then
+	 * safe to run on the same plan from any number of threads.
+	 * Optional. */
+	void *(*plan_new)(jwt_t *jwt);
+	int (*plan_verify)(jwt_t *jwt, void *pctx, const char *head,
+		unsigned int head_len, const unsigned char *sig,
+		unsigned int sig_len);
+	void (*plan_free)(void *pctx);
+
 	/* Parsing a JWK to prepare it for use */
 	int jwk_implemented;
 	int (*process_eddsa)(json_t *jwk, jwk_item_t *item);
@@ -175,6 +304,15 @@ JWT_NO_EXPORT
 extern struct jwt_crypto_ops jwt_mbedtls_ops;
 #endif
 
+/* The ops to sign or verify with: the ones picked for this jwt, else the
+ * ones set for its alg, else jwt_ops. Look them up once per operation. */
+JWT_NO_EXPORT
+struct jwt_crypto_ops *jwt_ops_get(const jwt_t *jwt);
+JWT_NO_EXPORT
+struct jwt_crypto_ops *jwt_ops_find(const char *opname);
+JWT_NO_EXPORT
+int jwt_ops_autotune(void);
+
 /* Memory allocators. */
 JWT_NO_EXPORT
 void *jwt_malloc(size_t size);
@@ -184,6 +322,64 @@ void __jwt_freemem(void *ptr);
 JWT_NO_EXPORT
 jwt_t *jwt_new(void);
 
+/* Tracing (see jwt-trace.c). An operation opens a jwt_trace on its stack
+ * and points jwt->trace at it, and each stage in between reports with
+ * jwt_trace_begin() and jwt_trace_end(). */
+struct jwt_trace {
+	jwt_trace_cb_t cb;
+	void *ctx;
+	int capture;
+	jwt_trace_op_t op;
+};
+
+JWT_NO_EXPORT
+uint64_t jwt_now_ns(void);
+JWT_NO_EXPORT
+int jwt_trace_open(struct jwt_trace *tr, const struct jwt_common *c,
+		   int builder);
+JWT_NO_EXPORT
+void jwt_trace_close(struct jwt_trace *tr, struct jwt_common *c,
+		     const jwt_t *jwt, size_t bytes);
+JWT_NO_EXPORT
+void jwt_trace_span(struct jwt_trace *tr, jwt_trace_stage_t stage,
+		    uint64_t start, size_t bytes);
+
+static inline uint64_t jwt_trace_begin(const jwt_t *jwt) {
+	return jwt->trace ? jwt_now_ns() : 0;
+}
+
+static inline void jwt_trace_end(const jwt_t *jwt, jwt_trace_stage_t stage,
+				 uint64_t start, size_t bytes) {
+	if (jwt->trace)
+		jwt_trace_span(jwt->trace, stage, start, bytes);
+}
+
+/* Metrics (see jwt-metrics.c). Take the start time before the operation,
+ * and record it after. Both do nothing for a NULL m. */
+JWT_NO_EXPORT
+struct jwt_metrics_live *jwt_metrics_new(int builder);
+JWT_NO_EXPORT
+void jwt_metrics_live_free(struct jwt_metrics_live *m);
+JWT_NO_EXPORT
+uint64_t jwt_metrics_start(const struct jwt_metrics_live *m);
+JWT_NO_EXPORT
+void jwt_metrics_record(struct jwt_metrics_live *m, jwt_alg_t alg,
+			const char *kid, jwt_metric_t result, uint64_t start);
+
+/* Which part of the library new allocations are counted against. Use
+ * JWT_ALLOC_SCOPE() at the top of a function, and it goes back to what it
+ * was when the function returns. */
+JWT_NO_EXPORT
+extern __thread jwt_alloc_sys_t jwt_alloc_cur;
+
+static inline void jwt_alloc_leave(jwt_alloc_sys_t *prev) {
+	jwt_alloc_cur = *prev;
+}
+#define JWT_ALLOC_SCOPE(__sys)						\
+	jwt_alloc_sys_t __attribute__((cleanup(jwt_alloc_leave)))	\
+		__jwt_alloc_prev = jwt_alloc_cur;			\
+	jwt_alloc_cur = (__sys)
+
 #define jwt_freemem(__ptr) ({		\
 	if (__ptr) {			\
 		__jwt_freemem(__ptr);	\
@@ -211,6 +407,10 @@ static inline void jwt_freep(jwt_t **jwt) {
  * as defined in RFC-4648. */
 JWT_NO_EXPORT
 int jwt_base64uri_encode(char **_dst, const char *plain, int plain_len);
+/* Same as above, but dst must have room for
+ * BASE64_ENCODE_OUT_SIZE(plain_len) + 1 bytes. */
+JWT_NO_EXPORT
+int jwt_base64uri_encode_buf(char *dst, const char *plain, int plain_len);
 JWT_NO_EXPORT
 void *jwt_base64uri_decode(const char *src, int *ret_len);
 
@@ -221,6 +421,45 @@ int jwt_strcmp(const char *str1, const char *str2);
 JWT_NO_EXPORT
 jwt_t *jwt_verify_sig(jwt_t *jwt, const char *head, unsigned int head_len,
                    const char *sig);
+
+/* Signing input that is fed in pieces. When the crypto ops or the alg
+ * can't do it incrementally, the pieces are collected instead. The first
+ * piece is used in place, so it has to stay valid until the digest is
+ * signed or verified. */
+typedef struct {
+	jwt_t *jwt;
+	struct jwt_crypto_ops *ops;	/* Picked once, at init		*/
+	void *dctx;		/* Crypto ops state			*/
+	int verify;
+	const char *data;	/* Collected input, if no dctx		*/
+	unsigned int len;
+	char *buf;		/* Our copy, once there's a second piece	*/
+	unsigned int size;
+	unsigned int total;	/* Everything fed in, for probes	*/
+} jwt_digest_t;
+
+JWT_NO_EXPORT
+int jwt_digest_init(jwt_digest_t *d, jwt_t *jwt, int verify);
+JWT_NO_EXPORT
+int jwt_digest_update(jwt_digest_t *d, const char *buf, unsigned int len);
+JWT_NO_EXPORT
+int jwt_digest_sign(jwt_digest_t *d, char **out, unsigned int *len);
+JWT_NO_EXPORT
+int jwt_digest_verify(jwt_digest_t *d, const char *sig_b64);
+JWT_NO_EXPORT
+void jwt_digest_free(jwt_digest_t *d);
+
+JWT_NO_EXPORT
+void jwt_plan_init(jwt_plan_t *p, jwt_alg_t alg, const jwk_item_t *key,
+		   struct jwt_crypto_ops *ops);
+JWT_NO_EXPORT
+int jwt_plan_match(const jwt_plan_t *p, const jwt_t *jwt);
+JWT_NO_EXPORT
+int jwt_plan_verify(const jwt_plan_t *p, jwt_t *jwt, const char *head,
+		    unsigned int head_len, const char *sig_b64);
+JWT_NO_EXPORT
+void jwt_plan_free(jwt_plan_t *p);
+
 JWT_NO_EXPORT
 int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
 	     unsigned int str_len);
@@ -233,7 +472,8 @@ JWT_NO_EXPORT
 jwt_value_error_t __getter(json_t *which, jwt_value_t *value);
 
 JWT_NO_EXPORT
-int jwt_parse(jwt_t *jwt, const char *token, unsigned int *len);
+int jwt_parse(jwt_t *jwt, const char *token, size_t token_len, char **buf,
+	      unsigned int *len);
 JWT_NO_EXPORT
 jwt_t *jwt_verify_complete(jwt_t *jwt, const jwt_config_t *config,
 			   const char *token, unsigned int payload_len);
@@ -244,6 +484,89 @@ char *jwt_encode_str(jwt_t *jwt);
 JWT_NO_EXPORT
 int jwt_head_setup(jwt_t *jwt);
 
+JWT_NO_EXPORT
+struct jwt_template *jwt_template_compile(jwt_builder_t *builder);
+JWT_NO_EXPORT
+char *jwt_template_generate(const struct jwt_template *tmpl, time_t now,
+			    const char *jti, jwt_t *jwt);
+JWT_NO_EXPORT
+int jwt_jti_make(const jwt_builder_t *builder, char *jti, jwt_t *jwt);
+JWT_NO_EXPORT
+void jwt_template_free(struct jwt_template *tmpl);
+
+/* JSON text in and out, see jwt-json.c */
+JWT_NO_EXPORT
+json_t *jwt_json_loadb(const char *buf, size_t len, size_t flags);
+JWT_NO_EXPORT
+char *jwt_json_dumps(const json_t *js, size_t flags);
+JWT_NO_EXPORT
+json_t *jwt_json_load_b64(const char *src, size_t len, size_t flags);
+
+JWT_NO_EXPORT
+struct jwt_matcher *jwt_matcher_compile(const jwt_policy_t *policy);
+JWT_NO_EXPORT
+int jwt_matcher_check(const struct jwt_matcher *m, const json_t *claims,
+		      jwt_claims_t *failed);
+JWT_NO_EXPORT
+void jwt_matcher_free(struct jwt_matcher *m);
+
+JWT_NO_EXPORT
+struct jwt_scopes *jwt_scopes_compile(const char *names[], unsigned int count);
+JWT_NO_EXPORT
+uint64_t jwt_scopes_get(const struct jwt_scopes *s, const json_t *claims);
+JWT_NO_EXPORT
+void jwt_scopes_free(struct jwt_scopes *s);
+
+/* Moves the headers and claims out of jwt (see jwt-verified.c) */
+JWT_NO_EXPORT
+jwt_verified_t *jwt_verified_take(jwt_t *jwt);
+
+/* Reading a key ring (see jwks-ring.c). The set is good until the
+ * matching unlock, and epoch is only for passing to it. */
+JWT_NO_EXPORT
+const jwk_set_t *jwks_ring_read_lock(jwks_ring_t *ring, unsigned int *epoch);
+JWT_NO_EXPORT
+void jwks_ring_read_unlock(jwks_ring_t *ring, unsigned int epoch);
+JWT_NO_EXPORT
+const jwk_item_t *jwks_ring_key(const jwk_set_t *jwk_set, const char *kid);
+
+/* Picks the key and alg for a token from a ring's set, which may be
+ * NULL. Errors are left in jwt. */
+JWT_NO_EXPORT
+int jwks_ring_pick(jwt_t *jwt, const jwk_set_t *jwk_set,
+		   const jwk_item_t **key, jwt_alg_t *alg);
+
+/* Worker pool for batch operations (see jwt-pool.c). fn is called once
+ * for each index from 0 to n - 1, from any of the threads. Indexes are
+ * handed out in the order given, or from 0 up if order is NULL. */
+typedef void (*jwt_pool_fn_t)(void *ctx, size_t idx);
+
+JWT_NO_EXPORT
+unsigned int jwt_pool_threads(size_t n);
+JWT_NO_EXPORT
+void jwt_pool_run(unsigned int threads, size_t n, const size_t *order,
+		  jwt_pool_fn_t fn, void *ctx);
+
+/* An order for the tokens that puts the ones with the same header, and
+ * so the same key, next to each other. Free with jwt_freemem(). */
+JWT_NO_EXPORT
+size_t *jwt_pool_group(const char *tokens[], const size_t lens[], size_t n);
+
+/* ECDSA signatures, raw R/S to and from DER (see jwt-ecdsa.c). The raw
+ * form is two values of n bytes each, n being the curve size. */
+#define JWT_ECDSA_RAW_MAX	(2 * 66)
+/* SEQUENCE header, plus two INTEGERs with a possible leading zero */
+#define JWT_ECDSA_DER_MAX	(3 + 2 * (2 + 67))
+
+JWT_NO_EXPORT
+unsigned int jwt_ecdsa_size(jwt_alg_t alg);
+JWT_NO_EXPORT
+int jwt_ecdsa_der_to_raw(const unsigned char *der, size_t der_len,
+			 unsigned char *raw, unsigned int n);
+JWT_NO_EXPORT
+size_t jwt_ecdsa_raw_to_der(const unsigned char *raw, size_t raw_len,
+			    unsigned char *der);
+
 #define __trace() fprintf(stderr, "%s:%d\n", __func__, __LINE__)
 
 #endif /* JWT_PRIVATE_H */
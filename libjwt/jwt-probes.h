@@ -0,0 +1,62 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JWT_PROBES_H
+#define JWT_PROBES_H
+
+/* USDT probes, for perf, bpftrace and friends. Built with WITH_USDT,
+ * each is a nop in the code and a note in the ELF until something
+ * attaches to it. Otherwise they are nothing at all, and the arguments
+ * are never evaluated.
+ *
+ * Probes are in the "libjwt" provider, and are listed with:
+ *
+ *   bpftrace -l 'usdt:/path/to/libjwt.so:*'
+ *
+ * verify__entry		(token_len)
+ * verify__return		(alg, kid, token_len, error)
+ * generate__entry		(alg)
+ * generate__return		(alg, kid, token_len, error)
+ * sign__entry			(alg, kid, len)
+ * sign__return			(alg, kid, len, error)
+ * sig_verify__entry		(alg, kid, len)
+ * sig_verify__return		(alg, kid, len, error)
+ * jwks_load__entry		(len)
+ * jwks_load__return		(len, count, error)
+ * jwks_fetch__entry		(url)
+ * jwks_fetch__return		(url, len, error)
+ *
+ * Strings (kid, url) may be NULL. */
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+#define JWT_PROBE1(__n, __a)			\
+	DTRACE_PROBE1(libjwt, __n, __a)
+#define JWT_PROBE2(__n, __a, __b)		\
+	DTRACE_PROBE2(libjwt, __n, __a, __b)
+#define JWT_PROBE3(__n, __a, __b, __c)		\
+	DTRACE_PROBE3(libjwt, __n, __a, __b, __c)
+#define JWT_PROBE4(__n, __a, __b, __c, __d)	\
+	DTRACE_PROBE4(libjwt, __n, __a, __b, __c, __d)
+
+#else
+
+#define JWT_PROBE1(__n, __a)			do { } while (0)
+#define JWT_PROBE2(__n, __a, __b)		do { } while (0)
+#define JWT_PROBE3(__n, __a, __b, __c)		do { } while (0)
+#define JWT_PROBE4(__n, __a, __b, __c, __d)	do { } while (0)
+
+#endif /* HAVE_USDT */
+
+/* The kid of the key in use, if there is one */
+#define JWT_PROBE_KID(__jwt) \
+	((__jwt)->key ? (__jwt)->key->kid : NULL)
+
+#endif /* JWT_PROBES_H */
@@ -87,7 +87,7 @@ static jwt_value_error_t jwt_get_json(json_t *which, jwt_value_t *jval)
 	if (json_val == NULL)
 		return jval->error = JWT_VALUE_ERR_NOEXIST;
 
-	jval->json_val = json_dumps(json_val, flags);
+	jval->json_val = jwt_json_dumps(json_val, flags);
 	if (jval->json_val == NULL)
 		jval->error = JWT_VALUE_ERR_INVALID; // LCOV_EXCL_LINE
 
@@ -155,7 +155,11 @@ static jwt_value_error_t jwt_set_json(json_t *which, jwt_value_t *jval)
 	json_t *json_val = NULL;
 	int ret;
 
-	json_val = json_loads(jval->json_val, flags, NULL);
+	if (jval->json_val == NULL)
+		return jval->error = JWT_VALUE_ERR_INVALID;
+
+	json_val = jwt_json_loadb(jval->json_val, strlen(jval->json_val),
+				  flags);
 
 	/* Because we didn't set JSON_DECODE_ANY, we are guaranteed an array or
 	 * object here. */
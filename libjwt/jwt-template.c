@@ -0,0 +1,448 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/random.h>
+
+#include <jwt.h>
+
+#include "base64.h"
+
+#include "jwt-private.h"
+
+/* A compiled builder template. The header never changes between tokens, so
+ * it is encoded once. The payload is kept as a list of pre-serialized
+ * members in the same order JSON_SORT_KEYS would give us, with empty slots
+ * for the time based claims and the jti that get filled in on each
+ * generate. */
+
+/* Enough for ``"xxx":`` and a long */
+#define TMPL_SLOT_MAX	32
+
+/* Enough for ``"jti":""`` and the ID */
+#define TMPL_JTI_MAX	(JWT_JTI_MAX + 8)
+
+/* Random bytes in a jti we make ourselves */
+#define JTI_RAND_LEN	16
+
+/* Use the stack for payloads up to this size */
+#define TMPL_STACK_MAX	1024
+
+struct jwt_tmpl_part {
+	const char *name;	/* Claim name, only used for sorting	*/
+	char *text;		/* ``"name":value`` or NULL for a slot	*/
+	size_t len;		/* Length of text			*/
+	jwt_claims_t claim;	/* Claim for this slot			*/
+};
+
+struct jwt_template {
+	jwt_alg_t alg;
+	const jwk_item_t *key;
+
+	char *head;		/* Base64url of the header		*/
+	int head_len;
+
+	struct jwt_tmpl_part *parts;
+	int nparts;
+
+	time_t nbf;
+	time_t exp;
+
+	size_t payload_max;	/* Largest the payload JSON can be	*/
+	unsigned int sig_max;	/* Largest the raw signature can be	*/
+};
+
+void jwt_template_free(struct jwt_template *tmpl)
+{
+	int i;
+
+	if (tmpl == NULL)
+		return;
+
+	for (i = 0; i < tmpl->nparts; i++)
+		jwt_freemem(tmpl->parts[i].text);
+
+	jwt_freemem(tmpl->parts);
+	jwt_freemem(tmpl->head);
+	jwt_freemem(tmpl);
+}
+
+/* Make the jti for one token, with the builder's callback or from random
+ * bytes. It goes in the template as is, so it has to be safe in a JSON
+ * string without escapes. */
+int jwt_jti_make(const jwt_builder_t *builder, char *jti, jwt_t *jwt)
+{
+	unsigned char rnd[JTI_RAND_LEN];
+	size_t i;
+
+	if (builder->jti_cb == NULL) {
+		if (getentropy(rnd, sizeof(rnd))) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "Error getting random bytes for jti");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+
+		jwt_base64uri_encode_buf(jti, (char *)rnd, sizeof(rnd));
+		return 0;
+	}
+
+	memset(jti, 0, JWT_JTI_MAX);
+	if (builder->jti_cb(jti, JWT_JTI_MAX, builder->jti_ctx)) {
+		jwt_write_errcode(jwt, JWT_ERR_CALLBACK);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_CALLBACK);
+		return 1;
+	}
+
+	for (i = 0; i < JWT_JTI_MAX && jti[i]; i++) {
+		if (jti[i] < 0x20 || jti[i] > 0x7e || jti[i] == '"' ||
+		    jti[i] == '\\')
+			break;
+	}
+
+	if (i == 0 || i == JWT_JTI_MAX || jti[i]) {
+		jwt_write_error(jwt, "Invalid jti returned by callback");
+		jwt_write_fail(jwt, JWT_METRIC_ERR_CALLBACK);
+		return 1;
+	}
+
+	return 0;
+}
+
+static unsigned int __sig_max(jwt_alg_t alg, const jwk_item_t *key)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		return 64;
+
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS256:
+	case JWT_ALG_PS384:
+	case JWT_ALG_PS512:
+		return (key->bits + 7) / 8;
+
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+	case JWT_ALG_ES384:
+	case JWT_ALG_ES512:
+		return 132;
+
+	case JWT_ALG_EDDSA:
+		return 114;
+
+	default:
+		return 0;
+	}
+}
+
+static int __tmpl_head(struct jwt_template *tmpl, json_t *headers)
+{
+	jwt_auto_t *jwt = NULL;
+	char_auto *buf = NULL;
+
+	jwt = jwt_malloc(sizeof(*jwt));
+	if (jwt == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	memset(jwt, 0, sizeof(*jwt));
+
+	jwt->headers = json_deep_copy(headers);
+	if (jwt->headers == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	jwt->alg = tmpl->alg;
+	jwt->key = tmpl->key;
+
+	if (jwt_head_setup(jwt))
+		return 1; // LCOV_EXCL_LINE
+
+	buf = jwt_json_dumps(jwt->headers, JSON_SORT_KEYS | JSON_COMPACT);
+	if (buf == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	tmpl->head_len = jwt_base64uri_encode(&tmpl->head, buf,
+					      (int)strlen(buf));
+
+	return tmpl->head_len <= 0 ? 1 : 0;
+}
+
+/* Serialize one member of the payload as ``"key":value`` */
+static char *__tmpl_member(const char *key, json_t *val)
+{
+	json_auto_t *jkey = NULL;
+	char_auto *k = NULL;
+	char_auto *v = NULL;
+	char *out;
+	size_t flags = JSON_SORT_KEYS | JSON_COMPACT | JSON_ENCODE_ANY;
+
+	jkey = json_string(key);
+	if (jkey == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	k = jwt_json_dumps(jkey, flags);
+	v = jwt_json_dumps(val, flags);
+	if (k == NULL || v == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	out = jwt_malloc(strlen(k) + strlen(v) + 2);
+	if (out == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	sprintf(out, "%s:%s", k, v);
+
+	return out;
+}
+
+static int __part_cmp(const void *a, const void *b)
+{
+	const struct jwt_tmpl_part *pa = a, *pb = b;
+
+	return strcmp(pa->name, pb->name);
+}
+
+static const char *__slot_name(jwt_claims_t claim)
+{
+	switch (claim) {
+	case JWT_CLAIM_EXP:
+		return "exp";
+	case JWT_CLAIM_IAT:
+		return "iat";
+	case JWT_CLAIM_NBF:
+		return "nbf";
+	case JWT_CLAIM_JTI:
+		return "jti";
+	// LCOV_EXCL_START
+	default:
+		return NULL;
+	// LCOV_EXCL_STOP
+	}
+}
+
+static int __tmpl_payload(struct jwt_template *tmpl, json_t *payload,
+			  jwt_claims_t claims)
+{
+	static const jwt_claims_t slots[] = {
+		JWT_CLAIM_EXP, JWT_CLAIM_IAT, JWT_CLAIM_NBF, JWT_CLAIM_JTI,
+	};
+	const char *key;
+	json_t *val;
+	size_t i, count;
+
+	count = json_object_size(payload) + ARRAY_SIZE(slots);
+	tmpl->parts = jwt_malloc(count * sizeof(*tmpl->parts));
+	if (tmpl->parts == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	memset(tmpl->parts, 0, count * sizeof(*tmpl->parts));
+
+	/* The dynamic claims get a slot */
+	for (i = 0; i < ARRAY_SIZE(slots); i++) {
+		struct jwt_tmpl_part *part;
+
+		if (!(claims & slots[i]))
+			continue;
+
+		part = &tmpl->parts[tmpl->nparts++];
+		part->name = __slot_name(slots[i]);
+		part->claim = slots[i];
+		tmpl->payload_max += slots[i] == JWT_CLAIM_JTI ?
+			TMPL_JTI_MAX : TMPL_SLOT_MAX;
+	}
+
+	/* Everything else is serialized now */
+	json_object_foreach(payload, key, val) {
+		struct jwt_tmpl_part *part;
+		int skip = 0;
+
+		/* Generated values replace any static value */
+		for (i = 0; i < ARRAY_SIZE(slots); i++) {
+			if ((claims & slots[i]) &&
+			    !strcmp(key, __slot_name(slots[i])))
+				skip = 1;
+		}
+		if (skip)
+			continue;
+
+		part = &tmpl->parts[tmpl->nparts++];
+		part->name = key;
+		part->text = __tmpl_member(key, val);
+		if (part->text == NULL)
+			return 1; // LCOV_EXCL_LINE
+		part->len = strlen(part->text);
+		tmpl->payload_max += part->len;
+	}
+
+	qsort(tmpl->parts, tmpl->nparts, sizeof(*tmpl->parts), __part_cmp);
+
+	/* The names point into the builder's payload, which can change
+	 * after we are compiled. We don't need them anymore. */
+	for (i = 0; i < (size_t)tmpl->nparts; i++)
+		tmpl->parts[i].name = NULL;
+
+	/* Braces and commas */
+	tmpl->payload_max += tmpl->nparts + 2;
+
+	return 0;
+}
+
+struct jwt_template *jwt_template_compile(jwt_builder_t *builder)
+{
+	struct jwt_template *tmpl;
+
+	tmpl = jwt_malloc(sizeof(*tmpl));
+	if (tmpl == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(tmpl, 0, sizeof(*tmpl));
+
+	/* Same alg and key rules as jwt_builder_generate() */
+	tmpl->alg = builder->c.alg;
+	if (tmpl->alg == JWT_ALG_NONE && builder->c.key)
+		tmpl->alg = builder->c.key->alg;
+	tmpl->key = builder->c.key;
+
+	tmpl->nbf = builder->c.nbf;
+	tmpl->exp = builder->c.exp;
+	tmpl->sig_max = __sig_max(tmpl->alg, tmpl->key);
+
+	if (__tmpl_head(tmpl, builder->c.headers) ||
+	    __tmpl_payload(tmpl, builder->c.payload, builder->c.claims)) {
+		// LCOV_EXCL_START
+		jwt_write_error(builder, "Error compiling template");
+		jwt_template_free(tmpl);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	return tmpl;
+}
+
+static size_t __tmpl_fill(const struct jwt_template *tmpl, char *buf,
+			  time_t now, const char *jti)
+{
+	size_t pos = 0;
+	int i;
+
+	buf[pos++] = '{';
+
+	for (i = 0; i < tmpl->nparts; i++) {
+		const struct jwt_tmpl_part *part = &tmpl->parts[i];
+		long val;
+
+		if (i)
+			buf[pos++] = ',';
+
+		if (part->text) {
+			memcpy(buf + pos, part->text, part->len);
+			pos += part->len;
+			continue;
+		}
+
+		/* Already checked, so no escapes needed */
+		if (part->claim == JWT_CLAIM_JTI) {
+			pos += sprintf(buf + pos, "\"jti\":\"%s\"", jti);
+			continue;
+		}
+
+		if (part->claim == JWT_CLAIM_EXP)
+			val = (long)(now + tmpl->exp);
+		else if (part->claim == JWT_CLAIM_NBF)
+			val = (long)(now + tmpl->nbf);
+		else
+			val = (long)now;
+
+		pos += sprintf(buf + pos, "\"%s\":%ld",
+			       __slot_name(part->claim), val);
+	}
+
+	buf[pos++] = '}';
+	buf[pos] = '\0';
+
+	return pos;
+}
+
+char *jwt_template_generate(const struct jwt_template *tmpl, time_t now,
+			    const char *jti, jwt_t *jwt)
+{
+	char stack_buf[TMPL_STACK_MAX];
+	char_auto *heap_buf = NULL;
+	char_auto *sig = NULL;
+	char *json = stack_buf;
+	unsigned int sig_len;
+	size_t json_len, len;
+	uint64_t start;
+	char *out;
+
+	if (tmpl->payload_max >= sizeof(stack_buf)) {
+		heap_buf = jwt_malloc(tmpl->payload_max + 1);
+		if (heap_buf == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "Error allocating memory");
+			return NULL;
+			// LCOV_EXCL_STOP
+		}
+		json = heap_buf;
+	}
+
+	start = jwt_trace_begin(jwt);
+	json_len = __tmpl_fill(tmpl, json, now, jti);
+	jwt_trace_end(jwt, JWT_TRACE_JSON, start, json_len);
+
+	/* Room for everything, including the signature, so we only need
+	 * the one allocation for the token. */
+	out = jwt_malloc(tmpl->head_len + BASE64_ENCODE_OUT_SIZE(json_len) +
+			 BASE64_ENCODE_OUT_SIZE(tmpl->sig_max) + 2);
+	if (out == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "Error allocating memory");
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	memcpy(out, tmpl->head, tmpl->head_len);
+	len = tmpl->head_len;
+	out[len++] = '.';
+	start = jwt_trace_begin(jwt);
+	len += jwt_base64uri_encode_buf(out + len, json, (int)json_len);
+	jwt_trace_end(jwt, JWT_TRACE_BASE64, start, json_len);
+
+	if (tmpl->alg == JWT_ALG_NONE) {
+		out[len++] = '.';
+		out[len] = '\0';
+		return out;
+	}
+
+	jwt->alg = tmpl->alg;
+	jwt->key = tmpl->key;
+
+	start = jwt_trace_begin(jwt);
+	if (jwt_sign(jwt, &sig, &sig_len, out, len)) {
+		jwt_freemem(out);
+		return NULL;
+	}
+	jwt_trace_end(jwt, JWT_TRACE_SIG, start, len);
+
+	if (sig_len > tmpl->sig_max) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "Signature too large");
+		jwt_freemem(out);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	out[len++] = '.';
+	jwt_base64uri_encode_buf(out + len, sig, sig_len);
+
+	return out;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* Stage tracing. Nothing here is used unless a checker or builder has a
+ * trace or slow callback, in which case each operation gets a jwt_trace
+ * on its stack for the stages to report to. */
+
+uint64_t jwt_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int jwt_trace_open(struct jwt_trace *tr, const struct jwt_common *c,
+		   int builder)
+{
+	if (c->trace_cb == NULL && c->slow_cb == NULL)
+		return 0;
+
+	tr->cb = c->trace_cb;
+	tr->ctx = c->trace_ctx;
+	tr->capture = c->slow_cb != NULL;
+
+	/* Only the header is cleared, the spans are filled as we go */
+	memset(&tr->op, 0, offsetof(jwt_trace_op_t, spans));
+	tr->op.builder = builder;
+	tr->op.start_ns = jwt_now_ns();
+
+	return 1;
+}
+
+void jwt_trace_span(struct jwt_trace *tr, jwt_trace_stage_t stage,
+		    uint64_t start, size_t bytes)
+{
+	jwt_trace_span_t span = {
+		.stage		= stage,
+		.start_ns	= start,
+		.end_ns		= jwt_now_ns(),
+		.bytes		= bytes,
+	};
+
+	if (tr->cb)
+		tr->cb(&span, tr->ctx);
+
+	if (!tr->capture)
+		return;
+
+	if (tr->op.count < JWT_TRACE_MAX_SPANS)
+		tr->op.spans[tr->op.count++] = span;
+	else
+		tr->op.dropped++; // LCOV_EXCL_LINE
+}
+
+void jwt_trace_close(struct jwt_trace *tr, struct jwt_common *c,
+		     const jwt_t *jwt, size_t bytes)
+{
+	unsigned int seen;
+
+	if (!tr->capture)
+		return;
+
+	tr->op.end_ns = jwt_now_ns();
+	if (tr->op.end_ns - tr->op.start_ns < c->slow_ns)
+		return;
+
+	/* One in every slow_sample gets reported */
+	seen = __atomic_fetch_add(&c->slow_seen, 1, __ATOMIC_RELAXED);
+	if (c->slow_sample > 1 && seen % c->slow_sample)
+		return;
+
+	tr->op.alg = jwt->alg;
+	tr->op.error = jwt->error;
+	tr->op.bytes = bytes;
+
+	c->slow_cb(&tr->op, c->slow_ctx);
+}
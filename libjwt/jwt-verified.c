@@ -0,0 +1,128 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* What is left of a jwt_t once it has been verified. The JSON is moved
+ * over, not copied, and nothing changes it after that, so any number of
+ * threads can read it as long as they hold a reference. */
+struct jwt_verified {
+	unsigned int refs;
+	jwt_alg_t alg;
+	json_t *claims;
+	json_t *headers;
+	uint64_t scopes;
+};
+
+jwt_verified_t *jwt_verified_take(jwt_t *jwt)
+{
+	jwt_verified_t *v = jwt_malloc(sizeof(*v));
+
+	if (v == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	v->refs = 1;
+	v->alg = jwt->alg;
+	v->claims = jwt->claims;
+	v->headers = jwt->headers;
+	v->scopes = jwt->scopes;
+
+	jwt->claims = NULL;
+	jwt->headers = NULL;
+
+	return v;
+}
+
+jwt_verified_t *jwt_verified_ref(jwt_verified_t *verified)
+{
+	if (verified)
+		__atomic_add_fetch(&verified->refs, 1, __ATOMIC_RELAXED);
+
+	return verified;
+}
+
+void jwt_verified_unref(jwt_verified_t *verified)
+{
+	if (verified == NULL)
+		return;
+
+	if (__atomic_sub_fetch(&verified->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	json_decref(verified->claims);
+	json_decref(verified->headers);
+
+	jwt_freemem(verified);
+}
+
+static jwt_value_error_t __verified_get(const json_t *which,
+					jwt_value_t *value)
+{
+	if (value == NULL)
+		return JWT_VALUE_ERR_INVALID;
+
+	if (which == NULL)
+		return value->error = JWT_VALUE_ERR_INVALID;
+
+	/* Getters only read, despite the type */
+	return __getter((json_t *)which, value);
+}
+
+jwt_value_error_t jwt_verified_header_get(const jwt_verified_t *verified,
+					  jwt_value_t *value)
+{
+	return __verified_get(verified ? verified->headers : NULL, value);
+}
+
+jwt_value_error_t jwt_verified_claim_get(const jwt_verified_t *verified,
+					 jwt_value_t *value)
+{
+	return __verified_get(verified ? verified->claims : NULL, value);
+}
+
+jwt_alg_t jwt_verified_alg(const jwt_verified_t *verified)
+{
+	if (verified == NULL)
+		return JWT_ALG_INVAL;
+
+	return verified->alg;
+}
+
+unsigned long long jwt_verified_scopes(const jwt_verified_t *verified)
+{
+	if (verified == NULL)
+		return 0;
+
+	return verified->scopes;
+}
+
+int jwt_verified_claims_view(const jwt_verified_t *verified, jwt_view_t *view)
+{
+	if (verified == NULL || view == NULL)
+		return 1;
+
+	view->node = verified->claims;
+
+	return 0;
+}
+
+int jwt_verified_headers_view(const jwt_verified_t *verified,
+			      jwt_view_t *view)
+{
+	if (verified == NULL || view == NULL)
+		return 1;
+
+	view->node = verified->headers;
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <jwt.h>
+#include <jwt-verifier.h>
+
+#include "jwt-private.h"
+
+/* The library side of jwt-verifier.h. Everything up to the signature is
+ * done inline by the caller, so all we keep is the key and its plan. The
+ * key is referenced, so it can be freed from its set while we live. */
+
+struct jwt_verifier {
+	jwt_alg_t alg;
+	const jwk_item_t *key;
+	jwt_plan_t plan;
+};
+
+jwt_verifier_t *jwt_verifier_new(jwt_alg_t alg, const jwk_item_t *key)
+{
+	jwt_verifier_t *v;
+
+	if (key == NULL)
+		return NULL;
+
+	/* Same rules as setkey */
+	if (alg == JWT_ALG_NONE)
+		alg = key->alg;
+	else if (key->alg != JWT_ALG_NONE && key->alg != alg)
+		return NULL;
+
+	if (alg == JWT_ALG_NONE || alg >= JWT_ALG_INVAL)
+		return NULL;
+
+	v = jwt_malloc(sizeof(*v));
+	if (v == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(v, 0, sizeof(*v));
+	v->alg = alg;
+	v->key = jwks_item_ref(key);
+
+	jwt_plan_init(&v->plan, alg, key, NULL);
+
+	return v;
+}
+
+void jwt_verifier_free(jwt_verifier_t *v)
+{
+	if (v == NULL)
+		return;
+
+	jwt_plan_free(&v->plan);
+	jwks_item_unref(v->key);
+	jwt_freemem(v);
+}
+
+int jwt_verifier_sig(const jwt_verifier_t *v, jwt_alg_t alg, const char *head,
+		     size_t head_len, const unsigned char *sig, size_t sig_len)
+{
+	char_auto *sig_b64 = NULL;
+	jwt_t jwt;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	if (v == NULL || alg != v->alg)
+		return 1;
+
+	memset(&jwt, 0, sizeof(jwt));
+	jwt.alg = v->alg;
+	jwt.key = v->key;
+
+	if (jwt_plan_match(&v->plan, &jwt))
+		return v->plan.ops->plan_verify(&jwt, v->plan.pctx, head,
+						head_len, sig, sig_len);
+
+	/* No plan from these ops, or the ops changed since. This is the
+	 * same path the checker takes. */
+	if (jwt_base64uri_encode(&sig_b64, (const char *)sig, sig_len) < 0)
+		return 1; // LCOV_EXCL_LINE
+
+	jwt_verify_sig(&jwt, head, head_len, sig_b64);
+
+	return jwt.error;
+}
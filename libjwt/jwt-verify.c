@@ -14,20 +14,106 @@
 
 #include "jwt-private.h"
 
-static json_t *jwt_base64uri_decode_to_json(char *src)
+/* One pass over JSON text, before it is parsed, to see if it is within
+ * the checker's limits. This doesn't validate anything, jansson does
+ * that after, so it only has to get the counting right for valid JSON. */
+static int __json_over_limits(const char *js, int len,
+			      const jwt_limits_t *limits)
 {
+	unsigned int depth = 0, members = 0;
+	const char *str = NULL;
+	int opened = 0;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		char c = js[i];
+
+		if (str != NULL) {
+			if (c == '\\')
+				i++;
+			else if (c == '"') {
+				if (limits->json_string &&
+				    (size_t)(js + i - str) > limits->json_string)
+					return 1;
+				str = NULL;
+			}
+			continue;
+		}
+
+		switch (c) {
+		case ' ': case '\t': case '\n': case '\r':
+			continue;
+
+		case '{': case '[':
+			if (opened)
+				members++;
+			if (++depth > limits->json_depth && limits->json_depth)
+				return 1;
+			opened = 1;
+			continue;
+
+		case '}': case ']':
+			depth--;
+			opened = 0;
+			continue;
+
+		case ',':
+			members++;
+			break;
+
+		case '"':
+			str = js + i + 1;
+			/* Fall through */
+		default:
+			if (opened)
+				members++;
+		}
+
+		opened = 0;
+		if (limits->json_members && members > limits->json_members)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Payloads at least this long (encoded) are decoded as they are parsed */
+#define JSON_STREAM_MIN	4096
+
+static json_t *jwt_base64uri_decode_to_json(jwt_t *jwt, char *src)
+{
+	uint64_t start = jwt_trace_begin(jwt);
+	size_t src_len = strlen(src);
 	json_t *js;
 	char *buf;
 	int len;
 
+	/* The limits need the whole text first, so they can't stream */
+	if (src_len >= JSON_STREAM_MIN &&
+	    !(jwt->checker && jwt->checker->json_limits)) {
+		js = jwt_json_load_b64(src, src_len, 0);
+		jwt_trace_end(jwt, JWT_TRACE_JSON, start, src_len);
+		return js;
+	}
+
 	buf = jwt_base64uri_decode(src, &len);
+	jwt_trace_end(jwt, JWT_TRACE_BASE64, start, src_len);
 
 	if (buf == NULL)
 		return NULL; // LCOV_EXCL_LINE
 
 	buf[len] = '\0';
 
-	js = json_loads(buf, 0, NULL);
+	if (jwt->checker && jwt->checker->json_limits &&
+	    __json_over_limits(buf, len, &jwt->checker->limits)) {
+		jwt_write_errcode(jwt, JWT_ERR_JSON_LIMIT);
+		jwt_freemem(buf);
+		return NULL;
+	}
+
+	start = jwt_trace_begin(jwt);
+	js = jwt_json_loadb(buf, len, 0);
+	jwt_trace_end(jwt, JWT_TRACE_JSON, start, len);
 
 	jwt_freemem(buf);
 
@@ -39,9 +125,9 @@ static int jwt_parse_payload(jwt_t *jwt, char *payload)
 	if (jwt->claims)
 		json_decrefp(&(jwt->claims));
 
-	jwt->claims = jwt_base64uri_decode_to_json(payload);
+	jwt->claims = jwt_base64uri_decode_to_json(jwt, payload);
 	if (!jwt->claims) {
-		jwt_write_error(jwt, "Error parsing payload");
+		jwt_write_errcode(jwt, JWT_ERR_PAYLOAD);
 		return 1;
 	}
 
@@ -55,9 +141,9 @@ static int jwt_parse_head(jwt_t *jwt, char *head)
 	if (jwt->headers)
 		json_decrefp(&(jwt->headers));
 
-	jwt->headers = jwt_base64uri_decode_to_json(head);
+	jwt->headers = jwt_base64uri_decode_to_json(jwt, head);
 	if (!jwt->headers) {
-		jwt_write_error(jwt, "Error parsing header");
+		jwt_write_errcode(jwt, JWT_ERR_HEADER);
 		return 1;
 	}
 
@@ -70,64 +156,213 @@ static int jwt_parse_head(jwt_t *jwt, char *head)
 		jwt->alg = jwt_str_alg(alg);
 
 		if (jwt->alg >= JWT_ALG_INVAL) {
-			jwt_write_error(jwt, "Invalid ALG: [%s]", alg);
+			jwt_write_errcode(jwt, JWT_ERR_BAD_ALG);
+			return 1;
+		}
+
+		/* Before we spend anything on the payload */
+		if (jwt->checker && jwt->checker->algs &&
+		    !(jwt->checker->algs & JWT_ALG_BIT(jwt->alg))) {
+			jwt_write_errcode(jwt, JWT_ERR_ALG_DENIED);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 			return 1;
 		}
 
 		return 0;
 	}
 
+	jwt_write_errcode(jwt, JWT_ERR_NO_ALG);
+
 	return 1;
 }
 
-int jwt_parse(jwt_t *jwt, const char *token, unsigned int *len)
+/* Base64url length of an n byte signature, with no padding */
+#define __SIG_B64(__n) (((__n) * 4 + 2) / 3)
+
+/* Whether a signature of sig_len base64url chars could be right for
+ * alg. Without a key, any size of RSA key is allowed. */
+static int __sig_len_ok(jwt_alg_t alg, const jwk_item_t *key, size_t sig_len)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+		return sig_len == __SIG_B64(32);
+	case JWT_ALG_HS384:
+		return sig_len == __SIG_B64(48);
+	case JWT_ALG_HS512:
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return sig_len == __SIG_B64(64);
+	case JWT_ALG_ES384:
+		return sig_len == __SIG_B64(96);
+	case JWT_ALG_ES512:
+		return sig_len == __SIG_B64(132);
+	case JWT_ALG_EDDSA:
+		/* Ed25519 or Ed448 */
+		return sig_len == __SIG_B64(64) || sig_len == __SIG_B64(114);
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS256:
+	case JWT_ALG_PS384:
+	case JWT_ALG_PS512:
+		if (key == NULL || !key->bits)
+			return 1;
+		return sig_len == __SIG_B64((key->bits + 7) / 8);
+	default:
+		return 1;
+	}
+}
+
+/* Checks that only need the header, done before the payload is decoded
+ * when the checker asks for it. Without a callback, the checker's alg
+ * and key, or the ring key for the header's kid, are the ones that will
+ * be used, so we can hold the token to them now. With one, the callback
+ * may change them, so only the signature length against the header's
+ * alg is checked. */
+static int __fail_fast(jwt_t *jwt, size_t payload_len, size_t sig_len)
 {
+	jwt_checker_t *checker = jwt->checker;
+	jwt_fail_fast_stats_t *ff = &checker->ff_stats;
+	const jwk_item_t *key = NULL;
+	unsigned long *counter;
+
+	if (checker->c.cb == NULL) {
+		jwt_alg_t expect = checker->c.alg;
+		const char *kid;
+
+		key = checker->c.key;
+		if (key == NULL && checker->ring != NULL &&
+		    jwks_ring_pick(jwt, jwt->keys, &key, &expect)) {
+			counter = jwt->fail == JWT_METRIC_ERR_KEY ?
+				&ff->kid : &ff->alg;
+			goto rejected;
+		}
+
+		if (expect == JWT_ALG_NONE && key != NULL)
+			expect = key->alg;
+
+		if ((key != NULL || checker->c.alg != JWT_ALG_NONE) &&
+		    jwt->alg != expect) {
+			jwt_write_errcode(jwt, checker->c.alg == JWT_ALG_NONE ?
+					  JWT_ERR_KEY_ALG : JWT_ERR_CONFIG_ALG);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
+			counter = &ff->alg;
+			goto rejected;
+		}
+
+		kid = json_string_value(json_object_get(jwt->headers, "kid"));
+		if (key != NULL && key->kid != NULL && kid != NULL &&
+		    strcmp(kid, key->kid)) {
+			jwt_write_errcode(jwt, JWT_ERR_KID);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_KEY);
+			counter = &ff->kid;
+			goto rejected;
+		}
+	}
+
+	/* No signature at all is reported the usual way */
+	if (sig_len && !__sig_len_ok(jwt->alg, key, sig_len)) {
+		jwt_write_errcode(jwt, JWT_ERR_SIG_LEN);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_SIG);
+		counter = &ff->sig_len;
+		goto rejected;
+	}
+
+	return 0;
+
+rejected:
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ff->payload_bytes, payload_len, __ATOMIC_RELAXED);
+
+	return 1;
+}
+
+int jwt_parse(jwt_t *jwt, const char *token, size_t token_len, char **buf,
+	      unsigned int *len)
+{
+	const jwt_limits_t *limits = jwt->checker ? &jwt->checker->limits : NULL;
+	uint64_t start = jwt_trace_begin(jwt);
+	const char *dot1, *dot2;
 	char_auto *head = NULL;
 	char *payload, *sig;
-	int head_len = strlen(token) + 1;
 
-	head = jwt_malloc(head_len);
-	if (!head) {
-		// LCOV_EXCL_START
-		jwt_write_error(jwt, "Error allocating memory");
+	JWT_ALLOC_SCOPE(JWT_ALLOC_PARSE);
+
+	/* Everything we can tell from the token as given comes first, so
+	 * a bad one costs nothing but a scan of it. */
+	if (limits && limits->token_len && token_len > limits->token_len) {
+		jwt_write_errcode(jwt, JWT_ERR_LIMIT);
 		return 1;
-		// LCOV_EXCL_STOP
 	}
 
-	/* head_len includes nil */
-	memcpy(head, token, head_len);
+	if (memchr(token, '\0', token_len) != NULL) {
+		jwt_write_errcode(jwt, JWT_ERR_TOKEN_NIL);
+		return 1;
+	}
 
 	/* Find the components. */
-	for (payload = head; payload[0] != '.'; payload++) {
-		if (payload[0] == '\0') {
-			jwt_write_error(jwt,
-				"No dot found looking for end of header");
-			return 1;
-		}
+	dot1 = memchr(token, '.', token_len);
+	if (dot1 == NULL) {
+		jwt_write_errcode(jwt, JWT_ERR_NO_HEADER_DOT);
+		return 1;
 	}
 
-	payload[0] = '\0';
-	payload++;
+	dot2 = memchr(dot1 + 1, '.', token_len - (dot1 + 1 - token));
+	if (dot2 == NULL) {
+		jwt_write_errcode(jwt, JWT_ERR_NO_PAYLOAD_DOT);
+		return 1;
+	}
 
-	for (sig = payload; sig[0] != '.'; sig++) {
-		if (sig[0] == '\0') {
-			jwt_write_error(jwt,
-				"No dot found looking for end of payload");
-			return 1;
-		}
+	if (limits && ((limits->header_len &&
+			(size_t)(dot1 - token) > limits->header_len) ||
+		       (limits->payload_len &&
+			(size_t)(dot2 - dot1 - 1) > limits->payload_len) ||
+		       (limits->sig_len &&
+			token_len - (dot2 + 1 - token) > limits->sig_len))) {
+		jwt_write_errcode(jwt, JWT_ERR_LIMIT);
+		return 1;
+	}
+
+	head = jwt_malloc(token_len + 1);
+	if (!head) {
+		// LCOV_EXCL_START
+		jwt_write_errcode(jwt, JWT_ERR_NOMEM);
+		return 1;
+		// LCOV_EXCL_STOP
 	}
 
+	/* The token may not be nil terminated, but our copy is */
+	memcpy(head, token, token_len);
+	head[token_len] = '\0';
+
+	payload = head + (dot1 - token);
+	payload[0] = '\0';
+	payload++;
+
+	sig = head + (dot2 - token);
 	sig[0] = '\0';
 
+	jwt_trace_end(jwt, JWT_TRACE_SPLIT, start, token_len);
+
 	/* Now that we have everything split up, let's check out the
 	 * header. */
 	if (jwt_parse_head(jwt, head))
 		return 1;
 
+	if (jwt->checker && jwt->checker->fail_fast &&
+	    __fail_fast(jwt, dot2 - dot1 - 1, token_len - (dot2 + 1 - token)))
+		return 1;
+
 	if (jwt_parse_payload(jwt, payload))
 		return 1;
 
+	/* Put it back together for the signature check */
+	payload[-1] = '.';
+	sig[0] = '.';
+
 	*len = sig - head;
+	*buf = head;
+	head = NULL;
 
 	return 0;
 }
@@ -205,22 +440,54 @@ static jwt_claims_t __verify_claims(jwt_t *jwt)
 	return failed;
 }
 
+/* The first of the failed claims, in the order they are checked */
+static jwt_metric_t __claim_fail(jwt_claims_t failed)
+{
+	if (failed & JWT_CLAIM_EXP)
+		return JWT_METRIC_ERR_EXP;
+	if (failed & JWT_CLAIM_NBF)
+		return JWT_METRIC_ERR_NBF;
+	if (failed & JWT_CLAIM_ISS)
+		return JWT_METRIC_ERR_ISS;
+	if (failed & JWT_CLAIM_SUB)
+		return JWT_METRIC_ERR_SUB;
+	if (failed & JWT_CLAIM_AUD)
+		return JWT_METRIC_ERR_AUD;
+
+	/* A policy on a claim we don't have a metric for */
+	return JWT_METRIC_ERR_OTHER;
+}
+
 /* This is after parsing and possibly a user callback. */
 static int __verify_config_post(jwt_t *jwt, const jwt_config_t *config,
 				unsigned int sig_len)
 {
+	uint64_t start = jwt_trace_begin(jwt);
+	jwt_error_t err = JWT_ERR_NONE;
+	jwt_claims_t failed;
+
 	/* Yes, we do this before checking a signature. */
-	if (__verify_claims(jwt)) {
-		/* TODO Pass back the ORd list of claims failed. */
-		jwt_write_error(jwt, "Failed one or more claims");
+	failed = __verify_claims(jwt);
+	if (failed)
+		err = JWT_ERR_CLAIMS;
+	else if (jwt->checker && jwt->checker->policy &&
+		 jwt_matcher_check(jwt->checker->policy, jwt->claims, &failed))
+		err = JWT_ERR_POLICY;
+	if (err == JWT_ERR_NONE && jwt->checker && jwt->checker->scopes)
+		jwt->scopes = jwt_scopes_get(jwt->checker->scopes, jwt->claims);
+	jwt_trace_end(jwt, JWT_TRACE_CLAIMS, start, 0);
+	if (err != JWT_ERR_NONE) {
+		jwt->claims_failed = failed;
+		jwt_write_errcode(jwt, err);
+		jwt_write_fail(jwt, __claim_fail(failed));
 		return 1;
 	}
 
 	if (!sig_len) {
 		if (config->key || config->alg != JWT_ALG_NONE ||
 		    jwt->alg != JWT_ALG_NONE) {
-			jwt_write_error(jwt,
-				"Expected a signature, but JWT has none");
+			jwt_write_errcode(jwt, JWT_ERR_SIG_MISSING);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 			return 1;
 		}
 
@@ -229,31 +496,35 @@ static int __verify_config_post(jwt_t *jwt, const jwt_config_t *config,
 
 	/* Signature is known to be present from this point */
 	if (jwt->alg == JWT_ALG_NONE) {
-		jwt_write_error(jwt, "JWT has signature block, but no alg set");
+		jwt_write_errcode(jwt, JWT_ERR_SIG_NO_ALG);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 		return 1;
 	}
 
 	if (config->key == NULL) {
-		jwt_write_error(jwt,
-			"JWT has signature, but no key was given");
+		jwt_write_errcode(jwt, JWT_ERR_NO_KEY);
+		jwt_write_fail(jwt, JWT_METRIC_ERR_KEY);
 		return 1;
 	}
 
 	/* Key is known to be given at this point */
 	if (config->alg == JWT_ALG_NONE) {
 		if (config->key->alg != jwt->alg) {
-			jwt_write_error(jwt, "Key alg does not match JWT");
+			jwt_write_errcode(jwt, JWT_ERR_KEY_ALG);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 			return 1;
 		}
 	} else if (config->key->alg == JWT_ALG_NONE) {
 		if (config->alg != jwt->alg) {
-			jwt_write_error(jwt, "Config alg does not match JWT");
+			jwt_write_errcode(jwt, JWT_ERR_CONFIG_ALG);
+			jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 			return 1;
 		}
 	} else if (config->alg != config->key->alg) {
 		/* It's not really possible to get here due to checks in setkey */
 		// LCOV_EXCL_START
 		jwt_write_error(jwt, "Config and key alg does not match");
+		jwt_write_fail(jwt, JWT_METRIC_ERR_ALG);
 		return 1;
 		// LCOV_EXCL_STOP
 	}
@@ -266,6 +537,7 @@ jwt_t *jwt_verify_complete(jwt_t *jwt, const jwt_config_t *config,
 {
 	const char *sig;
 	unsigned int sig_len;
+	uint64_t start;
 
 	sig = token + (payload_len + 1);
 	sig_len = strlen(sig);
@@ -281,5 +553,14 @@ jwt_t *jwt_verify_complete(jwt_t *jwt, const jwt_config_t *config,
 	/* At this point, config is never NULL */
 	jwt->key = config->key;
 
-	return jwt_verify_sig(jwt, token, payload_len, sig);
+	/* Unless a callback changed things, setkey did most of the work */
+	start = jwt_trace_begin(jwt);
+	if (jwt->checker && jwt_plan_match(&jwt->checker->plan, jwt))
+		jwt_plan_verify(&jwt->checker->plan, jwt, token, payload_len,
+				sig);
+	else
+		jwt_verify_sig(jwt, token, payload_len, sig);
+	jwt_trace_end(jwt, JWT_TRACE_SIG, start, payload_len);
+
+	return jwt;
 }
@@ -0,0 +1,264 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+/* Read-only views. A view is a json_t that we promise not to change, so
+ * none of this allocates or takes a reference. */
+
+/* Longest object member name in a JSON Pointer, once unescaped */
+#define VIEW_KEY_MAX	256
+
+#define __node(__view) ((json_t *)(__view)->node)
+
+int jwt_claims_view(const jwt_t *jwt, jwt_view_t *view)
+{
+	if (jwt == NULL || view == NULL)
+		return 1;
+
+	view->node = jwt->claims;
+
+	return 0;
+}
+
+int jwt_headers_view(const jwt_t *jwt, jwt_view_t *view)
+{
+	if (jwt == NULL || view == NULL)
+		return 1;
+
+	view->node = jwt->headers;
+
+	return 0;
+}
+
+/* Array index per RFC 6901: no leading zeros, no sign, no "-" */
+static int __pointer_index(const char *tok, size_t len, size_t *idx)
+{
+	size_t i, val = 0;
+
+	if (!len || len > 18 || (len > 1 && tok[0] == '0'))
+		return 1;
+
+	for (i = 0; i < len; i++) {
+		if (tok[i] < '0' || tok[i] > '9')
+			return 1;
+		val = val * 10 + (tok[i] - '0');
+	}
+
+	*idx = val;
+
+	return 0;
+}
+
+/* Unescape ~0 and ~1 into key, nil terminated */
+static int __pointer_key(const char *tok, size_t len, char *key)
+{
+	size_t i, o = 0;
+
+	for (i = 0; i < len; i++) {
+		if (o == VIEW_KEY_MAX - 1)
+			return 1;
+
+		if (tok[i] != '~') {
+			key[o++] = tok[i];
+			continue;
+		}
+
+		if (i + 1 == len || (tok[i + 1] != '0' && tok[i + 1] != '1'))
+			return 1;
+
+		key[o++] = tok[++i] == '0' ? '~' : '/';
+	}
+
+	key[o] = '\0';
+
+	return 0;
+}
+
+int jwt_view_pointer(const jwt_view_t *view, const char *pointer,
+		     jwt_view_t *out)
+{
+	char key[VIEW_KEY_MAX];
+	json_t *node;
+
+	if (view == NULL || pointer == NULL || out == NULL)
+		return 1;
+
+	node = __node(view);
+	if (node == NULL)
+		return 1;
+
+	if (*pointer != '\0' && *pointer != '/')
+		return 1;
+
+	while (*pointer) {
+		const char *tok = pointer + 1;
+		const char *end = strchr(tok, '/');
+		size_t len, idx;
+
+		if (end == NULL)
+			end = tok + strlen(tok);
+		len = end - tok;
+
+		if (json_is_object(node)) {
+			if (__pointer_key(tok, len, key))
+				return 1;
+			node = json_object_get(node, key);
+		} else if (json_is_array(node)) {
+			if (__pointer_index(tok, len, &idx))
+				return 1;
+			node = json_array_get(node, idx);
+		} else {
+			return 1;
+		}
+
+		if (node == NULL)
+			return 1;
+
+		pointer = end;
+	}
+
+	out->node = node;
+
+	return 0;
+}
+
+jwt_view_type_t jwt_view_type(const jwt_view_t *view)
+{
+	if (view == NULL || view->node == NULL)
+		return JWT_VIEW_NONE;
+
+	switch (json_typeof(__node(view))) {
+	case JSON_OBJECT:
+		return JWT_VIEW_OBJECT;
+	case JSON_ARRAY:
+		return JWT_VIEW_ARRAY;
+	case JSON_STRING:
+		return JWT_VIEW_STR;
+	case JSON_INTEGER:
+		return JWT_VIEW_INT;
+	case JSON_REAL:
+		return JWT_VIEW_REAL;
+	case JSON_TRUE:
+	case JSON_FALSE:
+		return JWT_VIEW_BOOL;
+	case JSON_NULL:
+		return JWT_VIEW_NULL;
+	}
+
+	return JWT_VIEW_NONE; // LCOV_EXCL_LINE
+}
+
+int jwt_view_str(const jwt_view_t *view, const char **str, size_t *len)
+{
+	if (view == NULL || str == NULL || !json_is_string(__node(view)))
+		return 1;
+
+	*str = json_string_value(__node(view));
+	if (len)
+		*len = json_string_length(__node(view));
+
+	return 0;
+}
+
+int jwt_view_int(const jwt_view_t *view, long long *val)
+{
+	if (view == NULL || val == NULL || !json_is_integer(__node(view)))
+		return 1;
+
+	*val = json_integer_value(__node(view));
+
+	return 0;
+}
+
+int jwt_view_real(const jwt_view_t *view, double *val)
+{
+	if (view == NULL || val == NULL || !json_is_number(__node(view)))
+		return 1;
+
+	*val = json_number_value(__node(view));
+
+	return 0;
+}
+
+int jwt_view_bool(const jwt_view_t *view, int *val)
+{
+	if (view == NULL || val == NULL || !json_is_boolean(__node(view)))
+		return 1;
+
+	*val = json_is_true(__node(view)) ? 1 : 0;
+
+	return 0;
+}
+
+size_t jwt_view_size(const jwt_view_t *view)
+{
+	if (view == NULL)
+		return 0;
+
+	if (json_is_array(__node(view)))
+		return json_array_size(__node(view));
+
+	/* Zero for anything that isn't an object, too */
+	return json_object_size(__node(view));
+}
+
+void jwt_view_iter_init(const jwt_view_t *view, jwt_view_iter_t *it)
+{
+	if (it == NULL)
+		return;
+
+	memset(it, 0, sizeof(*it));
+
+	if (view == NULL)
+		return;
+
+	if (json_is_object(__node(view))) {
+		it->node = view->node;
+		it->iter = json_object_iter(__node(view));
+	} else if (json_is_array(__node(view))) {
+		it->node = view->node;
+	}
+}
+
+int jwt_view_iter_next(jwt_view_iter_t *it, const char **key,
+		       jwt_view_t *val)
+{
+	json_t *node;
+
+	if (it == NULL || val == NULL || it->node == NULL)
+		return 1;
+
+	node = (json_t *)it->node;
+
+	if (json_is_array(node)) {
+		if (it->idx >= json_array_size(node))
+			return 1;
+
+		if (key)
+			*key = NULL;
+		val->node = json_array_get(node, it->idx++);
+
+		return 0;
+	}
+
+	if (it->iter == NULL)
+		return 1;
+
+	if (key)
+		*key = json_object_iter_key(it->iter);
+	val->node = json_object_iter_value(it->iter);
+	it->iter = json_object_iter_next(node, it->iter);
+
+	return 0;
+}
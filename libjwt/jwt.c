@@ -94,6 +94,47 @@ jwt_alg_t jwt_str_alg(const char *alg)
 	return JWT_ALG_INVAL;
 }
 
+/* Indexed by jwt_error_t. These are what the messages were before there
+ * were codes, so anyone matching on them still can. */
+static const char *jwt_error_strs[] = {
+	[JWT_ERR_NONE]		= "",
+	[JWT_ERR_OTHER]		= "",
+	[JWT_ERR_NOMEM]		= "Error allocating memory",
+	[JWT_ERR_NO_TOKEN]	= "Must pass a token",
+	[JWT_ERR_TOKEN_NIL]	= "Token contains a nil byte",
+	[JWT_ERR_NO_HEADER_DOT]	= "No dot found looking for end of header",
+	[JWT_ERR_NO_PAYLOAD_DOT] = "No dot found looking for end of payload",
+	[JWT_ERR_HEADER]	= "Error parsing header",
+	[JWT_ERR_PAYLOAD]	= "Error parsing payload",
+	[JWT_ERR_NO_ALG]	= "No alg found in header",
+	[JWT_ERR_BAD_ALG]	= "Invalid ALG in header",
+	[JWT_ERR_CALLBACK]	= "User callback returned error",
+	[JWT_ERR_CLAIMS]	= "Failed one or more claims",
+	[JWT_ERR_SIG_MISSING]	= "Expected a signature, but JWT has none",
+	[JWT_ERR_SIG_NO_ALG]	= "JWT has signature block, but no alg set",
+	[JWT_ERR_NO_KEY]	= "JWT has signature, but no key was given",
+	[JWT_ERR_KEY_ALG]	= "Key alg does not match JWT",
+	[JWT_ERR_CONFIG_ALG]	= "Config alg does not match JWT",
+	[JWT_ERR_SIG_DECODE]	= "Error decoding signature",
+	[JWT_ERR_SIG_VERIFY]	= "Token failed verification",
+	[JWT_ERR_SIGN]		= "Token failed signing",
+	[JWT_ERR_LIMIT]		= "Token exceeds size limits",
+	[JWT_ERR_JSON_LIMIT]	= "Token JSON exceeds limits",
+	[JWT_ERR_ALG_DENIED]	= "Alg is not allowed",
+	[JWT_ERR_KID]		= "Token kid does not match key",
+	[JWT_ERR_SIG_LEN]	= "Signature is the wrong length for alg",
+	[JWT_ERR_POLICY]	= "Failed claim policy",
+	[JWT_ERR_NO_KID]	= "Token has no kid, and no single key to use",
+};
+
+const char *jwt_error_str(jwt_error_t err)
+{
+	if (err < JWT_ERR_NONE || err >= (int)ARRAY_SIZE(jwt_error_strs))
+		return "";
+
+	return jwt_error_strs[err];
+}
+
 JWT_NO_EXPORT
 jwt_t *jwt_new(void)
 {
@@ -140,6 +181,8 @@ void *jwt_base64uri_decode(const char *src, int *ret_len)
 	char *new;
 	int len, i, z;
 
+	JWT_ALLOC_SCOPE(JWT_ALLOC_BASE64);
+
 	if (src == NULL || ret_len == NULL)
 		return NULL; // LCOV_EXCL_LINE
 			     // Should really be an abort
@@ -211,15 +254,22 @@ void *jwt_base64uri_decode(const char *src, int *ret_len)
 
 int jwt_base64uri_encode(char **_dst, const char *plain, int plain_len)
 {
-	int len, i;
 	char *dst;
 
-	len = BASE64_ENCODE_OUT_SIZE(plain_len);
-	dst = jwt_malloc(len + 1);
+	JWT_ALLOC_SCOPE(JWT_ALLOC_BASE64);
+
+	dst = jwt_malloc(BASE64_ENCODE_OUT_SIZE(plain_len) + 1);
 	if (dst == NULL)
 		return -1; // LCOV_EXCL_LINE
 	*_dst = dst;
 
+	return jwt_base64uri_encode_buf(dst, plain, plain_len);
+}
+
+int jwt_base64uri_encode_buf(char *dst, const char *plain, int plain_len)
+{
+	int len, i;
+
 	/* First, a normal base64 encoding */
 	len = base64_encode((const unsigned char *)plain, plain_len, dst);
 
@@ -232,13 +282,14 @@ int jwt_base64uri_encode(char **_dst, const char *plain, int plain_len)
 		case '/':
 			dst[i] = '_';
 			break;
-		case '=':
-			dst[i] = '\0';
-			break;
 		}
+
+		/* Padding only shows up at the end, so stop there */
+		if (dst[i] == '=')
+			break;
 	}
 
-	/* Just in case there's no padding. */
+	/* Drops the padding, or terminates if there was none. */
 	dst[i] = '\0';
 
 	return i;
@@ -333,9 +384,13 @@ static int __check_key_bits(jwt_t *jwt)
 	return 1; // LCOV_EXCL_LINE
 }
 
-int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
-	     unsigned int str_len)
+static int __sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
+		  unsigned int str_len)
 {
+	struct jwt_crypto_ops *ops = jwt_ops_get(jwt);
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
 	switch (jwt->alg) {
 	/* HMAC */
 	case JWT_ALG_HS256:
@@ -343,13 +398,13 @@ int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
 	case JWT_ALG_HS512:
 		if (__check_hmac(jwt))
 			return 1;
-		if (jwt_ops->sign_sha_hmac(jwt, out, len, str, str_len)) {
+		if (ops->sign_sha_hmac(jwt, out, len, str, str_len)) {
 			/* There's not really a way to induce failure here,
 			 * and there's not really much of a chance this can fail
 			 * other than an internal fatal error in the crypto
 			 * library. */
 			// LCOV_EXCL_START
-			jwt_write_error(jwt, "Token failed signing");
+			jwt_write_errcode_late(jwt, JWT_ERR_SIGN);
 			return 1;
 			// LCOV_EXCL_STOP
 		} else {
@@ -376,8 +431,8 @@ int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
 	case JWT_ALG_EDDSA:
 		if (__check_key_bits(jwt))
 			return 1;
-		if (jwt_ops->sign_sha_pem(jwt, out, len, str, str_len)) {
-			jwt_write_error(jwt, "Token failed signing");
+		if (ops->sign_sha_pem(jwt, out, len, str, str_len)) {
+			jwt_write_errcode_late(jwt, JWT_ERR_SIGN);
 			return 1;
 		} else {
 			return 0;
@@ -392,40 +447,40 @@ int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
 	}
 }
 
-static int _verify_sha_hmac(jwt_t *jwt, const char *head,
-			    unsigned int head_len, const char *sig)
+int jwt_sign(jwt_t *jwt, char **out, unsigned int *len, const char *str,
+	     unsigned int str_len)
 {
-	char_auto *res = NULL;
-	char_auto *buf = NULL;
-	unsigned int res_len;
 	int ret;
 
-	ret = jwt_sign(jwt, &res, &res_len, head, head_len);
-	if (ret)
-		return 1; // LCOV_EXCL_LINE
+	JWT_PROBE3(sign__entry, jwt->alg, JWT_PROBE_KID(jwt), str_len);
+	ret = __sign(jwt, out, len, str, str_len);
+	JWT_PROBE4(sign__return, jwt->alg, JWT_PROBE_KID(jwt), str_len, ret);
 
-	ret = jwt_base64uri_encode(&buf, res, res_len);
-	if (ret <= 0)
-		return 1; // LCOV_EXCL_LINE
+	return ret;
+}
 
-	return jwt_strcmp(buf, sig) ? 1 : 0;
+static int __is_hmac(jwt_alg_t alg)
+{
+	return alg == JWT_ALG_HS256 || alg == JWT_ALG_HS384 ||
+		alg == JWT_ALG_HS512;
 }
 
-jwt_t *jwt_verify_sig(jwt_t *jwt, const char *head, unsigned int head_len,
-		      const char *sig_b64)
+int jwt_digest_init(jwt_digest_t *d, jwt_t *jwt, int verify)
 {
-	int sig_len;
-	unsigned char *sig = NULL;
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
 
-	sig = jwt_base64uri_decode(sig_b64, &sig_len);
+	memset(d, 0, sizeof(*d));
+	d->jwt = jwt;
+	d->ops = jwt_ops_get(jwt);
+	d->verify = verify;
 
 	switch (jwt->alg) {
 	/* HMAC */
 	case JWT_ALG_HS256:
 	case JWT_ALG_HS384:
 	case JWT_ALG_HS512:
-		if (_verify_sha_hmac(jwt, head, head_len, sig_b64))
-			jwt_write_error(jwt, "Token failed verification");
+		if (__check_hmac(jwt))
+			return 1;
 		break;
 
 	/* RSA */
@@ -443,29 +498,269 @@ jwt_t *jwt_verify_sig(jwt_t *jwt, const char *head, unsigned int head_len,
 	case JWT_ALG_ES256K:
 	case JWT_ALG_ES384:
 	case JWT_ALG_ES512:
+		if (__check_key_bits(jwt))
+			return 1;
+		break;
 
-	/* EdDSA */
+	/* EdDSA signs the message itself, not a digest of it, so we have
+	 * to collect the pieces. */
 	case JWT_ALG_EDDSA:
-		if (__check_key_bits(jwt))
-			break;
+		return __check_key_bits(jwt);
+
+	/* You wut, mate? */
+	// LCOV_EXCL_START
+	default:
+		jwt_write_error(jwt, "Unknown algorigthm");
+		return 1;
+	// LCOV_EXCL_STOP
+	}
+
+	if (d->ops->digest_init == NULL)
+		return 0; // LCOV_EXCL_LINE
+
+	d->dctx = d->ops->digest_init(jwt, verify);
+	if (d->dctx == NULL) {
+		jwt_write_errcode_late(jwt, verify ? JWT_ERR_SIG_VERIFY :
+				       JWT_ERR_SIGN);
+		return 1;
+	}
+
+	return 0;
+}
+
+int jwt_digest_update(jwt_digest_t *d, const char *buf, unsigned int len)
+{
+	unsigned int size;
+	char *new_buf;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	d->total += len;
+
+	if (d->dctx) {
+		if (d->ops->digest_update(d->dctx, buf, len)) {
+			// LCOV_EXCL_START
+			jwt_write_error(d->jwt, "Error updating digest");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+		return 0;
+	}
+
+	/* The first piece is used where it is, so a single contiguous
+	 * input never gets copied. */
+	if (d->data == NULL) {
+		d->data = buf;
+		d->len = len;
+		return 0;
+	}
+
+	if (d->len + len > d->size) {
+		size = (d->len + len) * 2;
+		new_buf = jwt_malloc(size);
+		if (new_buf == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(d->jwt, "Error allocating memory");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+
+		memcpy(new_buf, d->data, d->len);
+		jwt_freemem(d->buf);
+		d->buf = new_buf;
+		d->data = new_buf;
+		d->size = size;
+	}
+
+	memcpy(d->buf + d->len, buf, len);
+	d->len += len;
+
+	return 0;
+}
+
+int jwt_digest_sign(jwt_digest_t *d, char **out, unsigned int *len)
+{
+	jwt_t *jwt = d->jwt;
+	int ret;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	JWT_PROBE3(sign__entry, jwt->alg, JWT_PROBE_KID(jwt), d->total);
+
+	if (d->dctx)
+		ret = d->ops->digest_sign(jwt, d->dctx, out, len);
+	else if (__is_hmac(jwt->alg))
+		ret = d->ops->sign_sha_hmac(jwt, out, len, d->data, d->len); // LCOV_EXCL_LINE
+	else
+		ret = d->ops->sign_sha_pem(jwt, out, len, d->data, d->len);
+
+	if (ret)
+		jwt_write_errcode_late(jwt, JWT_ERR_SIGN);
+
+	JWT_PROBE4(sign__return, jwt->alg, JWT_PROBE_KID(jwt), d->total, ret);
+
+	return ret;
+}
+
+static int __digest_verify(jwt_digest_t *d, const char *sig_b64)
+{
+	jwt_t *jwt = d->jwt;
+	unsigned char *sig;
+	int sig_len, ret;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	switch (jwt->alg) {
+	/* HMAC is just signing it again and comparing */
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512: {
+		char_auto *res = NULL;
+		char_auto *buf = NULL;
+		unsigned int res_len;
+
+		if (jwt_digest_sign(d, &res, &res_len))
+			return 1; // LCOV_EXCL_LINE
+
+		if (jwt_base64uri_encode(&buf, res, res_len) <= 0)
+			return 1; // LCOV_EXCL_LINE
+
+		ret = jwt_strcmp(buf, sig_b64) ? 1 : 0;
+		break;
+	}
 
+	default:
 		sig = jwt_base64uri_decode(sig_b64, &sig_len);
 		if (sig == NULL) {
-			jwt_write_error(jwt, "Error decoding signature");
-			break;
+			jwt_write_errcode(jwt, JWT_ERR_SIG_DECODE);
+			return 1;
 		}
 
-		if (jwt_ops->verify_sha_pem(jwt, head, head_len, sig, sig_len))
-			jwt_write_error(jwt, "Token failed verification");
+		if (d->dctx)
+			ret = d->ops->digest_verify(jwt, d->dctx, sig, sig_len);
+		else
+			ret = d->ops->verify_sha_pem(jwt, d->data, d->len,
+						      sig, sig_len);
 
 		jwt_freemem(sig);
-		break;
+	}
 
-	/* You wut, mate? */
-	// LCOV_EXCL_START
-	default:
-		jwt_write_error(jwt, "Unknown algorigthm");
-	} // LCOV_EXCL_STOP
+	if (ret)
+		jwt_write_errcode_late(jwt, JWT_ERR_SIG_VERIFY);
+
+	return ret;
+}
+
+/* For HMAC, this shows up as a sign inside the verify */
+int jwt_digest_verify(jwt_digest_t *d, const char *sig_b64)
+{
+	int ret;
+
+	JWT_PROBE3(sig_verify__entry, d->jwt->alg, JWT_PROBE_KID(d->jwt),
+		   d->total);
+	ret = __digest_verify(d, sig_b64);
+	JWT_PROBE4(sig_verify__return, d->jwt->alg, JWT_PROBE_KID(d->jwt),
+		   d->total, ret);
+
+	return ret;
+}
+
+void jwt_digest_free(jwt_digest_t *d)
+{
+	if (d->dctx)
+		d->ops->digest_free(d->dctx);
+
+	jwt_freemem(d->buf);
+	memset(d, 0, sizeof(*d));
+}
+
+jwt_t *jwt_verify_sig(jwt_t *jwt, const char *head, unsigned int head_len,
+		      const char *sig_b64)
+{
+	jwt_digest_t d;
+
+	if (!jwt_digest_init(&d, jwt, 1) &&
+	    !jwt_digest_update(&d, head, head_len))
+		jwt_digest_verify(&d, sig_b64);
+
+	jwt_digest_free(&d);
 
 	return jwt;
 }
+
+void jwt_plan_init(jwt_plan_t *p, jwt_alg_t alg, const jwk_item_t *key,
+		   struct jwt_crypto_ops *ops)
+{
+	jwt_t jwt;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	memset(p, 0, sizeof(*p));
+
+	if (key == NULL)
+		return;
+
+	/* With no alg given, tokens have to match the key's */
+	if (alg == JWT_ALG_NONE)
+		alg = key->alg;
+
+	memset(&jwt, 0, sizeof(jwt));
+	jwt.alg = alg;
+	jwt.key = key;
+	jwt.ops = ops;
+
+	p->alg = alg;
+	p->key = key;
+	p->ops = jwt_ops_get(&jwt);
+
+	if (p->ops->plan_new == NULL)
+		return;
+
+	/* A key that won't work gets no plan, and the error is reported
+	 * for each token, as it always has been. */
+	if (__is_hmac(alg) ? __check_hmac(&jwt) : __check_key_bits(&jwt))
+		return;
+
+	p->pctx = p->ops->plan_new(&jwt);
+}
+
+int jwt_plan_match(const jwt_plan_t *p, const jwt_t *jwt)
+{
+	return p->pctx != NULL && p->alg == jwt->alg && p->key == jwt->key &&
+		p->ops == jwt_ops_get(jwt);
+}
+
+int jwt_plan_verify(const jwt_plan_t *p, jwt_t *jwt, const char *head,
+		    unsigned int head_len, const char *sig_b64)
+{
+	unsigned char *sig;
+	int sig_len;
+
+	JWT_ALLOC_SCOPE(JWT_ALLOC_CRYPTO);
+
+	JWT_PROBE3(sig_verify__entry, jwt->alg, JWT_PROBE_KID(jwt), head_len);
+
+	sig = jwt_base64uri_decode(sig_b64, &sig_len);
+	if (sig == NULL) {
+		jwt_write_errcode(jwt, JWT_ERR_SIG_DECODE);
+	} else {
+		if (p->ops->plan_verify(jwt, p->pctx, head, head_len, sig,
+					sig_len))
+			jwt_write_errcode_late(jwt, JWT_ERR_SIG_VERIFY);
+
+		jwt_freemem(sig);
+	}
+
+	JWT_PROBE4(sig_verify__return, jwt->alg, JWT_PROBE_KID(jwt), head_len,
+		   jwt->error);
+
+	return jwt->error;
+}
+
+void jwt_plan_free(jwt_plan_t *p)
+{
+	if (p->pctx)
+		p->ops->plan_free(p->pctx);
+
+	memset(p, 0, sizeof(*p));
+}
@@ -85,28 +85,52 @@ static int mbedtls_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
 	return 0;
 }
 
+static const mbedtls_md_info_t *mbedtls_alg_md(jwt_alg_t alg)
+{
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_RS256:
+	case JWT_ALG_PS256:
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+	case JWT_ALG_HS384:
+	case JWT_ALG_RS384:
+	case JWT_ALG_PS384:
+	case JWT_ALG_ES384:
+		return mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
+	case JWT_ALG_HS512:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS512:
+	case JWT_ALG_ES512:
+		return mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
+	default:
+		return NULL;
+	}
+}
+
 #define SIGN_ERROR(_msg) { jwt_write_error(jwt, "JWT[MbedTLS]: " _msg); goto sign_clean_key; }
 
-static int mbedtls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-				const char *str, unsigned int str_len)
+/* Sign a digest that has already been computed */
+static int mbedtls_sign_hash(jwt_t *jwt, const mbedtls_md_info_t *md_info,
+			     const unsigned char *hash, char **out,
+			     unsigned int *len)
 {
 	size_t out_size;
 	mbedtls_pk_context pk;
-	const mbedtls_md_info_t *md_info;
-	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
 	unsigned char sig[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
 	mbedtls_entropy_context entropy;
 	mbedtls_ctr_drbg_context ctr_drbg;
 	size_t sig_len = 0;
 	const char *pers = "libjwt_ecdsa_sign";
 
-	if (jwt->key->pem == NULL)
-		SIGN_ERROR("Key is not compatible"); // LCOV_EXCL_LINE
-
 	mbedtls_pk_init(&pk);
 	mbedtls_entropy_init(&entropy);
 	mbedtls_ctr_drbg_init(&ctr_drbg);
 
+	if (jwt->key->pem == NULL)
+		SIGN_ERROR("Key is not compatible"); // LCOV_EXCL_LINE
+
 	if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func,
 			&entropy, (const unsigned char *)pers, strlen(pers)))
 		SIGN_ERROR("Failed RNG setup"); // LCOV_EXCL_LINE
@@ -117,82 +141,34 @@ static int mbedtls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
 				 NULL, 0, NULL, NULL))
 		SIGN_ERROR("Error parsing private key"); // LCOV_EXCL_LINE
 
-	/* Determine the hash algorithm */
-	switch (jwt->alg) {
-	case JWT_ALG_RS256:
-	case JWT_ALG_PS256:
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES256K:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-		break;
-	case JWT_ALG_RS384:
-	case JWT_ALG_PS384:
-	case JWT_ALG_ES384:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
-		break;
-	case JWT_ALG_RS512:
-	case JWT_ALG_PS512:
-	case JWT_ALG_ES512:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
-		break;
-	default:
-		SIGN_ERROR("Unsupported algorithm"); // LCOV_EXCL_LINE
-	}
-
-	/* Compute the hash of the input string */
-	if (mbedtls_md(md_info, (unsigned char *)str, str_len, hash))
-		SIGN_ERROR("Error initializing md context"); // LCOV_EXCL_LINE
-
 	/* For EC keys, convert signature to R/S format */
 	if (mbedtls_pk_can_do(&pk, MBEDTLS_PK_ECDSA)) {
-		mbedtls_mpi r, s;
-		mbedtls_ecdsa_context ecdsa;
-		int adj;
-
-		mbedtls_ecdsa_init(&ecdsa);
-		mbedtls_mpi_init(&r);
-		mbedtls_mpi_init(&s);
-
-		/* Extract ECDSA key */
-		if (mbedtls_ecdsa_from_keypair(&ecdsa, mbedtls_pk_ec(pk)))
-			SIGN_ERROR("Error getting ECDSA keypair"); // LCOV_EXCL_LINE
-
-		if (mbedtls_ecdsa_sign(&ecdsa.private_grp, &r, &s,
-				       &ecdsa.private_d, hash,
-				       mbedtls_md_get_size(md_info),
-				       mbedtls_ctr_drbg_random, &ctr_drbg))
-			SIGN_ERROR("Error signing token"); // LCOV_EXCL_LINE
+		unsigned int adj = jwt_ecdsa_size(jwt->alg);
 
-		/* Determine R/S sizes based on algorithm */
-		switch (jwt->alg) {
-		case JWT_ALG_ES256:
-		case JWT_ALG_ES256K:
-			adj = 32;
-			break;
-		case JWT_ALG_ES384:
-			adj = 48;
-			break;
-		case JWT_ALG_ES512:
-			adj = 66;
-			break;
-		default:
+		if (!adj)
 			SIGN_ERROR("Unknown EC alg"); // LCOV_EXCL_LINE
-		}
+
+		/* This gives us DER */
+		if (mbedtls_pk_sign(&pk, mbedtls_md_get_type(md_info), hash,
+				    mbedtls_md_get_size(md_info), sig,
+				    sizeof(sig), &sig_len,
+				    mbedtls_ctr_drbg_random, &ctr_drbg))
+			SIGN_ERROR("Error signing token"); // LCOV_EXCL_LINE
 
 		out_size = adj * 2;
 		*out = jwt_malloc(out_size);
 		if (*out == NULL)
 			SIGN_ERROR("Out of memory"); // LCOV_EXCL_LINE
-		memset(*out, 0, out_size);
 
-		mbedtls_mpi_write_binary(&r, (unsigned char *)(*out), adj);
-		mbedtls_mpi_write_binary(&s, (unsigned char *)(*out) + adj, adj);
+		if (jwt_ecdsa_der_to_raw(sig, sig_len, (unsigned char *)*out,
+					 adj)) {
+			// LCOV_EXCL_START
+			jwt_freemem(*out);
+			SIGN_ERROR("Error converting ECDSA sig");
+			// LCOV_EXCL_STOP
+		}
 
 		*len = out_size;
-
-		mbedtls_mpi_free(&r);
-		mbedtls_mpi_free(&s);
-		mbedtls_ecdsa_free(&ecdsa);
 	} else {
 		switch (jwt->alg) {
 		case JWT_ALG_PS256:
@@ -243,15 +219,40 @@ sign_clean_key:
 	return jwt->error;
 }
 
+static int mbedtls_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
+				const char *str, unsigned int str_len)
+{
+	const mbedtls_md_info_t *md_info;
+	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+
+	/* Determine the hash algorithm */
+	md_info = mbedtls_alg_md(jwt->alg);
+	if (md_info == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Unsupported algorithm");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	/* Compute the hash of the input string */
+	if (mbedtls_md(md_info, (unsigned char *)str, str_len, hash)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Error initializing md context");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return mbedtls_sign_hash(jwt, md_info, hash, out, len);
+}
+
 #define VERIFY_ERROR(_msg) { jwt_write_error(jwt, "JWT[MbedTLS]: " _msg); goto verify_clean_key; }
 
-static int mbedtls_verify_sha_pem(jwt_t *jwt, const char *head,
-				  unsigned int head_len,
-				  unsigned char *sig, int sig_len)
+/* Verify a digest that has already been computed */
+static int mbedtls_verify_hash(jwt_t *jwt, const mbedtls_md_info_t *md_info,
+			       const unsigned char *hash, unsigned char *sig,
+			       int sig_len)
 {
 	mbedtls_pk_context pk;
-	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
-	const mbedtls_md_info_t *md_info = NULL;
 	int ret = 1;
 
 	mbedtls_pk_init(&pk);
@@ -272,66 +273,22 @@ static int mbedtls_verify_sha_pem(jwt_t *jwt, const char *head,
 			VERIFY_ERROR("Failed to parse key"); // LCOV_EXCL_LINE
 	}
 
-	/* Determine the hash algorithm */
-	switch (jwt->alg) {
-	case JWT_ALG_RS256:
-	case JWT_ALG_PS256:
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES256K:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
-		break;
-	case JWT_ALG_RS384:
-	case JWT_ALG_PS384:
-	case JWT_ALG_ES384:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA384);
-		break;
-	case JWT_ALG_RS512:
-	case JWT_ALG_PS512:
-	case JWT_ALG_ES512:
-		md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA512);
-		break;
-	default:
-		VERIFY_ERROR("Unsupported algorithm"); // LCOV_EXCL_LINE
-	}
-
-	if (md_info == NULL)
-		VERIFY_ERROR("Failed to get hash alg info"); // LCOV_EXCL_LINE
-
-	/* Compute the hash of the input string */
-	if ((ret = mbedtls_md(md_info, (const unsigned char *)head, head_len,
-			      hash)))
-		VERIFY_ERROR("Failed to computer hash"); // LCOV_EXCL_LINE
-
 	/* Handle ECDSA R/S format conversion */
 	if (mbedtls_pk_can_do(&pk, MBEDTLS_PK_ECDSA)) {
-		mbedtls_mpi r, s;
-		mbedtls_ecdsa_context ecdsa;
-		mbedtls_ecdsa_init(&ecdsa);
-		mbedtls_mpi_init(&r);
-		mbedtls_mpi_init(&s);
-
-		/* Split R/S from the signature */
-		if (sig_len == 64 || sig_len == 96 || sig_len == 132) {
-			size_t r_size = sig_len / 2;
-			mbedtls_mpi_read_binary(&r, sig, r_size);
-			mbedtls_mpi_read_binary(&s, sig + r_size, r_size);
-		} else {
+		unsigned char der[JWT_ECDSA_DER_MAX];
+		size_t der_len;
+
+		if ((unsigned int)sig_len != jwt_ecdsa_size(jwt->alg) * 2)
 			VERIFY_ERROR("Invalid ECDSA sig size"); // LCOV_EXCL_LINE
-		}
 
-		/* Extract ECDSA public key */
-		if (mbedtls_ecdsa_from_keypair(&ecdsa, mbedtls_pk_ec(pk)))
-			VERIFY_ERROR("Failed to extract ECDSA public key"); // LCOV_EXCL_LINE
+		der_len = jwt_ecdsa_raw_to_der(sig, sig_len, der);
+		if (der_len == 0)
+			VERIFY_ERROR("Invalid ECDSA sig size"); // LCOV_EXCL_LINE
 
-		/* Verify ECDSA signature */
-		if (mbedtls_ecdsa_verify(&ecdsa.private_grp, hash,
-			mbedtls_md_get_size(md_info), &ecdsa.private_Q, &r, &s))
+		if (mbedtls_pk_verify(&pk, mbedtls_md_get_type(md_info), hash,
+				      mbedtls_md_get_size(md_info), der,
+				      der_len))
 			VERIFY_ERROR("Failed to verify signature"); // LCOV_EXCL_LINE
-
-		/* Free ECDSA resources */
-		mbedtls_mpi_free(&r);
-		mbedtls_mpi_free(&s);
-		mbedtls_ecdsa_free(&ecdsa);
 	} else if (mbedtls_pk_can_do(&pk, MBEDTLS_PK_RSA)) {
 		/* Verify RSA or RSA-PSS signature */
 		if (jwt->alg == JWT_ALG_PS256 || jwt->alg == JWT_ALG_PS384 ||
@@ -358,6 +315,164 @@ verify_clean_key:
 	return jwt->error;
 }
 
+static int mbedtls_verify_sha_pem(jwt_t *jwt, const char *head,
+				  unsigned int head_len,
+				  unsigned char *sig, int sig_len)
+{
+	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+	const mbedtls_md_info_t *md_info;
+
+	/* Determine the hash algorithm */
+	md_info = mbedtls_alg_md(jwt->alg);
+	if (md_info == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Unsupported algorithm");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	/* Compute the hash of the input string */
+	if (mbedtls_md(md_info, (const unsigned char *)head, head_len, hash)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Failed to computer hash");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return mbedtls_verify_hash(jwt, md_info, hash, sig, sig_len);
+}
+
+/* Incremental signing and verifying */
+struct mbedtls_digest {
+	mbedtls_md_context_t ctx;
+	const mbedtls_md_info_t *md_info;
+	int hmac;
+};
+
+static void mbedtls_digest_free(void *dctx)
+{
+	struct mbedtls_digest *d = dctx;
+
+	if (d == NULL)
+		return;
+
+	mbedtls_md_free(&d->ctx);
+	jwt_freemem(d);
+}
+
+static void *mbedtls_digest_init(jwt_t *jwt, int verify)
+{
+	struct mbedtls_digest *d;
+	int ret;
+
+	(void)verify;
+
+	d = jwt_malloc(sizeof(*d));
+	if (d == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(d, 0, sizeof(*d));
+	mbedtls_md_init(&d->ctx);
+
+	d->md_info = mbedtls_alg_md(jwt->alg);
+	if (d->md_info == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Unsupported algorithm");
+		mbedtls_digest_free(d);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	switch (jwt->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		d->hmac = 1;
+		break;
+	default:
+		break;
+	}
+
+	ret = mbedtls_md_setup(&d->ctx, d->md_info, d->hmac);
+	if (!ret && d->hmac)
+		ret = mbedtls_md_hmac_starts(&d->ctx, jwt->key->oct.key,
+					     jwt->key->oct.len);
+	else if (!ret)
+		ret = mbedtls_md_starts(&d->ctx);
+
+	if (ret) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Error initializing md context");
+		mbedtls_digest_free(d);
+		return NULL;
+		// LCOV_EXCL_STOP
+	}
+
+	return d;
+}
+
+static int mbedtls_digest_update(void *dctx, const char *buf,
+				 unsigned int len)
+{
+	struct mbedtls_digest *d = dctx;
+	const unsigned char *data = (const unsigned char *)buf;
+
+	if (d->hmac)
+		return mbedtls_md_hmac_update(&d->ctx, data, len) ? 1 : 0;
+
+	return mbedtls_md_update(&d->ctx, data, len) ? 1 : 0;
+}
+
+static int mbedtls_digest_sign(jwt_t *jwt, void *dctx, char **out,
+			       unsigned int *len)
+{
+	struct mbedtls_digest *d = dctx;
+	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+
+	*out = NULL;
+
+	if (d->hmac) {
+		*len = mbedtls_md_get_size(d->md_info);
+		*out = jwt_malloc(*len);
+		if (*out == NULL)
+			return 1; // LCOV_EXCL_LINE
+
+		if (mbedtls_md_hmac_finish(&d->ctx, (unsigned char *)*out)) {
+			// LCOV_EXCL_START
+			jwt_freemem(*out);
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+
+		return 0;
+	}
+
+	if (mbedtls_md_finish(&d->ctx, hash)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Failed to computer hash");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return mbedtls_sign_hash(jwt, d->md_info, hash, out, len);
+}
+
+static int mbedtls_digest_verify(jwt_t *jwt, void *dctx, unsigned char *sig,
+				 int sig_len)
+{
+	struct mbedtls_digest *d = dctx;
+	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+
+	if (mbedtls_md_finish(&d->ctx, hash)) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[MbedTLS]: Failed to computer hash");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return mbedtls_verify_hash(jwt, d->md_info, hash, sig, sig_len);
+}
+
 /* Export our ops */
 struct jwt_crypto_ops jwt_mbedtls_ops = {
 	.name			= "mbedtls",
@@ -367,6 +482,12 @@ struct jwt_crypto_ops jwt_mbedtls_ops = {
 	.sign_sha_pem		= mbedtls_sign_sha_pem,
 	.verify_sha_pem		= mbedtls_verify_sha_pem,
 
+	.digest_init		= mbedtls_digest_init,
+	.digest_update		= mbedtls_digest_update,
+	.digest_sign		= mbedtls_digest_sign,
+	.digest_verify		= mbedtls_digest_verify,
+	.digest_free		= mbedtls_digest_free,
+
 	/* Needs to be implemented */
 	.jwk_implemented	= 1,
 	.process_eddsa		= openssl_process_eddsa,
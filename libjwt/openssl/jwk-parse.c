@@ -56,7 +56,7 @@ static void *set_ec_pub_key(OSSL_PARAM_BLD *build, json_t *jx, json_t *jy,
 
 	/* Create the EC group and point */
 	nid = OBJ_sn2nid(curve_name);
-	group = EC_GROUP_new_by_curve_name(nid);
+	group = EC_GROUP_new_by_curve_name_ex(openssl_libctx(), NULL, nid);
 	if (group == NULL)
 		goto ec_pub_key_cleanup;
 
@@ -141,23 +141,13 @@ static unsigned char *set_one_octet(OSSL_PARAM_BLD *build,
 	return bin;
 }
 
-static int pctx_to_pem(EVP_PKEY_CTX *pctx, OSSL_PARAM *params,
-		       jwk_item_t *item, int priv)
+/* The item takes over pkey */
+static void pkey_to_item(EVP_PKEY *pkey, jwk_item_t *item, int priv)
 {
 	BIO *bio = NULL;
-	EVP_PKEY *pkey = NULL;
 	char *src = NULL, *dest = NULL;
 	long len;
-	int ret = -1;
-
-	ret = EVP_PKEY_fromdata(pctx, &pkey, EVP_PKEY_KEYPAIR, params);
-
-	if (ret <= 0 || pkey == NULL) {
-		// LCOV_EXCL_START
-		jwt_write_error(item, "Unable to create PEM from pkey");
-		goto cleanup_pem;
-		// LCOV_EXCL_STOP
-	}
+	int ret;
 
 	item->provider = JWT_CRYPTO_OPS_OPENSSL;
 	item->provider_data = pkey;
@@ -166,11 +156,9 @@ static int pctx_to_pem(EVP_PKEY_CTX *pctx, OSSL_PARAM *params,
 				  &item->bits);
 
 	/* From here after, we don't fail. PEM is optional. */
-	ret = 0;
-
 	bio = BIO_new(BIO_s_mem());
 	if (bio == NULL)
-		goto cleanup_pem; // LCOV_EXCL_LINE
+		return; // LCOV_EXCL_LINE
 
 	if (priv)
 		ret = PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0,
@@ -178,12 +166,8 @@ static int pctx_to_pem(EVP_PKEY_CTX *pctx, OSSL_PARAM *params,
 	else
 		ret = PEM_write_bio_PUBKEY(bio, pkey);
 
-	if (!ret) {
-		// LCOV_EXCL_START
-		ret = 0;
-		goto cleanup_pem;
-		// LCOV_EXCL_STOP
-	}
+	if (!ret)
+		goto cleanup_pem; // LCOV_EXCL_LINE
 
 	len = BIO_get_mem_data(bio, &src);
 	dest = OPENSSL_malloc(len + 1);
@@ -193,12 +177,85 @@ static int pctx_to_pem(EVP_PKEY_CTX *pctx, OSSL_PARAM *params,
 	memcpy(dest, src, len);
 	dest[len] = '\0';
 	item->pem = dest;
-	ret = 0;
 
 cleanup_pem:
 	BIO_free(bio);
+}
 
-	return ret;
+static int pctx_to_pem(EVP_PKEY_CTX *pctx, OSSL_PARAM *params,
+		       jwk_item_t *item, int priv)
+{
+	EVP_PKEY *pkey = NULL;
+	int ret;
+
+	ret = EVP_PKEY_fromdata(pctx, &pkey, EVP_PKEY_KEYPAIR, params);
+
+	if (ret <= 0 || pkey == NULL) {
+		// LCOV_EXCL_START
+		jwt_write_error(item, "Unable to create PEM from pkey");
+		return -1;
+		// LCOV_EXCL_STOP
+	}
+
+	pkey_to_item(pkey, item, priv);
+
+	return 0;
+}
+
+/* Make a throw away private key, for testing the crypto ops */
+JWT_NO_EXPORT
+int openssl_generate_key(jwk_item_t *item, jwt_alg_t alg)
+{
+	OSSL_LIB_CTX *libctx = openssl_libctx();
+	EVP_PKEY *pkey;
+
+	switch (alg) {
+	case JWT_ALG_RS256:
+	case JWT_ALG_RS384:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS256:
+	case JWT_ALG_PS384:
+	case JWT_ALG_PS512:
+		item->kty = JWK_KEY_TYPE_RSA;
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "RSA", (size_t)2048);
+		break;
+	case JWT_ALG_ES256:
+		item->kty = JWK_KEY_TYPE_EC;
+		strcpy(item->curve, "P-256");
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "EC", "P-256");
+		break;
+	case JWT_ALG_ES256K:
+		item->kty = JWK_KEY_TYPE_EC;
+		strcpy(item->curve, "secp256k1");
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "EC", "secp256k1");
+		break;
+	case JWT_ALG_ES384:
+		item->kty = JWK_KEY_TYPE_EC;
+		strcpy(item->curve, "P-384");
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "EC", "P-384");
+		break;
+	case JWT_ALG_ES512:
+		item->kty = JWK_KEY_TYPE_EC;
+		strcpy(item->curve, "P-521");
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "EC", "P-521");
+		break;
+	case JWT_ALG_EDDSA:
+		item->kty = JWK_KEY_TYPE_OKP;
+		strcpy(item->curve, "Ed25519");
+		pkey = EVP_PKEY_Q_keygen(libctx, NULL, "ED25519");
+		break;
+	default:
+		return 1;
+	}
+
+	if (pkey == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	item->alg = alg;
+	item->is_private_key = 1;
+	pkey_to_item(pkey, item, 1);
+
+	return 0;
 }
 
 /* For EdDSA keys */
@@ -235,9 +292,9 @@ int openssl_process_eddsa(json_t *jwk, jwk_item_t *item)
 
 	crv_str = json_string_value(crv);
 	if (!jwt_strcmp(crv_str, "Ed25519"))
-		pctx = EVP_PKEY_CTX_new_from_name(NULL, "ED25519", NULL);
+		pctx = EVP_PKEY_CTX_new_from_name(openssl_libctx(), "ED25519", NULL);
 	else if (!jwt_strcmp(crv_str, "Ed448"))
-		pctx = EVP_PKEY_CTX_new_from_name(NULL, "ED448", NULL);
+		pctx = EVP_PKEY_CTX_new_from_name(openssl_libctx(), "ED448", NULL);
 	else {
 		jwt_write_error(item,
                         "Unknown curve [%s] (note, curves are case sensitive)",
@@ -358,8 +415,8 @@ int openssl_process_rsa(json_t *jwk, jwk_item_t *item)
 		goto cleanup_rsa;
 	}
 
-	pctx = EVP_PKEY_CTX_new_from_name(NULL, is_rsa_pss ? "RSA-PSS" : "RSA",
-					  NULL);
+	pctx = EVP_PKEY_CTX_new_from_name(openssl_libctx(),
+					  is_rsa_pss ? "RSA-PSS" : "RSA", NULL);
 	if (pctx == NULL) {
 		// LCOV_EXCL_START
 		jwt_write_error(item, "Error creating pkey context");
@@ -479,7 +536,7 @@ int openssl_process_ec(json_t *jwk, jwk_item_t *item)
 	if (d != NULL)
 		item->is_private_key = priv = 1;
 
-	pctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL);
+	pctx = EVP_PKEY_CTX_new_from_name(openssl_libctx(), "EC", NULL);
 	if (pctx == NULL) {
 		// LCOV_EXCL_START
 		jwt_write_error(item, "Error creating pkey context");
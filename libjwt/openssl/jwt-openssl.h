@@ -13,5 +13,11 @@ int openssl_process_eddsa(json_t *jwk, jwk_item_t *item);
 int openssl_process_rsa(json_t *jwk, jwk_item_t *item);
 int openssl_process_ec(json_t *jwk, jwk_item_t *item);
 void openssl_process_item_free(jwk_item_t *item);
+int openssl_generate_key(jwk_item_t *item, jwt_alg_t alg);
+
+/* Fetched once, see libctx.c */
+OSSL_LIB_CTX *openssl_libctx(void);
+const EVP_MD *openssl_md(jwt_alg_t alg);
+EVP_MAC *openssl_hmac(void);
 
 #endif /* JWT_OPENSSL_H */
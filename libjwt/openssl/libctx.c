@@ -0,0 +1,184 @@
+/* Copyright (C) 2015-2025 maClara, LLC <info@maclara-llc.com>
+   This file is part of the JWT C Library
+
+   SPDX-License-Identifier:  MPL-2.0
+   This Source Code Form is subject to the terms of the Mozilla Public
+   License, v. 2.0. If a copy of the MPL was not distributed with this
+   file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include <jwt.h>
+
+#include "jwt-private.h"
+
+#include "openssl/jwt-openssl.h"
+
+/* Passing EVP_sha256() and friends to OpenSSL 3 means it has to go and find
+ * an implementation on every operation, which takes a lock that's shared
+ * with every other thread. We fetch everything once here, in the library
+ * context that we are using, and keep it for the life of the library.
+ *
+ * The fetch happens exactly once, under openssl_algs_once, either for the
+ * default context on first use or for the one given to
+ * jwt_set_crypto_libctx(). Nothing changes after that, so readers need no
+ * locking, and nothing can be freed while it is in use. */
+
+static struct {
+	OSSL_LIB_CTX *libctx;
+	int owned;
+	EVP_MD *sha256;
+	EVP_MD *sha384;
+	EVP_MD *sha512;
+	EVP_MAC *hmac;
+} openssl_algs;
+
+static pthread_once_t openssl_algs_once = PTHREAD_ONCE_INIT;
+
+/* What jwt_set_crypto_libctx() wants, under its lock */
+static pthread_mutex_t openssl_algs_lock = PTHREAD_MUTEX_INITIALIZER;
+static OSSL_LIB_CTX *openssl_algs_want;
+static int openssl_algs_want_owned;
+
+static void __algs_free(void)
+{
+	EVP_MD_free(openssl_algs.sha256);
+	EVP_MD_free(openssl_algs.sha384);
+	EVP_MD_free(openssl_algs.sha512);
+	EVP_MAC_free(openssl_algs.hmac);
+
+	if (openssl_algs.owned)
+		OSSL_LIB_CTX_free(openssl_algs.libctx);
+
+	memset(&openssl_algs, 0, sizeof(openssl_algs));
+}
+
+static int __algs_fetch(OSSL_LIB_CTX *libctx, int owned)
+{
+	openssl_algs.libctx = libctx;
+	openssl_algs.owned = owned;
+
+	openssl_algs.sha256 = EVP_MD_fetch(libctx, "SHA256", NULL);
+	openssl_algs.sha384 = EVP_MD_fetch(libctx, "SHA384", NULL);
+	openssl_algs.sha512 = EVP_MD_fetch(libctx, "SHA512", NULL);
+	openssl_algs.hmac = EVP_MAC_fetch(libctx, "HMAC", NULL);
+
+	if (openssl_algs.sha256 == NULL || openssl_algs.sha384 == NULL ||
+	    openssl_algs.sha512 == NULL || openssl_algs.hmac == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	return 0;
+}
+
+/* Freed by whichever comes first: OpenSSL's own cleanup, which has to
+ * happen while OpenSSL is still there to free them into, or the library
+ * going away. The other then finds nothing left to do. */
+__attribute__((destructor))
+static void __algs_fini(void)
+{
+	__algs_free();
+}
+
+static void __algs_default(void)
+{
+	__algs_fetch(NULL, 0);
+	OPENSSL_atexit(__algs_fini);
+}
+
+/* Only run from jwt_set_crypto_libctx(), which holds the lock. Taking the
+ * context clears openssl_algs_want, so the caller knows it's ours now. */
+static void __algs_set(void)
+{
+	OSSL_LIB_CTX *ctx = openssl_algs_want;
+
+	openssl_algs_want = NULL;
+
+	if (__algs_fetch(ctx, openssl_algs_want_owned)) {
+		// LCOV_EXCL_START
+		__algs_free();
+		__algs_fetch(NULL, 0);
+		// LCOV_EXCL_STOP
+	}
+
+	OPENSSL_atexit(__algs_fini);
+}
+
+OSSL_LIB_CTX *openssl_libctx(void)
+{
+	pthread_once(&openssl_algs_once, __algs_default);
+
+	return openssl_algs.libctx;
+}
+
+const EVP_MD *openssl_md(jwt_alg_t alg)
+{
+	pthread_once(&openssl_algs_once, __algs_default);
+
+	switch (alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_RS256:
+	case JWT_ALG_PS256:
+	case JWT_ALG_ES256:
+	case JWT_ALG_ES256K:
+		return openssl_algs.sha256;
+	case JWT_ALG_HS384:
+	case JWT_ALG_RS384:
+	case JWT_ALG_PS384:
+	case JWT_ALG_ES384:
+		return openssl_algs.sha384;
+	case JWT_ALG_HS512:
+	case JWT_ALG_RS512:
+	case JWT_ALG_PS512:
+	case JWT_ALG_ES512:
+		return openssl_algs.sha512;
+	default:
+		return NULL;
+	}
+}
+
+EVP_MAC *openssl_hmac(void)
+{
+	pthread_once(&openssl_algs_once, __algs_default);
+
+	return openssl_algs.hmac;
+}
+
+int jwt_set_crypto_libctx(void *libctx)
+{
+	OSSL_LIB_CTX *ctx = libctx;
+	int ret;
+
+	pthread_mutex_lock(&openssl_algs_lock);
+
+	if (ctx == NULL) {
+		ctx = OSSL_LIB_CTX_new();
+		if (ctx == NULL) {
+			// LCOV_EXCL_START
+			pthread_mutex_unlock(&openssl_algs_lock);
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+	}
+
+	/* If anything got here first, be it a use of the ops or an earlier
+	 * call, this does nothing and we fail. */
+	openssl_algs_want = ctx;
+	openssl_algs_want_owned = libctx == NULL;
+	pthread_once(&openssl_algs_once, __algs_set);
+
+	ret = openssl_algs.libctx != ctx;
+
+	/* Not taken, so ours to drop if we made it */
+	if (openssl_algs_want != NULL && libctx == NULL)
+		OSSL_LIB_CTX_free(ctx);
+	openssl_algs_want = NULL;
+
+	pthread_mutex_unlock(&openssl_algs_lock);
+
+	return ret;
+}
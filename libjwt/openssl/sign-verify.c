@@ -18,6 +18,9 @@
 #include <openssl/rsa.h>
 #include <openssl/opensslv.h>
 #include <openssl/err.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/crypto.h>
 
 #include <jwt.h>
 
@@ -27,202 +30,248 @@
 
 /* Routines to support crypto in LibJWT using OpenSSL. */
 
-static int openssl_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
-				 const char *str, unsigned int str_len)
+static EVP_MAC_CTX *openssl_hmac_start(jwt_t *jwt)
 {
-	const EVP_MD *alg;
-	void *key;
-	size_t key_len;
+	OSSL_PARAM params[2];
+	EVP_MAC_CTX *ctx;
+	const EVP_MD *md;
 
-	key = jwt->key->oct.key;
-	key_len = jwt->key->oct.len;
+	md = openssl_md(jwt->alg);
+	if (md == NULL)
+		return NULL; // LCOV_EXCL_LINE
 
-	*out = NULL;
+	ctx = EVP_MAC_CTX_new(openssl_hmac());
+	if (ctx == NULL)
+		return NULL; // LCOV_EXCL_LINE
 
-	switch (jwt->alg) {
-	/* HMAC */
-	case JWT_ALG_HS256:
-		alg = EVP_sha256();
-		break;
-	case JWT_ALG_HS384:
-		alg = EVP_sha384();
-		break;
-	case JWT_ALG_HS512:
-		alg = EVP_sha512();
-		break;
-	// LCOV_EXCL_START
-	default:
-		return 1;
-	// LCOV_EXCL_STOP
-	}
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+				(char *)EVP_MD_get0_name(md), 0);
+	params[1] = OSSL_PARAM_construct_end();
 
-	*out = jwt_malloc(EVP_MAX_MD_SIZE);
-	if (*out == NULL)
-		return 1; // LCOV_EXCL_LINE
-
-	if (HMAC(alg, key, key_len, (const unsigned char *)str, str_len,
-		 (unsigned char *)*out, len) == NULL) {
+	if (EVP_MAC_init(ctx, jwt->key->oct.key, jwt->key->oct.len,
+			 params) != 1) {
 		// LCOV_EXCL_START
-		jwt_freemem(*out);
-		*out = NULL;
-		return 1;
+		EVP_MAC_CTX_free(ctx);
+		return NULL;
 		// LCOV_EXCL_STOP
 	}
 
-	return 0;
+	return ctx;
 }
 
-static int jwt_ec_d2i(jwt_t *jwt, char **out, unsigned int *len,
-		      unsigned char *sig, unsigned int slen)
+static int openssl_sign_sha_hmac(jwt_t *jwt, char **out, unsigned int *len,
+				 const char *str, unsigned int str_len)
 {
-	unsigned int bn_len, r_len, s_len, buf_len;
-	ECDSA_SIG *ec_sig = NULL;
-	const BIGNUM *ec_sig_r;
-	const BIGNUM *ec_sig_s;
-	unsigned char *buf;
-
-	/* Get the sig from the DER encoded version. */
-	ec_sig = d2i_ECDSA_SIG(NULL, (const unsigned char **)&sig, slen);
-	if (ec_sig == NULL)
+	EVP_MAC_CTX *ctx;
+	size_t slen;
+
+	*out = NULL;
+
+	ctx = openssl_hmac_start(jwt);
+	if (ctx == NULL)
 		return 1; // LCOV_EXCL_LINE
 
-	ECDSA_SIG_get0(ec_sig, &ec_sig_r, &ec_sig_s);
-	r_len = BN_num_bytes(ec_sig_r);
-	s_len = BN_num_bytes(ec_sig_s);
-	bn_len = (jwt->key->bits + 7) / 8;
-	if ((r_len > bn_len) || (s_len > bn_len)) {
+	*out = jwt_malloc(EVP_MAX_MD_SIZE);
+	if (*out == NULL) {
 		// LCOV_EXCL_START
-		ECDSA_SIG_free(ec_sig);
+		EVP_MAC_CTX_free(ctx);
 		return 1;
 		// LCOV_EXCL_STOP
 	}
 
-	buf_len = 2 * bn_len;
-	buf = jwt_malloc(buf_len);
-	if (buf == NULL) {
+	if (EVP_MAC_update(ctx, (const unsigned char *)str, str_len) != 1 ||
+	    EVP_MAC_final(ctx, (unsigned char *)*out, &slen,
+			  EVP_MAX_MD_SIZE) != 1) {
 		// LCOV_EXCL_START
-		ECDSA_SIG_free(ec_sig);
+		jwt_freemem(*out);
+		EVP_MAC_CTX_free(ctx);
 		return 1;
 		// LCOV_EXCL_STOP
 	}
 
-	/* Pad the bignums with leading zeroes. Ends up looking sort
-	 * of like this "0000rrrrrrrSSSSS". */
-	memset(buf, 0, buf_len);
-	BN_bn2bin(ec_sig_r, buf + (bn_len - r_len));
-	BN_bn2bin(ec_sig_s, buf + (buf_len - s_len));
-
-	ECDSA_SIG_free(ec_sig);
-
-	*out = (char *)buf;
-	*len = buf_len;
+	EVP_MAC_CTX_free(ctx);
+	*len = slen;
 
 	return 0;
 }
 
-#define SIGN_ERROR(_msg) { jwt_write_error(jwt, "JWT[OpenSSL]: " _msg); goto jwt_sign_sha_pem_done; }
-
-static int openssl_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
-				const char *str, unsigned int str_len)
+/* Figure out the digest and key type for an alg, and make sure the key can
+ * be used with it. */
+static int openssl_alg_md(jwt_t *jwt, EVP_PKEY *pkey, const EVP_MD **alg,
+			  int *type)
 {
-	EVP_MD_CTX *mdctx = NULL;
-	EVP_PKEY_CTX *pkey_ctx = NULL;
-	BIO *bufkey = NULL;
-	const EVP_MD *alg;
-	int type;
-	EVP_PKEY *pkey = NULL;
-	unsigned char *sig = NULL;
-	size_t slen;
-
-	pkey = jwt->key->provider_data;
+	*alg = openssl_md(jwt->alg);
 
 	switch (jwt->alg) {
 	/* RSA */
 	case JWT_ALG_RS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA;
-		break;
 	case JWT_ALG_RS512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_RSA;
+		*type = EVP_PKEY_RSA;
 		break;
 
 	/* RSA-PSS */
 	case JWT_ALG_PS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA_PSS;
-		break;
 	case JWT_ALG_PS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA_PSS;
-		break;
 	case JWT_ALG_PS512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_RSA_PSS;
+		*type = EVP_PKEY_RSA_PSS;
 		break;
 
 	/* ECC */
 	case JWT_ALG_ES256:
 	case JWT_ALG_ES256K:
-		alg = EVP_sha256();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_EC;
-		break;
 	case JWT_ALG_ES512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_EC;
+		*type = EVP_PKEY_EC;
 		break;
 
 	/* EdDSA */
 	case JWT_ALG_EDDSA:
 		/* Technically this is sha512 for ED25519 and
-		 * shake256 for ED448 */
-		alg = EVP_md_null();
-		type = EVP_PKEY_id(pkey);
-		if (type != EVP_PKEY_ED25519 && type != EVP_PKEY_ED448)
-			SIGN_ERROR("Unknown EdDSA curve"); // LCOV_EXCL_LINE
+		 * shake256 for ED448, but it's done internally */
+		*alg = NULL;
+		*type = EVP_PKEY_id(pkey);
+		if (*type != EVP_PKEY_ED25519 && *type != EVP_PKEY_ED448) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "JWT[OpenSSL]: Unknown EdDSA curve");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
 		break;
 
 	// LCOV_EXCL_START
 	default:
+		jwt_write_error(jwt, "JWT[OpenSSL]: Unknown algorithm");
 		return 1;
 	// LCOV_EXCL_STOP
 	}
 
-	if (type == EVP_PKEY_RSA_PSS) {
-	       if (EVP_PKEY_id(pkey) != EVP_PKEY_RSA &&
-		   EVP_PKEY_id(pkey) != EVP_PKEY_RSA_PSS) {
-			SIGN_ERROR("Incompatible key for RSASSA-PSS"); // LCOV_EXCL_LINE
-	       }
-	} else if (type != EVP_PKEY_id(pkey)) {
-		SIGN_ERROR("Incompatible key"); // LCOV_EXCL_LINE
+	if (*type == EVP_PKEY_RSA_PSS) {
+		if (EVP_PKEY_id(pkey) != EVP_PKEY_RSA_PSS &&
+		    EVP_PKEY_id(pkey) != EVP_PKEY_RSA) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "JWT[OpenSSL]: Incompatible key for RSASSA-PSS");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+	} else if (*type != EVP_PKEY_id(pkey)) {
+		jwt_write_error(jwt, "JWT[OpenSSL]: Incompatible key for algorithm");
+		return 1;
 	}
 
-	mdctx = EVP_MD_CTX_create();
+	return 0;
+}
+
+#define MD_ERROR(_msg) { jwt_write_error(jwt, "JWT[OpenSSL]: " _msg); goto md_start_error; }
+
+/* Setup a DigestSign or DigestVerify context for the alg and key */
+static EVP_MD_CTX *openssl_md_start(jwt_t *jwt, int verify, int *type)
+{
+	EVP_PKEY_CTX *pkey_ctx = NULL;
+	EVP_MD_CTX *mdctx = NULL;
+	EVP_PKEY *pkey;
+	const EVP_MD *alg;
+	int ret;
+
+	pkey = jwt->key->provider_data;
+
+	if (openssl_alg_md(jwt, pkey, &alg, type))
+		return NULL;
+
+	mdctx = EVP_MD_CTX_new();
 	if (mdctx == NULL)
-		SIGN_ERROR("Error creating MD context"); // LCOV_EXCL_LINE
+		MD_ERROR("Error creating MD context"); // LCOV_EXCL_LINE
 
-	/* Initialize the DigestSign operation using alg */
-	if (EVP_DigestSignInit(mdctx, &pkey_ctx, alg, NULL, pkey) != 1)
-		SIGN_ERROR("Failued to initialize digest"); // LCOV_EXCL_LINE
+	if (verify)
+		ret = EVP_DigestVerifyInit(mdctx, &pkey_ctx, alg, NULL, pkey);
+	else
+		ret = EVP_DigestSignInit(mdctx, &pkey_ctx, alg, NULL, pkey);
+	if (ret != 1)
+		MD_ERROR("Failed to initialize digest"); // LCOV_EXCL_LINE
 
 	/* Required for RSA-PSS */
-	if (type == EVP_PKEY_RSA_PSS) {
+	if (*type == EVP_PKEY_RSA_PSS) {
 		if (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx,
-						RSA_PKCS1_PSS_PADDING) < 0)
-			SIGN_ERROR("Error setting RSASSA-PSS padding"); // LCOV_EXCL_LINE
-		if (EVP_PKEY_CTX_set_rsa_pss_saltlen(pkey_ctx,
-						RSA_PSS_SALTLEN_DIGEST) < 0)
-			SIGN_ERROR("Error setting RSASSA-PSS salt length"); // LCOV_EXCL_LINE
+						 RSA_PKCS1_PSS_PADDING) < 0)
+			MD_ERROR("Error setting RSASSA-PSS padding"); // LCOV_EXCL_LINE
+		if (EVP_PKEY_CTX_set_rsa_pss_saltlen(pkey_ctx, verify ?
+				RSA_PSS_SALTLEN_AUTO : RSA_PSS_SALTLEN_DIGEST) < 0)
+			MD_ERROR("Error setting RSASSA-PSS salt length"); // LCOV_EXCL_LINE
 	}
 
+	return mdctx;
+
+md_start_error:
+	EVP_MD_CTX_free(mdctx); // LCOV_EXCL_LINE
+	return NULL; // LCOV_EXCL_LINE
+}
+
+/* Convert EC sigs from JWA's raw R/S back to DER. */
+static int openssl_ec_der(jwt_t *jwt, const unsigned char *sig, int slen,
+			  unsigned char *der, int *der_len)
+{
+	unsigned int bn_len = (jwt->key->bits + 7) / 8;
+
+	if ((bn_len * 2) != (unsigned int)slen) {
+		jwt_write_error(jwt, "JWT[OpenSSL]: ECDSA micmatch with sig len");
+		return 1;
+	}
+
+	*der_len = (int)jwt_ecdsa_raw_to_der(sig, slen, der);
+	if (*der_len == 0) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[OpenSSL]: Error calculating ECDSA sig");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
+
+	return 0;
+}
+
+/* Hand back the signature in the format JWA wants */
+static int openssl_sig_out(jwt_t *jwt, int type, unsigned char *sig,
+			   size_t slen, char **out, unsigned int *len)
+{
+	if (type == EVP_PKEY_EC) {
+		/* For EC we need to convert to a raw format of R/S. The DER
+		 * is always bigger, so it goes back in the same buffer. */
+		unsigned char raw[JWT_ECDSA_RAW_MAX];
+		unsigned int bn_len = (jwt->key->bits + 7) / 8;
+
+		if (bn_len * 2 > slen ||
+		    jwt_ecdsa_der_to_raw(sig, slen, raw, bn_len)) {
+			// LCOV_EXCL_START
+			jwt_freemem(sig);
+			jwt_write_error(jwt, "JWT[OpenSSL]: ECDSA failed d2i");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+
+		memcpy(sig, raw, bn_len * 2);
+		slen = bn_len * 2;
+	}
+
+	/* Everything else, just pass back the original sig. */
+	*out = (char *)sig;
+	*len = slen;
+
+	return 0;
+}
+
+#define SIGN_ERROR(_msg) { jwt_write_error(jwt, "JWT[OpenSSL]: " _msg); goto jwt_sign_sha_pem_done; }
+
+static int openssl_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
+				const char *str, unsigned int str_len)
+{
+	EVP_MD_CTX *mdctx = NULL;
+	unsigned char *sig = NULL;
+	size_t slen;
+	int type;
+
+	mdctx = openssl_md_start(jwt, 0, &type);
+	if (mdctx == NULL)
+		return 1;
+
 	/* Get the size of sig first */
 	if (EVP_DigestSign(mdctx, NULL, &slen, (const unsigned char *)str,
 			   str_len) != 1)
@@ -236,29 +285,14 @@ static int openssl_sign_sha_pem(jwt_t *jwt, char **out, unsigned int *len,
 	/* Actual signing */
 	if (EVP_DigestSign(mdctx, sig, &slen, (const unsigned char *)str,
 			   str_len) != 1)
-		SIGN_ERROR("Error singing token") // LCOV_EXCL_LINE;
-
-	if (type == EVP_PKEY_EC) {
-		/* For EC we need to convert to a raw format of R/S. */
-		if (jwt_ec_d2i(jwt, out, len, sig, slen))
-			SIGN_ERROR("ECDSA failed d2i"); // LCOV_EXCL_LINE
+		SIGN_ERROR("Error singing token"); // LCOV_EXCL_LINE
 
-		/* jwt_ec_d2i has updated the out and len pointers on
-		 * success. Either way, we're done with this buffer. */
-		jwt_freemem(sig);
-		sig = NULL;
-	} else {
-		/* Everything else, just pass back the original sig. */
-		*out = (char *)sig;
-		*len = slen;
-	}
+	openssl_sig_out(jwt, type, sig, slen, out, len);
+	sig = NULL;
 
 jwt_sign_sha_pem_done:
-	if (jwt->error)
-		jwt_freemem(sig); // LCOV_EXCL_LINE
-
-	BIO_free(bufkey);
-	EVP_MD_CTX_destroy(mdctx);
+	jwt_freemem(sig);
+	EVP_MD_CTX_free(mdctx);
 
 	return jwt->error;
 }
@@ -270,148 +304,319 @@ static int openssl_verify_sha_pem(jwt_t *jwt, const char *head,
 				  unsigned char *sig, int slen)
 {
 	EVP_MD_CTX *mdctx = NULL;
-	EVP_PKEY_CTX *pkey_ctx = NULL;
-	ECDSA_SIG *ec_sig = NULL;
-	BIGNUM *ec_sig_r = NULL;
-	BIGNUM *ec_sig_s = NULL;
-	EVP_PKEY *pkey = NULL;
-	const EVP_MD *alg;
+	unsigned char der[JWT_ECDSA_DER_MAX];
 	int type;
-	BIO *bufkey = NULL;
 
-	pkey = jwt->key->provider_data;
+	mdctx = openssl_md_start(jwt, 1, &type);
+	if (mdctx == NULL)
+		return 1;
 
-	switch (jwt->alg) {
-	/* RSA */
-	case JWT_ALG_RS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA;
-		break;
-	case JWT_ALG_RS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA;
-		break;
-	case JWT_ALG_RS512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_RSA;
-		break;
+	if (type == EVP_PKEY_EC) {
+		if (openssl_ec_der(jwt, sig, slen, der, &slen))
+			goto jwt_verify_sha_pem_done;
+		sig = der;
+	}
 
-	/* RSA-PSS */
-	case JWT_ALG_PS256:
-		alg = EVP_sha256();
-		type = EVP_PKEY_RSA_PSS;
-		break;
-	case JWT_ALG_PS384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_RSA_PSS;
-		break;
-	case JWT_ALG_PS512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_RSA_PSS;
-		break;
+	/* One-shot update and verify */
+	if (EVP_DigestVerify(mdctx, sig, slen, (const unsigned char *)head,
+			     head_len) != 1)
+		VERIFY_ERROR("Failed to verify signature");
 
-	/* ECC */
-	case JWT_ALG_ES256:
-	case JWT_ALG_ES256K:
-		alg = EVP_sha256();
-		type = EVP_PKEY_EC;
-		break;
-	case JWT_ALG_ES384:
-		alg = EVP_sha384();
-		type = EVP_PKEY_EC;
-		break;
-	case JWT_ALG_ES512:
-		alg = EVP_sha512();
-		type = EVP_PKEY_EC;
-		break;
+jwt_verify_sha_pem_done:
+	EVP_MD_CTX_free(mdctx);
 
-	/* EdDSA */
-	case JWT_ALG_EDDSA:
-		alg = NULL;
-		if (EVP_PKEY_id(pkey) == EVP_PKEY_ED25519 ||
-		    EVP_PKEY_id(pkey) == EVP_PKEY_ED448)
-			type = EVP_PKEY_id(pkey);
-		else
-			VERIFY_ERROR("Unknown EdDSA curve"); // LCOV_EXCL_LINE
+	return jwt->error;
+}
+
+/* Incremental signing and verifying */
+struct openssl_digest {
+	EVP_MAC_CTX *mac;	/* HMAC					*/
+	EVP_MD_CTX *mdctx;	/* Everything else			*/
+	int type;
+	int verify;
+};
+
+static void openssl_digest_free(void *dctx)
+{
+	struct openssl_digest *d = dctx;
+
+	if (d == NULL)
+		return;
+
+	EVP_MAC_CTX_free(d->mac);
+	EVP_MD_CTX_free(d->mdctx);
+	jwt_freemem(d);
+}
+
+static void *openssl_digest_init(jwt_t *jwt, int verify)
+{
+	struct openssl_digest *d;
+
+	d = jwt_malloc(sizeof(*d));
+	if (d == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(d, 0, sizeof(*d));
+	d->verify = verify;
+
+	switch (jwt->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		d->mac = openssl_hmac_start(jwt);
+		if (d->mac == NULL) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "JWT[OpenSSL]: Error starting HMAC");
+			openssl_digest_free(d);
+			return NULL;
+			// LCOV_EXCL_STOP
+		}
 		break;
 
-	// LCOV_EXCL_START
 	default:
-		VERIFY_ERROR("Unknown algorithm");
-	// LCOV_EXCL_STOP
+		d->mdctx = openssl_md_start(jwt, verify, &d->type);
+		if (d->mdctx == NULL) {
+			openssl_digest_free(d);
+			return NULL;
+		}
 	}
 
-	if (type == EVP_PKEY_RSA_PSS) {
-		if (EVP_PKEY_id(pkey) != EVP_PKEY_RSA_PSS &&
-		    EVP_PKEY_id(pkey) != EVP_PKEY_RSA)
-			VERIFY_ERROR("Incompatible key for RSASSA-PSS"); // LCOV_EXCL_LINE
-	} else if (type != EVP_PKEY_id(pkey))
-		VERIFY_ERROR("Incompatible key for algorithm");
+	return d;
+}
+
+static int openssl_digest_update(void *dctx, const char *buf,
+				 unsigned int len)
+{
+	struct openssl_digest *d = dctx;
+	const unsigned char *data = (const unsigned char *)buf;
 
-        if (type == EVP_PKEY_EC) {
-		/* Convert EC sigs back to ASN1. */
-		unsigned int bn_len;
-		unsigned char *p;
+	if (d->mac)
+		return EVP_MAC_update(d->mac, data, len) == 1 ? 0 : 1;
 
-		ec_sig = ECDSA_SIG_new();
-		if (ec_sig == NULL)
-			VERIFY_ERROR("Failed to allocate ECDSA sig"); // LCOV_EXCL_LINE
+	if (d->verify)
+		return EVP_DigestVerifyUpdate(d->mdctx, data, len) == 1 ? 0 : 1;
 
-		bn_len = (jwt->key->bits + 7) / 8;
-		if ((bn_len * 2) != (unsigned int)slen)
-			VERIFY_ERROR("ECDSA micmatch with sig len"); // LCOV_EXCL_LINE
+	return EVP_DigestSignUpdate(d->mdctx, data, len) == 1 ? 0 : 1;
+}
+
+static int openssl_digest_sign(jwt_t *jwt, void *dctx, char **out,
+			       unsigned int *len)
+{
+	struct openssl_digest *d = dctx;
+	unsigned char *sig;
+	size_t slen;
 
-		ec_sig_r = BN_bin2bn(sig, bn_len, NULL);
-		ec_sig_s = BN_bin2bn(sig + bn_len, bn_len, NULL);
-		if (ec_sig_r  == NULL || ec_sig_s == NULL)
-			VERIFY_ERROR("Error allocating R/S params"); // LCOV_EXCL_LINE
+	*out = NULL;
 
-		ECDSA_SIG_set0(ec_sig, ec_sig_r, ec_sig_s);
+	if (d->mac) {
+		if (EVP_MAC_final(d->mac, NULL, &slen, 0) != 1)
+			return 1; // LCOV_EXCL_LINE
+	} else if (EVP_DigestSignFinal(d->mdctx, NULL, &slen) != 1) {
+		// LCOV_EXCL_START
+		jwt_write_error(jwt, "JWT[OpenSSL]: Error checking sig size");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
 
-		slen = i2d_ECDSA_SIG(ec_sig, NULL);
+	sig = jwt_malloc(slen);
+	if (sig == NULL)
+		return 1; // LCOV_EXCL_LINE
 
-		/* Reset this with the new information */
-		sig = jwt_malloc(slen);
-		if (sig == NULL)
-			VERIFY_ERROR("Out of memory"); // LCOV_EXCL_LINE
+	if (d->mac) {
+		if (EVP_MAC_final(d->mac, sig, &slen, slen) != 1) {
+			// LCOV_EXCL_START
+			jwt_freemem(sig);
+			return 1;
+			// LCOV_EXCL_STOP
+		}
 
-		p = sig;
-		slen = i2d_ECDSA_SIG(ec_sig, &p);
+		*out = (char *)sig;
+		*len = slen;
 
-		if (slen == 0)
-			VERIFY_ERROR("Error calculating ECDSA sig"); // LCOV_EXCL_LINE
+		return 0;
 	}
 
-	mdctx = EVP_MD_CTX_create();
-	if (mdctx == NULL)
-		VERIFY_ERROR("Error creatign MD context"); // LCOV_EXCL_LINE
+	if (EVP_DigestSignFinal(d->mdctx, sig, &slen) != 1) {
+		// LCOV_EXCL_START
+		jwt_freemem(sig);
+		jwt_write_error(jwt, "JWT[OpenSSL]: Error singing token");
+		return 1;
+		// LCOV_EXCL_STOP
+	}
 
-	/* Initialize the DigestVerify operation using alg */
-	if (EVP_DigestVerifyInit(mdctx, &pkey_ctx, alg, NULL, pkey) != 1)
-		VERIFY_ERROR("Error initializing mdctx"); // LCOV_EXCL_LINE
+	return openssl_sig_out(jwt, d->type, sig, slen, out, len);
+}
 
-	if (type == EVP_PKEY_RSA_PSS) {
-		if (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx,
-						 RSA_PKCS1_PSS_PADDING) < 0)
-			VERIFY_ERROR("Error setting RSASSA-PSS padding"); // LCOV_EXCL_LINE
-		if (EVP_PKEY_CTX_set_rsa_pss_saltlen(pkey_ctx,
-						     RSA_PSS_SALTLEN_AUTO) < 0)
-			VERIFY_ERROR("Error setting RSASSA-PSS salt length"); // LCOV_EXCL_LINE
+static int openssl_digest_verify(jwt_t *jwt, void *dctx, unsigned char *sig,
+				 int slen)
+{
+	struct openssl_digest *d = dctx;
+	unsigned char der[JWT_ECDSA_DER_MAX];
+
+	if (d->type == EVP_PKEY_EC) {
+		if (openssl_ec_der(jwt, sig, slen, der, &slen))
+			return 1;
+		sig = der;
+	}
+
+	if (EVP_DigestVerifyFinal(d->mdctx, sig, slen) != 1)
+		jwt_write_error(jwt, "JWT[OpenSSL]: Failed to verify signature");
+
+	return jwt->error;
+}
+
+/* Verification plans. Everything is looked up and initialized once, and
+ * each token works on a copy, so the plan itself is never changed. */
+struct openssl_plan {
+	int (*verify)(jwt_t *jwt, struct openssl_plan *p, const char *head,
+		      unsigned int head_len, const unsigned char *sig,
+		      unsigned int slen);
+	EVP_MAC_CTX *mac;	/* Keyed HMAC				*/
+	EVP_MD_CTX *mdctx;	/* After EVP_DigestVerifyInit()		*/
+	int type;
+	unsigned int sig_len;	/* Anything else can't be right		*/
+};
+
+static int openssl_plan_hmac(jwt_t *jwt, struct openssl_plan *p,
+			     const char *head, unsigned int head_len,
+			     const unsigned char *sig, unsigned int slen)
+{
+	unsigned char res[EVP_MAX_MD_SIZE];
+	EVP_MAC_CTX *mac;
+	size_t res_len;
+	int ret = 1;
+
+	if (slen != p->sig_len) {
+		jwt_write_errcode(jwt, JWT_ERR_SIG_VERIFY);
+		return 1;
+	}
+
+	mac = EVP_MAC_CTX_dup(p->mac);
+	if (mac == NULL)
+		return 1; // LCOV_EXCL_LINE
+
+	if (EVP_MAC_update(mac, (const unsigned char *)head, head_len) == 1 &&
+	    EVP_MAC_final(mac, res, &res_len, sizeof(res)) == 1 &&
+	    res_len == slen)
+		ret = CRYPTO_memcmp(res, sig, slen) ? 1 : 0;
+
+	EVP_MAC_CTX_free(mac);
+
+	if (ret)
+		jwt_write_errcode(jwt, JWT_ERR_SIG_VERIFY);
+
+	return ret;
+}
+
+static int openssl_plan_pkey(jwt_t *jwt, struct openssl_plan *p,
+			     const char *head, unsigned int head_len,
+			     const unsigned char *sig, unsigned int slen)
+{
+	unsigned char der[JWT_ECDSA_DER_MAX];
+	EVP_MD_CTX *mdctx;
+	int type;
+
+	if (slen != p->sig_len) {
+		if (p->type == EVP_PKEY_EC)
+			jwt_write_error(jwt, "JWT[OpenSSL]: ECDSA micmatch with sig len");
+		else
+			jwt_write_error(jwt, "JWT[OpenSSL]: Failed to verify signature");
+		return 1;
+	}
+
+	if (p->type == EVP_PKEY_EC) {
+		slen = jwt_ecdsa_raw_to_der(sig, slen, der);
+		if (slen == 0) {
+			// LCOV_EXCL_START
+			jwt_write_error(jwt, "JWT[OpenSSL]: Error calculating ECDSA sig");
+			return 1;
+			// LCOV_EXCL_STOP
+		}
+		sig = der;
+	}
+
+	/* Not everything can be copied once initialized, so fall back to
+	 * doing it from scratch. */
+	mdctx = EVP_MD_CTX_new();
+	if (mdctx == NULL || EVP_MD_CTX_copy_ex(mdctx, p->mdctx) != 1) {
+		// LCOV_EXCL_START
+		EVP_MD_CTX_free(mdctx);
+		mdctx = openssl_md_start(jwt, 1, &type);
+		if (mdctx == NULL)
+			return 1;
+		// LCOV_EXCL_STOP
 	}
 
-	/* One-shot update and verify */
 	if (EVP_DigestVerify(mdctx, sig, slen, (const unsigned char *)head,
 			     head_len) != 1)
-		VERIFY_ERROR("Failed to verify signature");
+		jwt_write_error(jwt, "JWT[OpenSSL]: Failed to verify signature");
 
-jwt_verify_sha_pem_done:
-	BIO_free(bufkey);
-	EVP_MD_CTX_destroy(mdctx);
-	ECDSA_SIG_free(ec_sig);
+	EVP_MD_CTX_free(mdctx);
 
 	return jwt->error;
 }
 
+static void openssl_plan_free(void *pctx)
+{
+	struct openssl_plan *p = pctx;
+
+	if (p == NULL)
+		return; // LCOV_EXCL_LINE
+
+	EVP_MAC_CTX_free(p->mac);
+	EVP_MD_CTX_free(p->mdctx);
+	jwt_freemem(p);
+}
+
+static void *openssl_plan_new(jwt_t *jwt)
+{
+	struct openssl_plan *p;
+
+	p = jwt_malloc(sizeof(*p));
+	if (p == NULL)
+		return NULL; // LCOV_EXCL_LINE
+
+	memset(p, 0, sizeof(*p));
+
+	switch (jwt->alg) {
+	case JWT_ALG_HS256:
+	case JWT_ALG_HS384:
+	case JWT_ALG_HS512:
+		p->mac = openssl_hmac_start(jwt);
+		if (p->mac == NULL)
+			break; // LCOV_EXCL_LINE
+
+		p->verify = openssl_plan_hmac;
+		p->sig_len = EVP_MD_get_size(openssl_md(jwt->alg));
+		return p;
+
+	default:
+		p->mdctx = openssl_md_start(jwt, 1, &p->type);
+		if (p->mdctx == NULL)
+			break;
+
+		p->verify = openssl_plan_pkey;
+		if (p->type == EVP_PKEY_EC)
+			p->sig_len = ((jwt->key->bits + 7) / 8) * 2;
+		else
+			p->sig_len = EVP_PKEY_get_size(jwt->key->provider_data);
+		return p;
+	}
+
+	openssl_plan_free(p);
+
+	return NULL;
+}
+
+static int openssl_plan_verify(jwt_t *jwt, void *pctx, const char *head,
+			       unsigned int head_len, const unsigned char *sig,
+			       unsigned int slen)
+{
+	struct openssl_plan *p = pctx;
+
+	return p->verify(jwt, p, head, head_len, sig, slen);
+}
+
 /* Export our ops */
 struct jwt_crypto_ops jwt_openssl_ops = {
 	.name			= "openssl",
@@ -421,6 +626,16 @@ struct jwt_crypto_ops jwt_openssl_ops = {
 	.sign_sha_pem		= openssl_sign_sha_pem,
 	.verify_sha_pem		= openssl_verify_sha_pem,
 
+	.digest_init		= openssl_digest_init,
+	.digest_update		= openssl_digest_update,
+	.digest_sign		= openssl_digest_sign,
+	.digest_verify		= openssl_digest_verify,
+	.digest_free		= openssl_digest_free,
+
+	.plan_new		= openssl_plan_new,
+	.plan_verify		= openssl_plan_verify,
+	.plan_free		= openssl_plan_free,
+
 	.jwk_implemented	= 1,
 	.process_eddsa		= openssl_process_eddsa,
 	.process_rsa		= openssl_process_rsa,
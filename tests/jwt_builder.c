@@ -848,6 +848,518 @@ START_TEST(sign_es256_bad_sig)
 }
 END_TEST
 
+START_TEST(gen_template)
+{
+	jwt_builder_auto_t *builder = NULL;
+	char_auto *out = NULL;
+	char_auto *tmpl_out = NULL;
+	jwt_value_t jval;
+	int ret;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+
+	ret = jwt_builder_enable_iat(builder, 0);
+	ck_assert_int_eq(ret, 1);
+
+	read_json("oct_key_256.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_set_SET_STR(&jval, "sub", "user0");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_INT(&jval, "admin", 1);
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_JSON(&jval, "aud", "[\"a\",\"b\\/c\"]");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_STR(&jval, "kid", "key-1");
+	ck_assert_int_eq(jwt_builder_header_set(builder, &jval), 0);
+
+	out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out);
+
+	ret = jwt_builder_enable_template(builder, 1);
+	ck_assert_int_eq(ret, 0);
+
+	/* Same token, with or without the template */
+	tmpl_out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(tmpl_out);
+	ck_assert_str_eq(out, tmpl_out);
+	jwt_freemem(tmpl_out);
+
+	/* And again, from the compiled version */
+	tmpl_out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(tmpl_out);
+	ck_assert_str_eq(out, tmpl_out);
+	jwt_freemem(tmpl_out);
+
+	/* Changing the builder drops the template */
+	jwt_set_SET_STR(&jval, "sub", "user1");
+	jval.replace = 1;
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	tmpl_out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(tmpl_out);
+	ck_assert_str_ne(out, tmpl_out);
+
+	ret = jwt_builder_enable_template(builder, 0);
+	ck_assert_int_eq(ret, 1);
+
+	jwt_freemem(out);
+	out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out);
+	ck_assert_str_eq(out, tmpl_out);
+
+	ck_assert_int_eq(jwt_builder_enable_template(NULL, 1), -1);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(gen_template_setcb)
+{
+	jwt_builder_auto_t *builder = NULL;
+	char_auto *out = NULL;
+	int ret;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+
+	read_json("oct_key_256.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_builder_enable_template(builder, 1), 0);
+
+	/* Compiles the template */
+	out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out);
+
+	/* A callback set after that still sees every token */
+	ret = jwt_builder_setcb(builder, __just_fail_cb, NULL);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_null(jwt_builder_generate(builder));
+	ck_assert_int_eq(jwt_builder_error_code(builder), JWT_ERR_CALLBACK);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(gen_template_time)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_value_t jval;
+	int ret, i;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+
+	read_json("oct_key_256.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_time_offset(builder, JWT_CLAIM_EXP, 300);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_builder_time_offset(builder, JWT_CLAIM_NBF, 10);
+	ck_assert_int_eq(ret, 0);
+
+	/* The generated values replace these */
+	jwt_set_SET_INT(&jval, "exp", 1);
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_STR(&jval, "iss", "files.maclara-llc.com");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	/* Try a few times, in case we cross a second boundary */
+	for (i = 0; i < 5; i++) {
+		char_auto *first = NULL, *second = NULL, *tmpl_out = NULL;
+
+		jwt_builder_enable_template(builder, 0);
+		first = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(first);
+
+		jwt_builder_enable_template(builder, 1);
+		tmpl_out = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(tmpl_out);
+
+		jwt_builder_enable_template(builder, 0);
+		second = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(second);
+
+		if (strcmp(first, second))
+			continue;
+
+		ck_assert_str_eq(first, tmpl_out);
+		break;
+	}
+	ck_assert_int_lt(i, 5);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(gen_template_verify)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	jwt_value_t jval;
+	int ret, i;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	read_json("ec_key_secp384r1.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_ES384, g_item);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_setkey(checker, JWT_ALG_ES384, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_time_offset(builder, JWT_CLAIM_EXP, 300);
+	ck_assert_int_eq(ret, 0);
+	jwt_set_SET_STR(&jval, "sub", "user0");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	ret = jwt_builder_enable_template(builder, 1);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < 10; i++) {
+		char_auto *out = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(out);
+
+		ret = jwt_checker_verify(checker, out);
+		ck_assert_int_eq(ret, 0);
+	}
+
+	free_key();
+}
+END_TEST
+
+/* Verify the token, and copy out its jti */
+static void __jti_get(jwt_checker_t *checker, const char *token, char *jti)
+{
+	jwt_verified_auto_t *v = NULL;
+	jwt_view_t claims, view;
+	const char *str;
+	size_t len;
+
+	ck_assert_int_eq(jwt_checker_verify_extract(checker, token, &v), 0);
+	ck_assert_int_eq(jwt_verified_claims_view(v, &claims), 0);
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/jti", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_int_lt(len, JWT_JTI_MAX);
+	strcpy(jti, str);
+}
+
+static int __jti_cb(char *jti, size_t len, void *ctx)
+{
+	int *count = ctx;
+
+	(*count)++;
+
+	if (*count == 100)
+		return 1;
+	if (*count == 101)
+		strcpy(jti, "no \"quotes\"");
+	else if (*count == 102)
+		memset(jti, 'x', len);
+	else
+		snprintf(jti, len, "id-%d", *count);
+
+	return 0;
+}
+
+START_TEST(gen_template_jti)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char jti[2][JWT_JTI_MAX];
+	char *out[8];
+	jwt_value_t jval;
+	int ret, i, count = 0;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	read_json("oct_key_256.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	/* Generated values replace this */
+	jwt_set_SET_STR(&jval, "jti", "static");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	ck_assert_int_eq(jwt_builder_enable_jti(builder, 1), 0);
+	ck_assert_int_eq(jwt_builder_enable_template(builder, 1), 0);
+
+	/* Random, and different every time */
+	for (i = 0; i < 2; i++) {
+		char_auto *tok = jwt_builder_generate(builder);
+
+		ck_assert_ptr_nonnull(tok);
+		__jti_get(checker, tok, jti[i]);
+		ck_assert_int_eq(strlen(jti[i]), 22);
+	}
+	ck_assert_str_ne(jti[0], jti[1]);
+
+	/* Same without the template */
+	jwt_builder_enable_template(builder, 0);
+	for (i = 0; i < 2; i++) {
+		char_auto *tok = jwt_builder_generate(builder);
+
+		ck_assert_ptr_nonnull(tok);
+		__jti_get(checker, tok, jti[i]);
+	}
+	ck_assert_str_ne(jti[0], jti[1]);
+
+	/* From a callback, which is the same either way */
+	ck_assert_int_eq(jwt_builder_enable_iat(builder, 0), 1);
+	ck_assert_int_eq(jwt_builder_setjti(builder, __jti_cb, &count), 0);
+
+	for (i = 0; i < 2; i++) {
+		char_auto *tok = NULL, *tmpl_out = NULL;
+
+		count = i;
+		jwt_builder_enable_template(builder, 0);
+		tok = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(tok);
+
+		count = i;
+		jwt_builder_enable_template(builder, 1);
+		tmpl_out = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(tmpl_out);
+		ck_assert_str_eq(tok, tmpl_out);
+
+		__jti_get(checker, tok, jti[i]);
+	}
+	ck_assert_str_eq(jti[0], "id-1");
+	ck_assert_str_eq(jti[1], "id-2");
+
+	/* Batches get one each */
+	count = 0;
+	ret = jwt_builder_generate_batch(builder, NULL, 8, out);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(count, 8);
+	for (i = 0; i < 8; i++) {
+		ck_assert_ptr_nonnull(out[i]);
+		if (i)
+			ck_assert_str_ne(out[i], out[i - 1]);
+	}
+	for (i = 0; i < 8; i++)
+		free(out[i]);
+
+	/* The callback failing, and IDs we can't use */
+	for (count = 99; count < 102;) {
+		char_auto *tok = jwt_builder_generate(builder);
+
+		ck_assert_ptr_null(tok);
+		ck_assert_int_ne(jwt_builder_error(builder), 0);
+	}
+
+	/* Back to random, then off */
+	ck_assert_int_eq(jwt_builder_setjti(builder, NULL, NULL), 0);
+	ck_assert_int_eq(jwt_builder_enable_jti(builder, 0), 1);
+	out[0] = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out[0]);
+	__jti_get(checker, out[0], jti[0]);
+	ck_assert_str_eq(jti[0], "static");
+	free(out[0]);
+
+	ck_assert_int_eq(jwt_builder_enable_jti(NULL, 1), -1);
+	ck_assert_int_ne(jwt_builder_setjti(NULL, NULL, NULL), 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(gen_batch)
+{
+	jwt_builder_auto_t *builder = NULL;
+	const char *extra[64];
+	char *out[64];
+	char buf[64][32];
+	jwt_value_t jval;
+	int ret, i;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+
+	ret = jwt_builder_enable_iat(builder, 0);
+	ck_assert_int_eq(ret, 1);
+
+	read_json("oct_key_256.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_set_SET_STR(&jval, "iss", "files.maclara-llc.com");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	for (i = 0; i < 64; i++) {
+		sprintf(buf[i], "{\"sub\":\"user-%d\"}", i);
+		extra[i] = buf[i];
+	}
+	/* One without any extras */
+	extra[10] = NULL;
+
+	ret = jwt_builder_generate_batch(builder, extra, 64, out);
+	ck_assert_int_eq(ret, 0);
+
+	/* Should be in order, and the same as one at a time */
+	for (i = 0; i < 64; i++) {
+		char_auto *one = NULL;
+
+		if (i != 10) {
+			sprintf(buf[i], "user-%d", i);
+			jwt_set_SET_STR(&jval, "sub", buf[i]);
+			ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+		}
+
+		one = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(one);
+		ck_assert_ptr_nonnull(out[i]);
+		ck_assert_str_eq(out[i], one);
+
+		if (i != 10)
+			jwt_builder_claim_del(builder, "sub");
+
+		free(out[i]);
+	}
+
+	/* No extras at all, from the template */
+	ret = jwt_builder_enable_template(builder, 1);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_generate_batch(builder, NULL, 8, out);
+	ck_assert_int_eq(ret, 0);
+	for (i = 0; i < 8; i++) {
+		ck_assert_ptr_nonnull(out[i]);
+		ck_assert_str_eq(out[i], out[0]);
+	}
+	for (i = 0; i < 8; i++)
+		free(out[i]);
+
+	free_key();
+}
+END_TEST
+
+static int __batch_cb(jwt_t *jwt, jwt_config_t *config)
+{
+	int *count = config->ctx;
+
+	ck_assert_ptr_nonnull(jwt);
+	(*count)++;
+
+	return 0;
+}
+
+START_TEST(gen_batch_verify)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char *out[16];
+	int ret, i, count = 0;
+
+	SET_OPS();
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	read_json("ec_key_prime256v1.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_ES256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_setkey(checker, JWT_ALG_ES256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_generate_batch(builder, NULL, 16, out);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < 16; i++) {
+		ck_assert_ptr_nonnull(out[i]);
+		ck_assert_int_eq(jwt_checker_verify(checker, out[i]), 0);
+		free(out[i]);
+	}
+
+	/* Callbacks see every token */
+	ret = jwt_builder_setcb(builder, __batch_cb, &count);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_generate_batch(builder, NULL, 16, out);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(count, 16);
+
+	for (i = 0; i < 16; i++) {
+		ck_assert_int_eq(jwt_checker_verify(checker, out[i]), 0);
+		free(out[i]);
+	}
+
+	free_key();
+}
+END_TEST
+
+START_TEST(gen_batch_errors)
+{
+	jwt_builder_auto_t *builder = NULL;
+	const char *extra[] = { "{\"sub\":\"ok\"}", "[1, 2]" };
+	char *out[2];
+	int ret;
+
+	SET_OPS();
+
+	ret = jwt_builder_generate_batch(NULL, NULL, 2, out);
+	ck_assert_int_eq(ret, -1);
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+
+	ret = jwt_builder_generate_batch(builder, NULL, 2, NULL);
+	ck_assert_int_eq(ret, -1);
+	ck_assert_str_eq(jwt_builder_error_msg(builder),
+			 "Must pass an output array");
+	jwt_builder_error_clear(builder);
+
+	ret = jwt_builder_generate_batch(builder, extra, 2, out);
+	ck_assert_int_eq(ret, -1);
+	ck_assert_ptr_null(out[0]);
+	ck_assert_ptr_null(out[1]);
+	ck_assert_str_eq(jwt_builder_error_msg(builder),
+			 "Claims override 1 is not a JSON object");
+	jwt_builder_error_clear(builder);
+
+	/* Every token fails in the callback */
+	ret = jwt_builder_setcb(builder, __just_fail_cb, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_builder_generate_batch(builder, NULL, 2, out);
+	ck_assert_int_eq(ret, 2);
+	ck_assert_ptr_null(out[0]);
+	ck_assert_ptr_null(out[1]);
+	ck_assert_str_eq(jwt_builder_error_msg(builder),
+			 "User callback returned error");
+
+	/* Nothing to do is fine */
+	jwt_builder_error_clear(builder);
+	ret = jwt_builder_generate_batch(builder, NULL, 0, out);
+	ck_assert_int_eq(ret, 0);
+}
+END_TEST
+
 static Suite *libjwt_suite(const char *title)
 {
 	Suite *s;
@@ -882,6 +1394,21 @@ static Suite *libjwt_suite(const char *title)
 	tcase_add_loop_test(tc_core, gen_hs256_wcb, 0, i);
 	suite_add_tcase(s, tc_core);
 
+	tc_core = tcase_create("Template Gen");
+	tcase_add_loop_test(tc_core, gen_template, 0, i);
+	tcase_add_loop_test(tc_core, gen_template_time, 0, i);
+	tcase_add_loop_test(tc_core, gen_template_verify, 0, i);
+	tcase_add_loop_test(tc_core, gen_template_jti, 0, i);
+	tcase_add_loop_test(tc_core, gen_template_setcb, 0, i);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("Batch Gen");
+	tcase_add_loop_test(tc_core, gen_batch, 0, i);
+	tcase_add_loop_test(tc_core, gen_batch_verify, 0, i);
+	tcase_add_loop_test(tc_core, gen_batch_errors, 0, i);
+	tcase_set_timeout(tc_core, 30);
+	suite_add_tcase(s, tc_core);
+
 	tc_core = tcase_create("Claims SetGetDel");
 	tcase_add_loop_test(tc_core, claim_str_setgetdel, 0, i);
 	tcase_add_loop_test(tc_core, claim_int_setgetdel, 0, i);
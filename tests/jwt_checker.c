@@ -5,6 +5,7 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "jwt_tests.h"
 
@@ -90,6 +91,8 @@ START_TEST(no_alg)
 
 	ret = jwt_checker_verify(checker, token);
 	ck_assert_int_ne(ret, 0);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "No alg found in header");
 }
 END_TEST
 
@@ -909,47 +912,1962 @@ START_TEST(verify_es256_bad_sig)
 }
 END_TEST
 
-static Suite *libjwt_suite(const char *title)
+START_TEST(verify_plan)
 {
-	Suite *s;
-	TCase *tc_core;
-	int i = ARRAY_SIZE(jwt_test_ops);
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	jwk_set_auto_t *other_set = NULL;
+	const jwk_item_t *other;
+	char_auto *token = NULL;
+	size_t i, len;
+	int ret;
 
-	s = suite_create(title);
+	SET_OPS();
 
-	tc_core = tcase_create("New");
-	tcase_add_loop_test(tc_core, new, 0, i);
-	suite_add_tcase(s, tc_core);
+	read_json("rsa_key_2048.json");
 
-	tc_core = tcase_create("Verify");
-	tcase_add_loop_test(tc_core, verify, 0, i);
-	tcase_add_loop_test(tc_core, verify_bad_header, 0, i);
-	tcase_add_loop_test(tc_core, verify_bad_payload, 0, i);
-	tcase_add_loop_test(tc_core, verify_rsapss384, 0, i);
-	tcase_add_loop_test(tc_core, verify_wcb, 0, i);
-	tcase_add_loop_test(tc_core, just_fail_wcb, 0, i);
-	tcase_add_loop_test(tc_core, verify_stress, 0, i);
-	suite_add_tcase(s, tc_core);
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_RS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
 
-	tc_core = tcase_create("Error Handling");
-	tcase_add_loop_test(tc_core, null_handling, 0, i);
-	tcase_add_loop_test(tc_core, bad_alg, 0, i);
-	tcase_add_loop_test(tc_core, no_alg, 0, i);
-	tcase_add_loop_test(tc_core, no_first_dot, 0, i);
-	tcase_add_loop_test(tc_core, no_second_dot, 0, i);
-	tcase_add_loop_test(tc_core, alg_none_with_sig, 0, i);
-	tcase_add_loop_test(tc_core, hs256_no_key, 0, i);
-	tcase_add_loop_test(tc_core, hs256_wrong_key, 0, i);
-	tcase_add_loop_test(tc_core, hs256_wrong_key_alg, 0, i);
-	tcase_add_loop_test(tc_core, hs256_token_failed, 0, i);
-	suite_add_tcase(s, tc_core);
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_RS256, g_item);
+	ck_assert_int_eq(ret, 0);
 
-	tc_core = tcase_create("HS256 Key Verify");
-	tcase_add_loop_test(tc_core, verify_hs256, 0, i);
-	tcase_add_loop_test(tc_core, verify_hs256_wcb, 0, i);
-	tcase_add_loop_test(tc_core, verify_hs256_stress, 0, i);
-	tcase_add_loop_test(tc_core, verify_hs256_fail, 0, i);
-	tcase_add_loop_test(tc_core, verify_hs256_fail_stress, 0, i);
+	ret = jwt_checker_verify(checker, token);
+	ck_assert_int_eq(ret, 0);
+
+	/* The plan has to follow the ops, however they are changed */
+	for (i = 0; i < ARRAY_SIZE(jwt_test_ops); i++) {
+		ret = jwt_checker_set_crypto_ops(checker, jwt_test_ops[i].name);
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_checker_verify(checker, token);
+		ck_assert_int_eq(ret, 0);
+
+		ret = jwt_set_crypto_ops_alg(JWT_ALG_RS256,
+					     jwt_test_ops[i].name);
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_checker_set_crypto_ops(checker, NULL);
+		ck_assert_int_eq(ret, 0);
+		ret = jwt_checker_verify(checker, token);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_RS256, NULL), 0);
+	}
+
+	/* Short signature */
+	len = strlen(token);
+	token[len - 4] = '\0';
+	ret = jwt_checker_verify(checker, token);
+	ck_assert_int_ne(ret, 0);
+	jwt_checker_error_clear(checker);
+
+	/* The plan has to follow the key too */
+	other_set = jwks_create_fromfile(KEYDIR "/rsa_key_4096.json");
+	ck_assert_ptr_nonnull(other_set);
+	other = jwks_item_get(other_set, 0);
+	ck_assert_ptr_nonnull(other);
+
+	ret = jwt_builder_setkey(builder, JWT_ALG_RS384, other);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_freemem(token);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+	ret = jwt_checker_verify(checker, token);
+	ck_assert_int_ne(ret, 0);
+	jwt_checker_error_clear(checker);
+
+	ret = jwt_checker_setkey(checker, JWT_ALG_RS384, other);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_verify(checker, token);
+	ck_assert_int_eq(ret, 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(verify_plan_short_key)
+{
+	jwt_checker_auto_t *checker = NULL;
+	const char token[] = "eyJhbGciOiJSUzI1NiJ9.e30.AAAA";
+	int ret;
+
+	SET_OPS();
+
+	read_json("rsa_key_1024.json");
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	/* Still accepted here, but caught on every verify */
+	ret = jwt_checker_setkey(checker, JWT_ALG_RS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_checker_verify(checker, token);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Key too short for RSA algs: 1024 bits");
+
+	free_key();
+}
+END_TEST
+
+START_TEST(verify_batch)
+{
+	jwt_checker_auto_t *checker = NULL;
+	const char good[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.CM4dD95Nj"
+		"0vSfMGtDas432AUW1HAo7feCiAbt5Yjuds";
+	const char bad[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.CM4dD95Nj"
+		"0vSfMGtDas432AUW1HAo7feCiAbt5YjudX";
+	char buf[sizeof(good) * 64];
+	const char *tokens[64];
+	size_t lens[64];
+	int results[64];
+	int ret, i;
+
+	SET_OPS();
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	read_json("oct_key_256.json");
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	/* All of them in one buffer, separated by newlines */
+	for (i = 0; i < 64; i++) {
+		char *tok = buf + (i * sizeof(good));
+
+		memcpy(tok, (i % 4) ? good : bad, sizeof(good) - 1);
+		tok[sizeof(good) - 1] = '\n';
+		tokens[i] = tok;
+		lens[i] = sizeof(good) - 1;
+	}
+
+	ret = jwt_checker_verify_batch(checker, tokens, lens, 64, results);
+	ck_assert_int_eq(ret, 16);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Token failed verification");
+
+	for (i = 0; i < 64; i++) {
+		if (i % 4)
+			ck_assert_int_eq(results[i], 0);
+		else
+			ck_assert_int_ne(results[i], 0);
+	}
+
+	/* And now as strings */
+	for (i = 0; i < 64; i++)
+		tokens[i] = good;
+
+	ret = jwt_checker_verify_batch(checker, tokens, NULL, 64, results);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_checker_error(checker), 0);
+
+	for (i = 0; i < 64; i++)
+		ck_assert_int_eq(results[i], 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(verify_batch_wcb)
+{
+	jwt_checker_auto_t *checker = NULL;
+	const char token[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.CM4dD95Nj"
+		"0vSfMGtDas432AUW1HAo7feCiAbt5Yjuds";
+	const char *tokens[] = { token, token, token, token };
+	int results[4];
+	int ret, i;
+
+	SET_OPS();
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	read_json("oct_key_256.json");
+
+	/* The key comes from the callback */
+	ret = jwt_checker_setcb(checker, __verify_hs256_wcb, "ctx");
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_checker_verify_batch(checker, tokens, NULL, 4, results);
+	ck_assert_int_eq(ret, 0);
+
+	for (i = 0; i < 4; i++)
+		ck_assert_int_eq(results[i], 0);
+
+	ret = jwt_checker_setcb(checker, __verify_hs256_wcb, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_checker_verify_batch(checker, tokens, NULL, 4, results);
+	ck_assert_int_eq(ret, 4);
+
+	for (i = 0; i < 4; i++)
+		ck_assert_int_ne(results[i], 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(verify_batch_errors)
+{
+	jwt_checker_auto_t *checker = NULL;
+	const char token[] = "eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.e30.CM4dD95Nj"
+		"0vSfMGtDas432AUW1HAo7feCiAbt5Yjuds";
+	const char *tokens[] = { token, NULL, token, "nodots" };
+	size_t lens[] = { sizeof(token) - 1, 0, 10, 6 };
+	int results[4];
+	int ret;
+
+	SET_OPS();
+
+	ret = jwt_checker_verify_batch(NULL, tokens, NULL, 4, results);
+	ck_assert_int_eq(ret, -1);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	ret = jwt_checker_verify_batch(checker, tokens, NULL, 4, NULL);
+	ck_assert_int_eq(ret, -1);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Must pass token and result arrays");
+
+	read_json("oct_key_256.json");
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_checker_verify_batch(checker, tokens, lens, 4, results);
+	ck_assert_int_eq(ret, 3);
+	ck_assert_int_eq(results[0], 0);
+	ck_assert_int_ne(results[1], 0);
+	ck_assert_int_ne(results[2], 0);
+	ck_assert_int_ne(results[3], 0);
+
+	/* A nil inside the given length is not part of a token */
+	lens[0] = sizeof(token);
+	ret = jwt_checker_verify_batch(checker, tokens, lens, 1, results);
+	ck_assert_int_eq(ret, 1);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Token contains a nil byte");
+
+	ret = jwt_checker_verify_batch(checker, tokens, lens, 0, results);
+	ck_assert_int_eq(ret, 0);
+
+	free_key();
+}
+END_TEST
+
+/* The kid of oct_key_256_issue1.json */
+#define KID "987cd169-c39c-42d4-a918-d444668a3ba7"
+
+START_TEST(verify_metrics)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	jwt_metrics_t *snap, *other;
+	char_auto *good = NULL, *expired = NULL, *wrong_iss = NULL;
+	char_auto *bad_sig = NULL, *prom = NULL;
+	jwt_value_t jval;
+	size_t len;
+	int ret;
+
+	SET_OPS();
+
+	read_json("oct_key_256_issue1.json");
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_set_SET_STR(&jval, "kid", "key-1");
+	ck_assert_int_eq(jwt_builder_header_set(builder, &jval), 0);
+	jwt_set_SET_STR(&jval, "iss", "us");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	good = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(good);
+
+	jwt_set_SET_STR(&jval, "iss", "them");
+	jval.replace = 1;
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	wrong_iss = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(wrong_iss);
+
+	jwt_set_SET_STR(&jval, "iss", "us");
+	jval.replace = 1;
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_INT(&jval, "exp", TS_CONST);
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	expired = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(expired);
+
+	bad_sig = strdup(good);
+	ck_assert_ptr_nonnull(bad_sig);
+	len = strlen(bad_sig);
+	bad_sig[len - 2] = bad_sig[len - 2] == 'A' ? 'B' : 'A';
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_claim_set(checker, JWT_CLAIM_ISS, "us");
+	ck_assert_int_eq(ret, 0);
+
+	/* Off by default */
+	ck_assert_ptr_null(jwt_checker_metrics_snapshot(checker));
+	ck_assert_int_eq(jwt_checker_metrics_enable(NULL, 1), 1);
+	ck_assert_int_eq(jwt_checker_metrics_enable(checker, 1), 0);
+	ck_assert_int_eq(jwt_checker_metrics_enable(checker, 1), 0);
+
+	ck_assert_int_eq(jwt_checker_verify(checker, good), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, good), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, good), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, expired), 0);
+	jwt_checker_error_clear(checker);
+	ck_assert_int_ne(jwt_checker_verify(checker, wrong_iss), 0);
+	jwt_checker_error_clear(checker);
+	ck_assert_int_ne(jwt_checker_verify(checker, bad_sig), 0);
+	jwt_checker_error_clear(checker);
+	ck_assert_int_ne(jwt_checker_verify(checker, "garbage"), 0);
+	jwt_checker_error_clear(checker);
+
+	snap = jwt_checker_metrics_snapshot(checker);
+	ck_assert_ptr_nonnull(snap);
+
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_OK), 3);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_INVAL,
+					   JWT_METRIC_OK), 3);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_ERR_EXP), 1);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_ERR_ISS), 1);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_ERR_SIG), 1);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_NONE,
+					   JWT_METRIC_ERR_PARSE), 1);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_COUNT), 0);
+	ck_assert_int_eq(jwt_metrics_count(NULL, JWT_ALG_HS256,
+					   JWT_METRIC_OK), 0);
+
+	/* The key's kid, not what the token said */
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, KID, 0), 3);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, KID, 1), 3);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, "key-1", 0), 0);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, "key-1", 1), 0);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, "", 0), 0);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, "", 1), 1);
+
+	ck_assert_int_gt(jwt_metrics_quantile(snap, JWT_ALG_HS256, 0.5), 0);
+	ck_assert_int_ge(jwt_metrics_quantile(snap, JWT_ALG_INVAL, 1.0),
+			 jwt_metrics_quantile(snap, JWT_ALG_HS256, 0.5));
+	ck_assert_int_eq(jwt_metrics_quantile(snap, JWT_ALG_ES256, 0.5), 0);
+	ck_assert_int_eq(jwt_metrics_quantile(snap, JWT_ALG_HS256, 2.0), 0);
+
+	prom = jwt_metrics_prometheus(snap, NULL);
+	ck_assert_ptr_nonnull(prom);
+	ck_assert_ptr_nonnull(strstr(prom,
+		"jwt_verify_total{alg=\"HS256\",result=\"ok\"} 3\n"));
+	ck_assert_ptr_nonnull(strstr(prom,
+		"jwt_verify_total{alg=\"none\",result=\"parse\"} 1\n"));
+	ck_assert_ptr_nonnull(strstr(prom,
+		"jwt_verify_kid_total{kid=\"" KID "\",result=\"error\"} 3\n"));
+	ck_assert_ptr_nonnull(strstr(prom,
+		"jwt_verify_duration_seconds_bucket{alg=\"HS256\",le=\"+Inf\"} 6\n"));
+	ck_assert_ptr_nonnull(strstr(prom,
+		"jwt_verify_duration_seconds_count{alg=\"HS256\"} 6\n"));
+
+	/* Merging two of the same adds them up */
+	other = jwt_checker_metrics_snapshot(checker);
+	ck_assert_ptr_nonnull(other);
+	ck_assert_int_eq(jwt_metrics_merge(snap, other), 0);
+	ck_assert_int_eq(jwt_metrics_count(snap, JWT_ALG_HS256,
+					   JWT_METRIC_OK), 6);
+	ck_assert_int_eq(jwt_metrics_kid_count(snap, KID, 1), 6);
+	jwt_metrics_free(other);
+
+	/* But not a builder's into a checker's */
+	ck_assert_int_eq(jwt_builder_metrics_enable(builder, 1), 0);
+	jwt_freemem(prom);
+	prom = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(prom);
+	other = jwt_builder_metrics_snapshot(builder);
+	ck_assert_ptr_nonnull(other);
+	ck_assert_int_eq(jwt_metrics_count(other, JWT_ALG_HS256,
+					   JWT_METRIC_OK), 1);
+	ck_assert_int_ne(jwt_metrics_merge(snap, other), 0);
+	jwt_freemem(prom);
+	prom = jwt_metrics_prometheus(other, "app");
+	ck_assert_ptr_nonnull(strstr(prom,
+		"app_generate_total{alg=\"HS256\",result=\"ok\"} 1\n"));
+	jwt_metrics_free(other);
+	jwt_metrics_free(snap);
+
+	ck_assert_int_eq(jwt_checker_metrics_enable(checker, 0), 0);
+	ck_assert_ptr_null(jwt_checker_metrics_snapshot(checker));
+
+	free_key();
+}
+END_TEST
+
+static void __trace_stages(const jwt_trace_span_t *span, void *ctx)
+{
+	unsigned int *seen = ctx;
+
+	ck_assert_uint_ge(span->end_ns, span->start_ns);
+	*seen |= 1U << span->stage;
+}
+
+static void __trace_slow(const jwt_trace_op_t *op, void *ctx)
+{
+	int *count = ctx;
+
+	ck_assert_uint_eq(op->dropped, 0);
+	ck_assert_uint_ge(op->end_ns, op->start_ns);
+	ck_assert_uint_gt(op->bytes, 0);
+	(*count)++;
+
+	/* Failed before any stage finished */
+	if (op->error)
+		return;
+
+	ck_assert_uint_gt(op->count, 0);
+	ck_assert_uint_eq(op->spans[0].stage, op->builder ?
+			  JWT_TRACE_JSON : JWT_TRACE_SPLIT);
+	ck_assert_int_eq(op->alg, JWT_ALG_HS256);
+}
+
+static int __trace_cb(jwt_t *jwt, jwt_config_t *config)
+{
+	ck_assert_ptr_nonnull(jwt);
+	ck_assert_ptr_nonnull(config);
+
+	return 0;
+}
+
+START_TEST(verify_trace)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char_auto *token = NULL;
+	unsigned int seen = 0;
+	int i, count = 0;
+	int ret;
+
+	SET_OPS();
+
+	read_json("oct_key_256.json");
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_ne(jwt_builder_set_trace(NULL, __trace_stages, &seen), 0);
+	ck_assert_int_eq(jwt_builder_set_trace(builder, __trace_stages,
+					       &seen), 0);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+	ck_assert_uint_eq(seen, (1U << JWT_TRACE_JSON) |
+			  (1U << JWT_TRACE_BASE64) | (1U << JWT_TRACE_SIG));
+	ck_assert_int_eq(jwt_builder_set_trace(builder, NULL, NULL), 0);
+
+	ck_assert_int_eq(jwt_builder_set_trace_slow(builder, 0, 0,
+						    __trace_slow, &count), 0);
+	jwt_freemem(token);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+	ck_assert_int_eq(count, 1);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_ne(jwt_checker_set_trace(NULL, __trace_stages, &seen), 0);
+	ck_assert_int_eq(jwt_checker_set_trace(checker, __trace_stages,
+					       &seen), 0);
+	seen = 0;
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+	ck_assert_uint_eq(seen, (1U << JWT_TRACE_SPLIT) |
+			  (1U << JWT_TRACE_BASE64) | (1U << JWT_TRACE_JSON) |
+			  (1U << JWT_TRACE_CLAIMS) | (1U << JWT_TRACE_SIG));
+
+	/* The callback is a stage too */
+	ret = jwt_checker_setcb(checker, __trace_cb, NULL);
+	ck_assert_int_eq(ret, 0);
+	seen = 0;
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+	ck_assert(seen & (1U << JWT_TRACE_CALLBACK));
+	ck_assert_int_eq(jwt_checker_set_trace(checker, NULL, NULL), 0);
+
+	/* Threshold of 0 makes them all slow, but only every other one is
+	 * reported */
+	count = 0;
+	ck_assert_int_eq(jwt_checker_set_trace_slow(checker, 0, 2,
+						    __trace_slow, &count), 0);
+	for (i = 0; i < 4; i++)
+		ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(count, 2);
+
+	/* Failures still get reported */
+	ck_assert_int_eq(jwt_checker_set_trace_slow(checker, 0, 1,
+						    __trace_slow, &count), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, "a.b"), 0);
+	ck_assert_int_eq(count, 3);
+
+	/* Nothing is that slow */
+	ck_assert_int_eq(jwt_checker_set_trace_slow(checker, ~0ULL, 1,
+						    __trace_slow, &count), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(count, 3);
+
+	ck_assert_int_ne(jwt_checker_set_trace_slow(NULL, 0, 1, NULL,
+						    NULL), 0);
+
+	free_key();
+}
+END_TEST
+
+/* Code for a token signed with the key in file, and then broken */
+static jwt_error_t __bad_sig_code(const char *file, jwt_alg_t alg)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char_auto *token = NULL;
+	jwt_error_t err;
+	size_t len;
+
+	read_json(file);
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ck_assert_int_eq(jwt_builder_setkey(builder, alg, g_item), 0);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_setkey(checker, alg, g_item), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	len = strlen(token);
+	token[len - 10] = token[len - 10] == 'A' ? 'B' : 'A';
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_str_ne(jwt_checker_error_msg(checker), "");
+	err = jwt_checker_error_code(checker);
+
+	free_key();
+
+	return err;
+}
+
+START_TEST(verify_error_codes)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char_auto *token = NULL;
+	const char *tokens[2];
+	int results[2];
+	jwt_value_t jval;
+	size_t len;
+	int ret;
+
+	SET_OPS();
+
+	read_json("oct_key_256.json");
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ck_assert_int_eq(jwt_builder_error_code(builder), JWT_ERR_NONE);
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_set_SET_STR(&jval, "iss", "them");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_INT(&jval, "exp", TS_CONST);
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NONE);
+	ck_assert_int_eq(jwt_checker_error_claims(checker), 0);
+	ck_assert_int_eq(jwt_checker_error_code(NULL), JWT_ERR_NONE);
+	ck_assert_int_eq(jwt_checker_error_claims(NULL), 0);
+
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_checker_claim_set(checker, JWT_CLAIM_ISS, "us");
+	ck_assert_int_eq(ret, 0);
+
+	/* Every claim is checked, and every one that failed is reported */
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_CLAIMS);
+	ck_assert_int_eq(jwt_checker_error_claims(checker),
+			 JWT_CLAIM_EXP | JWT_CLAIM_ISS);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Failed one or more claims");
+	ck_assert_str_eq(jwt_error_str(JWT_ERR_CLAIMS),
+			 "Failed one or more claims");
+
+	jwt_checker_error_clear(checker);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NONE);
+	ck_assert_int_eq(jwt_checker_error_claims(checker), 0);
+	ck_assert_str_eq(jwt_checker_error_msg(checker), "");
+
+	ck_assert_int_ne(jwt_checker_verify(checker, "garbage"), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker),
+			 JWT_ERR_NO_HEADER_DOT);
+	ck_assert_int_eq(jwt_checker_error_claims(checker), 0);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, "e30.e30"), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker),
+			 JWT_ERR_NO_PAYLOAD_DOT);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, "e30.e30.e30"), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NO_ALG);
+	jwt_checker_error_clear(checker);
+
+	/* A good token with a broken signature */
+	jwt_set_SET_STR(&jval, "iss", "us");
+	jval.replace = 1;
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	ck_assert_int_eq(jwt_builder_claim_del(builder, "exp"), 0);
+	jwt_freemem(token);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	len = strlen(token);
+	token[len - 2] = token[len - 2] == 'A' ? 'B' : 'A';
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_VERIFY);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Token failed verification");
+
+	/* Batches report the first failure the same way */
+	tokens[0] = token;
+	tokens[1] = "garbage";
+	ret = jwt_checker_verify_batch(checker, tokens, NULL, 2, results);
+	ck_assert_int_eq(ret, 2);
+	ck_assert_int_ne(jwt_checker_error_code(checker), JWT_ERR_NONE);
+	ck_assert_int_ne(jwt_checker_error_code(checker), JWT_ERR_OTHER);
+
+	/* Errors without a code of their own */
+	jwt_checker_error_clear(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_ES256, g_item);
+	ck_assert_int_ne(ret, 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_OTHER);
+	ck_assert_str_ne(jwt_checker_error_msg(checker), "");
+
+	ck_assert_str_eq(jwt_error_str(JWT_ERR_NONE), "");
+	ck_assert_str_eq(jwt_error_str(JWT_ERR_OTHER), "");
+	ck_assert_str_eq(jwt_error_str((jwt_error_t)1000), "");
+	ck_assert_str_eq(jwt_error_str((jwt_error_t)-1), "");
+
+	free_key();
+
+	/* The backend explains why, but it's still the signature */
+	ck_assert_int_eq(__bad_sig_code("rsa_key_2048.json", JWT_ALG_RS256),
+			 JWT_ERR_SIG_VERIFY);
+	ck_assert_int_eq(__bad_sig_code("ec_key_prime256v1.json",
+					JWT_ALG_ES256), JWT_ERR_SIG_VERIFY);
+	ck_assert_int_eq(__bad_sig_code("rsa_pss_key_2048.json",
+					JWT_ALG_PS256), JWT_ERR_SIG_VERIFY);
+	ck_assert_int_eq(__bad_sig_code("eddsa_key_ed25519.json",
+					JWT_ALG_EDDSA), JWT_ERR_SIG_VERIFY);
+}
+END_TEST
+
+START_TEST(verify_limits)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char_auto *token = NULL;
+	jwt_limits_t limits;
+	jwt_alloc_stats_t st;
+	jwt_value_t jval;
+	const char *dot;
+	int ret;
+
+	SET_OPS();
+
+	read_json("oct_key_256.json");
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_builder_enable_iat(builder, 0), 1);
+
+	/* 8 members, 3 deep, and "HS256" is the longest string */
+	jwt_set_SET_STR(&jval, "iss", "us");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_JSON(&jval, "list", "[1,2,3]");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	jwt_set_SET_JSON(&jval, "obj", "{\"a\":{\"b\":1}}");
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_ne(jwt_checker_set_limits(NULL, NULL), 0);
+	ck_assert_int_eq(jwt_checker_set_limits(checker, NULL), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	/* Right at each limit is fine */
+	memset(&limits, 0, sizeof(limits));
+	dot = strchr(token, '.');
+	limits.token_len = strlen(token);
+	limits.header_len = dot - token;
+	limits.payload_len = strchr(dot + 1, '.') - dot - 1;
+	limits.sig_len = strlen(strrchr(token, '.') + 1);
+	limits.json_depth = 3;
+	limits.json_members = 8;
+	limits.json_string = 5;
+	ck_assert_int_eq(jwt_checker_set_limits(checker, &limits), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+#define OVER(__field, __err) do {					\
+	limits.__field--;						\
+	ck_assert_int_eq(jwt_checker_set_limits(checker, &limits), 0);	\
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);	\
+	ck_assert_int_eq(jwt_checker_error_code(checker), __err);	\
+	jwt_checker_error_clear(checker);				\
+	limits.__field++;						\
+} while (0)
+
+	OVER(token_len, JWT_ERR_LIMIT);
+	OVER(header_len, JWT_ERR_LIMIT);
+	OVER(payload_len, JWT_ERR_LIMIT);
+	OVER(sig_len, JWT_ERR_LIMIT);
+	OVER(json_depth, JWT_ERR_JSON_LIMIT);
+	OVER(json_members, JWT_ERR_JSON_LIMIT);
+	OVER(json_string, JWT_ERR_JSON_LIMIT);
+#undef OVER
+
+	/* Too long is turned away before the token is copied or decoded */
+	limits.token_len = 10;
+	ck_assert_int_eq(jwt_checker_set_limits(checker, &limits), 0);
+	ck_assert_int_eq(jwt_alloc_stats_enable(1), 0);
+	jwt_alloc_stats_reset();
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "Token exceeds size limits");
+	ck_assert_int_eq(jwt_alloc_stats_get(JWT_ALLOC_PARSE, &st), 0);
+	ck_assert_int_eq(st.count, 0);
+	ck_assert_int_eq(jwt_alloc_stats_get(JWT_ALLOC_BASE64, &st), 0);
+	ck_assert_int_eq(st.count, 0);
+	ck_assert_int_eq(jwt_alloc_stats_enable(0), 0);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwt_checker_set_limits(checker, NULL), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	/* Allowed algs */
+	ck_assert_int_ne(jwt_checker_set_algs(NULL, 0), 0);
+	ck_assert_int_ne(jwt_checker_set_algs(checker,
+					      JWT_ALG_BIT(JWT_ALG_INVAL)), 0);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwt_checker_set_algs(checker,
+					      JWT_ALG_BIT(JWT_ALG_ES256)), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_ALG_DENIED);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwt_checker_set_algs(checker,
+					      JWT_ALG_BIT(JWT_ALG_ES256) |
+					      JWT_ALG_BIT(JWT_ALG_HS256)), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	ck_assert_int_eq(jwt_checker_set_algs(checker, 0), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, token), 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(verify_fail_fast)
+{
+	const char json[] = "{\"kty\":\"oct\",\"alg\":\"HS256\",\"kid\":"
+		"\"key-1\",\"k\":\"0gmNspkRljssLSrldySnYUS-zhtCo5sqeqo_yl7n2XA\"}";
+	const char *none = "eyJhbGciOiJub25lIn0.eyJzdWIiOiJhZG1pbiJ9.";
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	jwks_ring_auto_t *ring = NULL;
+	char_auto *good = NULL, *other_kid = NULL, *short_sig = NULL;
+	char_auto *other_alg = NULL;
+	jwk_set_auto_t *jwk_set = NULL;
+	const jwk_item_t *item;
+	jwt_fail_fast_stats_t ff;
+	jwt_value_t jval;
+	const char *dot;
+	int ret;
+
+	SET_OPS();
+
+	jwk_set = jwks_create(json);
+	ck_assert_ptr_nonnull(jwk_set);
+	item = jwks_item_get(jwk_set, 0);
+	ck_assert_ptr_nonnull(item);
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS256, item);
+	ck_assert_int_eq(ret, 0);
+
+	jwt_set_SET_STR(&jval, "kid", "key-1");
+	ck_assert_int_eq(jwt_builder_header_set(builder, &jval), 0);
+	good = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(good);
+
+	short_sig = strdup(good);
+	ck_assert_ptr_nonnull(short_sig);
+	short_sig[strlen(short_sig) - 1] = '\0';
+
+	jwt_set_SET_STR(&jval, "kid", "key-2");
+	jval.replace = 1;
+	ck_assert_int_eq(jwt_builder_header_set(builder, &jval), 0);
+	other_kid = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(other_kid);
+
+	/* Same key, but the header says HS384 */
+	read_json("oct_key_384.json");
+	ret = jwt_builder_setkey(builder, JWT_ALG_HS384, g_item);
+	ck_assert_int_eq(ret, 0);
+	other_alg = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(other_alg);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_HS256, item);
+	ck_assert_int_eq(ret, 0);
+
+	/* Without it, the kid is not looked at */
+	ck_assert_int_eq(jwt_checker_verify(checker, other_kid), 0);
+
+	ck_assert_int_ne(jwt_checker_fail_fast(NULL, 1), 0);
+	ck_assert_int_eq(jwt_checker_fail_fast(checker, 1), 0);
+
+	ck_assert_int_eq(jwt_checker_verify(checker, good), 0);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, other_kid), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_KID);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, other_alg), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_CONFIG_ALG);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, short_sig), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_LEN);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_fail_fast_stats(checker, NULL), 0);
+	ck_assert_int_ne(jwt_checker_fail_fast_stats(NULL, &ff), 0);
+	ck_assert_int_eq(jwt_checker_fail_fast_stats(checker, &ff), 0);
+	ck_assert_int_eq(ff.alg, 1);
+	ck_assert_int_eq(ff.kid, 1);
+	ck_assert_int_eq(ff.sig_len, 1);
+	dot = strchr(good, '.');
+	ck_assert_int_eq(ff.payload_bytes, 3 * (strchr(dot + 1, '.') - dot - 1));
+
+	/* A callback may pick another key, so only the length counts */
+	ret = jwt_checker_setcb(checker, __trace_cb, NULL);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, other_kid), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, short_sig), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_LEN);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwt_checker_fail_fast_stats(checker, &ff), 0);
+	ck_assert_int_eq(ff.sig_len, 2);
+
+	ck_assert_int_eq(jwt_checker_fail_fast(checker, 0), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, short_sig), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_VERIFY);
+	jwt_checker_free(checker);
+
+	/* With a key ring, the key for the header's kid is the one */
+	ring = jwks_ring_new(jwks_create(json));
+	ck_assert_ptr_nonnull(ring);
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_set_keyring(checker, ring), 0);
+	ck_assert_int_eq(jwt_checker_fail_fast(checker, 1), 0);
+
+	ck_assert_int_eq(jwt_checker_verify(checker, good), 0);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, other_kid), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NO_KEY);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, none), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_MISSING);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify(checker, short_sig), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_SIG_LEN);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwt_checker_fail_fast_stats(checker, &ff), 0);
+	ck_assert_int_eq(ff.alg, 1);
+	ck_assert_int_eq(ff.kid, 1);
+	ck_assert_int_eq(ff.sig_len, 1);
+
+	free_key();
+}
+END_TEST
+
+/* Unsigned token with just the claims in json */
+static char *__policy_token(const char *json)
+{
+	jwt_builder_auto_t *builder = jwt_builder_new();
+	jwt_value_t jval;
+
+	ck_assert_ptr_nonnull(builder);
+	jwt_builder_enable_iat(builder, 0);
+
+	jwt_set_SET_JSON(&jval, NULL, (char *)json);
+	ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+
+	return jwt_builder_generate(builder);
+}
+
+#define POLICY_OK(__json) ({						\
+	char_auto *__t = __policy_token(__json);			\
+	ck_assert_ptr_nonnull(__t);					\
+	ck_assert_int_eq(jwt_checker_verify(checker, __t), 0);		\
+})
+
+#define POLICY_FAIL(__json, __claims) ({				\
+	char_auto *__t = __policy_token(__json);			\
+	ck_assert_ptr_nonnull(__t);					\
+	ck_assert_int_ne(jwt_checker_verify(checker, __t), 0);		\
+	ck_assert_int_eq(jwt_checker_error_code(checker),		\
+			 JWT_ERR_POLICY);				\
+	ck_assert_int_eq(jwt_checker_error_claims(checker), __claims);	\
+	jwt_checker_error_clear(checker);				\
+})
+
+START_TEST(verify_policy)
+{
+	jwt_checker_auto_t *checker = NULL;
+	jwt_policy_t *policy;
+	char name[16];
+	int ret, i;
+
+	SET_OPS();
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	policy = jwt_policy_new();
+	ck_assert_ptr_nonnull(policy);
+
+	/* Bad args */
+	ck_assert_int_ne(jwt_policy_require(NULL, "jti"), 0);
+	ck_assert_int_ne(jwt_policy_require(policy, NULL), 0);
+	ck_assert_int_ne(jwt_policy_require(policy, ""), 0);
+	ck_assert_int_ne(jwt_policy_add_str(policy, "iss", NULL), 0);
+	ck_assert_int_ne(jwt_policy_add_range(policy, "level", 5, 1), 0);
+	ck_assert_int_ne(jwt_checker_set_policy(NULL, policy), 0);
+
+	ret = jwt_policy_add_str(policy, "iss", "https://a.example.com");
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_policy_add_str(policy, "iss", "https://b.example.com");
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_policy_add_str(policy, "iss", "https://a.example.com");
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_policy_add_str(policy, "aud", "api"), 0);
+	ck_assert_int_eq(jwt_policy_add_range(policy, "level", 1, 5), 0);
+	ck_assert_int_eq(jwt_policy_require(policy, "jti"), 0);
+
+	/* A claim can't have values and a range */
+	ck_assert_int_ne(jwt_policy_add_range(policy, "iss", 1, 5), 0);
+	ck_assert_int_ne(jwt_policy_add_str(policy, "level", "1"), 0);
+
+	ck_assert_int_eq(jwt_checker_set_policy(checker, policy), 0);
+
+	/* The checker has its own copy */
+	jwt_policy_free(policy);
+
+	POLICY_OK("{\"iss\":\"https://a.example.com\",\"aud\":\"api\","
+		  "\"level\":1,\"jti\":\"x\"}");
+	POLICY_OK("{\"iss\":\"https://b.example.com\",\"aud\":[\"web\",\"api\"],"
+		  "\"level\":5,\"jti\":3,\"other\":true}");
+
+	POLICY_FAIL("{\"iss\":\"https://c.example.com\",\"aud\":\"api\","
+		    "\"level\":1,\"jti\":\"x\"}", JWT_CLAIM_ISS);
+	POLICY_FAIL("{\"iss\":\"https://a.example.com\",\"aud\":[\"web\"],"
+		    "\"level\":1,\"jti\":\"x\"}", JWT_CLAIM_AUD);
+	POLICY_FAIL("{\"iss\":\"https://a.example.com\",\"aud\":7,"
+		    "\"level\":1}", JWT_CLAIM_AUD | JWT_CLAIM_JTI);
+	POLICY_FAIL("{\"iss\":\"https://a.example.com\",\"aud\":\"api\","
+		    "\"level\":6,\"jti\":\"x\"}", 0);
+	POLICY_FAIL("{\"iss\":\"https://a.example.com\",\"aud\":\"api\","
+		    "\"level\":\"1\",\"jti\":\"x\"}", 0);
+	POLICY_FAIL("{\"iss\":\"https://a.example.com\",\"aud\":\"api\","
+		    "\"jti\":\"x\"}", 0);
+	POLICY_FAIL("{}", JWT_CLAIM_ISS | JWT_CLAIM_AUD | JWT_CLAIM_JTI);
+
+	/* Standard claim checks come first */
+	ret = jwt_checker_claim_set(checker, JWT_CLAIM_SUB, "user");
+	ck_assert_int_eq(ret, 0);
+	{
+		char_auto *t = __policy_token("{\"sub\":\"other\"}");
+
+		ck_assert_ptr_nonnull(t);
+		ck_assert_int_ne(jwt_checker_verify(checker, t), 0);
+		ck_assert_int_eq(jwt_checker_error_code(checker),
+				 JWT_ERR_CLAIMS);
+		jwt_checker_error_clear(checker);
+	}
+	ck_assert_int_eq(jwt_checker_claim_del(checker, JWT_CLAIM_SUB), 0);
+
+	/* Removing it lets anything through again */
+	ck_assert_int_eq(jwt_checker_set_policy(checker, NULL), 0);
+	POLICY_OK("{}");
+
+	/* Up to JWT_POLICY_MAX_RULES claims */
+	policy = jwt_policy_new();
+	ck_assert_ptr_nonnull(policy);
+	for (i = 0; i < JWT_POLICY_MAX_RULES; i++) {
+		sprintf(name, "c%d", i);
+		ck_assert_int_eq(jwt_policy_require(policy, name), 0);
+	}
+	ck_assert_int_ne(jwt_policy_require(policy, "one-more"), 0);
+	ck_assert_int_eq(jwt_policy_require(policy, "c63"), 0);
+	ck_assert_int_eq(jwt_checker_set_policy(checker, policy), 0);
+	ck_assert_int_eq(jwt_checker_set_policy(checker, policy), 0);
+	jwt_policy_free(policy);
+	jwt_policy_free(NULL);
+
+	POLICY_FAIL("{\"c0\":1,\"c63\":2}", 0);
+}
+END_TEST
+
+START_TEST(verify_scopes)
+{
+	const char *names[] = { "read", "write", "admin", "billing" };
+	const char *dupes[] = { "read", "write", "read" };
+	const char *empty[] = { "read", "" };
+	jwt_checker_auto_t *checker = NULL;
+	unsigned long long scopes = 1;
+	char_auto *t1 = NULL, *t2 = NULL, *t3 = NULL;
+	int ret;
+
+	SET_OPS();
+
+	t1 = __policy_token("{\"scope\":\"read  unknown admin\"}");
+	ck_assert_ptr_nonnull(t1);
+	t2 = __policy_token("{\"scp\":[\"write\",7,\"other\"],"
+			    "\"roles\":\"billing\"}");
+	ck_assert_ptr_nonnull(t2);
+	t3 = __policy_token("{\"scope\":\"admin\",\"exp\":1}");
+	ck_assert_ptr_nonnull(t3);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	ck_assert_int_ne(jwt_checker_set_scopes(NULL, names, 4), 0);
+	ck_assert_int_ne(jwt_checker_set_scopes(checker, dupes, 3), 0);
+	jwt_checker_error_clear(checker);
+	ck_assert_int_ne(jwt_checker_set_scopes(checker, empty, 2), 0);
+	jwt_checker_error_clear(checker);
+	ret = jwt_checker_set_scopes(checker, names, JWT_SCOPES_MAX + 1);
+	ck_assert_int_ne(ret, 0);
+	jwt_checker_error_clear(checker);
+
+	/* No names, no scopes */
+	ck_assert_int_eq(jwt_checker_verify_scopes(checker, t1, &scopes), 0);
+	ck_assert_int_eq(scopes, 0);
+
+	ck_assert_int_eq(jwt_checker_set_scopes(checker, names, 4), 0);
+
+	ck_assert_int_eq(jwt_checker_verify_scopes(checker, t1, &scopes), 0);
+	ck_assert_int_eq(scopes, JWT_SCOPE_BIT(0) | JWT_SCOPE_BIT(2));
+
+	ck_assert_int_eq(jwt_checker_verify_scopes(checker, t2, &scopes), 0);
+	ck_assert_int_eq(scopes, JWT_SCOPE_BIT(1) | JWT_SCOPE_BIT(3));
+
+	/* Nothing is granted by a token that fails */
+	scopes = 1;
+	ck_assert_int_ne(jwt_checker_verify_scopes(checker, t3, &scopes), 0);
+	ck_assert_int_eq(scopes, 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_CLAIMS);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_ne(jwt_checker_verify_scopes(NULL, t1, &scopes), 0);
+	ck_assert_int_ne(jwt_checker_verify_scopes(checker, t1, NULL), 0);
+	jwt_checker_error_clear(checker);
+
+	/* Removing them */
+	ck_assert_int_eq(jwt_checker_set_scopes(checker, NULL, 0), 0);
+	ck_assert_int_eq(jwt_checker_verify_scopes(checker, t1, &scopes), 0);
+	ck_assert_int_eq(scopes, 0);
+}
+END_TEST
+
+START_TEST(verify_extract)
+{
+	const char *names[] = { "read", "write" };
+	jwt_checker_auto_t *checker = NULL;
+	jwt_verified_auto_t *v = NULL;
+	jwt_verified_t *ref;
+	char_auto *good = NULL, *expired = NULL;
+	jwt_value_t jval;
+	int ret;
+
+	SET_OPS();
+
+	good = __policy_token("{\"sub\":\"user\",\"level\":3,"
+			      "\"scope\":\"write\"}");
+	ck_assert_ptr_nonnull(good);
+	expired = __policy_token("{\"sub\":\"user\",\"exp\":1}");
+	ck_assert_ptr_nonnull(expired);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_set_scopes(checker, names, 2), 0);
+
+	ck_assert_int_ne(jwt_checker_verify_extract(NULL, good, &v), 0);
+	ck_assert_int_ne(jwt_checker_verify_extract(checker, good, NULL), 0);
+	jwt_checker_error_clear(checker);
+
+	v = (jwt_verified_t *)1;
+	ck_assert_int_ne(jwt_checker_verify_extract(checker, expired, &v), 0);
+	ck_assert_ptr_null(v);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_CLAIMS);
+	jwt_checker_error_clear(checker);
+
+	ret = jwt_checker_verify_extract(checker, good, &v);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_ptr_nonnull(v);
+
+	ck_assert_int_eq(jwt_verified_alg(v), JWT_ALG_NONE);
+	ck_assert_int_eq(jwt_verified_scopes(v), JWT_SCOPE_BIT(1));
+
+	jwt_set_GET_STR(&jval, "sub");
+	ck_assert_int_eq(jwt_verified_claim_get(v, &jval), JWT_VALUE_ERR_NONE);
+	ck_assert_str_eq(jval.str_val, "user");
+
+	jwt_set_GET_INT(&jval, "level");
+	ck_assert_int_eq(jwt_verified_claim_get(v, &jval), JWT_VALUE_ERR_NONE);
+	ck_assert_int_eq(jval.int_val, 3);
+
+	jwt_set_GET_STR(&jval, "alg");
+	ck_assert_int_eq(jwt_verified_header_get(v, &jval),
+			 JWT_VALUE_ERR_NONE);
+	ck_assert_str_eq(jval.str_val, "none");
+
+	jwt_set_GET_STR(&jval, "missing");
+	ck_assert_int_eq(jwt_verified_claim_get(v, &jval),
+			 JWT_VALUE_ERR_NOEXIST);
+
+	/* A second holder keeps it alive */
+	ref = jwt_verified_ref(v);
+	ck_assert_ptr_eq(ref, v);
+	jwt_verified_unref(v);
+	v = NULL;
+
+	jwt_set_GET_STR(&jval, "sub");
+	ck_assert_int_eq(jwt_verified_claim_get(ref, &jval),
+			 JWT_VALUE_ERR_NONE);
+	ck_assert_str_eq(jval.str_val, "user");
+	jwt_verified_unref(ref);
+
+	/* NULL handling */
+	ck_assert_ptr_null(jwt_verified_ref(NULL));
+	jwt_verified_unref(NULL);
+	ck_assert_int_eq(jwt_verified_alg(NULL), JWT_ALG_INVAL);
+	ck_assert_int_eq(jwt_verified_scopes(NULL), 0);
+	ck_assert_int_eq(jwt_verified_claim_get(NULL, &jval),
+			 JWT_VALUE_ERR_INVALID);
+	ck_assert_int_eq(jwt_verified_header_get(NULL, NULL),
+			 JWT_VALUE_ERR_INVALID);
+}
+END_TEST
+
+static int __view_cb(jwt_t *jwt, jwt_config_t *config)
+{
+	jwt_view_t view;
+	const char *str;
+
+	(void)config;
+
+	ck_assert_int_eq(jwt_headers_view(jwt, &view), 0);
+	ck_assert_int_eq(jwt_view_pointer(&view, "/alg", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, NULL), 0);
+	ck_assert_str_eq(str, "none");
+
+	ck_assert_int_eq(jwt_claims_view(jwt, &view), 0);
+	ck_assert_int_eq(jwt_view_pointer(&view, "/a~1b/~0c", &view), 0);
+
+	return jwt_view_type(&view) == JWT_VIEW_BOOL ? 0 : 1;
+}
+
+START_TEST(verify_views)
+{
+	jwt_checker_auto_t *checker = NULL;
+	jwt_verified_auto_t *v = NULL;
+	char_auto *token = NULL;
+	jwt_view_t claims, view;
+	jwt_view_iter_t it;
+	const char *str, *key;
+	long long num;
+	double real;
+	size_t len;
+	int ret, b, count;
+
+	SET_OPS();
+
+	token = __policy_token("{\"sub\":\"user\",\"n\":42,\"r\":1.5,"
+		"\"ok\":false,\"nil\":null,\"a/b\":{\"~c\":true},"
+		"\"realm\":{\"roles\":[\"admin\",\"ops\",\"dev\"]}}");
+	ck_assert_ptr_nonnull(token);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setcb(checker, __view_cb, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	ret = jwt_checker_verify_extract(checker, token, &v);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_ne(jwt_verified_claims_view(NULL, &claims), 0);
+	ck_assert_int_ne(jwt_verified_claims_view(v, NULL), 0);
+	ck_assert_int_eq(jwt_verified_claims_view(v, &claims), 0);
+	ck_assert_int_eq(jwt_view_type(&claims), JWT_VIEW_OBJECT);
+	ck_assert_int_eq(jwt_view_size(&claims), 7);
+
+	/* Empty pointer is the view itself */
+	ck_assert_int_eq(jwt_view_pointer(&claims, "", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_OBJECT);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/sub", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_str_eq(str, "user");
+	ck_assert_int_eq(len, 4);
+	ck_assert_int_ne(jwt_view_int(&view, &num), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/n", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_INT);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert_int_eq(num, 42);
+	ck_assert_int_eq(jwt_view_real(&view, &real), 0);
+	ck_assert(real == 42.0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/r", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_REAL);
+	ck_assert_int_eq(jwt_view_real(&view, &real), 0);
+	ck_assert(real == 1.5);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/ok", &view), 0);
+	ck_assert_int_eq(jwt_view_bool(&view, &b), 0);
+	ck_assert_int_eq(b, 0);
+	ck_assert_int_ne(jwt_view_str(&view, &str, &len), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/nil", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_NULL);
+	ck_assert_int_ne(jwt_view_bool(&view, &b), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/a~1b/~0c", &view), 0);
+	ck_assert_int_eq(jwt_view_bool(&view, &b), 0);
+	ck_assert_int_eq(b, 1);
+
+	ret = jwt_view_pointer(&claims, "/realm/roles/2", &view);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_str_eq(str, "dev");
+	ck_assert_int_eq(len, 3);
+
+	/* Not there, or not a valid pointer */
+	ck_assert_int_ne(jwt_view_pointer(&claims, "sub", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/nope", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/sub/0", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/realm/roles/3", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/realm/roles/01", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/realm/roles/-", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/realm/roles/", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/a~2b", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, "/a~", &view), 0);
+	ck_assert_int_ne(jwt_view_pointer(&claims, NULL, &view), 0);
+	ck_assert_int_eq(jwt_view_type(NULL), JWT_VIEW_NONE);
+
+	/* Walk an array */
+	ret = jwt_view_pointer(&claims, "/realm/roles", &view);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_view_size(&view), 3);
+	jwt_view_iter_init(&view, &it);
+	ck_assert_int_eq(jwt_view_iter_next(&it, &key, &view), 0);
+	ck_assert_ptr_null(key);
+	ck_assert_int_eq(jwt_view_str(&view, &str, NULL), 0);
+	ck_assert_str_eq(str, "admin");
+	ck_assert_int_eq(jwt_view_iter_next(&it, NULL, &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, NULL), 0);
+	ck_assert_str_eq(str, "ops");
+	ck_assert_int_eq(jwt_view_iter_next(&it, NULL, &view), 0);
+	ck_assert_int_ne(jwt_view_iter_next(&it, NULL, &view), 0);
+
+	/* And an object */
+	count = 0;
+	jwt_view_iter_init(&claims, &it);
+	while (!jwt_view_iter_next(&it, &key, &view)) {
+		ck_assert_ptr_nonnull(key);
+		ck_assert_int_ne(jwt_view_type(&view), JWT_VIEW_NONE);
+		count++;
+	}
+	ck_assert_int_eq(count, 7);
+
+	/* Anything else has nothing to walk */
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/n", &view), 0);
+	ck_assert_int_eq(jwt_view_size(&view), 0);
+	jwt_view_iter_init(&view, &it);
+	ck_assert_int_ne(jwt_view_iter_next(&it, &key, &view), 0);
+
+	ck_assert_int_eq(jwt_verified_headers_view(v, &view), 0);
+	ck_assert_int_eq(jwt_view_pointer(&view, "/alg", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, NULL), 0);
+	ck_assert_str_eq(str, "none");
+	ck_assert_int_ne(jwt_verified_headers_view(NULL, &view), 0);
+}
+END_TEST
+
+static int __json_loads_ok(const char *json)
+{
+	jwt_builder_auto_t *builder = jwt_builder_new();
+	jwt_value_t jval;
+
+	ck_assert_ptr_nonnull(builder);
+
+	jwt_set_SET_JSON(&jval, "v", (char *)json);
+
+	return jwt_builder_claim_set(builder, &jval) == JWT_VALUE_ERR_NONE;
+}
+
+START_TEST(verify_json)
+{
+	const char *bad[] = {
+		"", " ", "1", "\"str\"", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}",
+		"{\"a\":1} x", "{a:1}", "[01]", "[1.]", "[.5]", "[1e]", "[+1]",
+		"[-]", "[tru]", "[nul]", "[\"\\x\"]", "[\"\\u12\"]",
+		"[\"\\u0000\"]", "[\"\\udc00\"]", "[\"\\ud800\"]",
+		"[\"\\ud800\\u0041\"]", "[\"\t\"]", "[\"\xff\"]",
+		"{\"\xff\":1}", "[99999999999999999999]", "[1e999]",
+		"{\"a\":1,\"a\":2}", "[\"open]",
+	};
+	jwt_checker_auto_t *checker = NULL;
+	jwt_verified_auto_t *v = NULL;
+	char_auto *token = NULL;
+	jwt_view_t claims, view;
+	const char *str;
+	long long num;
+	double real;
+	size_t len;
+	unsigned int i;
+	char *big;
+	int ret;
+
+	SET_OPS();
+
+	for (i = 0; i < ARRAY_SIZE(bad); i++)
+		ck_assert_msg(!__json_loads_ok(bad[i]), "Parsed [%s]", bad[i]);
+
+	ck_assert(__json_loads_ok(" { } "));
+	ck_assert(__json_loads_ok("[]"));
+	ck_assert(__json_loads_ok("[[[[{\"a\":[{}]}]]]]"));
+
+	/* Through the builder, then back through the parser */
+	token = __policy_token("{\"esc\":\"q\\\"b\\\\s\\/\\b\\f\\n\\r\\t\","
+		"\"uni\":\"\\u00e9\\u20ac\\ud83d\\ude00\",\"utf8\":\"\xc3\xa9\","
+		"\"n\":-0,\"big\":9007199254740993,\"neg\":-42,"
+		"\"r\":-1.25e2,\"e\":2E-1,\"arr\":[ true , false , null ],"
+		"\"nest\":{\"a\":{\"b\":[1,[2,[3]]]}}}");
+	ck_assert_ptr_nonnull(token);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_verify_extract(checker, token, &v);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_verified_claims_view(v, &claims), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/esc", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_str_eq(str, "q\"b\\s/\b\f\n\r\t");
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/uni", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_str_eq(str, "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/utf8", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_str_eq(str, "\xc3\xa9");
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/n", &view), 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert_int_eq(num, 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/big", &view), 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert(num == 9007199254740993LL);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/neg", &view), 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert_int_eq(num, -42);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/r", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_REAL);
+	ck_assert_int_eq(jwt_view_real(&view, &real), 0);
+	ck_assert(real == -125.0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/e", &view), 0);
+	ck_assert_int_eq(jwt_view_real(&view, &real), 0);
+	ck_assert(real > 0.19 && real < 0.21);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/arr/2", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_NULL);
+
+	ret = jwt_view_pointer(&claims, "/nest/a/b/1/1/0", &view);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert_int_eq(num, 3);
+
+	/* Too big for the stack */
+	big = malloc(4096);
+	ck_assert_ptr_nonnull(big);
+	strcpy(big, "{\"pad\":\"");
+	memset(big + 8, 'x', 3000);
+	strcpy(big + 3008, "\\u00e9\"}");
+	ck_assert(__json_loads_ok(big));
+
+	/* Numbers have no length limit, but integers still have a range */
+	strcpy(big, "[0.");
+	memset(big + 3, '0', 200);
+	strcpy(big + 203, "1e-3]");
+	ck_assert(__json_loads_ok(big));
+	memset(big + 1, '1', 200);
+	strcpy(big + 201, "]");
+	ck_assert(!__json_loads_ok(big));
+	free(big);
+
+	/* The long number as is, since the builder would write it out
+	 * short: {"n":0.<70 zeros>15e72,"i":-9223372036854775808} */
+	jwt_verified_unref(v);
+	v = NULL;
+	ret = jwt_checker_verify_extract(checker, "eyJhbGciOiJub25lIn0."
+		"eyJuIjowLjAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAw"
+		"MDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAwMDAxNWU3MiwiaSI6LTky"
+		"MjMzNzIwMzY4NTQ3NzU4MDh9.", &v);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(jwt_verified_claims_view(v, &claims), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/n", &view), 0);
+	ck_assert_int_eq(jwt_view_real(&view, &real), 0);
+	ck_assert(real > 14.9 && real < 15.1);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/i", &view), 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert(num == -9223372036854775807LL - 1);
+}
+END_TEST
+
+START_TEST(verify_json_stream)
+{
+	jwt_checker_auto_t *checker = NULL;
+	jwt_verified_auto_t *v = NULL;
+	char_auto *token = NULL;
+	jwt_view_t claims, view;
+	jwt_limits_t limits;
+	jwt_alloc_stats_t st;
+	const char *str;
+	long long num;
+	size_t len, i;
+	char *json, *o, c;
+	int ret;
+
+	SET_OPS();
+
+	/* Long enough to be streamed, with escapes, numbers and keys
+	 * landing all over the chunk boundaries */
+	json = malloc(64 * 1024);
+	ck_assert_ptr_nonnull(json);
+	o = json + sprintf(json, "{\"pad\":\"");
+	for (i = 0; i < 2000; i++)
+		o += sprintf(o, "ab\\n\\ud83d\\ude00");
+	o += sprintf(o, "\"");
+	for (i = 0; i < 500; i++)
+		o += sprintf(o, ",\"k%zu\":[%zu,-%zu.5e1,true,null]", i, i, i);
+	sprintf(o, "}");
+
+	token = __policy_token(json);
+	ck_assert_ptr_nonnull(token);
+	ck_assert_int_gt(strlen(token), 4096);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+
+	ck_assert_int_eq(jwt_alloc_stats_enable(1), 0);
+	jwt_alloc_stats_reset();
+	ret = jwt_checker_verify_extract(checker, token, &v);
+	ck_assert_int_eq(ret, 0);
+
+	/* Only the header went through the whole buffer decode */
+	ck_assert_int_eq(jwt_alloc_stats_get(JWT_ALLOC_BASE64, &st), 0);
+	ck_assert_uint_lt(st.peak, 1024);
+	ck_assert_int_eq(jwt_alloc_stats_enable(0), 0);
+
+	ck_assert_int_eq(jwt_verified_claims_view(v, &claims), 0);
+	ck_assert_int_eq(jwt_view_size(&claims), 501);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/pad", &view), 0);
+	ck_assert_int_eq(jwt_view_str(&view, &str, &len), 0);
+	ck_assert_int_eq(len, 2000 * 7);
+	for (i = 0; i < 2000; i++)
+		ck_assert_int_eq(memcmp(str + i * 7, "ab\n\xf0\x9f\x98\x80", 7), 0);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/k499/0", &view), 0);
+	ck_assert_int_eq(jwt_view_int(&view, &num), 0);
+	ck_assert_int_eq(num, 499);
+
+	ck_assert_int_eq(jwt_view_pointer(&claims, "/k321/3", &view), 0);
+	ck_assert_int_eq(jwt_view_type(&view), JWT_VIEW_NULL);
+	jwt_verified_unref(v);
+	v = NULL;
+
+	/* With JSON limits, it's all decoded first so it can be checked */
+	memset(&limits, 0, sizeof(limits));
+	limits.json_members = 100;
+	ck_assert_int_eq(jwt_checker_set_limits(checker, &limits), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_JSON_LIMIT);
+	jwt_checker_error_clear(checker);
+	ck_assert_int_eq(jwt_checker_set_limits(checker, NULL), 0);
+
+	/* Bad base64 part way through */
+	o = strchr(token, '.') + 3000;
+	c = *o;
+	*o = '*';
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_PAYLOAD);
+	jwt_checker_error_clear(checker);
+
+	/* Or in the very last quad */
+	*o = c;
+	o = strrchr(token, '.');
+	o[-1] = '*';
+	ck_assert_int_ne(jwt_checker_verify(checker, token), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_PAYLOAD);
+	jwt_checker_error_clear(checker);
+
+	free(json);
+}
+END_TEST
+
+#define PEEK_STR(__f, __s) ({						\
+	ck_assert_ptr_nonnull((__f).value);				\
+	ck_assert_int_eq((__f).len, strlen(__s));			\
+	ck_assert_str_eq((__f).value, __s);				\
+})
+
+START_TEST(verify_peek)
+{
+	jwt_checker_auto_t *checker = NULL;
+	jwt_verified_auto_t *v = NULL;
+	char_auto *token = NULL;
+	jwt_peek_field_t fields[] = {
+		{ .where = JWT_PEEK_HEADER, .name = "alg" },
+		{ .where = JWT_PEEK_CLAIM, .name = "iss" },
+		{ .where = JWT_PEEK_CLAIM, .name = "exp" },
+		{ .where = JWT_PEEK_CLAIM, .name = "grp" },
+		{ .where = JWT_PEEK_CLAIM, .name = "esc" },
+		{ .where = JWT_PEEK_CLAIM, .name = "n" },
+		{ .where = JWT_PEEK_CLAIM, .name = "sub" },
+		{ .where = JWT_PEEK_HEADER, .name = "iss" },
+	};
+	const char *dup = "eyJhbGciOiJub25lIiwia2lkIjoia1x1MDBlOXkifQ."
+		"eyJpc3MiOiJhIiwic3ViIjp7ImlzcyI6IngifSwiaXNzIjoiYiJ9.";
+	jwt_peek_t peek;
+	jwt_value_t jval;
+	char *json, *o, *tok;
+	size_t i;
+
+	SET_OPS();
+
+	token = __policy_token("{\"iss\":\"https://a.example\","
+			       "\"exp\":4000000000,\"grp\":[\"x\",{}],"
+			       "\"esc\":\"a\\\"b\\u00e9\",\"n\":null}");
+	ck_assert_ptr_nonnull(token);
+
+	ck_assert_int_eq(jwt_peek(token, strlen(token), &peek, fields,
+				  ARRAY_SIZE(fields)), 0);
+
+	ck_assert_int_eq(peek.header_len, strchr(token, '.') - token);
+	ck_assert_int_eq(peek.payload_off, peek.header_len + 1);
+	ck_assert_int_eq(peek.sig_off, strrchr(token, '.') + 1 - token);
+	ck_assert_int_eq(peek.payload_off + peek.payload_len + 1, peek.sig_off);
+	ck_assert_int_eq(peek.sig_len, 0);
+
+	PEEK_STR(fields[0], "none");
+	PEEK_STR(fields[1], "https://a.example");
+	PEEK_STR(fields[2], "4000000000");
+	ck_assert_ptr_null(fields[3].value);
+	PEEK_STR(fields[4], "a\"b\xc3\xa9");
+	PEEK_STR(fields[5], "null");
+	ck_assert_ptr_null(fields[6].value);
+	ck_assert_ptr_null(fields[7].value);
+
+	/* It sees what the checker sees */
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_verify_extract(checker, token, &v), 0);
+	jwt_set_GET_STR(&jval, "iss");
+	ck_assert_int_eq(jwt_verified_claim_get(v, &jval), JWT_VALUE_ERR_NONE);
+	ck_assert_str_eq(jval.str_val, fields[1].value);
+
+	/* The last one wins, and nested members don't count */
+	ck_assert_int_eq(jwt_peek(dup, strlen(dup), &peek, fields, 2), 0);
+	PEEK_STR(fields[1], "b");
+
+	/* Not even a token, and nothing is left set */
+	ck_assert_int_ne(jwt_peek("abc", 3, &peek, fields, 2), 0);
+	ck_assert_ptr_null(fields[0].value);
+	ck_assert_int_ne(jwt_peek("abc.def", 7, &peek, fields, 2), 0);
+	ck_assert_int_ne(jwt_peek(token, strlen(token), NULL, fields, 2), 0);
+	ck_assert_int_ne(jwt_peek(token, strlen(token), &peek, NULL, 2), 0);
+	ck_assert_int_eq(jwt_peek(token, strlen(token), &peek, NULL, 0), 0);
+
+	/* Same as the checker: trailing text, trailing commas, numbers
+	 * too big and bad base64 are all errors */
+	tok = "eyJhbGciOiJub25lIn0geA.eyJpc3MiOiJhIn0.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3MiOiJhIix9.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0."
+		"eyJuIjoxMjM0NTY3ODkwMTIzNDU2Nzg5MDEyMzQ1Njc4OTB9.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3*iOiJhIn0.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	ck_assert_int_ne(jwt_peek(token, peek.header_len + 2, &peek,
+				  fields, 2), 0);
+
+	/* Strings have to be good UTF-8, kept or not: a stray byte, a cut
+	 * off character, a surrogate and an overlong form all fail */
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3MiOiL_In0.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJ4IjoiwyJ9.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3MiOiLtoIAifQ.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3MiOiLggK8ifQ.";
+	ck_assert_int_ne(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	tok = "eyJhbGciOiJub25lIn0.eyJpc3MiOiLwn5iAIn0.";
+	ck_assert_int_eq(jwt_peek(tok, strlen(tok), &peek, fields, 2), 0);
+	PEEK_STR(fields[1], "\xf0\x9f\x98\x80");
+
+	/* A big payload, with a value too long to keep before the one we
+	 * want, and that one at the very end */
+	json = malloc(64 * 1024);
+	ck_assert_ptr_nonnull(json);
+	o = json + sprintf(json, "{\"iss\":\"");
+	for (i = 0; i < JWT_PEEK_BUF; i++)
+		*o++ = 'x';
+	o += sprintf(o, "\"");
+	for (i = 0; i < 500; i++)
+		o += sprintf(o, ",\"k%zu\":[%zu,{\"a\":\"\\n\"}]", i, i);
+	sprintf(o, ",\"exp\":-1.5e3}");
+
+	jwt_freemem(token);
+	token = __policy_token(json);
+	free(json);
+	ck_assert_ptr_nonnull(token);
+	ck_assert_int_gt(strlen(token), 4096);
+
+	ck_assert_int_eq(jwt_peek(token, strlen(token), &peek, fields, 3), 0);
+	PEEK_STR(fields[0], "none");
+	ck_assert_ptr_null(fields[1].value);
+	PEEK_STR(fields[2], "-1500.0");
+}
+END_TEST
+
+#define RING_KEY(__kid, __k)						\
+	"{\"kty\":\"oct\",\"alg\":\"HS256\",\"kid\":\"" __kid "\","	\
+	"\"k\":\"" __k "\"}"
+
+#define RING_A	"{\"keys\":[" RING_KEY("a",				\
+		"0gmNspkRljssLSrldySnYUS-zhtCo5sqeqo_yl7n2XA") ","	\
+		"{\"kty\":\"oct\",\"kid\":\"x\"}]}"
+#define RING_B	"{\"keys\":[" RING_KEY("b",				\
+		"bEF4W8hDzNbrqs2uzvf1lXSlqCYmhSWMWRBi2nkDPpk") "]}"
+#define RING_C	"{\"keys\":[{\"kty\":\"oct\",\"kid\":\"c\",\"k\":"	\
+		"\"0gmNspkRljssLSrldySnYUS-zhtCo5sqeqo_yl7n2XA\"},"	\
+		RING_KEY("b", "bEF4W8hDzNbrqs2uzvf1lXSlqCYmhSWMWRBi2nkDPpk") "]}"
+
+static char *__ring_token_alg(const char *jwks, jwt_alg_t alg, int kid)
+{
+	jwk_set_auto_t *set = jwks_create(jwks);
+	jwt_builder_auto_t *builder = jwt_builder_new();
+	const jwk_item_t *item;
+	jwt_value_t jval;
+
+	ck_assert_ptr_nonnull(set);
+	ck_assert_ptr_nonnull(builder);
+
+	item = jwks_item_get(set, 0);
+	ck_assert_int_eq(jwt_builder_setkey(builder, alg, item), 0);
+
+	if (kid) {
+		jwt_set_SET_STR(&jval, "kid", jwks_item_kid(item));
+		ck_assert_int_eq(jwt_builder_header_set(builder, &jval), 0);
+	}
+
+	return jwt_builder_generate(builder);
+}
+
+static char *__ring_token(const char *jwks)
+{
+	return __ring_token_alg(jwks, JWT_ALG_HS256, 1);
+}
+
+struct ring_reader {
+	jwks_ring_t *ring;
+	const char *tokens[2];
+	unsigned long ok;
+	unsigned long bad;
+};
+
+static void *__ring_read(void *arg)
+{
+	struct ring_reader *r = arg;
+	jwt_checker_auto_t *checker = jwt_checker_new();
+	int i;
+
+	if (checker == NULL || jwt_checker_set_keyring(checker, r->ring))
+		return NULL;
+
+	for (i = 0; i < 2000; i++) {
+		if (!jwt_checker_verify(checker, r->tokens[i & 1]))
+			r->ok++;
+		else if (jwt_checker_error_code(checker) != JWT_ERR_NO_KEY)
+			r->bad++;
+		jwt_checker_error_clear(checker);
+	}
+
+	return NULL;
+}
+
+#define RING_FAIL(__tok, __code) do {					\
+	ck_assert_int_ne(jwt_checker_verify(checker, __tok), 0);	\
+	ck_assert_int_eq(jwt_checker_error_code(checker), __code);	\
+	jwt_checker_error_clear(checker);				\
+} while (0)
+
+START_TEST(verify_keyring)
+{
+	jwt_checker_auto_t *checker = NULL;
+	jwks_ring_auto_t *ring = NULL;
+	char_auto *tok_a = NULL, *tok_b = NULL;
+	char_auto *tok_c = NULL, *tok_nokid = NULL;
+	const char *none = "eyJhbGciOiJub25lIn0.eyJzdWIiOiJhZG1pbiJ9.";
+	const char *none_kid = "eyJhbGciOiJub25lIiwia2lkIjoiYSJ9."
+		"eyJzdWIiOiJhZG1pbiJ9.";
+	const char *rs_c = "eyJhbGciOiJSUzI1NiIsImtpZCI6ImMifQ."
+		"eyJzdWIiOiJhZG1pbiJ9.AAAA";
+	const char *batch[64];
+	int results[64];
+	struct ring_reader r[4];
+	pthread_t th[4];
+	const jwk_item_t *item;
+	jwk_set_t *set;
+	int i;
+
+	SET_OPS();
+
+	tok_a = __ring_token(RING_A);
+	tok_b = __ring_token(RING_B);
+	ck_assert_ptr_nonnull(tok_a);
+	ck_assert_ptr_nonnull(tok_b);
+
+	/* A key outlives its set */
+	set = jwks_create(RING_A);
+	ck_assert_ptr_nonnull(set);
+	item = jwks_item_ref(jwks_item_get(set, 0));
+	jwks_free(set);
+	ck_assert_str_eq(jwks_item_kid(item), "a");
+	jwks_item_unref(item);
+	jwks_item_unref(NULL);
+
+	ring = jwks_ring_new(jwks_create(RING_A));
+	ck_assert_ptr_nonnull(ring);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_ne(jwt_checker_set_keyring(NULL, ring), 0);
+	ck_assert_int_eq(jwt_checker_set_keyring(checker, ring), 0);
+
+	/* Picked by kid, and keys with errors are never used */
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_a), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, tok_b), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NO_KEY);
+	jwt_checker_error_clear(checker);
+
+	/* Unsigned tokens never get past a ring, kid or not */
+	RING_FAIL(none, JWT_ERR_SIG_MISSING);
+	RING_FAIL(none_kid, JWT_ERR_SIG_MISSING);
+
+	/* No kid gets the only usable key */
+	tok_nokid = __ring_token_alg(RING_A, JWT_ALG_HS256, 0);
+	ck_assert_ptr_nonnull(tok_nokid);
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_nokid), 0);
+
+	/* A key with no alg takes the header's, if it fits the key */
+	tok_c = __ring_token_alg(RING_C, JWT_ALG_HS256, 1);
+	ck_assert_ptr_nonnull(tok_c);
+	ck_assert_int_eq(jwks_ring_swap(ring, jwks_create(RING_C)), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_c), 0);
+	RING_FAIL(rs_c, JWT_ERR_KEY_ALG);
+
+	/* With two keys, no kid can't pick one */
+	RING_FAIL(tok_nokid, JWT_ERR_NO_KID);
+	ck_assert_str_eq(jwt_error_str(JWT_ERR_NO_KID),
+			 "Token has no kid, and no single key to use");
+
+	/* Batches find each token's key, whatever order they come in */
+	for (i = 0; i < 64; i++)
+		batch[i] = i & 1 ? tok_c : i & 2 ? tok_b : rs_c;
+	ck_assert_int_eq(jwt_checker_verify_batch(checker, batch, NULL, 64,
+						  results), 16);
+	for (i = 0; i < 64; i++)
+		ck_assert_int_eq(results[i] != 0, batch[i] == rs_c);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_KEY_ALG);
+	jwt_checker_error_clear(checker);
+
+	ck_assert_int_eq(jwks_ring_swap(ring, jwks_create(RING_B)), 0);
+	ck_assert_int_eq(jwks_ring_swaps(ring), 2);
+	RING_FAIL(tok_a, JWT_ERR_NO_KEY);
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_b), 0);
+
+	/* The checker's own key wins, and it holds on to it */
+	set = jwks_create(RING_A);
+	ck_assert_ptr_nonnull(set);
+	ck_assert_int_eq(jwt_checker_setkey(checker, JWT_ALG_HS256,
+					    jwks_item_get(set, 0)), 0);
+	jwks_free(set);
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_a), 0);
+	ck_assert_int_eq(jwt_checker_setkey(checker, JWT_ALG_NONE, NULL), 0);
+
+	/* An empty ring has no keys */
+	ck_assert_int_eq(jwks_ring_swap(ring, NULL), 0);
+	ck_assert_int_ne(jwt_checker_verify(checker, tok_b), 0);
+	ck_assert_int_eq(jwt_checker_error_code(checker), JWT_ERR_NO_KEY);
+	jwt_checker_error_clear(checker);
+	RING_FAIL(none, JWT_ERR_SIG_MISSING);
+	ck_assert_int_ne(jwks_ring_swap(NULL, NULL), 0);
+	ck_assert_int_eq(jwks_ring_swaps(NULL), 0);
+
+	/* Swapping while others verify. Every verify either uses a whole
+	 * set or finds no key, never anything in between. */
+	for (i = 0; i < 4; i++) {
+		r[i] = (struct ring_reader){ ring, { tok_a, tok_b }, 0, 0 };
+		ck_assert_int_eq(pthread_create(&th[i], NULL, __ring_read,
+						&r[i]), 0);
+	}
+
+	for (i = 0; i < 200; i++)
+		ck_assert_int_eq(jwks_ring_swap(ring, jwks_create(i & 1 ?
+						 RING_B : RING_A)), 0);
+
+	for (i = 0; i < 4; i++) {
+		ck_assert_int_eq(pthread_join(th[i], NULL), 0);
+		ck_assert_uint_eq(r[i].bad, 0);
+	}
+
+	/* The checker keeps the ring after we let go */
+	jwks_ring_unref(ring);
+	ring = NULL;
+	ck_assert_int_eq(jwt_checker_verify(checker, tok_b), 0);
+	ck_assert_int_eq(jwt_checker_set_keyring(checker, NULL), 0);
+}
+END_TEST
+
+static Suite *libjwt_suite(const char *title)
+{
+	Suite *s;
+	TCase *tc_core;
+	int i = ARRAY_SIZE(jwt_test_ops);
+
+	s = suite_create(title);
+
+	tc_core = tcase_create("New");
+	tcase_add_loop_test(tc_core, new, 0, i);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("Verify");
+	tcase_add_loop_test(tc_core, verify, 0, i);
+	tcase_add_loop_test(tc_core, verify_bad_header, 0, i);
+	tcase_add_loop_test(tc_core, verify_bad_payload, 0, i);
+	tcase_add_loop_test(tc_core, verify_rsapss384, 0, i);
+	tcase_add_loop_test(tc_core, verify_wcb, 0, i);
+	tcase_add_loop_test(tc_core, just_fail_wcb, 0, i);
+	tcase_add_loop_test(tc_core, verify_stress, 0, i);
+	tcase_add_loop_test(tc_core, verify_plan, 0, i);
+	tcase_add_loop_test(tc_core, verify_plan_short_key, 0, i);
+	tcase_add_loop_test(tc_core, verify_metrics, 0, i);
+	tcase_add_loop_test(tc_core, verify_trace, 0, i);
+	tcase_add_loop_test(tc_core, verify_error_codes, 0, i);
+	tcase_add_loop_test(tc_core, verify_limits, 0, i);
+	tcase_add_loop_test(tc_core, verify_fail_fast, 0, i);
+	tcase_add_loop_test(tc_core, verify_policy, 0, i);
+	tcase_add_loop_test(tc_core, verify_scopes, 0, i);
+	tcase_add_loop_test(tc_core, verify_extract, 0, i);
+	tcase_add_loop_test(tc_core, verify_views, 0, i);
+	tcase_add_loop_test(tc_core, verify_json, 0, i);
+	tcase_add_loop_test(tc_core, verify_json_stream, 0, i);
+	tcase_add_loop_test(tc_core, verify_peek, 0, i);
+	tcase_add_loop_test(tc_core, verify_keyring, 0, i);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("Error Handling");
+	tcase_add_loop_test(tc_core, null_handling, 0, i);
+	tcase_add_loop_test(tc_core, bad_alg, 0, i);
+	tcase_add_loop_test(tc_core, no_alg, 0, i);
+	tcase_add_loop_test(tc_core, no_first_dot, 0, i);
+	tcase_add_loop_test(tc_core, no_second_dot, 0, i);
+	tcase_add_loop_test(tc_core, alg_none_with_sig, 0, i);
+	tcase_add_loop_test(tc_core, hs256_no_key, 0, i);
+	tcase_add_loop_test(tc_core, hs256_wrong_key, 0, i);
+	tcase_add_loop_test(tc_core, hs256_wrong_key_alg, 0, i);
+	tcase_add_loop_test(tc_core, hs256_token_failed, 0, i);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("HS256 Key Verify");
+	tcase_add_loop_test(tc_core, verify_hs256, 0, i);
+	tcase_add_loop_test(tc_core, verify_hs256_wcb, 0, i);
+	tcase_add_loop_test(tc_core, verify_hs256_stress, 0, i);
+	tcase_add_loop_test(tc_core, verify_hs256_fail, 0, i);
+	tcase_add_loop_test(tc_core, verify_hs256_fail_stress, 0, i);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("Batch Verify");
+	tcase_add_loop_test(tc_core, verify_batch, 0, i);
+	tcase_add_loop_test(tc_core, verify_batch_wcb, 0, i);
+	tcase_add_loop_test(tc_core, verify_batch_errors, 0, i);
+	tcase_set_timeout(tc_core, 30);
 	suite_add_tcase(s, tc_core);
 
 	tc_core = tcase_create("Claims");
@@ -35,6 +35,150 @@ START_TEST(test_jwt_ops)
 }
 END_TEST
 
+static void __libctx_flip(const char *key, jwt_alg_t alg)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	char_auto *out = NULL;
+
+	read_json(key);
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ck_assert_int_eq(jwt_builder_setkey(builder, alg, g_item), 0);
+
+	out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_setkey(checker, alg, g_item), 0);
+	ck_assert_int_eq(jwt_checker_verify(checker, out), 0);
+
+	free_key();
+}
+
+START_TEST(test_jwt_libctx)
+{
+	ck_assert(!jwt_set_crypto_ops("openssl"));
+
+	/* Keys loaded from here on are in our own library context */
+	ck_assert_int_eq(jwt_set_crypto_libctx(NULL), 0);
+
+	/* And it's fixed from here on */
+	ck_assert_int_ne(jwt_set_crypto_libctx(NULL), 0);
+
+	__libctx_flip("oct_key_256.json", JWT_ALG_HS256);
+	__libctx_flip("ec_key_prime256v1.json", JWT_ALG_ES256);
+	__libctx_flip("rsa_pss_key_2048.json", JWT_ALG_PS256);
+	__libctx_flip("eddsa_key_ed25519.json", JWT_ALG_EDDSA);
+}
+END_TEST
+
+START_TEST(test_jwt_ops_alg)
+{
+	size_t i;
+
+	ck_assert(!jwt_set_crypto_ops(jwt_test_ops[0].name));
+
+	for (i = 0; i < ARRAY_SIZE(jwt_test_ops); i++) {
+		jwt_test_op_t *op = &jwt_test_ops[i];
+
+		ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_ES256,
+							op->name), 0);
+		ck_assert_str_eq(jwt_get_crypto_ops_alg(JWT_ALG_ES256),
+				 op->name);
+		ck_assert_str_eq(jwt_get_crypto_ops_alg(JWT_ALG_HS256),
+				 jwt_test_ops[0].name);
+
+		__libctx_flip("ec_key_prime256v1.json", JWT_ALG_ES256);
+	}
+
+	/* Back to the default */
+	ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_ES256, NULL), 0);
+	ck_assert_str_eq(jwt_get_crypto_ops_alg(JWT_ALG_ES256),
+			 jwt_get_crypto_ops());
+
+	/* Setting the default clears them all */
+	ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_RS256,
+						jwt_test_ops[0].name), 0);
+	ck_assert(!jwt_set_crypto_ops(jwt_test_ops[0].name));
+	ck_assert_ptr_eq(jwt_get_crypto_ops_alg(JWT_ALG_RS256),
+			 jwt_get_crypto_ops());
+
+	ck_assert_int_ne(jwt_set_crypto_ops_alg(JWT_ALG_ES256,
+						"ALWAYS FAIL"), 0);
+	ck_assert_int_ne(jwt_set_crypto_ops_alg(JWT_ALG_NONE,
+						jwt_test_ops[0].name), 0);
+	ck_assert_int_ne(jwt_set_crypto_ops_alg(JWT_ALG_INVAL,
+						jwt_test_ops[0].name), 0);
+	ck_assert_ptr_null(jwt_get_crypto_ops_alg(JWT_ALG_INVAL));
+}
+END_TEST
+
+START_TEST(test_jwt_ops_cmd)
+{
+	jwt_builder_auto_t *builder = NULL;
+	jwt_checker_auto_t *checker = NULL;
+	size_t i, j;
+
+	read_json("rsa_key_2048.json");
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ck_assert_int_eq(jwt_builder_setkey(builder, JWT_ALG_RS256, g_item), 0);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_setkey(checker, JWT_ALG_RS256, g_item), 0);
+
+	/* Every ops has to verify what every other ops signed */
+	for (i = 0; i < ARRAY_SIZE(jwt_test_ops); i++) {
+		char_auto *out = NULL;
+
+		ck_assert_int_eq(jwt_builder_set_crypto_ops(builder,
+				 jwt_test_ops[i].name), 0);
+		out = jwt_builder_generate(builder);
+		ck_assert_ptr_nonnull(out);
+
+		for (j = 0; j < ARRAY_SIZE(jwt_test_ops); j++) {
+			ck_assert_int_eq(jwt_checker_set_crypto_ops(checker,
+					 jwt_test_ops[j].name), 0);
+			ck_assert_int_eq(jwt_checker_verify(checker, out), 0);
+		}
+	}
+
+	ck_assert_int_eq(jwt_builder_set_crypto_ops(builder, NULL), 0);
+	ck_assert_int_eq(jwt_checker_set_crypto_ops(checker, NULL), 0);
+
+	ck_assert_int_ne(jwt_builder_set_crypto_ops(builder, "ALWAYS FAIL"), 0);
+	ck_assert_str_eq(jwt_builder_error_msg(builder),
+			 "No such crypto ops [ALWAYS FAIL]");
+	ck_assert_int_ne(jwt_checker_set_crypto_ops(checker, "ALWAYS FAIL"), 0);
+	ck_assert_str_eq(jwt_checker_error_msg(checker),
+			 "No such crypto ops [ALWAYS FAIL]");
+
+	ck_assert_int_ne(jwt_builder_set_crypto_ops(NULL, NULL), 0);
+	ck_assert_int_ne(jwt_checker_set_crypto_ops(NULL, NULL), 0);
+
+	free_key();
+}
+END_TEST
+
+START_TEST(test_jwt_ops_autotune)
+{
+	ck_assert(!jwt_set_crypto_ops(jwt_test_ops[0].name));
+	ck_assert_int_eq(jwt_crypto_ops_autotune(), 0);
+
+	/* Whatever it picked has to work */
+	__libctx_flip("oct_key_256.json", JWT_ALG_HS256);
+	__libctx_flip("ec_key_secp384r1.json", JWT_ALG_ES384);
+	__libctx_flip("rsa_key_2048.json", JWT_ALG_RS256);
+
+	ck_assert(!jwt_set_crypto_ops(jwt_test_ops[0].name));
+}
+END_TEST
+
 static Suite *libjwt_suite(const char *title)
 {
 	Suite *s;
@@ -45,6 +189,10 @@ static Suite *libjwt_suite(const char *title)
 	tc_core = tcase_create("jwt_crypto");
 
 	tcase_add_test(tc_core, test_jwt_ops);
+	tcase_add_test(tc_core, test_jwt_libctx);
+	tcase_add_test(tc_core, test_jwt_ops_alg);
+	tcase_add_test(tc_core, test_jwt_ops_cmd);
+	tcase_add_test(tc_core, test_jwt_ops_autotune);
 
 	tcase_set_timeout(tc_core, 30);
 
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <jansson.h>
 
 #include "jwt_tests.h"
 
@@ -57,7 +59,128 @@ START_TEST(test_alloc_funcs)
 }
 END_TEST
 
-static char *__builder(const char *cops, const char *priv, jwt_alg_t alg)
+START_TEST(test_alloc_stats)
+{
+	jwt_builder_t *builder;
+	jwt_checker_t *checker;
+	jwt_alloc_stats_t st, sys;
+	unsigned long count, total;
+	json_malloc_t jm, jm2;
+	json_free_t jf, jf2;
+	char *out;
+	int i, ret;
+
+	SET_OPS();
+
+	/* Off, there's nothing */
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(st.count, 0);
+
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL + 1, &st);
+	ck_assert_int_eq(ret, EINVAL);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL, NULL);
+	ck_assert_int_eq(ret, EINVAL);
+
+	/* Jansson's allocators aren't ours to change */
+	json_get_alloc_funcs(&jm, &jf);
+	ck_assert_int_eq(jwt_alloc_stats_enable(1), 0);
+	json_get_alloc_funcs(&jm2, &jf2);
+	ck_assert(jm2 == jm && jf2 == jf);
+	ck_assert_int_eq(jwt_alloc_stats_enable(0), 0);
+
+	/* Until they go through us */
+	ret = test_set_alloc();
+	ck_assert_int_eq(ret, 0);
+	json_get_alloc_funcs(&jm, &jf);
+
+	ret = jwt_alloc_stats_enable(1);
+	ck_assert_int_eq(ret, 0);
+	json_get_alloc_funcs(&jm2, &jf2);
+	ck_assert(jm2 != jm && jf2 == jf);
+
+	read_json("ec_key_prime256v1.json");
+
+	ret = jwt_alloc_stats_get(JWT_ALLOC_JWKS, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(st.count, 0);
+	ck_assert_int_gt(st.live, 0);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_JSON, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(st.count, 0);
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ret = jwt_builder_setkey(builder, JWT_ALG_ES256, g_item);
+	ck_assert_int_eq(ret, 0);
+	out = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(out);
+
+	checker = jwt_checker_new();
+	ck_assert_ptr_nonnull(checker);
+	ret = jwt_checker_setkey(checker, JWT_ALG_ES256, g_item);
+	ck_assert_int_eq(ret, 0);
+
+	/* The same token costs the same every time */
+	jwt_alloc_stats_reset();
+	ret = jwt_checker_verify(checker, out);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(st.count, 0);
+	ck_assert_int_eq(st.count, st.frees);
+	ck_assert_int_gt(st.peak, 0);
+	count = st.count;
+
+	jwt_alloc_stats_reset();
+	ret = jwt_checker_verify(checker, out);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(st.count, count);
+
+	/* Parts add up to the whole */
+	for (i = JWT_ALLOC_OTHER, total = 0; i < JWT_ALLOC_ALL; i++) {
+		ret = jwt_alloc_stats_get(i, &sys);
+		ck_assert_int_eq(ret, 0);
+		total += sys.count;
+	}
+	ck_assert_int_eq(total, st.count);
+
+	ret = jwt_alloc_stats_get(JWT_ALLOC_PARSE, &sys);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(sys.count, 0);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_BASE64, &sys);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(sys.count, 0);
+
+	jwt_checker_free(checker);
+	jwt_builder_free(builder);
+	free_key();
+
+	/* Nothing left behind, the token is JWT_ALLOC_OTHER */
+	for (i = JWT_ALLOC_PARSE; i < JWT_ALLOC_ALL; i++) {
+		ret = jwt_alloc_stats_get(i, &sys);
+		ck_assert_int_eq(ret, 0);
+		ck_assert_int_eq(sys.live, 0);
+	}
+
+	free(out);
+
+	ret = jwt_alloc_stats_enable(0);
+	ck_assert_int_eq(ret, 0);
+	ret = jwt_alloc_stats_get(JWT_ALLOC_ALL, &st);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(st.count, 0);
+
+	/* And back to how they were */
+	json_get_alloc_funcs(&jm2, &jf2);
+	ck_assert(jm2 == jm && jf2 == jf);
+}
+END_TEST
+
+static char *__builder(const char *cops, const char *priv, jwt_alg_t alg,
+		       const char *big)
 {
 	jwt_builder_auto_t *builder;
 	jwt_alg_t a_check = JWT_ALG_NONE;
@@ -79,6 +202,13 @@ static char *__builder(const char *cops, const char *priv, jwt_alg_t alg)
 	ret = jwt_builder_setkey(builder, a_check, g_item);
 	ck_assert_int_eq(ret, 0);
 
+	if (big != NULL) {
+		jwt_value_t jval;
+
+		jwt_set_SET_STR(&jval, "big", big);
+		ck_assert_int_eq(jwt_builder_claim_set(builder, &jval), 0);
+	}
+
 	out = jwt_builder_generate(builder);
 	if (out == NULL)
 		fprintf(stderr, "BuildErr[%s]: %s\n", jwt_alg_str(alg),
@@ -117,7 +247,8 @@ static void __checker(const char *cops, const char *pub, jwt_alg_t alg,
 	free_key();
 }
 
-static void __flip_one(const char *priv, const char *pub, jwt_alg_t alg)
+static void __flip(const char *priv, const char *pub, jwt_alg_t alg,
+		   const char *big)
 {
 	char *out = NULL;
 	size_t i;
@@ -127,7 +258,7 @@ static void __flip_one(const char *priv, const char *pub, jwt_alg_t alg)
 		size_t c;
 
 		/* Generate on Here */
-		out = __builder(jwt_test_ops[i].name, priv, alg);
+		out = __builder(jwt_test_ops[i].name, priv, alg, big);
 		if (out == NULL)
 			continue;
 
@@ -143,6 +274,44 @@ static void __flip_one(const char *priv, const char *pub, jwt_alg_t alg)
 	}
 }
 
+static void __flip_one(const char *priv, const char *pub, jwt_alg_t alg)
+{
+	__flip(priv, pub, alg, NULL);
+}
+
+/* Large payloads go through the signing digest in pieces */
+static void __flip_big(const char *priv, const char *pub, jwt_alg_t alg)
+{
+	size_t len = 256 * 1024;
+	char *big = malloc(len + 1);
+
+	ck_assert_ptr_nonnull(big);
+	memset(big, 'x', len);
+	big[len] = '\0';
+
+	__flip(priv, pub, alg, big);
+
+	free(big);
+}
+
+#define FLIPFLOP_BIG(__name, __pub, __alg)	\
+START_TEST(big_ ## __name)			\
+{						\
+	__flip_big(#__name ".json",		\
+		   #__pub ".json", __alg);	\
+}						\
+END_TEST
+
+/* Run it in a loop so we see R and S values with leading zeros and
+ * high bits, which change the size of the DER encoding. */
+#define FLIPFLOP_RS(__name, __pub, __alg)	\
+START_TEST(rs_ ## __name)			\
+{						\
+	__flip_one(#__name ".json",		\
+		   #__pub ".json", __alg);	\
+}						\
+END_TEST
+
 #define FLIPFLOP_KEY(__name, __pub, __alg)	\
 START_TEST(__name)				\
 {						\
@@ -169,6 +338,13 @@ FLIPFLOP_KEY(ec_key_secp521r1,
 	     ec_key_secp521r1,
 	     JWT_ALG_ES512);
 
+FLIPFLOP_RS(ec_key_prime256v1,
+	    ec_key_prime256v1_pub,
+	    JWT_ALG_ES256);
+FLIPFLOP_RS(ec_key_secp521r1,
+	    ec_key_secp521r1,
+	    JWT_ALG_ES512);
+
 FLIPFLOP_KEY(eddsa_key_ed25519,
 	     eddsa_key_ed25519,
 	     JWT_ALG_EDDSA);
@@ -227,10 +403,24 @@ FLIPFLOP_KEY(oct_key_512,
 	     oct_key_512,
 	     JWT_ALG_HS512);
 
+FLIPFLOP_BIG(ec_key_prime256v1,
+	     ec_key_prime256v1_pub,
+	     JWT_ALG_ES256);
+FLIPFLOP_BIG(eddsa_key_ed25519,
+	     eddsa_key_ed25519_pub,
+	     JWT_ALG_EDDSA);
+FLIPFLOP_BIG(rsa_pss_key_2048,
+	     rsa_pss_key_2048_pub,
+	     JWT_ALG_PS256);
+FLIPFLOP_BIG(oct_key_512,
+	     oct_key_512,
+	     JWT_ALG_HS512);
+
 static Suite *libjwt_suite(const char *title)
 {
 	Suite *s;
 	TCase *tc_core;
+	int i = ARRAY_SIZE(jwt_test_ops);
 
 	s = suite_create(title);
 
@@ -265,12 +455,27 @@ static Suite *libjwt_suite(const char *title)
 
 	suite_add_tcase(s, tc_core);
 
+	tc_core = tcase_create("EC R/S");
+	tcase_add_loop_test(tc_core, rs_ec_key_prime256v1, 0, 128);
+	tcase_add_loop_test(tc_core, rs_ec_key_secp521r1, 0, 128);
+	tcase_set_timeout(tc_core, 60);
+	suite_add_tcase(s, tc_core);
+
+	tc_core = tcase_create("Large Payload");
+	tcase_add_test(tc_core, big_ec_key_prime256v1);
+	tcase_add_test(tc_core, big_eddsa_key_ed25519);
+	tcase_add_test(tc_core, big_rsa_pss_key_2048);
+	tcase_add_test(tc_core, big_oct_key_512);
+	tcase_set_timeout(tc_core, 30);
+	suite_add_tcase(s, tc_core);
+
 	/* We run this here so we get some usage out of it */
 	tc_core = tcase_create("Utility");
 #ifdef JWT_CONSTRUCTOR
 	tcase_add_test(tc_core, test_jwt_crypto_ops);
 #endif
 	tcase_add_test(tc_core, test_alloc_funcs);
+	tcase_add_loop_test(tc_core, test_alloc_stats, 0, i);
 	suite_add_tcase(s, tc_core);
 
 	return s;
@@ -0,0 +1,397 @@
+/* Public domain, no copyright. Use at your own risk. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jwt_tests.h"
+
+#include <jwt-verifier.h>
+
+JWT_DEFINE_VERIFIER(verify_hs256, JWT_ALG_HS256, 4096)
+JWT_DEFINE_VERIFIER(verify_es256, JWT_ALG_ES256, 4096)
+JWT_DEFINE_VERIFIER(verify_rs256, JWT_ALG_RS256, 4096)
+JWT_DEFINE_VERIFIER(verify_eddsa, JWT_ALG_EDDSA, 4096)
+JWT_DEFINE_VERIFIER(verify_tiny, JWT_ALG_HS256, 64)
+
+typedef jwt_verifier_err_t (*verify_fn)(const jwt_verifier_t *,
+					const jwt_verifier_policy_t *,
+					const char *, size_t);
+
+/* A checker set up the same way as the verifier and policy */
+static jwt_checker_t *__checker(jwt_alg_t alg,
+				const jwt_verifier_policy_t *policy)
+{
+	jwt_checker_t *checker = jwt_checker_new();
+
+	ck_assert_ptr_nonnull(checker);
+	ck_assert_int_eq(jwt_checker_setkey(checker, alg, g_item), 0);
+
+	if (policy->iss)
+		ck_assert_int_eq(jwt_checker_claim_set(checker, JWT_CLAIM_ISS,
+						       policy->iss), 0);
+	if (policy->sub)
+		ck_assert_int_eq(jwt_checker_claim_set(checker, JWT_CLAIM_SUB,
+						       policy->sub), 0);
+	if (policy->aud)
+		ck_assert_int_eq(jwt_checker_claim_set(checker, JWT_CLAIM_AUD,
+						       policy->aud), 0);
+
+	ck_assert_int_eq(jwt_checker_time_leeway(checker, JWT_CLAIM_EXP,
+						 policy->exp), 0);
+	ck_assert_int_eq(jwt_checker_time_leeway(checker, JWT_CLAIM_NBF,
+						 policy->nbf), 0);
+
+	return checker;
+}
+
+/* The verifier and the checker have to agree */
+static jwt_verifier_err_t __agree(verify_fn fn, jwt_alg_t alg,
+				  const jwt_verifier_policy_t *policy,
+				  const char *token)
+{
+	jwt_checker_auto_t *checker = __checker(alg, policy);
+	jwt_verifier_t *v;
+	jwt_verifier_err_t err;
+	int ret;
+
+	v = jwt_verifier_new(alg, g_item);
+	ck_assert_ptr_nonnull(v);
+
+	err = fn(v, policy, token, strlen(token));
+	ret = jwt_checker_verify(checker, token);
+
+	ck_assert_int_eq(err == JWT_VERIFIER_OK, ret == 0);
+
+	jwt_verifier_free(v);
+
+	return err;
+}
+
+static char *__generate(jwt_alg_t alg, jwt_value_t *claims, int count)
+{
+	jwt_builder_auto_t *builder = NULL;
+	char *token;
+	int i;
+
+	builder = jwt_builder_new();
+	ck_assert_ptr_nonnull(builder);
+	ck_assert_int_eq(jwt_builder_setkey(builder, alg, g_item), 0);
+
+	for (i = 0; i < count; i++)
+		ck_assert_int_eq(jwt_builder_claim_set(builder, &claims[i]),
+				 JWT_VALUE_ERR_NONE);
+
+	token = jwt_builder_generate(builder);
+	ck_assert_ptr_nonnull(token);
+
+	return token;
+}
+
+static void __check_alg(const char *key, jwt_alg_t alg, verify_fn fn)
+{
+	jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+	char_auto *token = NULL;
+	size_t len;
+
+	read_json(key);
+
+	token = __generate(alg, NULL, 0);
+	ck_assert_int_eq(__agree(fn, alg, &policy, token), JWT_VERIFIER_OK);
+
+	/* Break the signature */
+	len = strlen(token);
+	token[len - 3] = token[len - 3] == 'A' ? 'B' : 'A';
+	ck_assert_int_eq(__agree(fn, alg, &policy, token),
+			 JWT_VERIFIER_ERR_SIG);
+
+	/* No signature at all */
+	*strrchr(token, '.') = '\0';
+	strcat(token, ".");
+	ck_assert_int_eq(__agree(fn, alg, &policy, token),
+			 JWT_VERIFIER_ERR_SIG);
+
+	free_key();
+}
+
+START_TEST(verifier_algs)
+{
+	SET_OPS();
+
+	__check_alg("oct_key_256.json", JWT_ALG_HS256, verify_hs256);
+	__check_alg("ec_key_prime256v1.json", JWT_ALG_ES256, verify_es256);
+	__check_alg("rsa_key_2048.json", JWT_ALG_RS256, verify_rs256);
+	__check_alg("eddsa_key_ed25519.json", JWT_ALG_EDDSA, verify_eddsa);
+}
+END_TEST
+
+START_TEST(verifier_claims)
+{
+	jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+	time_t now = time(NULL);
+	jwt_value_t claims[3];
+	char *token;
+
+	SET_OPS();
+
+	read_json("oct_key_256.json");
+
+	policy.iss = "files.maclara-llc.com";
+	policy.aud = "libjwt";
+
+	/* All good */
+	jwt_set_SET_STR(&claims[0], "iss", "files.maclara-llc.com");
+	jwt_set_SET_STR(&claims[1], "aud", "libjwt");
+	jwt_set_SET_INT(&claims[2], "exp", now + 60);
+	token = __generate(JWT_ALG_HS256, claims, 3);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_OK);
+	free(token);
+
+	/* Wrong issuer */
+	jwt_set_SET_STR(&claims[0], "iss", "files.maclara-llc.org");
+	token = __generate(JWT_ALG_HS256, claims, 3);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	free(token);
+
+	/* Missing audience */
+	jwt_set_SET_STR(&claims[0], "iss", "files.maclara-llc.com");
+	token = __generate(JWT_ALG_HS256, claims, 1);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	free(token);
+
+	/* Expired, then allowed with leeway, then not checked */
+	jwt_set_SET_INT(&claims[2], "exp", now - 30);
+	token = __generate(JWT_ALG_HS256, claims, 3);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	policy.exp = 60;
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_OK);
+	policy.exp = -1;
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_OK);
+	free(token);
+	policy.exp = 0;
+
+	/* Not valid yet */
+	jwt_set_SET_INT(&claims[2], "nbf", now + 60);
+	token = __generate(JWT_ALG_HS256, claims, 3);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	free(token);
+
+	/* Wrong type */
+	jwt_set_SET_STR(&claims[2], "exp", "tomorrow");
+	token = __generate(JWT_ALG_HS256, claims, 3);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy, token),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	free(token);
+
+	free_key();
+}
+END_TEST
+
+/* HS256 with oct_key_256.json, over payloads that are not quite JSON:
+ * {"x":tru}, {"a":"\xff"}, {"n":0123}, {"a":[1,]}, {"a":{"b":nul}},
+ * {"a":"\u0000"}, {"a":"\ud800"}, {"a":"\xc0\xaf"},
+ * {"n":9223372036854775808}, {"n":1e999}, {"n":-} and {"a":"\x"} */
+static const char *bad_json[] = {
+	"eyJhbGciOiJIUzI1NiJ9.eyJ4Ijp0cnV9."
+	"VqQ8e7fJaBAuYMTY6lFzReMPVxtagoIHeSrH7OF4JrE",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjoi_yJ9."
+	"acPGBtQ-FheeJCp7IDmDUhzLpd56YRlyT7FXBosLBj8",
+	"eyJhbGciOiJIUzI1NiJ9.eyJuIjowMTIzfQ."
+	"iMdInTqB41xeFcoyOhFWP8eneIPUOLauwLzdjz1UOxo",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjpbMSxdfQ."
+	"dGbL7YUJbRZBgxWo6rMYCoWjAVctfUJIqsn19u1IUKY",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjp7ImIiOm51bH19."
+	"HhG73Wb02iBwwDHcowa72cd9PJdbzXHw95aZg6y5ZRY",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjoiXHUwMDAwIn0."
+	"5ySYEp8FkXaMOkm1yhiKIocSSLGgKlaqC60xWJhpwVQ",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjoiXHVkODAwIn0."
+	"1pLF4223Z5PAW976AZtBz7o8xv025x1qsYi8JkBAC3g",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjoiwK8ifQ."
+	"adQQnWWtO6pLTKdUhLYAuHV6BIi47k7pI1_CCHUshwA",
+	"eyJhbGciOiJIUzI1NiJ9.eyJuIjo5MjIzMzcyMDM2ODU0Nzc1ODA4fQ."
+	"yV9SIa4HgKlGj3Kr8zv8c5KNsu_s-uvs5pWRLQ1C-3Y",
+	"eyJhbGciOiJIUzI1NiJ9.eyJuIjoxZTk5OX0."
+	"i7Adlj1eCvPpmJQZrHoNfUJGDJC-egyh9EE2jPqO0Oc",
+	"eyJhbGciOiJIUzI1NiJ9.eyJuIjotfQ."
+	"6QUs9OCClW_qD1KgBzvQ27wIqfylPhkNkR34Ih9tzQY",
+	"eyJhbGciOiJIUzI1NiJ9.eyJhIjoiXHgifQ."
+	"xR6OJQZuyv7P0NGQgr7_0mRcqDgNUQyBNBPPhhdVN8E",
+};
+
+/* {"n":9223372036854775807,"m":-9223372036854775808,"r":-1.5e-3,
+ *  "s":"\u00e9\ud83d\ude00 \xc3\xa9","a":[true,false,null,{},[]]} */
+static const char good_json[] =
+	"eyJhbGciOiJIUzI1NiJ9.eyJuIjo5MjIzMzcyMDM2ODU0Nzc1ODA3LCJtIjotOTIy"
+	"MzM3MjAzNjg1NDc3NTgwOCwiciI6LTEuNWUtMywicyI6Ilx1MDBlOVx1ZDgzZFx1"
+	"ZGUwMCDDqSIsImEiOlt0cnVlLGZhbHNlLG51bGwse30sW11dfQ."
+	"JJt7opJLogOVzgpr-sTTvW07-flsBEgqi3Th6J5q1tE";
+
+START_TEST(verifier_format)
+{
+	jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+	jwt_value_t claims[1];
+	jwt_verifier_t *v;
+	const char *token;
+	char *big;
+	size_t i;
+
+	SET_OPS();
+
+	read_json("oct_key_256.json");
+
+	/* Not three parts, not base64url, not an object */
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9"), JWT_VERIFIER_ERR_FORMAT);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9.e30"), JWT_VERIFIER_ERR_FORMAT);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9.e3!.AAAA"),
+			 JWT_VERIFIER_ERR_FORMAT);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9.WzFd.AAAA"),
+			 JWT_VERIFIER_ERR_FORMAT);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9.e30gMQ.AAAA"),
+			 JWT_VERIFIER_ERR_FORMAT);
+
+	/* Header alg is missing, or not ours */
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJ0eXAiOiJKV1QifQ.e30.AAAA"), JWT_VERIFIER_ERR_ALG);
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzM4NCJ9.e30.AAAA"),
+			 JWT_VERIFIER_ERR_ALG);
+
+	/* Nested values are skipped */
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+			 "eyJhbGciOiJIUzI1NiJ9.eyJhIjp7ImIiOlsxLCJ9Il19fQ.AAAA"),
+			 JWT_VERIFIER_ERR_SIG);
+
+	/* Signed, but not JSON the checker would take */
+	for (i = 0; i < ARRAY_SIZE(bad_json); i++)
+		ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+					 bad_json[i]), JWT_VERIFIER_ERR_FORMAT);
+
+	/* Right up to the edges of it */
+	ck_assert_int_eq(__agree(verify_hs256, JWT_ALG_HS256, &policy,
+				 good_json), JWT_VERIFIER_OK);
+
+	/* Too big for this one */
+	big = __generate(JWT_ALG_HS256, NULL, 0);
+	v = jwt_verifier_new(JWT_ALG_HS256, g_item);
+	ck_assert_ptr_nonnull(v);
+	ck_assert_int_eq(verify_tiny(v, &policy, big, strlen(big)),
+			 JWT_VERIFIER_ERR_SIZE);
+	free(big);
+
+	/* Escapes are turned away, even when the checker is fine */
+	policy.iss = "\"quoted\"";
+	jwt_set_SET_STR(&claims[0], "iss", "\"quoted\"");
+	big = __generate(JWT_ALG_HS256, claims, 1);
+	ck_assert_int_eq(verify_hs256(v, &policy, big, strlen(big)),
+			 JWT_VERIFIER_ERR_CLAIMS);
+	free(big);
+
+	/* Made for another alg */
+	policy.iss = NULL;
+	token = "eyJhbGciOiJFUzI1NiJ9.e30.AAAA";
+	ck_assert_int_eq(verify_es256(v, &policy, token, strlen(token)),
+			 JWT_VERIFIER_ERR_SIG);
+
+	jwt_verifier_free(v);
+	free_key();
+}
+END_TEST
+
+START_TEST(verifier_new)
+{
+	jwt_verifier_t *v;
+
+	SET_OPS();
+
+	ck_assert_ptr_null(jwt_verifier_new(JWT_ALG_HS256, NULL));
+
+	read_json("oct_key_256.json");
+
+	ck_assert_ptr_null(jwt_verifier_new(JWT_ALG_HS384, g_item));
+	ck_assert_ptr_null(jwt_verifier_new(JWT_ALG_INVAL, g_item));
+
+	/* Alg from the key */
+	v = jwt_verifier_new(JWT_ALG_NONE, g_item);
+	ck_assert_ptr_nonnull(v);
+	jwt_verifier_free(v);
+
+	jwt_verifier_free(NULL);
+	ck_assert_int_ne(jwt_verifier_sig(NULL, JWT_ALG_HS256, "", 0,
+					  (const unsigned char *)"", 0), 0);
+
+	free_key();
+
+	/* A key with no alg needs one given */
+	read_json("eddsa_key_ed25519.json");
+	ck_assert_ptr_null(jwt_verifier_new(JWT_ALG_NONE, g_item));
+	free_key();
+}
+END_TEST
+
+START_TEST(verifier_ops_change)
+{
+	jwt_verifier_policy_t policy = JWT_VERIFIER_POLICY_INIT;
+	char_auto *token = NULL;
+	jwt_verifier_t *v;
+	size_t i;
+
+	SET_OPS();
+
+	read_json("ec_key_prime256v1.json");
+	token = __generate(JWT_ALG_ES256, NULL, 0);
+
+	v = jwt_verifier_new(JWT_ALG_ES256, g_item);
+	ck_assert_ptr_nonnull(v);
+
+	/* Whatever the plan was made with, it has to keep working */
+	for (i = 0; i < ARRAY_SIZE(jwt_test_ops); i++) {
+		ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_ES256,
+				 jwt_test_ops[i].name), 0);
+		ck_assert_int_eq(verify_es256(v, &policy, token,
+					      strlen(token)), JWT_VERIFIER_OK);
+	}
+
+	ck_assert_int_eq(jwt_set_crypto_ops_alg(JWT_ALG_ES256, NULL), 0);
+
+	jwt_verifier_free(v);
+	free_key();
+}
+END_TEST
+
+static Suite *libjwt_suite(const char *title)
+{
+	Suite *s;
+	TCase *tc_core;
+	int i = ARRAY_SIZE(jwt_test_ops);
+
+	s = suite_create(title);
+
+	tc_core = tcase_create("Specialized Verifier");
+	tcase_add_loop_test(tc_core, verifier_algs, 0, i);
+	tcase_add_loop_test(tc_core, verifier_claims, 0, i);
+	tcase_add_loop_test(tc_core, verifier_format, 0, i);
+	tcase_add_loop_test(tc_core, verifier_new, 0, i);
+	tcase_add_loop_test(tc_core, verifier_ops_change, 0, i);
+	tcase_set_timeout(tc_core, 30);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
+
+int main(void)
+{
+	JWT_TEST_MAIN("LibJWT Specialized Verifier");
+}